@@ -0,0 +1,60 @@
+%%
+% TestCallbacks.m: Unit tests for MATLAB calls made from Python threads.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+classdef TestCallbacks < tests.PyTestCase
+    
+    methods (Test)
+    
+        function testFevalFromThread(testCase)
+            py_eval('import pymex, threading');
+            py_eval('futures = []');
+            py_eval('worker = threading.Thread(target=lambda: futures.append(pymex.feval("plus", 1.0, 2.0)))');
+            py_eval('worker.start(); worker.join()');
+            testCase.pyAssertTrue('isinstance(futures[0], pymex.Future)');
+            % The call was queued, and runs at the next pymex call.
+            py_pump();
+            testCase.pyAssertTrue('futures[0].done() and futures[0].result() == 3.0');
+        end
+        
+        function testPumpRunsThreads(testCase)
+            py_eval('import pymex, threading');
+            py_eval('results = []');
+            py_eval('worker = threading.Thread(target=lambda: results.extend(pymex.feval("plus", float(i), 1.0).result() for i in range(10)))');
+            py_eval('worker.start()');
+            while py_eval('worker.is_alive()', struct())
+                py_pump(0.1);
+            end
+            testCase.pyAssertTrue('results == [i + 1.0 for i in range(10)]');
+        end
+        
+        function testErrorFromThread(testCase)
+            py_eval('import pymex, threading');
+            py_eval('futures = []');
+            py_eval('worker = threading.Thread(target=lambda: futures.append(pymex.feval("error", "pymex:test", "expected")))');
+            py_eval('worker.start(); worker.join()');
+            py_pump();
+            testCase.pyAssertTrue('isinstance(futures[0].exception(), pymex.MatlabError)');
+        end
+        
+    end
+
+end
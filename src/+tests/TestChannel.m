@@ -0,0 +1,58 @@
+%%
+% TestChannel.m: Unit tests for streaming channels.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+classdef TestChannel < tests.PyTestCase
+    
+    methods (Test)
+    
+        function testFramesView(testCase)
+            py_eval('import numpy as np');
+            ch = py_channel([2 3], 'double', 8);
+            py_put('ch', ch);
+            testCase.assertEqual(py_channel_write(ch, reshape(1:30, 6, 5)), 5);
+            % Frames keep MATLAB's layout, and are views onto the ring.
+            py_eval('f = ch.frames()');
+            testCase.pyAssertTrue('f.shape == (5, 2, 3) and not f.flags.owndata');
+            testCase.pyAssertTrue('np.all(f[1] == np.arange(7, 13).reshape(2, 3, order="F"))');
+            py_eval('del f; ch.release(5)');
+            testCase.pyAssertTrue('ch.available() == 0');
+        end
+        
+        function testNonblockingWrite(testCase)
+            ch = py_channel(4, 'int32', 4);
+            frames = zeros(4, 6, 'int32');
+            testCase.assertEqual(py_channel_write(ch, frames, false), 4);
+            testCase.assertEqual(py_channel_write(ch, frames, false), 0);
+            testCase.assertError(@() py_channel_write(ch, zeros(4, 1)), ?MException);
+        end
+        
+        function testClose(testCase)
+            ch = py_channel(1);
+            py_put('ch', ch);
+            py_eval('ch.close()');
+            testCase.pyAssertTrue('ch.closed and len(ch.acquire()) == 0');
+            testCase.assertError(@() py_channel_write(ch, 1), ?MException);
+        end
+        
+    end
+
+end
@@ -0,0 +1,69 @@
+%%
+% TestEval.m: Tests of evaluating Python expressions with bound arguments.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+classdef TestEval < tests.PyTestCase
+    
+    methods (Test)
+    
+        function testEvalExpression(testCase)
+            testCase.assertEqual(py_eval('x + y', struct('x', 1, 'y', 2)), 3);
+        end
+        
+        function testEvalWithoutBindings(testCase)
+            testCase.assertEqual(py_eval('"-".join(["a", "b"])', struct()), 'a-b');
+        end
+        
+        function testEvalRepeated(testCase)
+            % The second call reuses the compiled code, but not the bindings.
+            testCase.assertEqual(py_eval('x * 2', struct('x', 3)), 6);
+            testCase.assertEqual(py_eval('x * 2', struct('x', 4)), 8);
+        end
+        
+        function testEvalLeavesMainUntouched(testCase)
+            py_eval('eval_probe', struct('eval_probe', 1));
+            testCase.pyAssertTrue('"eval_probe" not in globals()');
+        end
+        
+        function testEvalSeesMainGlobals(testCase)
+            py_eval('import os');
+            testCase.assertEqual(py_eval('os.path.join(a, b)', struct('a', 'x', 'b', 'y')), ['x' filesep 'y']);
+        end
+        
+        function testContexts(testCase)
+            a = py_context();
+            b = py_context('b');
+            py_put('x', 1, a);
+            py_put('x', 2, b);
+            py_eval('y = x * 10', a);
+            testCase.assertEqual(py_get('y', a), 10);
+            testCase.assertEqual(py_eval('x + z', struct('z', 3), b), 5);
+            testCase.assertEqual(py_eval('__name__', struct(), b), 'b');
+            % Neither touches __main__, nor each other.
+            testCase.pyAssertTrue('"y" not in globals()');
+            testCase.assertError(@() py_get('y', b), ?MException);
+            % Builtins are still there.
+            testCase.assertEqual(py_eval('float(len("abc"))', struct(), a), 3);
+        end
+    
+    end
+
+end
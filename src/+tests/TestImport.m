@@ -43,7 +43,23 @@ classdef TestImport < tests.PyTestCase
             b = py_import('tests.deep_package.a.b');
             testCase.assertEqual(b.sentinel, int32(42))
         end
-        
+
+        function testFromImport(testCase)
+            sentinel = py_import('tests.deep_package.a.b', 'sentinel');
+            testCase.assertEqual(sentinel, int32(42))
+        end
+
+        function testFromImportSubmodule(testCase)
+            py_import tests.deep_package.a b
+            testCase.assertEqual(b.sentinel, int32(42))
+        end
+
+        function testImportReusesHandle(testCase)
+            os1 = py_import('os');
+            os2 = py_import('os');
+            testCase.assertSameHandle(os1, os2)
+        end
+
         function testImportExtensionModule(testCase)
             % Note that CPython 2.7 implements itertools as an extension
             % module, so if we can import that package, we're good.
@@ -37,6 +37,14 @@ classdef TestMarshal < tests.PyTestCase
             testCase.assertTrue(ischar(x));
         end
         
+        function testLongStringRoundTrip(testCase)
+            % Long enough to go through the vectorized char conversions.
+            s = repmat('pymex-', 1, 1000);
+            py_put('x', s);
+            testCase.pyAssertTrue('x == "pymex-" * 1000');
+            testCase.assertEqual(py_get('x'), s);
+        end
+        
         function testPutDoubleScalar(testCase)
             py_put('x', 42.0);
             testCase.pyAssertTrue('x == 42.0');
@@ -101,6 +109,80 @@ classdef TestMarshal < tests.PyTestCase
             testCase.pyAssertTrue('x == {"a": "a_key", "b": 42.0}');
             testCase.pyAssertTrue('isinstance(x, dict)');
         end
+        
+        function testRegisteredConverter(testCase)
+            py_eval('import pymex; from tests.stub_classes import ConvertibleStub');
+            py_eval('pymex.register_converter(ConvertibleStub, lambda x: x.value)');
+            py_eval('x = ConvertibleStub(42.0)');
+            testCase.assertEqual(py_get('x'), 42.0);
+            py_eval('pymex.register_converter(ConvertibleStub, None)');
+            testCase.assertClass(py_get('x'), 'PyObject');
+        end
+        
+        function testRegisteredConverterSkipsSubclasses(testCase)
+            py_eval('import pymex; from tests.stub_classes import ConvertibleStub, ConvertibleStubSubclass');
+            py_eval('pymex.register_converter(ConvertibleStub, lambda x: x.value)');
+            py_eval('x = ConvertibleStubSubclass(42.0)');
+            x = py_get('x');
+            py_eval('pymex.register_converter(ConvertibleStub, None)');
+            testCase.assertClass(x, 'PyObject');
+        end
+        
+        function testBuiltinSubclassConverted(testCase)
+            % Subclasses of built-in types miss the exact-type table, but
+            % are still converted like their base class.
+            py_eval('class FloatSubclass(float): pass');
+            py_eval('x = FloatSubclass(1.5)');
+            testCase.assertEqual(py_get('x'), 1.5);
+        end
+        
+        function testPutLargeCellInParallel(testCase)
+            % Large enough (24 MB) that the matrices are copied on the pool.
+            py_eval('import pymex; old_threads = pymex.set_marshal_threads(4)');
+            c = {rand(1024), rand(1024) > 0.5, int16(magic(2048)), 'a', 1};
+            py_put('x', c);
+            py_eval('pymex.set_marshal_threads(old_threads)');
+            x = py_get('x');
+            testCase.assertEqual(x{1}, c);
+        end
+        
+        function testLazyStruct(testCase)
+            py_eval('import pymex, collections; old_lazy = pymex.set_lazy_structs(True)');
+            s = struct('name', 'run', 'data', rand(100), 'opts', struct('tol', 1e-6));
+            py_put('x', s);
+            py_eval('pymex.set_lazy_structs(old_lazy)');
+            testCase.pyAssertTrue('isinstance(x, pymex.StructProxy) and isinstance(x, collections.Mapping)');
+            testCase.pyAssertTrue('sorted(x) == ["data", "name", "opts"] and "tol" not in x');
+            testCase.pyAssertTrue('x["name"] == "run" and x["opts"]["tol"] == 1e-6');
+            testCase.pyAssertTrue('isinstance(x["opts"], pymex.StructProxy) and x["opts"] is x["opts"]');
+            % Proxies come back as the structs they hold.
+            testCase.assertEqual(py_get('x'), s);
+            testCase.assertEqual(py_eval('x["opts"]', struct()), s.opts);
+        end
+        
+        function testTableToDataFrame(testCase)
+            py_import pandas;
+            t = table([1.5; 2.5; 3.5], [true; false; true], {'one'; 'two'; 'three'}, ...
+                categorical({'low'; 'high'; 'low'}), 'VariableNames', {'x', 'flag', 'label', 'kind'}, ...
+                'RowNames', {'a', 'b', 'c'});
+            py_put('df', t);
+            testCase.pyAssertTrue('isinstance(df, pandas.DataFrame) and list(df.columns) == ["x", "flag", "label", "kind"]');
+            testCase.pyAssertTrue('list(df.index) == ["a", "b", "c"] and df["x"].dtype == "f8" and df["flag"].dtype == bool');
+            testCase.pyAssertTrue('list(df["label"]) == ["one", "two", "three"] and df["kind"].dtype == "category"');
+            % DataFrames come back as tables.
+            testCase.assertEqual(py_get('df'), t);
+        end
+        
+        function testBytes(testCase)
+            data = uint8([0 1 2 255 10 13]);
+            py_put('b', PyBytes(data));
+            testCase.pyAssertTrue('isinstance(b, memoryview) and b.readonly');
+            testCase.pyAssertTrue('b.tobytes() == "\x00\x01\x02\xff\n\r"');
+            % Binary data comes back as a column vector; str stays text.
+            testCase.assertEqual(py_eval('bytearray(b)', struct()), data(:));
+            testCase.assertEqual(py_eval('buffer("ab")', struct()), uint8([97; 98]));
+            testCase.assertEqual(py_eval('"ab"', struct()), 'ab');
+        end
     
     end
 
@@ -32,6 +32,27 @@ classdef TestPyObject < tests.PyTestCase
             testCase.assertEqual(x{'b'}, 42.0);
         end
         
+        function testGetSlice(testCase)
+            py_eval('x = tuple(range(10))');
+            x = py_get('x');
+            py_put('y', x{2:4});
+            testCase.pyAssertTrue('y == (2, 3, 4)');
+            py_put('y', x{8:-2:0});
+            testCase.pyAssertTrue('y == (8, 6, 4, 2, 0)');
+            py_put('y', x{end-1:end});
+            testCase.pyAssertTrue('y == (8, 9)');
+            py_put('y', x{[3 1 4]});
+            testCase.pyAssertTrue('y == (3, 1, 4)');
+        end
+        
+        function testGetSliceIsView(testCase)
+            py_eval('import numpy as np; x = np.arange(12).reshape(3, 4)');
+            x = py_get('x');
+            py_put('y', x{0:1, ':'});
+            testCase.pyAssertTrue('y.shape == (2, 4)');
+            testCase.pyAssertTrue('y.base is x');
+        end
+        
         function testMul(testCase)
             % FIXME: this relies on complexes not marshalling; change to
             %        a stub class.
@@ -54,6 +75,153 @@ classdef TestPyObject < tests.PyTestCase
             testCase.assertTrue(C >= A);
             testCase.assertTrue(A ~= C);
         end
+        
+        function testArithmetic(testCase)
+            py_eval('x = 1+2j');
+            x = py_get('x');
+            py_put('y', x + 1);
+            testCase.pyAssertTrue('y == 2+2j');
+            py_put('y', 1 - x);
+            testCase.pyAssertTrue('y == -2j');
+            py_put('y', -x);
+            testCase.pyAssertTrue('y == -1-2j');
+            py_put('y', x ./ 2);
+            testCase.pyAssertTrue('y == 0.5+1j');
+            py_eval('z = 3+4j');
+            testCase.assertEqual(abs(py_get('z')), 5.0);
+            % idivide rounds towards zero unless told otherwise.
+            py_eval('import fractions; n = fractions.Fraction(-7)');
+            n = py_get('n');
+            py_put('y', idivide(n, 2));
+            testCase.pyAssertTrue('y == -3');
+            py_put('y', idivide(n, 2, 'floor'));
+            testCase.pyAssertTrue('y == -4');
+            py_put('y', idivide(n, 2, 'round'));
+            testCase.pyAssertTrue('y == -4');
+        end
+        
+        function testScalarFastPath(testCase)
+            % Operators that produce plain Python floats and bools should
+            % come back as MATLAB scalars rather than boxed PyObjects.
+            py_eval('import fractions; h = fractions.Fraction(1, 2)');
+            h = py_get('h');
+            testCase.assertTrue(isa(h * 4.0, 'double'));
+            testCase.assertEqual(h * 4.0, 2.0);
+            testCase.assertTrue(islogical(h < 1.0));
+        end
+        
+        function testSetItem(testCase)
+            py_eval('x = {}');
+            x = py_get('x');
+            x{'a'} = 42.0;
+            testCase.pyAssertTrue('x == {"a": 42.0}');
+        end
+        
+        function testSetAttr(testCase)
+            py_eval('from tests.stub_classes import ComparisonStub');
+            py_eval('s = ComparisonStub(1)');
+            s = py_get('s');
+            s.wrapped = 'foo';
+            testCase.pyAssertTrue('s.wrapped == "foo"');
+        end
+        
+        function testDeferredRelease(testCase)
+            py_eval('import sys; x = object()');
+            x = py_get('x');
+            py_eval('base = sys.getrefcount(x)');
+            clear x
+            % The reference is queued, not released, until the next call.
+            testCase.assertGreaterThanOrEqual(py_flush(), 1);
+            testCase.pyAssertTrue('sys.getrefcount(x) == base - 1');
+        end
+        
+        function testLength(testCase)
+            py_eval('x = {"a": 1, "b": 2, "c": 3}');
+            x = py_get('x');
+            testCase.assertEqual(length(x), 3);
+            testCase.assertEqual(numel(x), 3);
+        end
+
+        function testBuiltins(testCase)
+            testCase.assertClass(py_builtins.repr, 'PyObject');
+            testCase.assertEqual(py_builtins.repr('abc'), '''abc''');
+            % Globals in __main__ must not shadow builtins.
+            py_eval('repr = None');
+            testCase.assertEqual(py_builtins.repr('abc'), '''abc''');
+            py_eval('del repr');
+        end
+
+        function testPreparedCall(testCase)
+            hypot = py_import('math', 'hypot');
+            f = py_prepare(hypot, 1, 1);
+            testCase.assertEqual(f(3, 4), 5);
+            testCase.assertEqual(f(5, 12), 13);
+            % Arguments of other classes take the generic path.
+            testCase.assertEqual(f(int32(3), int32(4)), 5);
+        end
+
+        function testFunctionHandle(testCase)
+            py_eval('rosen = lambda x: (1 - x[0])**2 + 100 * (x[1] - x[0]**2)**2');
+            f = py_function_handle(py_get('rosen'), 'NumInputs', 1);
+            x = fminsearch(f, [-1.2, 1]);
+            testCase.assertEqual(x, [1, 1], 'AbsTol', 1e-3);
+            % Sequences of numbers come back as column vectors.
+            py_eval('grad = lambda x: [2 * v for v in x]');
+            g = py_function_handle(py_get('grad'));
+            testCase.assertEqual(g([1 2 3]), [2; 4; 6]);
+        end
+        
+        function testVectorizedFunctionHandle(testCase)
+            py_eval('square = lambda x: x * x');
+            f = py_function_handle(py_get('square'), 'Vectorized', true);
+            testCase.assertEqual(f([1 2 3]), [1 4 9]);
+            testCase.assertEqual(integral(f, 0, 1), 1/3, 'AbsTol', 1e-10);
+            % Each column is one point; here, y' = -y for a 2-vector y.
+            py_eval('decay = lambda t, y: [-v for v in y]');
+            f = py_function_handle(py_get('decay'), 'Vectorized', true);
+            testCase.assertEqual(f(0, [1 2; 3 4]), -[1 2; 3 4]);
+        end
+        
+        function testMemoize(testCase)
+            py_eval('calls = [0]');
+            py_eval('def describe(*args): calls[0] += 1; return repr(args)');
+            [f, memo] = py_memoize(py_get('describe'));
+            testCase.assertEqual(f('abc', 2), '(''abc'', 2.0)');
+            testCase.assertEqual(f('abc', 2), '(''abc'', 2.0)');
+            % Arguments of another class are different arguments.
+            testCase.assertEqual(f('abc', int32(2)), '(''abc'', 2)');
+            testCase.pyAssertTrue('calls[0] == 2');
+            testCase.assertEqual(memo.hits, int32(1));
+            testCase.assertEqual(memo.misses, int32(2));
+            memo.clear();
+            testCase.assertEqual(memo.entries, int32(0));
+        end
+        
+        function testMap(testCase)
+            py_eval('import struct');
+            py_eval('total = lambda v: sum(struct.unpack(v.format * len(v), v.tobytes()))');
+            x = magic(4);
+            testCase.assertEqual(py_map(py_get('total'), x), sum(x, 1));
+            testCase.assertEqual(py_map(py_get('total'), x, 'Dim', 1), sum(x, 2));
+            py_eval('square = lambda x: x * x');
+            testCase.assertEqual(py_map(py_get('square'), int32([1 2 3]), 'Output', 'int32'), int32([1 4 9]));
+            py_eval('upper = lambda s: s.upper()');
+            testCase.assertEqual(py_map(py_get('upper'), {'ab', 'c'}, 'Output', 'cell'), {'AB', 'C'});
+        end
+        
+        function testSaveLoad(testCase)
+            py_eval('import array; x = {"big": "x" * 4096, "arr": array.array("d", range(1000))}');
+            x = py_get('x');
+            filename = [tempname() '.mat'];
+            save(filename, 'x');
+            loaded = load(filename);
+            delete(filename);
+            py_put('y', loaded.x);
+            testCase.pyAssertTrue('y == x and y is not x');
+            % Objects that can't be pickled say so when saved.
+            py_eval('import threading; z = threading.Lock()');
+            testCase.assertError(@() saveobj(py_get('z')), 'pymex:PyObject:saveobj');
+        end
    
     end
         
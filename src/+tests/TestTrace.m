@@ -0,0 +1,100 @@
+%%
+% TestTrace.m: Unit tests for tracing calls with py_trace.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+classdef TestTrace < tests.PyTestCase
+ 
+    methods (TestMethodSetup)
+        
+        function startTracing(testCase)
+            py_trace reset
+            py_trace on
+        end
+        
+    end
+    
+    methods (TestMethodTeardown)
+        
+        function stopTracing(testCase)
+            py_trace off
+            py_trace reset
+        end
+        
+    end
+ 
+    methods (Test)
+
+        function testRecordsOpcodes(testCase)
+            py_put('x', {1, 'a'});
+            events = testCase.saveTrace();
+            put = events(strcmp({events.name}, 'put'));
+            testCase.assertNumElements(put, 1);
+            testCase.assertEqual(put.args.depth, 0);
+            marshal = events(strcmp({events.name}, 'mat2py cell'));
+            testCase.assertEqual(marshal.cat, 'marshal');
+            testCase.assertEqual(marshal.args.depth, 1);
+        end
+        
+        function testRecordsCallbacks(testCase)
+            py_eval('import pymex; y = pymex.feval(''plus'', 1.0, 2.0)');
+            events = testCase.saveTrace();
+            feval = events(strcmp({events.name}, 'feval plus'));
+            testCase.assertEqual(feval.cat, 'matlab');
+            testCase.assertEqual(feval.args.depth, 1);
+        end
+        
+        function testRecordsFrames(testCase)
+            py_trace frames
+            py_eval('f = lambda: len("abc")');
+            py_eval('n = f()');
+            events = testCase.saveTrace();
+            testCase.assertTrue(any(strncmp({events.name}, '<lambda>', 8)));
+            testCase.assertTrue(any(strcmp({events.name}, 'len')));
+        end
+        
+        function testUntracedWhenOff(testCase)
+            py_trace off
+            py_eval('x = 1');
+            filename = [tempname() '.json'];
+            testCase.assertEqual(py_trace('save', filename), 0);
+            delete(filename);
+        end
+   
+    end
+    
+    methods
+        
+        function events = saveTrace(testCase)
+            filename = [tempname() '.json'];
+            py_trace('save', filename);
+            trace = jsondecode(fileread(filename));
+            delete(filename);
+            events = trace.traceEvents;
+            if iscell(events)
+                events = [events{strcmp(cellfun(@(e) e.ph, events, 'UniformOutput', false), 'X')}];
+            else
+                events = events(strcmp({events.ph}, 'X'));
+            end
+        end
+        
+    end
+        
+end
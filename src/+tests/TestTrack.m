@@ -0,0 +1,97 @@
+%%
+% TestTrack.m: Unit tests for tracking object lifetimes with py_track.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+classdef TestTrack < tests.PyTestCase
+ 
+    methods (TestMethodSetup)
+        
+        function startTracking(testCase)
+            py_track reset
+            py_track on
+        end
+        
+    end
+    
+    methods (TestMethodTeardown)
+        
+        function stopTracking(testCase)
+            py_track off
+            py_track reset
+        end
+        
+    end
+ 
+    methods (Test)
+
+        function testTracksBoxedPyObject(testCase)
+            py_eval('x = object()');
+            x = py_get('x');
+            live = py_track('dump');
+            testCase.assertTrue(any(strcmp({live.type}, 'object')));
+            
+            clear x
+            py_flush();
+            live = py_track('dump');
+            testCase.assertFalse(any(strcmp({live.type}, 'object')));
+        end
+        
+        function testGroupsByType(testCase)
+            py_eval('xs = [object() for _ in range(3)]');
+            xs = py_get('xs');
+            live = py_track('dump');
+            group = live(strcmp({live.type}, 'object'));
+            testCase.assertEqual(group.count, 3);
+            testCase.assertEqual(group.opcode, 'GET');
+        end
+        
+        function testNestedCallsKeepOuterOpcode(testCase)
+            % The object is boxed by CALL after a nested EVAL has returned.
+            py_eval('import pymex');
+            py_eval('def box(): pymex.feval(''py_eval'', ''0''); return object()');
+            box = py_get('box');
+            x = box();
+            live = py_track('dump');
+            group = live(strcmp({live.type}, 'object'));
+            testCase.assertEqual(group.opcode, 'CALL');
+        end
+        
+        function testUntrackedWhenOff(testCase)
+            py_track off
+            py_eval('x = object()');
+            x = py_get('x');
+            testCase.assertEmpty(py_track('dump'));
+        end
+        
+        function testReleasedAfterOff(testCase)
+            py_eval('x = object()');
+            x = py_get('x');
+            py_track off
+            
+            clear x
+            py_flush();
+            live = py_track('dump');
+            testCase.assertFalse(any(strcmp({live.type}, 'object')));
+        end
+   
+    end
+        
+end
@@ -0,0 +1,47 @@
+%%
+% PyBytes.m: Marks a uint8 array as binary data for Python.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+classdef PyBytes
+    % b = PyBytes(data) marks the uint8 array data as binary data, rather
+    % than numbers, when passed to Python: it arrives as a read-only
+    % memoryview over the bytes of data(:), without conversion. Python's
+    % bytearray, buffer and memoryview objects come back to MATLAB as
+    % uint8 column vectors; to send a str as binary, wrap it in buffer().
+    
+    properties (SetAccess = private)
+        data = zeros(0, 1, 'uint8');
+    end
+    
+    methods
+        
+        function self = PyBytes(data)
+            if nargin > 0
+                if ~isa(data, 'uint8') || ~isreal(data)
+                    error('pymex:PyBytes', 'PyBytes data must be a real uint8 array.');
+                end
+                self.data = data(:);
+            end
+        end
+        
+    end
+    
+end
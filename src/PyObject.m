@@ -42,15 +42,36 @@ classdef PyObject < handle
                 newobj = PyObject(py_ptr);
             end
         end
+        
+        function obj = loadobj(s)
+            % Unpickles what saveobj saved, in this process's interpreter.
+            load_state = py_import('_pymex.pickling', 'load_state');
+            buffers = s.buffers;
+            buffers(s.binary) = cellfun(@PyBytes, buffers(s.binary), 'UniformOutput', false);
+            obj = load_state(PyBytes(s.pickle), buffers);
+        end
     
     end
+    
+    methods (Static, Access = private)
+        
+        function r = binop(op, a, b)
+            % Either of a or b may be the PyObject, depending on which side
+            % of the operator it appeared; the MEX side handles both.
+            r = pymex_fns(py_function_t.BINOP, op, a, b);
+        end
+        
+    end
 
     methods
         
         %% MATLAB MAGIC METHODS %%
         
         function delete(self)
-            pymex_fns(py_function_t.DECREF, self);
+            % Pass the raw pointer, rather than self, so that the MEX side
+            % needn't unbox it. The release itself is queued and done in
+            % bulk; see also py_flush.
+            pymex_fns(py_function_t.DECREF, self.py_pointer);
         end
         
         function b = subsref(self, subs)
@@ -76,32 +97,170 @@ classdef PyObject < handle
             fprintf('%s\n', str(self))
         end
         
-        function product = mtimes(self, other)
-            product = pymex_fns(py_function_t.MUL, self, other);
+        function self = subsasgn(self, subs, value)
+            if numel(subs) == 1
+                if strcmp(subs.type, '.')
+                    setattr(self, subs.subs, value);
+                elseif strcmp(subs.type, '{}')
+                    setitem(self, subs.subs{:}, value);
+                else
+                    error('pymex:PyObject:subsasgn', ...
+                        'Cannot assign to the result of a call.');
+                end
+            else
+                % Walk down to the object that owns the last subscript, then
+                % assign into that. Since PyObject is a handle class, self
+                % sees the change without being reassigned.
+                target = subsref(self, subs(1:end-1));
+                if ~isa(target, 'PyObject')
+                    error('pymex:PyObject:subsasgn', ...
+                        'Cannot assign into a value that was marshalled to MATLAB.');
+                end
+                subsasgn(target, subs(end), value);
+            end
+        end
+        
+        function n = numel(self, varargin)
+            % With index arguments, MATLAB is asking how many outputs an
+            % indexing expression produces, which is always one.
+            if nargin > 1
+                n = 1;
+            else
+                n = pymex_fns(py_function_t.UNOP, py_operator_t.NUMEL, self);
+            end
+        end
+        
+        function n = numArgumentsFromSubscript(self, subs, context)
+            n = 1;
+        end
+        
+        function n = length(self)
+            n = pymex_fns(py_function_t.UNOP, py_operator_t.LEN, self);
+        end
+        
+        function idx = end(self, k, n)
+            % Python indices are zero-based, so the last valid one is one
+            % less than the length along that axis. We return an integer
+            % class so that the index reaches Python as an int, not a float.
+            if n == 1
+                idx = int64(length(self)) - 1;
+            else
+                shape = getattr(self, 'shape');
+                idx = int64(getitem(shape, int64(k - 1))) - 1;
+            end
+        end
+        
+        %% ARITHMETIC OPERATORS %%
+        
+        function r = plus(a, b)
+            r = PyObject.binop(py_operator_t.ADD, a, b);
+        end
+        
+        function r = minus(a, b)
+            r = PyObject.binop(py_operator_t.SUB, a, b);
+        end
+        
+        function r = times(a, b)
+            r = PyObject.binop(py_operator_t.MUL, a, b);
+        end
+        
+        function r = mtimes(a, b)
+            r = PyObject.binop(py_operator_t.MUL, a, b);
+        end
+        
+        function r = rdivide(a, b)
+            r = PyObject.binop(py_operator_t.TRUEDIV, a, b);
+        end
+        
+        function r = mrdivide(a, b)
+            r = PyObject.binop(py_operator_t.TRUEDIV, a, b);
+        end
+        
+        function r = ldivide(a, b)
+            r = PyObject.binop(py_operator_t.TRUEDIV, b, a);
+        end
+        
+        function r = mldivide(a, b)
+            r = PyObject.binop(py_operator_t.TRUEDIV, b, a);
+        end
+        
+        function r = power(a, b)
+            r = PyObject.binop(py_operator_t.POW, a, b);
+        end
+        
+        function r = mpower(a, b)
+            r = PyObject.binop(py_operator_t.POW, a, b);
+        end
+        
+        function r = mod(a, b)
+            r = PyObject.binop(py_operator_t.MOD, a, b);
+        end
+        
+        function r = idivide(a, b, opt)
+            % As for integers, the quotient is rounded towards zero unless
+            % opt is 'floor', 'ceil' or 'round'.
+            if nargin < 3
+                opt = 'fix';
+            end
+            if strcmp(opt, 'floor')
+                r = PyObject.binop(py_operator_t.FLOORDIV, a, b);
+            else
+                r = call(py_import('_pymex.mat_funcs', 'idivide'), a, b, opt);
+            end
+        end
+        
+        function r = and(a, b)
+            r = PyObject.binop(py_operator_t.AND, a, b);
+        end
+        
+        function r = or(a, b)
+            r = PyObject.binop(py_operator_t.OR, a, b);
+        end
+        
+        function r = xor(a, b)
+            r = PyObject.binop(py_operator_t.XOR, a, b);
+        end
+        
+        function r = uminus(a)
+            r = pymex_fns(py_function_t.UNOP, py_operator_t.NEG, a);
         end
         
-        function cmp = eq(self, other)
-            cmp = pymex_fns(py_function_t.EQ, self, other);
+        function r = uplus(a)
+            r = pymex_fns(py_function_t.UNOP, py_operator_t.POS, a);
         end
         
-        function cmp = lt(self, other)
-            cmp = pymex_fns(py_function_t.LT, self, other);
+        function r = abs(a)
+            r = pymex_fns(py_function_t.UNOP, py_operator_t.ABS, a);
+        end
+        
+        function r = not(a)
+            r = pymex_fns(py_function_t.UNOP, py_operator_t.NOT, a);
+        end
+        
+        %% COMPARISON OPERATORS %%
+        
+        function cmp = eq(a, b)
+            cmp = PyObject.binop(py_operator_t.EQ, a, b);
         end
         
-        function cmp = gt(self, other)
-            cmp = pymex_fns(py_function_t.GT, self, other);
+        function cmp = lt(a, b)
+            cmp = PyObject.binop(py_operator_t.LT, a, b);
         end
         
-        function cmp = le(self, other)
-            cmp = pymex_fns(py_function_t.LE, self, other);
+        function cmp = gt(a, b)
+            cmp = PyObject.binop(py_operator_t.GT, a, b);
         end
         
-        function cmp = ge(self, other)
-            cmp = pymex_fns(py_function_t.GE, self, other);
+        function cmp = le(a, b)
+            cmp = PyObject.binop(py_operator_t.LE, a, b);
         end
         
-        function cmp = ne(self, other)
-            cmp = pymex_fns(py_function_t.NE, self, other);
+        function cmp = ge(a, b)
+            cmp = PyObject.binop(py_operator_t.GE, a, b);
+        end
+        
+        function cmp = ne(a, b)
+            cmp = PyObject.binop(py_operator_t.NE, a, b);
         end
         
         %% OTHER METHODS %%
@@ -122,6 +281,21 @@ classdef PyObject < handle
             s = pymex_fns(py_function_t.STR, self);
         end
         
+        function s = saveobj(self)
+            % Pickles the Python object, so that save and parfor can move
+            % it to another MATLAB; large buffers are kept out of the
+            % pickle as MATLAB arrays (see _pymex/pickling.py).
+            dump_state = py_import('_pymex.pickling', 'dump_state');
+            try
+                state = dump_state(self);
+            catch err
+                error('pymex:PyObject:saveobj', ...
+                    'Could not save %s, as it could not be pickled: %s', repr(self), err.message);
+            end
+            s = struct('pickle', state{1}, 'buffers', {reshape(state{2}, 1, [])}, ...
+                'binary', {logical(state{3}(:)')});
+        end
+        
         function s = repr(self)
             s = call(py_builtins.repr, self);
         end
@@ -130,8 +304,19 @@ classdef PyObject < handle
             obj = pymex_fns(py_function_t.GETATTR, self, name);
         end
         
-        function value = getitem(self, key)
-            value = pymex_fns(py_function_t.GETITEM, self, key);
+        function value = getitem(self, varargin)
+            % Multiple keys are passed as a tuple, and ranges such as
+            % 0:9 or end-2:end become slices.
+            value = pymex_fns(py_function_t.GETITEM, self, varargin{:});
+        end
+        
+        function setattr(self, name, value)
+            pymex_fns(py_function_t.SETATTR, self, name, value);
+        end
+        
+        function setitem(self, varargin)
+            % The value to assign comes last, after any number of keys.
+            pymex_fns(py_function_t.SETITEM, self, varargin{:});
         end
         
     end
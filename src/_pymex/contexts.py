@@ -0,0 +1,45 @@
+# -*- coding: utf-8 -*-
+##
+# contexts.py: Separate namespaces for py_eval, py_put and py_get.
+##
+# (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+#    
+# This file is a part of the pymex-embed project.
+# Licensed under the AGPL version 3.
+##
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+##
+
+## FEATURES ###################################################################
+
+from __future__ import division
+
+## IMPORTS ####################################################################
+
+import __builtin__
+import imp
+
+## FUNCTIONS ##################################################################
+
+def new_context(name='__context__'):
+    """
+    Returns a new, empty module to run code in, in place of __main__. It
+    isn't added to sys.modules, so nothing else can reach its globals; the
+    modules it imports are shared with the rest of the interpreter, as
+    usual.
+    """
+    context = imp.new_module(name)
+    # Without this, code run in the module would see no builtins at all.
+    context.__builtins__ = __builtin__
+    return context
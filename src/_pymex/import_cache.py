@@ -0,0 +1,222 @@
+# -*- coding: utf-8 -*-
+##
+# import_cache.py: Finds modules from shared directory listings.
+##
+# (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+#    
+# This file is a part of the pymex-embed project.
+# Licensed under the AGPL version 3.
+##
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+##
+
+## FEATURES ###################################################################
+
+from __future__ import division
+
+## IMPORTS ####################################################################
+
+import atexit
+import imp
+import marshal
+import os
+import sys
+import warnings
+
+## DOCUMENTATION ##############################################################
+
+# Importing a module normally tries several file names in each directory on
+# sys.path in turn, until one of them exists; with a long sys.path and big
+# packages, that is tens of thousands of system calls for each new Python,
+# and each worker of a parallel pool repeats them all, often against a
+# shared file system. An ImportIndex lists each directory once instead, and
+# looks for modules in those listings, so that only the directory that has
+# the module is searched. Each lookup still stats every directory it passes,
+# and lists again any that were modified since they were listed, so modules
+# added or removed since are noticed; the working directory ('' on
+# sys.path) can change at any time, so it is listed afresh on every lookup.
+#
+# The listings can be kept in an index file: the first process to list a
+# directory saves it there, and later processes (such as the other workers
+# of a pool) take it from the file, checking the same way that the
+# directory hasn't been modified since. Modules the listings don't find are
+# left to the usual import machinery. A listing that is stale all the same,
+# because a directory changed without its modification time doing so
+# (within the timestamp resolution of some file systems, say), can hide a
+# module that shadows one later on sys.path.
+
+## CONSTANTS ##################################################################
+
+SUFFIXES = [suffix for suffix, mode, kind in imp.get_suffixes()]
+
+## CLASSES ####################################################################
+
+class _Loader(object):
+    def __init__(self, found):
+        self.found = found
+    
+    def load_module(self, fullname):
+        file, pathname, description = self.found
+        try:
+            return imp.load_module(fullname, file, pathname, description)
+        finally:
+            if file is not None:
+                file.close()
+
+class ImportIndex(object):
+    """
+    Finds modules (as an entry of sys.meta_path) from listings of the
+    directories they may be in, optionally shared through an index file.
+    """
+    
+    def __init__(self, filename=None):
+        self.filename = filename
+        # Directory -> (mtime, set of names in it), or (mtime, None) if it
+        # can't be listed.
+        self.listings = {}
+        # Directory -> (mtime, names), as read from or to be saved to the
+        # index file.
+        self.saved = {}
+        self.changed = False
+        self.listed = 0
+        self.reused = 0
+        self.hits = 0
+        self.fallbacks = 0
+        if filename is not None:
+            self._load()
+    
+    def _load(self):
+        try:
+            with open(self.filename, 'rb') as f:
+                saved = marshal.load(f)
+        except (IOError, EOFError, ValueError, TypeError):
+            return
+        if isinstance(saved, dict):
+            self.saved = saved
+    
+    def _listing(self, entry):
+        # The working directory isn't shared, so it isn't saved, and can
+        # change, so it isn't kept either.
+        dirname = entry if entry else os.getcwd()
+        shared = bool(entry) and os.path.isabs(entry)
+        try:
+            mtime = os.stat(dirname).st_mtime
+        except OSError:
+            return None
+        if entry and entry in self.listings and self.listings[entry][0] == mtime:
+            return self.listings[entry][1]
+        names = None
+        try:
+            if shared and dirname in self.saved and self.saved[dirname][0] == mtime:
+                names = frozenset(self.saved[dirname][1])
+                self.reused += 1
+            else:
+                names = frozenset(os.listdir(dirname))
+                self.listed += 1
+                if shared:
+                    self.saved[dirname] = (mtime, sorted(names))
+                    self.changed = True
+        except OSError:
+            # Not a directory: an egg or zip file, say, which only its path
+            # hook knows how to search.
+            pass
+        if entry:
+            self.listings[entry] = (mtime, names)
+        return names
+    
+    def find_module(self, fullname, path=None):
+        name = fullname.rpartition('.')[2]
+        if path is None:
+            if fullname in sys.builtin_module_names:
+                return None
+            path = sys.path
+        candidates = [name] + [name + suffix for suffix in SUFFIXES]
+        for entry in path:
+            names = self._listing(entry) if isinstance(entry, str) else None
+            if names is None:
+                # Leave entries we can't see into, and everything after
+                # them, to the usual machinery.
+                break
+            if any(candidate in names for candidate in candidates):
+                try:
+                    found = imp.find_module(name, [entry])
+                except ImportError:
+                    # Gone since it was listed, or a directory that isn't
+                    # a package.
+                    continue
+                self.hits += 1
+                return _Loader(found)
+        self.fallbacks += 1
+        return None
+    
+    def save(self):
+        """
+        Adds any directories listed since the index file was read to it.
+        """
+        if self.filename is None or not self.changed:
+            return
+        # Keep what other processes have saved meanwhile.
+        saved = self.saved
+        self._load()
+        self.saved.update(saved)
+        temp_name = '{}.{}'.format(self.filename, os.getpid())
+        try:
+            with open(temp_name, 'wb') as f:
+                marshal.dump(self.saved, f)
+            os.rename(temp_name, self.filename)
+            self.changed = False
+        except (IOError, OSError) as ex:
+            warnings.warn("Could not save the import index {}: {}".format(self.filename, ex))
+
+## GLOBALS ####################################################################
+
+index = None
+
+## FUNCTIONS ##################################################################
+
+def install(filename=None):
+    """
+    Puts an ImportIndex, saved to filename if given, at the front of
+    sys.meta_path, and returns it.
+    """
+    global index
+    if index is not None:
+        sys.meta_path.remove(index)
+    index = ImportIndex(filename)
+    sys.meta_path.insert(0, index)
+    atexit.register(index.save)
+    return index
+
+def preload(modules):
+    """
+    Imports each of a list of module names (or a string of them separated
+    by commas or spaces), warning about any that fail.
+    """
+    if isinstance(modules, basestring):
+        modules = modules.replace(',', ' ').split()
+    for module in modules:
+        try:
+            __import__(module)
+        except Exception as ex:
+            warnings.warn("Could not preload {}: {}".format(module, ex))
+
+def startup(index_file, modules):
+    """
+    Called as pymex starts, with the import_index and preload preferences.
+    """
+    if index_file:
+        install(index_file)
+    preload(modules)
+    if index is not None:
+        index.save()
@@ -42,3 +42,25 @@ def matfunc(name):
 
     r = pymex.feval(str2func, name)
     return r
+
+def idivide(a, b, rounding='fix'):
+    """
+    Divides a by b, rounding the quotient as MATLAB's idivide does: towards
+    zero ('fix', the default), down ('floor'), up ('ceil') or to the nearest
+    integer, with ties away from zero ('round'). Works elementwise for
+    NumPy arrays.
+    """
+    q = a // b
+    # r has the sign of b, and |r| < |b|.
+    r = a - q * b
+    if rounding == 'floor':
+        return q
+    elif rounding == 'ceil':
+        return q + (r != 0)
+    elif rounding == 'fix':
+        return q + ((r != 0) & ((a < 0) != (b < 0)))
+    elif rounding == 'round':
+        twice = 2 * abs(r)
+        return q + ((twice > abs(b)) | ((twice == abs(b)) & (q >= 0)))
+    else:
+        raise ValueError("Unknown rounding option '%s'." % rounding)
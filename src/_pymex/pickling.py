@@ -0,0 +1,171 @@
+# -*- coding: utf-8 -*-
+##
+# pickling.py: Pickles PyObjects for MATLAB's save, load and parfor.
+##
+# (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+#    
+# This file is a part of the pymex-embed project.
+# Licensed under the AGPL version 3.
+##
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+##
+
+## FEATURES ###################################################################
+
+from __future__ import division
+
+## IMPORTS ####################################################################
+
+import array
+import cPickle
+from cStringIO import StringIO
+
+import pymex
+from _pymex.mx_array import mxArray
+
+## DOCUMENTATION ##############################################################
+
+# PyObject.saveobj and .loadobj call these to move Python objects through
+# MAT-files and to parfor workers. Objects are pickled with protocol 2, but
+# large binary and numeric buffers (and boxed MATLAB arrays, which can't be
+# pickled at all) are left out of the pickle as persistent IDs, and handed
+# to MATLAB separately: buffers as uint8 column vectors, MATLAB arrays as
+# themselves. The pickle is then only as big as the structure around them,
+# and the buffers are saved as MATLAB arrays rather than inside a pickle.
+# Numeric arrays (array.array and NumPy) are copied straight into MATLAB
+# arrays of their own class and shape, with only the dtype and order kept
+# in the pickle; other arrays are saved as their raw bytes.
+
+## CONSTANTS ##################################################################
+
+# Buffers smaller than this stay in the pickle.
+OUT_OF_BAND_BYTES = 1024
+
+# Type codes that pymex.to_matlab_array has a MATLAB class for.
+ARRAY_TYPECODES = 'bBhHiIlLfd'
+NUMPY_TYPECODES = ARRAY_TYPECODES + 'qQDF?'
+
+## FUNCTIONS ##################################################################
+
+def _numpy():
+    # Only look for NumPy if something already imported it; saving an
+    # object can't contain an array otherwise.
+    import sys
+    return sys.modules.get('numpy')
+
+def dump_state(obj):
+    """
+    Pickles obj, returning [pickle, buffers, binary]: the pickle as a
+    bytearray, the list of out-of-band buffers, and a bytearray with a 1 for
+    each buffer that is binary data (to come back as a memoryview) rather
+    than a MATLAB array.
+    """
+    buffers = []
+    binary = bytearray()
+    # The pickler asks for persistent IDs before looking in its memo, so
+    # remember them here to save each shared buffer once. Each entry keeps
+    # its object alive, since a temporary (a __reduce__ result, say) could
+    # otherwise be freed and its id reused by a different buffer.
+    ids = {}
+    np = _numpy()
+    
+    def out_of_band(kind, value, *info):
+        buffers.append(value)
+        binary.append(0 if isinstance(value, mxArray) else 1)
+        return (kind, len(buffers) - 1) + info
+    
+    def persistent_id(value):
+        if id(value) in ids:
+            return ids[id(value)][1]
+        pid = new_persistent_id(value)
+        if pid is not None:
+            ids[id(value)] = (value, pid)
+        return pid
+    
+    def new_persistent_id(value):
+        if isinstance(value, mxArray):
+            return out_of_band('mxArray', value)
+        if type(value) in (str, bytearray) and len(value) >= OUT_OF_BAND_BYTES:
+            return out_of_band(type(value).__name__, buffer(value))
+        if type(value) is array.array and len(value) * value.itemsize >= OUT_OF_BAND_BYTES:
+            if value.typecode in ARRAY_TYPECODES:
+                data = pymex.to_matlab_array(value, value.typecode, (len(value),))
+            else:
+                data = buffer(value)
+            return out_of_band('array', data, value.typecode)
+        if (np is not None and type(value) is np.ndarray and not value.dtype.hasobject
+                and value.nbytes >= OUT_OF_BAND_BYTES):
+            order = 'F' if value.flags.f_contiguous and not value.flags.c_contiguous else 'C'
+            if value.dtype.isnative and value.dtype.char in NUMPY_TYPECODES:
+                if not (value.flags.c_contiguous or value.flags.f_contiguous):
+                    value = np.ascontiguousarray(value)
+                data = pymex.to_matlab_array(value.data, value.dtype.char, value.shape, order)
+            else:
+                data = buffer(value.tobytes(order))
+            return out_of_band('ndarray', data, value.dtype.str, value.shape, order)
+        return None
+    
+    stream = StringIO()
+    pickler = cPickle.Pickler(stream, 2)
+    pickler.persistent_id = persistent_id
+    try:
+        pickler.dump(obj)
+    except (cPickle.PicklingError, TypeError) as ex:
+        raise cPickle.PicklingError(
+            "Can't save {!r}: it can't be pickled ({}).".format(obj, ex)
+        )
+    return [bytearray(stream.getvalue()), buffers, binary]
+
+def load_state(data, buffers):
+    """
+    Unpickles what dump_state returned, given the pickle as a buffer and the
+    out-of-band buffers in order (memoryviews for binary ones).
+    """
+    # A row cell array from MATLAB arrives as a list holding one list.
+    if len(buffers) == 1 and isinstance(buffers[0], list):
+        buffers = buffers[0]
+    
+    loaded = {}
+    
+    def persistent_load(pid):
+        if pid[1] not in loaded:
+            loaded[pid[1]] = new_object(pid)
+        return loaded[pid[1]]
+    
+    def new_object(pid):
+        kind, value = pid[0], buffers[pid[1]]
+        if kind == 'mxArray':
+            return value
+        if kind == 'str':
+            return value.tobytes()
+        if kind == 'bytearray':
+            return bytearray(value)
+        # Numeric arrays come back as MATLAB arrays, anything else (or
+        # anything saved before they did) as raw bytes.
+        if isinstance(value, mxArray):
+            value = pymex.from_matlab_array(value, pid[4] if kind == 'ndarray' else 'C')
+        else:
+            value = bytearray(value)
+        if kind == 'array':
+            restored = array.array(pid[2])
+            restored.fromstring(buffer(value))
+            return restored
+        if kind == 'ndarray':
+            np = __import__('numpy')
+            return np.frombuffer(value, dtype=pid[2]).reshape(pid[3], order=pid[4])
+        raise cPickle.UnpicklingError("Unknown out-of-band buffer kind {!r}.".format(kind))
+    
+    unpickler = cPickle.Unpickler(StringIO(memoryview(data).tobytes()))
+    unpickler.persistent_load = persistent_load
+    return unpickler.load()
@@ -0,0 +1,96 @@
+# -*- coding: utf-8 -*-
+##
+# tables.py: Columnar conversion between MATLAB tables and pandas DataFrames.
+##
+# (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+#    
+# This file is a part of the pymex-embed project.
+# Licensed under the AGPL version 3.
+##
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+##
+
+## FEATURES ###################################################################
+
+from __future__ import division
+
+## DOCUMENTATION ##############################################################
+
+# pymex_table.c takes MATLAB tables apart into columns, and builds them back
+# up, calling these functions for the pandas side. A column is one of
+#
+#     ('numeric', buffer, dtype)
+#         A column vector of a numeric or logical class, as its raw data and
+#         a NumPy dtype string such as 'f8', 'i4' or 'b1'.
+#     ('categorical', codes, categories)
+#         One-based category codes, as the raw data of doubles (NaN where
+#         undefined), and the list of category names.
+#     ('objects', values)
+#         Anything else, as a list with one Python value per row; cellstrs,
+#         strings and char matrices arrive like this as lists of str.
+#
+# Buffers from MATLAB only live as long as the MEX call that made them, so
+# DataFrames are built with copy=True.
+
+## FUNCTIONS ##################################################################
+
+def dataframe_from_columns(names, columns, row_names):
+    """
+    Returns a DataFrame with the given columns, indexed by row_names (or by
+    position if that is None).
+    """
+    import numpy as np
+    import pandas as pd
+    
+    data = {}
+    for name, column in zip(names, columns):
+        kind = column[0]
+        if kind == 'numeric':
+            data[name] = np.frombuffer(column[1], dtype=column[2])
+        elif kind == 'categorical':
+            codes = np.frombuffer(column[1], dtype='f8')
+            codes = np.where(np.isnan(codes), 0, codes).astype('i8') - 1
+            data[name] = pd.Categorical.from_codes(codes, column[2])
+        else:
+            data[name] = column[1]
+    return pd.DataFrame(data, columns=names, index=row_names, copy=True)
+
+def columns_from_dataframe(frame):
+    """
+    Returns (names, columns, row_names) for a DataFrame, where row_names is
+    None for a default (0, 1, ...) index. Numeric buffers are contiguous
+    NumPy arrays, which are copied once into MATLAB arrays.
+    """
+    import numpy as np
+    import pandas as pd
+    
+    columns = []
+    for idx in range(frame.shape[1]):
+        series = frame.iloc[:, idx]
+        dtype = series.dtype
+        if isinstance(dtype, pd.api.types.CategoricalDtype):
+            codes = np.ascontiguousarray(series.cat.codes.values, dtype='f8') + 1
+            columns.append(('categorical', codes, [str(c) for c in series.cat.categories]))
+        elif dtype.kind in 'biuf':
+            values = np.ascontiguousarray(series.values, dtype=dtype.newbyteorder('='))
+            columns.append(('numeric', values, '{}{}'.format(dtype.kind, dtype.itemsize)))
+        else:
+            columns.append(('objects', list(series.values)))
+    
+    index = frame.index
+    if isinstance(index, pd.RangeIndex) and index.equals(pd.RangeIndex(len(index))):
+        row_names = None
+    else:
+        row_names = [str(name) for name in index]
+    return [str(name) for name in frame.columns], columns, row_names
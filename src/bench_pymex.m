@@ -0,0 +1,215 @@
+%%
+% bench_pymex.m: Benchmarks opcode latency, marshalling and startup.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+function results = bench_pymex(varargin)
+    % results = bench_pymex() times pymex on the running host (MATLAB or
+    % GNU Octave): the latency of the common opcodes, the throughput of
+    % py_put and py_get for arrays of each class and size, and the time
+    % taken to start the host and embedded Python from scratch. Each
+    % result is appended as a row to a CSV file (by default
+    % pymex_bench.csv), so that runs from different releases and hosts
+    % can be compared; the rows are also returned as a struct array.
+    %
+    % Options, as name-value pairs:
+    %   'Output'   CSV file to append to, or '' for none.
+    %   'Label'    free text recorded with each row, e.g. a release tag.
+    %   'Sizes'    numbers of elements to marshal (default [1 100 1e4 1e6]).
+    %   'Classes'  classes to marshal (default all of those below).
+    %   'MinTime'  seconds to run each measurement for (default 0.2).
+    %   'Startup'  whether to time startup in a new host process (default
+    %              true; this takes a few host launches).
+    parser = inputParser;
+    parser.addParamValue('Output', 'pymex_bench.csv', @ischar);
+    parser.addParamValue('Label', '', @ischar);
+    parser.addParamValue('Sizes', [1 100 1e4 1e6], @isnumeric);
+    parser.addParamValue('Classes', {'double', 'single', 'int32', 'uint8', 'logical', 'char', 'cell'}, @iscellstr);
+    parser.addParamValue('MinTime', 0.2, @isnumeric);
+    parser.addParamValue('Startup', true, @islogical);
+    parser.parse(varargin{:});
+    opts = parser.Results;
+    
+    results = struct('benchmark', {}, 'class', {}, 'numel', {}, 'bytes', {}, 'calls', {}, 'seconds', {});
+    
+    % Opcode latency, calling pymex_fns directly so that only the MEX call
+    % itself (and one function handle call) is timed.
+    py_eval('import math; _bench_x = 1.0; _bench_t = (1.0,)');
+    math = py_import('math');
+    hypot = math.hypot;
+    tup = py_get('_bench_t');
+    timings = { ...
+        'EVAL', py_function_t.EVAL, {'pass'}; ...
+        'CALL', py_function_t.CALL, {hypot, {3, 4}}; ...
+        'GETATTR', py_function_t.GETATTR, {math, 'pi'}; ...
+        'GETITEM', py_function_t.GETITEM, {tup, 0}; ...
+        'PUT', py_function_t.PUT, {'_bench_x', 1}; ...
+        'GET', py_function_t.GET, {'_bench_x'}};
+    for idx = 1:size(timings, 1)
+        args = timings{idx, 3};
+        [seconds, calls] = time_per_call(make_call(timings{idx, 2}, args), opts.MinTime);
+        results(end+1) = make_result(timings{idx, 1}, '', 1, 0, calls, seconds);
+    end
+    
+    % Marshalling throughput, each way.
+    put_op = py_function_t.PUT;
+    get_op = py_function_t.GET;
+    for class_name = opts.Classes
+        for n = opts.Sizes
+            [value, bytes] = make_value(class_name{1}, n);
+            [seconds, calls] = time_per_call(make_call(put_op, {'_bench_x', value}), opts.MinTime);
+            results(end+1) = make_result('py_put', class_name{1}, n, bytes, calls, seconds);
+            pymex_fns(put_op, '_bench_x', value);
+            [seconds, calls] = time_per_call(make_call(get_op, {'_bench_x'}), opts.MinTime);
+            results(end+1) = make_result('py_get', class_name{1}, n, bytes, calls, seconds);
+        end
+    end
+    py_eval('del _bench_x, _bench_t');
+    
+    if opts.Startup
+        seconds = time_startup(fileparts(mfilename('fullpath')));
+        if ~isempty(seconds)
+            results(end+1) = make_result('startup', '', 0, 0, 1, seconds);
+        end
+    end
+    
+    print_results(results);
+    if ~isempty(opts.Output)
+        write_results(opts.Output, opts.Label, results);
+    end
+end
+
+function fn = make_call(op, args)
+    fn = @() pymex_fns(op, args{:});
+end
+
+function result = make_result(benchmark, class_name, n, bytes, calls, seconds)
+    result = struct('benchmark', benchmark, 'class', class_name, 'numel', n, ...
+        'bytes', bytes, 'calls', calls, 'seconds', seconds);
+end
+
+function [value, bytes] = make_value(class_name, n)
+    switch class_name
+        case 'char'
+            value = repmat('a', 1, n);
+            bytes = n;
+        case 'cell'
+            value = num2cell(1:n);
+            bytes = 8 * n;
+        case 'logical'
+            value = true(1, n);
+            bytes = n;
+        otherwise
+            value = ones(1, n, class_name);
+            bytes = n * numel(typecast(value(1), 'uint8'));
+    end
+end
+
+function [seconds, calls] = time_per_call(fn, min_time)
+    % Returns the seconds per call to fn, from the fastest of three runs,
+    % each of enough calls to take at least min_time.
+    calls = 1;
+    while true
+        elapsed = run_calls(fn, calls);
+        if elapsed >= min_time
+            break;
+        end
+        calls = calls * min(100, max(2, ceil(min_time / max(elapsed, 1e-6))));
+    end
+    seconds = min([elapsed, run_calls(fn, calls), run_calls(fn, calls)]) / calls;
+end
+
+function elapsed = run_calls(fn, calls)
+    start = tic;
+    for idx = 1:calls
+        fn();
+    end
+    elapsed = toc(start);
+end
+
+function seconds = time_startup(src_dir)
+    % Returns the time taken by a new host process to start Python and run
+    % a statement, over that taken to start without Python, or [] if the
+    % host could not be launched.
+    if is_octave()
+        launch = sprintf('"%s" --norc --eval "%%s"', fullfile(OCTAVE_HOME, 'bin', 'octave-cli'));
+    else
+        launch = sprintf('"%s" -nodisplay -nosplash -nodesktop -r "%%s; exit"', fullfile(matlabroot, 'bin', 'matlab'));
+        if ispc
+            % Otherwise, the launcher returns before MATLAB exits.
+            launch = strrep(launch, ' -r ', ' -wait -r ');
+        end
+    end
+    setup = sprintf('addpath(''%s'')', src_dir);
+    commands = {sprintf(launch, setup), sprintf(launch, [setup '; py_eval(''pass'')'])};
+    
+    times = inf(3, 2);
+    for trial = 1:size(times, 1)
+        for idx = 1:2
+            start = tic;
+            [status, out] = system(commands{idx});
+            times(trial, idx) = toc(start);
+            if status ~= 0
+                warning('pymex:bench', 'Could not time startup: %s', out);
+                seconds = [];
+                return;
+            end
+        end
+    end
+    seconds = min(times(:, 2)) - min(times(:, 1));
+end
+
+function print_results(results)
+    fprintf('%-10s %-8s %10s %8s %14s %14s\n', 'benchmark', 'class', 'numel', 'calls', 'us/call', 'MB/s');
+    for result = results
+        fprintf('%-10s %-8s %10d %8d %14.2f %14.1f\n', result.benchmark, result.class, ...
+            result.numel, result.calls, 1e6 * result.seconds, result.bytes / result.seconds / 1e6);
+    end
+end
+
+function write_results(filename, label, results)
+    % Appends results to a CSV file, with a header if the file is new.
+    if is_octave()
+        host = 'Octave';
+    else
+        host = 'MATLAB';
+    end
+    python_version = py_eval('platform.python_version()', struct('platform', py_import('platform')));
+    when = datestr(now, 'yyyy-mm-ddTHH:MM:SS');
+    
+    is_new = exist(filename, 'file') ~= 2;
+    fid = fopen(filename, 'a');
+    if fid < 0
+        error('pymex:bench', 'Could not open %s.', filename);
+    end
+    cleanup = onCleanup(@() fclose(fid));
+    if is_new
+        fprintf(fid, 'time,label,host,host_version,python_version,arch,benchmark,class,numel,bytes,calls,seconds\n');
+    end
+    for result = results
+        fprintf(fid, '%s,"%s",%s,%s,%s,%s,%s,%s,%d,%d,%d,%.9g\n', when, strrep(label, '"', '""'), ...
+            host, version, python_version, computer, result.benchmark, result.class, ...
+            result.numel, result.bytes, result.calls, result.seconds);
+    end
+end
+
+function tf = is_octave()
+    tf = exist('OCTAVE_VERSION', 'builtin') ~= 0;
+end
@@ -34,149 +34,449 @@ classdef (Sealed) py_builtins
         end
     end
     
+    %% LOOKUP %%
+    % Builtins are fetched from Python the first time each is used, and
+    % kept thereafter. If called with arguments, the builtin is called
+    % with them, so that e.g. py_builtins.repr(obj) works as expected.
+    methods (Static, Access = private)
+        function obj = lookup(name, args)
+            persistent cache;
+            if isempty(cache)
+                cache = containers.Map();
+            end
+            
+            if isKey(cache, name)
+                obj = cache(name);
+            else
+                obj = pymex_fns(py_function_t.BUILTIN, name);
+                cache(name) = obj;
+            end
+            
+            if ~isempty(args)
+                obj = call(obj, args{:});
+            end
+        end
+    end
+    
     %% FUNCTION VALUES %%
     % Generated using:
     % >>> import __builtin__
-    % >>> print "\n".join([(" " * 8) + ("{0} = py_get('{0}')".format(builtin_name)) for builtin_name in dir(__builtin__) if not builtin_name.startswith('_')])
-    properties (Access = public, Constant)
-        ArithmeticError = py_get('ArithmeticError')
-        AssertionError = py_get('AssertionError')
-        AttributeError = py_get('AttributeError')
-        BaseException = py_get('BaseException')
-        BufferError = py_get('BufferError')
-        BytesWarning = py_get('BytesWarning')
-        DeprecationWarning = py_get('DeprecationWarning')
-        EOFError = py_get('EOFError')
-        Ellipsis = py_get('Ellipsis')
-        EnvironmentError = py_get('EnvironmentError')
-        Exception = py_get('Exception')
-        False = py_get('False')
-        FloatingPointError = py_get('FloatingPointError')
-        FutureWarning = py_get('FutureWarning')
-        GeneratorExit = py_get('GeneratorExit')
-        IOError = py_get('IOError')
-        ImportError = py_get('ImportError')
-        ImportWarning = py_get('ImportWarning')
-        IndentationError = py_get('IndentationError')
-        IndexError = py_get('IndexError')
-        KeyError = py_get('KeyError')
-        KeyboardInterrupt = py_get('KeyboardInterrupt')
-        LookupError = py_get('LookupError')
-        MemoryError = py_get('MemoryError')
-        NameError = py_get('NameError')
-        None = py_get('None')
-        NotImplemented = py_get('NotImplemented')
-        NotImplementedError = py_get('NotImplementedError')
-        OSError = py_get('OSError')
-        OverflowError = py_get('OverflowError')
-        PendingDeprecationWarning = py_get('PendingDeprecationWarning')
-        ReferenceError = py_get('ReferenceError')
-        RuntimeError = py_get('RuntimeError')
-        RuntimeWarning = py_get('RuntimeWarning')
-        StandardError = py_get('StandardError')
-        StopIteration = py_get('StopIteration')
-        SyntaxError = py_get('SyntaxError')
-        SyntaxWarning = py_get('SyntaxWarning')
-        SystemError = py_get('SystemError')
-        SystemExit = py_get('SystemExit')
-        TabError = py_get('TabError')
-        True = py_get('True')
-        TypeError = py_get('TypeError')
-        UnboundLocalError = py_get('UnboundLocalError')
-        UnicodeDecodeError = py_get('UnicodeDecodeError')
-        UnicodeEncodeError = py_get('UnicodeEncodeError')
-        UnicodeError = py_get('UnicodeError')
-        UnicodeTranslateError = py_get('UnicodeTranslateError')
-        UnicodeWarning = py_get('UnicodeWarning')
-        UserWarning = py_get('UserWarning')
-        ValueError = py_get('ValueError')
-        Warning = py_get('Warning')
-        ZeroDivisionError = py_get('ZeroDivisionError')
-        abs = py_get('abs')
-        all = py_get('all')
-        any = py_get('any')
-        apply = py_get('apply')
-        basestring = py_get('basestring')
-        bin = py_get('bin')
-        bool = py_get('bool')
-        buffer = py_get('buffer')
-        bytearray = py_get('bytearray')
-        bytes = py_get('bytes')
-        callable = py_get('callable')
-        chr = py_get('chr')
-        classmethod = py_get('classmethod')
-        cmp = py_get('cmp')
-        coerce = py_get('coerce')
-        compile = py_get('compile')
-        complex = py_get('complex')
-        copyright = py_get('copyright')
-        credits = py_get('credits')
-        delattr = py_get('delattr')
-        dict = py_get('dict')
-        dir = py_get('dir')
-        divmod = py_get('divmod')
-        enumerate = py_get('enumerate')
-        eval = py_get('eval')
-        execfile = py_get('execfile')
-        exit = py_get('exit')
-        file = py_get('file')
-        filter = py_get('filter')
-        float = py_get('float')
-        format = py_get('format')
-        frozenset = py_get('frozenset')
-        getattr = py_get('getattr')
-        globals = py_get('globals')
-        hasattr = py_get('hasattr')
-        hash = py_get('hash')
-        help = py_get('help')
-        hex = py_get('hex')
-        id = py_get('id')
-        input = py_get('input')
-        int = py_get('int')
-        intern = py_get('intern')
-        isinstance = py_get('isinstance')
-        issubclass = py_get('issubclass')
-        iter = py_get('iter')
-        len = py_get('len')
-        license = py_get('license')
-        list = py_get('list')
-        locals = py_get('locals')
-        long = py_get('long')
-        map = py_get('map')
-        max = py_get('max')
-        memoryview = py_get('memoryview')
-        min = py_get('min')
-        next = py_get('next')
-        object = py_get('object')
-        oct = py_get('oct')
-        open = py_get('open')
-        ord = py_get('ord')
-        pow = py_get('pow')
-        print = py_get('print')
-        property = py_get('property')
-        quit = py_get('quit')
-        range = py_get('range')
-        raw_input = py_get('raw_input')
-        reduce = py_get('reduce')
-        reload = py_get('reload')
-        repr = py_get('repr')
-        reversed = py_get('reversed')
-        round = py_get('round')
-        set = py_get('set')
-        setattr = py_get('setattr')
-        slice = py_get('slice')
-        sorted = py_get('sorted')
-        staticmethod = py_get('staticmethod')
-        str = py_get('str')
-        sum = py_get('sum')
-        super = py_get('super')
-        tuple = py_get('tuple')
-        type = py_get('type')
-        unichr = py_get('unichr')
-        unicode = py_get('unicode')
-        vars = py_get('vars')
-        xrange = py_get('xrange')
-        zip = py_get('zip')
+    % >>> print "\n".join([(" " * 8) + ("function obj = {0}(varargin)\n            obj = py_builtins.lookup('{0}', varargin);\n        end".format(builtin_name)) for builtin_name in dir(__builtin__) if not builtin_name.startswith('_')])
+    methods (Static)
+        function obj = ArithmeticError(varargin)
+            obj = py_builtins.lookup('ArithmeticError', varargin);
+        end
+        function obj = AssertionError(varargin)
+            obj = py_builtins.lookup('AssertionError', varargin);
+        end
+        function obj = AttributeError(varargin)
+            obj = py_builtins.lookup('AttributeError', varargin);
+        end
+        function obj = BaseException(varargin)
+            obj = py_builtins.lookup('BaseException', varargin);
+        end
+        function obj = BufferError(varargin)
+            obj = py_builtins.lookup('BufferError', varargin);
+        end
+        function obj = BytesWarning(varargin)
+            obj = py_builtins.lookup('BytesWarning', varargin);
+        end
+        function obj = DeprecationWarning(varargin)
+            obj = py_builtins.lookup('DeprecationWarning', varargin);
+        end
+        function obj = EOFError(varargin)
+            obj = py_builtins.lookup('EOFError', varargin);
+        end
+        function obj = Ellipsis(varargin)
+            obj = py_builtins.lookup('Ellipsis', varargin);
+        end
+        function obj = EnvironmentError(varargin)
+            obj = py_builtins.lookup('EnvironmentError', varargin);
+        end
+        function obj = Exception(varargin)
+            obj = py_builtins.lookup('Exception', varargin);
+        end
+        function obj = False(varargin)
+            obj = py_builtins.lookup('False', varargin);
+        end
+        function obj = FloatingPointError(varargin)
+            obj = py_builtins.lookup('FloatingPointError', varargin);
+        end
+        function obj = FutureWarning(varargin)
+            obj = py_builtins.lookup('FutureWarning', varargin);
+        end
+        function obj = GeneratorExit(varargin)
+            obj = py_builtins.lookup('GeneratorExit', varargin);
+        end
+        function obj = IOError(varargin)
+            obj = py_builtins.lookup('IOError', varargin);
+        end
+        function obj = ImportError(varargin)
+            obj = py_builtins.lookup('ImportError', varargin);
+        end
+        function obj = ImportWarning(varargin)
+            obj = py_builtins.lookup('ImportWarning', varargin);
+        end
+        function obj = IndentationError(varargin)
+            obj = py_builtins.lookup('IndentationError', varargin);
+        end
+        function obj = IndexError(varargin)
+            obj = py_builtins.lookup('IndexError', varargin);
+        end
+        function obj = KeyError(varargin)
+            obj = py_builtins.lookup('KeyError', varargin);
+        end
+        function obj = KeyboardInterrupt(varargin)
+            obj = py_builtins.lookup('KeyboardInterrupt', varargin);
+        end
+        function obj = LookupError(varargin)
+            obj = py_builtins.lookup('LookupError', varargin);
+        end
+        function obj = MemoryError(varargin)
+            obj = py_builtins.lookup('MemoryError', varargin);
+        end
+        function obj = NameError(varargin)
+            obj = py_builtins.lookup('NameError', varargin);
+        end
+        function obj = None(varargin)
+            obj = py_builtins.lookup('None', varargin);
+        end
+        function obj = NotImplemented(varargin)
+            obj = py_builtins.lookup('NotImplemented', varargin);
+        end
+        function obj = NotImplementedError(varargin)
+            obj = py_builtins.lookup('NotImplementedError', varargin);
+        end
+        function obj = OSError(varargin)
+            obj = py_builtins.lookup('OSError', varargin);
+        end
+        function obj = OverflowError(varargin)
+            obj = py_builtins.lookup('OverflowError', varargin);
+        end
+        function obj = PendingDeprecationWarning(varargin)
+            obj = py_builtins.lookup('PendingDeprecationWarning', varargin);
+        end
+        function obj = ReferenceError(varargin)
+            obj = py_builtins.lookup('ReferenceError', varargin);
+        end
+        function obj = RuntimeError(varargin)
+            obj = py_builtins.lookup('RuntimeError', varargin);
+        end
+        function obj = RuntimeWarning(varargin)
+            obj = py_builtins.lookup('RuntimeWarning', varargin);
+        end
+        function obj = StandardError(varargin)
+            obj = py_builtins.lookup('StandardError', varargin);
+        end
+        function obj = StopIteration(varargin)
+            obj = py_builtins.lookup('StopIteration', varargin);
+        end
+        function obj = SyntaxError(varargin)
+            obj = py_builtins.lookup('SyntaxError', varargin);
+        end
+        function obj = SyntaxWarning(varargin)
+            obj = py_builtins.lookup('SyntaxWarning', varargin);
+        end
+        function obj = SystemError(varargin)
+            obj = py_builtins.lookup('SystemError', varargin);
+        end
+        function obj = SystemExit(varargin)
+            obj = py_builtins.lookup('SystemExit', varargin);
+        end
+        function obj = TabError(varargin)
+            obj = py_builtins.lookup('TabError', varargin);
+        end
+        function obj = True(varargin)
+            obj = py_builtins.lookup('True', varargin);
+        end
+        function obj = TypeError(varargin)
+            obj = py_builtins.lookup('TypeError', varargin);
+        end
+        function obj = UnboundLocalError(varargin)
+            obj = py_builtins.lookup('UnboundLocalError', varargin);
+        end
+        function obj = UnicodeDecodeError(varargin)
+            obj = py_builtins.lookup('UnicodeDecodeError', varargin);
+        end
+        function obj = UnicodeEncodeError(varargin)
+            obj = py_builtins.lookup('UnicodeEncodeError', varargin);
+        end
+        function obj = UnicodeError(varargin)
+            obj = py_builtins.lookup('UnicodeError', varargin);
+        end
+        function obj = UnicodeTranslateError(varargin)
+            obj = py_builtins.lookup('UnicodeTranslateError', varargin);
+        end
+        function obj = UnicodeWarning(varargin)
+            obj = py_builtins.lookup('UnicodeWarning', varargin);
+        end
+        function obj = UserWarning(varargin)
+            obj = py_builtins.lookup('UserWarning', varargin);
+        end
+        function obj = ValueError(varargin)
+            obj = py_builtins.lookup('ValueError', varargin);
+        end
+        function obj = Warning(varargin)
+            obj = py_builtins.lookup('Warning', varargin);
+        end
+        function obj = ZeroDivisionError(varargin)
+            obj = py_builtins.lookup('ZeroDivisionError', varargin);
+        end
+        function obj = abs(varargin)
+            obj = py_builtins.lookup('abs', varargin);
+        end
+        function obj = all(varargin)
+            obj = py_builtins.lookup('all', varargin);
+        end
+        function obj = any(varargin)
+            obj = py_builtins.lookup('any', varargin);
+        end
+        function obj = apply(varargin)
+            obj = py_builtins.lookup('apply', varargin);
+        end
+        function obj = basestring(varargin)
+            obj = py_builtins.lookup('basestring', varargin);
+        end
+        function obj = bin(varargin)
+            obj = py_builtins.lookup('bin', varargin);
+        end
+        function obj = bool(varargin)
+            obj = py_builtins.lookup('bool', varargin);
+        end
+        function obj = buffer(varargin)
+            obj = py_builtins.lookup('buffer', varargin);
+        end
+        function obj = bytearray(varargin)
+            obj = py_builtins.lookup('bytearray', varargin);
+        end
+        function obj = bytes(varargin)
+            obj = py_builtins.lookup('bytes', varargin);
+        end
+        function obj = callable(varargin)
+            obj = py_builtins.lookup('callable', varargin);
+        end
+        function obj = chr(varargin)
+            obj = py_builtins.lookup('chr', varargin);
+        end
+        function obj = classmethod(varargin)
+            obj = py_builtins.lookup('classmethod', varargin);
+        end
+        function obj = cmp(varargin)
+            obj = py_builtins.lookup('cmp', varargin);
+        end
+        function obj = coerce(varargin)
+            obj = py_builtins.lookup('coerce', varargin);
+        end
+        function obj = compile(varargin)
+            obj = py_builtins.lookup('compile', varargin);
+        end
+        function obj = complex(varargin)
+            obj = py_builtins.lookup('complex', varargin);
+        end
+        function obj = copyright(varargin)
+            obj = py_builtins.lookup('copyright', varargin);
+        end
+        function obj = credits(varargin)
+            obj = py_builtins.lookup('credits', varargin);
+        end
+        function obj = delattr(varargin)
+            obj = py_builtins.lookup('delattr', varargin);
+        end
+        function obj = dict(varargin)
+            obj = py_builtins.lookup('dict', varargin);
+        end
+        function obj = dir(varargin)
+            obj = py_builtins.lookup('dir', varargin);
+        end
+        function obj = divmod(varargin)
+            obj = py_builtins.lookup('divmod', varargin);
+        end
+        function obj = enumerate(varargin)
+            obj = py_builtins.lookup('enumerate', varargin);
+        end
+        function obj = eval(varargin)
+            obj = py_builtins.lookup('eval', varargin);
+        end
+        function obj = execfile(varargin)
+            obj = py_builtins.lookup('execfile', varargin);
+        end
+        function obj = exit(varargin)
+            obj = py_builtins.lookup('exit', varargin);
+        end
+        function obj = file(varargin)
+            obj = py_builtins.lookup('file', varargin);
+        end
+        function obj = filter(varargin)
+            obj = py_builtins.lookup('filter', varargin);
+        end
+        function obj = float(varargin)
+            obj = py_builtins.lookup('float', varargin);
+        end
+        function obj = format(varargin)
+            obj = py_builtins.lookup('format', varargin);
+        end
+        function obj = frozenset(varargin)
+            obj = py_builtins.lookup('frozenset', varargin);
+        end
+        function obj = getattr(varargin)
+            obj = py_builtins.lookup('getattr', varargin);
+        end
+        function obj = globals(varargin)
+            obj = py_builtins.lookup('globals', varargin);
+        end
+        function obj = hasattr(varargin)
+            obj = py_builtins.lookup('hasattr', varargin);
+        end
+        function obj = hash(varargin)
+            obj = py_builtins.lookup('hash', varargin);
+        end
+        function obj = help(varargin)
+            obj = py_builtins.lookup('help', varargin);
+        end
+        function obj = hex(varargin)
+            obj = py_builtins.lookup('hex', varargin);
+        end
+        function obj = id(varargin)
+            obj = py_builtins.lookup('id', varargin);
+        end
+        function obj = input(varargin)
+            obj = py_builtins.lookup('input', varargin);
+        end
+        function obj = int(varargin)
+            obj = py_builtins.lookup('int', varargin);
+        end
+        function obj = intern(varargin)
+            obj = py_builtins.lookup('intern', varargin);
+        end
+        function obj = isinstance(varargin)
+            obj = py_builtins.lookup('isinstance', varargin);
+        end
+        function obj = issubclass(varargin)
+            obj = py_builtins.lookup('issubclass', varargin);
+        end
+        function obj = iter(varargin)
+            obj = py_builtins.lookup('iter', varargin);
+        end
+        function obj = len(varargin)
+            obj = py_builtins.lookup('len', varargin);
+        end
+        function obj = license(varargin)
+            obj = py_builtins.lookup('license', varargin);
+        end
+        function obj = list(varargin)
+            obj = py_builtins.lookup('list', varargin);
+        end
+        function obj = locals(varargin)
+            obj = py_builtins.lookup('locals', varargin);
+        end
+        function obj = long(varargin)
+            obj = py_builtins.lookup('long', varargin);
+        end
+        function obj = map(varargin)
+            obj = py_builtins.lookup('map', varargin);
+        end
+        function obj = max(varargin)
+            obj = py_builtins.lookup('max', varargin);
+        end
+        function obj = memoryview(varargin)
+            obj = py_builtins.lookup('memoryview', varargin);
+        end
+        function obj = min(varargin)
+            obj = py_builtins.lookup('min', varargin);
+        end
+        function obj = next(varargin)
+            obj = py_builtins.lookup('next', varargin);
+        end
+        function obj = object(varargin)
+            obj = py_builtins.lookup('object', varargin);
+        end
+        function obj = oct(varargin)
+            obj = py_builtins.lookup('oct', varargin);
+        end
+        function obj = open(varargin)
+            obj = py_builtins.lookup('open', varargin);
+        end
+        function obj = ord(varargin)
+            obj = py_builtins.lookup('ord', varargin);
+        end
+        function obj = pow(varargin)
+            obj = py_builtins.lookup('pow', varargin);
+        end
+        function obj = print(varargin)
+            obj = py_builtins.lookup('print', varargin);
+        end
+        function obj = property(varargin)
+            obj = py_builtins.lookup('property', varargin);
+        end
+        function obj = quit(varargin)
+            obj = py_builtins.lookup('quit', varargin);
+        end
+        function obj = range(varargin)
+            obj = py_builtins.lookup('range', varargin);
+        end
+        function obj = raw_input(varargin)
+            obj = py_builtins.lookup('raw_input', varargin);
+        end
+        function obj = reduce(varargin)
+            obj = py_builtins.lookup('reduce', varargin);
+        end
+        function obj = reload(varargin)
+            obj = py_builtins.lookup('reload', varargin);
+        end
+        function obj = repr(varargin)
+            obj = py_builtins.lookup('repr', varargin);
+        end
+        function obj = reversed(varargin)
+            obj = py_builtins.lookup('reversed', varargin);
+        end
+        function obj = round(varargin)
+            obj = py_builtins.lookup('round', varargin);
+        end
+        function obj = set(varargin)
+            obj = py_builtins.lookup('set', varargin);
+        end
+        function obj = setattr(varargin)
+            obj = py_builtins.lookup('setattr', varargin);
+        end
+        function obj = slice(varargin)
+            obj = py_builtins.lookup('slice', varargin);
+        end
+        function obj = sorted(varargin)
+            obj = py_builtins.lookup('sorted', varargin);
+        end
+        function obj = staticmethod(varargin)
+            obj = py_builtins.lookup('staticmethod', varargin);
+        end
+        function obj = str(varargin)
+            obj = py_builtins.lookup('str', varargin);
+        end
+        function obj = sum(varargin)
+            obj = py_builtins.lookup('sum', varargin);
+        end
+        function obj = super(varargin)
+            obj = py_builtins.lookup('super', varargin);
+        end
+        function obj = tuple(varargin)
+            obj = py_builtins.lookup('tuple', varargin);
+        end
+        function obj = type(varargin)
+            obj = py_builtins.lookup('type', varargin);
+        end
+        function obj = unichr(varargin)
+            obj = py_builtins.lookup('unichr', varargin);
+        end
+        function obj = unicode(varargin)
+            obj = py_builtins.lookup('unicode', varargin);
+        end
+        function obj = vars(varargin)
+            obj = py_builtins.lookup('vars', varargin);
+        end
+        function obj = xrange(varargin)
+            obj = py_builtins.lookup('xrange', varargin);
+        end
+        function obj = zip(varargin)
+            obj = py_builtins.lookup('zip', varargin);
+        end
     end
 
 end
@@ -0,0 +1,38 @@
+%%
+% py_channel.m: Makes a ring buffer for streaming frames into Python.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+function ch = py_channel(shape, class_name, capacity)
+    % ch = py_channel(shape, class_name, capacity) returns a pymex.Channel,
+    % a ring buffer of up to capacity (default 1024, rounded up to a power
+    % of two) frames, each a real array of the given shape and class. Write
+    % frames with py_channel_write; pass ch to Python, where a reader (e.g.
+    % on a background thread) takes NumPy views of them with ch.frames()
+    % and hands them back with ch.release(n). Call ch.close() when done, so
+    % that a blocked reader returns.
+    if nargin < 2
+        class_name = 'double';
+    end
+    if nargin < 3
+        capacity = 1024;
+    end
+    ch = pymex_fns(py_function_t.CHANNEL, double(shape), class_name, capacity);
+end
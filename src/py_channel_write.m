@@ -0,0 +1,36 @@
+%%
+% py_channel_write.m: Writes frames to a channel made by py_channel.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+function n = py_channel_write(ch, frames, block)
+    % n = py_channel_write(ch, frames) copies every frame in frames (whose
+    % elements, in MATLAB's order, must make whole frames; e.g. a stack of
+    % frames along the last dimension) into the channel ch, and makes them
+    % visible to the reader all at once. Waits, letting Python threads
+    % run, until there is room for all of them.
+    %
+    % n = py_channel_write(ch, frames, false) instead writes only as many
+    % frames as fit right away. Returns the number of frames written.
+    if nargin < 3
+        block = true;
+    end
+    n = pymex_fns(py_function_t.CHANWRITE, ch, frames, logical(block));
+end
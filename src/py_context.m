@@ -0,0 +1,39 @@
+%%
+% py_context.m: Makes a separate namespace for running Python code.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+
+function context = py_context(name)
+    % context = py_context() returns a new, empty namespace to use in place
+    % of __main__, by passing it as the last argument of py_eval, py_put
+    % and py_get. Globals set in one context aren't seen by code run in
+    % __main__ or in any other context, so that independent pieces of code
+    % can't overwrite each other's variables; imported modules are shared.
+    %
+    % py_context(name) also sets the context's __name__ (by default,
+    % '__context__').
+    new_context = py_import('_pymex.contexts', 'new_context');
+    if nargin < 1
+        context = new_context();
+    else
+        context = new_context(name);
+    end
+end
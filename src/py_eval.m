@@ -21,16 +21,33 @@
 %%
 
 function retval = py_eval(varargin)
-    if nargin > 1
+    % py_eval(statement) or py_eval statement: runs Python code in __main__.
+    % value = py_eval(expr, bindings): evaluates a Python expression, with
+    % the fields of the struct bindings as local variables, and returns its
+    % value, all in one call and without touching __main__.
+    % py_eval(..., context) does either in a context from py_context, in
+    % place of __main__.
+    context = {};
+    if nargin > 1 && isa(varargin{end}, 'PyObject')
+        context = varargin(end);
+        varargin(end) = [];
+    end
+    
+    if numel(varargin) == 2 && isstruct(varargin{2})
+        retval = pymex_fns(py_function_t.EVALEXPR, varargin{1}, varargin{2}, context{:});
+        return;
+    end
+
+    if numel(varargin) > 1
         cmd = varargin{1};
-        for idx = 2:nargin
+        for idx = 2:numel(varargin)
             cmd = [cmd ' ' varargin{idx}];
         end
     else
         cmd = varargin{1};
     end
 
-    % FIXME: always returns None for some reason.
-    retval = pymex_fns(py_function_t.EVAL, cmd);
+    % Statements have no value, so this is always None.
+    retval = pymex_fns(py_function_t.EVAL, cmd, context{:});
     
 end
@@ -0,0 +1,29 @@
+%%
+% py_flush.m: Releases Python objects whose PyObject handles were destroyed.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+function n = py_flush()
+    % Destroying a PyObject only queues its reference to be released; the
+    % queue is drained in bulk by the next pymex call, or once it grows
+    % large enough. Call py_flush to release everything right away, e.g.
+    % before measuring Python's memory usage.
+    n = pymex_fns(py_function_t.FLUSH);
+end
@@ -0,0 +1,56 @@
+%%
+% py_function_handle.m: Wraps a Python callable as a MATLAB function handle.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+function fn = py_function_handle(callee, varargin)
+    % fn = py_function_handle(callee) returns a function handle that calls
+    % callee, for passing to fminsearch, fzero, ode45 and the like. Unlike
+    % other calls into Python, real double arrays are passed as lists of
+    % floats (in column-major order), and numbers and sequences of numbers
+    % are returned as doubles (sequences as column vectors).
+    %
+    % fn = py_function_handle(callee, 'Vectorized', true) instead calls
+    % callee once per column of the last argument, and returns the results
+    % as the columns of a matrix; use this for integral, or for ode45 with
+    % odeset('Vectorized', 'on').
+    %
+    % fn = py_function_handle(callee, 'NumInputs', n) returns a handle
+    % taking exactly n (at most 3) arguments, which is cheaper to call than
+    % one taking varargin.
+    parser = inputParser;
+    parser.addParamValue('Vectorized', false, @islogical);
+    parser.addParamValue('NumInputs', [], @isnumeric);
+    parser.parse(varargin{:});
+    
+    plan = pymex_fns(py_function_t.FHANDLE, callee, parser.Results.Vectorized);
+    op = py_function_t.CALLPLAN;
+    
+    switch parser.Results.NumInputs
+        case 1
+            fn = @(a) pymex_fns(op, plan, a);
+        case 2
+            fn = @(a, b) pymex_fns(op, plan, a, b);
+        case 3
+            fn = @(a, b, c) pymex_fns(op, plan, a, b, c);
+        otherwise
+            fn = @(varargin) pymex_fns(op, plan, varargin{:});
+    end
+end
@@ -44,13 +44,24 @@ classdef (Sealed) py_function_t
         GETATTR = int8(6);
         CALL = int8(7);
         GETITEM = int8(8);
-        MUL = int8(9);
-        EQ = int8(10);
-        LT = int8(11);
-        GT = int8(12);
-        LE = int8(13);
-        GE = int8(14);
-        NE = int8(15);
+        BINOP = int8(9);
+        UNOP = int8(10);
+        SETATTR = int8(11);
+        SETITEM = int8(12);
+        FLUSH = int8(13);
+        TRACK = int8(14);
+        BUILTIN = int8(15);
+        EVALEXPR = int8(16);
+        PREPARE = int8(17);
+        CALLPLAN = int8(18);
+        FHANDLE = int8(19);
+        PUMP = int8(20);
+        CHANNEL = int8(21);
+        CHANWRITE = int8(22);
+        MEMOIZE = int8(23);
+        MEMOCALL = int8(24);
+        MAP = int8(25);
+        TRACE = int8(26);
     end
 
 end
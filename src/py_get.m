@@ -20,9 +20,11 @@
 % along with this program.  If not, see <http://www.gnu.org/licenses/>.
 %%
 
-function pyobj = py_get(varname)
+function pyobj = py_get(varname, varargin)
+    % py_get(varname) returns a global of __main__ (or a builtin);
+    % py_get(varname, context) returns one of a context from py_context.
     % TODO: move call to PyObject constructor into pymex_fns.c, as
     %       we will need to add special cases.
-    pyobj = pymex_fns(py_function_t.GET, varname);
+    pyobj = pymex_fns(py_function_t.GET, varname, varargin{:});
     %pyobj = PyObject.new(ptr);
 end
@@ -20,18 +20,29 @@
 % along with this program.  If not, see <http://www.gnu.org/licenses/>.
 %%
 
-function [varargout] = py_import(name)
-    py_obj = pymex_fns(py_function_t.IMPORT, name);
-    if nargout == 1
-        varargout{1} = py_obj;
+function [varargout] = py_import(name, varargin)
+    % py_import(name) or py_import name: imports a module, binding it (or
+    % for dotted names, its root package) in the caller's workspace.
+    % py_import(name, attr1, attr2, ...): imports attributes or submodules
+    % from a module, as Python's "from name import attr1, attr2, ...".
+    if ~isempty(varargin)
+        objs = cell(1, numel(varargin));
+        [objs{:}] = pymex_fns(py_function_t.IMPORT, name, varargin{:});
+        if nargout == 0
+            for idx = 1:numel(varargin)
+                assignin('caller', varargin{idx}, objs{idx});
+            end
+        else
+            varargout = objs;
+        end
+    elseif nargout == 1
+        varargout{1} = pymex_fns(py_function_t.IMPORT, name);
     else
-        % If there's a dot, we need to import until we get the "root" object,
-        % then put that in the caller's namespace.
+        % The MEX side resolves the root package in the same call.
+        [py_obj, root_obj] = pymex_fns(py_function_t.IMPORT, name);
         idxs_dot = strfind(name, '.');
         if ~isempty(idxs_dot)
-            root_name = name(1:idxs_dot(1)-1);
-            root_obj = py_import(root_name);
-            assignin('caller', root_name, root_obj);
+            assignin('caller', name(1:idxs_dot(1)-1), root_obj);
         else
             assignin('caller', name, py_obj);
         end
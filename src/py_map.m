@@ -0,0 +1,54 @@
+%%
+% py_map.m: Applies a Python callable to each slice of an array.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+
+function out = py_map(fn, data, varargin)
+    % out = py_map(fn, data) calls the Python callable fn on each column of
+    % the matrix data (each element, if data is a vector or a cell array),
+    % all in one call into pymex rather than one per column, and returns
+    % the results as a double array: a row vector if fn returns numbers, or
+    % a K x N matrix if it returns sequences of K numbers.
+    %
+    % Columns of more than one element are passed as read-only memoryviews
+    % of their data, which np.asarray turns into arrays without copying;
+    % single elements are passed as Python scalars.
+    %
+    % py_map(..., 'Dim', 1) maps over the rows of data instead (giving an
+    % N x K result), and py_map(..., 'Output', class) gives a result of
+    % another numeric class, or 'logical', or with 'cell', a cell array of
+    % whatever fn returns, converted as py_get would.
+    parser = inputParser;
+    parser.addParamValue('Dim', [], @isnumeric);
+    parser.addParamValue('Output', 'double', @ischar);
+    parser.parse(varargin{:});
+    
+    dim = parser.Results.Dim;
+    if isempty(dim)
+        if ~iscell(data) && size(data, 2) == 1
+            dim = 1;
+        else
+            dim = 2;
+        end
+    end
+    
+    out = pymex_fns(py_function_t.MAP, fn, data, dim, parser.Results.Output);
+end
@@ -0,0 +1,49 @@
+%%
+% py_memoize.m: Caches the results of a pure Python callable.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+function [fn, memo] = py_memoize(callee, varargin)
+    % [fn, memo] = py_memoize(callee) returns a function handle that calls
+    % callee, which must be a pure function of its arguments, and caches
+    % what it returns. Calls with the same arguments (by class, shape and
+    % contents) return the cached result without converting anything or
+    % calling Python. Calls with PyObjects or other MATLAB objects as
+    % arguments are not cached.
+    %
+    % Results that come back as PyObjects are cached as the Python objects
+    % themselves, so every hit returns the very same object: if callee
+    % returns something mutable, changes made through one result are seen
+    % by every later hit. Return immutable values, or copy on the way out.
+    %
+    % memo is the pymex.Memo behind fn: read memo.hits, memo.misses,
+    % memo.hit_rate, memo.entries and memo.bytes for statistics, and call
+    % memo.clear() to empty it.
+    %
+    % py_memoize(callee, 'Budget', n) keeps at most n bytes of results
+    % (default 64 MiB), evicting the least recently used first.
+    parser = inputParser;
+    parser.addParamValue('Budget', 64 * 2^20, @isnumeric);
+    parser.parse(varargin{:});
+    
+    memo = pymex_fns(py_function_t.MEMOIZE, callee, parser.Results.Budget);
+    op = py_function_t.MEMOCALL;
+    fn = @(varargin) pymex_fns(op, memo, varargin{:});
+end
@@ -0,0 +1,67 @@
+%%
+% py_operator_t.m: Class copying `operator_t` enumeration from
+%     pymex_operators.h.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+classdef (Sealed) py_operator_t
+
+    % As with py_function_t, these are literal int8 values rather than an
+    % enumeration so that they can be passed directly through MEX.
+
+    % Prevent construction.
+    methods (Access = private)
+        function self = py_operator_t()
+        end
+    end
+    
+    %% ENUM VALUES %%
+    properties (Access = public, Constant)
+        % Binary arithmetic operators.
+        ADD = int8(0);
+        SUB = int8(1);
+        MUL = int8(2);
+        TRUEDIV = int8(3);
+        FLOORDIV = int8(4);
+        MOD = int8(5);
+        POW = int8(6);
+        AND = int8(7);
+        OR = int8(8);
+        XOR = int8(9);
+        LSHIFT = int8(10);
+        RSHIFT = int8(11);
+        % Rich comparisons.
+        LT = int8(12);
+        LE = int8(13);
+        EQ = int8(14);
+        NE = int8(15);
+        GT = int8(16);
+        GE = int8(17);
+        % Unary operators.
+        NEG = int8(18);
+        POS = int8(19);
+        ABS = int8(20);
+        INVERT = int8(21);
+        NOT = int8(22);
+        LEN = int8(23);
+        NUMEL = int8(24);
+    end
+
+end
@@ -0,0 +1,32 @@
+%%
+% py_prepare.m: Prepares a call plan for a Python callable.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+function fn = py_prepare(callee, varargin)
+    % fn = py_prepare(callee, example_args...) returns a function handle
+    % that calls callee, specialized to arguments of the same classes as
+    % example_args (double, logical, int32 and int64 scalars, strings and
+    % PyObjects) and to the type of the first value returned. Arguments and
+    % returns that don't match are still converted, just more slowly.
+    plan = pymex_fns(py_function_t.PREPARE, callee, varargin{:});
+    op = py_function_t.CALLPLAN;
+    fn = @(varargin) pymex_fns(op, plan, varargin{:});
+end
@@ -0,0 +1,38 @@
+%%
+% py_pump.m: Runs MATLAB calls queued by Python threads.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+function n = py_pump(timeout)
+    % MATLAB can only be called from its own thread, so pymex.feval,
+    % pymex.mateval, pymex.matwrite and pymex.get called from other Python
+    % threads are queued, and return a pymex.Future. The queue is run at the
+    % start of every pymex call; py_pump runs it explicitly, first waiting
+    % up to timeout seconds (default 0) for something to arrive. Python
+    % threads run while py_pump waits, so a loop like
+    %
+    %     while py_eval('worker.is_alive()', struct()), py_pump(0.1); end
+    %
+    % keeps a background pipeline moving. Returns how many calls ran.
+    if nargin < 1
+        timeout = 0;
+    end
+    n = pymex_fns(py_function_t.PUMP, timeout);
+end
@@ -20,6 +20,8 @@
 % along with this program.  If not, see <http://www.gnu.org/licenses/>.
 %%
 
-function py_put(varname, value)
-    pymex_fns(int8(4), varname, value);
+function py_put(varname, value, varargin)
+    % py_put(varname, value) sets a global of __main__; py_put(varname,
+    % value, context) sets one of a context from py_context instead.
+    pymex_fns(int8(4), varname, value, varargin{:});
 end
\ No newline at end of file
@@ -0,0 +1,45 @@
+%%
+% py_trace.m: Records a trace of calls between MATLAB and Python.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+function varargout = py_trace(command, filename)
+    % PY_TRACE  Records calls across the MATLAB/Python boundary as a trace.
+    %
+    %   py_trace on      starts recording each pymex call, each conversion
+    %                    between MATLAB and Python values, and each call
+    %                    back into MATLAB, with when it started and ended.
+    %   py_trace frames  as on, but also records each Python call.
+    %   py_trace off     stops recording; recorded events are kept.
+    %   py_trace reset   discards all recorded events.
+    %
+    %   n = py_trace('save', filename) writes the recorded events to filename
+    %   in the Chrome trace event format, as read by chrome://tracing and
+    %   https://ui.perfetto.dev, and returns how many there were.
+    
+    if strcmp(command, 'save')
+        n_events = pymex_fns(py_function_t.TRACE, 'save', filename);
+        if nargout > 0
+            varargout{1} = n_events;
+        end
+    else
+        pymex_fns(py_function_t.TRACE, command);
+    end
+end
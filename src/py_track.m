@@ -0,0 +1,84 @@
+%%
+% py_track.m: Tracks objects passed between MATLAB and Python, to find leaks.
+%%
+% (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+%    
+% This file is a part of the pymex-embed project.
+% Licensed under the AGPL version 3.
+%%
+% This program is free software: you can redistribute it and/or modify
+% it under the terms of the GNU Affero General Public License as published by
+% the Free Software Foundation, either version 3 of the License, or
+% (at your option) any later version.
+%
+% This program is distributed in the hope that it will be useful,
+% but WITHOUT ANY WARRANTY; without even the implied warranty of
+% MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+% GNU Affero General Public License for more details.
+%
+% You should have received a copy of the GNU Affero General Public License
+% along with this program.  If not, see <http://www.gnu.org/licenses/>.
+%%
+
+function varargout = py_track(command)
+    % PY_TRACK  Records objects handed across the MATLAB/Python boundary.
+    %
+    %   py_track on     starts recording each boxed PyObject and each
+    %                   persistent mxArray, along with where it came from.
+    %   py_track off    stops recording new objects. Objects already recorded
+    %                   are kept until they are released.
+    %   py_track reset  forgets all recorded objects.
+    %
+    %   live = py_track('dump') returns a struct array describing recorded
+    %   objects that are still alive, grouped by kind, type, opcode and
+    %   origin, with the largest groups (by bytes) first. Without an output
+    %   argument, the summary is printed instead.
+    
+    if strcmp(command, 'dump')
+        live = group_records(pymex_fns(py_function_t.TRACK, 'dump'));
+        if nargout == 0
+            for group = live
+                fprintf('%10d B %6d x %-8s %-24s %-8s %s\n', ...
+                    group.bytes, group.count, group.kind, group.type, ...
+                    group.opcode, group.origin);
+            end
+        else
+            varargout{1} = live;
+        end
+    else
+        pymex_fns(py_function_t.TRACK, command);
+    end
+end
+
+function groups = group_records(records)
+    if isempty(records)
+        groups = records;
+        return;
+    end
+    
+    keys = arrayfun(@(r) sprintf('%s|%s|%d|%s', r.kind, r.type, r.opcode, r.origin), ...
+        records, 'UniformOutput', false);
+    [~, first, which] = unique(keys);
+    counts = accumarray(which(:), [records.count]');
+    bytes = accumarray(which(:), [records.bytes]');
+    
+    names = opcode_names();
+    groups = records(first);
+    for idx = 1:numel(groups)
+        groups(idx).count = counts(idx);
+        groups(idx).bytes = bytes(idx);
+        groups(idx).opcode = names(int32(groups(idx).opcode));
+    end
+    
+    [~, order] = sort(bytes, 'descend');
+    groups = groups(order);
+end
+
+function names = opcode_names()
+    % Maps py_function_t values back to their names.
+    names = containers.Map('KeyType', 'int32', 'ValueType', 'char');
+    names(-1) = 'UNKNOWN';
+    for prop = meta.class.fromName('py_function_t').PropertyList'
+        names(int32(prop.DefaultValue)) = prop.Name;
+    end
+end
@@ -0,0 +1,162 @@
+/**
+ * pymex_bytes.c: Binary data as uint8 arrays and read-only memoryviews.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// Python's str is text as far as py2mat is concerned (it becomes a char
+// array), so binary data is told apart by type instead: bytearray, buffer
+// and memoryview objects become uint8 column vectors, in one copy, and a
+// str can be sent as binary by wrapping it in buffer() or memoryview(),
+// neither of which copies. In the other direction, a uint8 array wrapped
+// in a PyBytes object arrives in Python as a read-only memoryview over the
+// array's data.
+//
+// The memoryview needs the data to outlive the MEX call, so it is a view of
+// a pymex._BytesHolder, which owns the persistent copy of the array that
+// mxGetProperty hands us, and frees it when the last view goes. MAP uses
+// holders the same way, for views of slices of its input (see pymex_map.c).
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "pymex_bytes.h"
+#include "pymex_callbacks.h"
+#include "pymex_marshal.h"
+#include "pymex_track.h"
+#include <string.h>
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    PyObject_HEAD
+    mxArray* array;
+    // Read from the array up front, since views may be taken on any thread.
+    void* data;
+    Py_ssize_t n_bytes;
+} bytes_holder_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+static PyTypeObject bytes_holder_type = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+// HOLDERS /////////////////////////////////////////////////////////////////////
+
+static void bytes_holder_dealloc(bytes_holder_t* self) {
+    TRACK_RELEASE(self->array);
+    destroy_array_on_mex_thread(self->array);
+    PyObject_Del(self);
+}
+
+static int bytes_holder_getbuffer(bytes_holder_t* self, Py_buffer* view, int flags) {
+    return PyBuffer_FillInfo(view, (PyObject*) self, self->data, self->n_bytes, 1, flags);
+}
+
+static PyBufferProcs bytes_holder_as_buffer;
+
+void init_bytes_type(PyObject* module) {
+    bytes_holder_as_buffer.bf_getbuffer = (getbufferproc) bytes_holder_getbuffer;
+    
+    bytes_holder_type.tp_name = "pymex._BytesHolder";
+    bytes_holder_type.tp_basicsize = sizeof(bytes_holder_t);
+    bytes_holder_type.tp_dealloc = (destructor) bytes_holder_dealloc;
+    bytes_holder_type.tp_as_buffer = &bytes_holder_as_buffer;
+    bytes_holder_type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER;
+    bytes_holder_type.tp_doc = "Owner of the MATLAB array behind a memoryview made from PyBytes.";
+    if (PyType_Ready(&bytes_holder_type) < 0) {
+        return;
+    }
+    Py_INCREF(&bytes_holder_type);
+    PyModule_AddObject(module, "_BytesHolder", (PyObject*) &bytes_holder_type);
+}
+
+/**
+ * Returns a holder that takes over array, making it persistent; its buffer
+ * is the array's data, as read-only bytes. MEX thread only.
+ */
+PyObject* new_array_holder(mxArray* array) {
+    bytes_holder_t* holder = PyObject_New(bytes_holder_t, &bytes_holder_type);
+    
+    if (holder == NULL) {
+        mxDestroyArray(array);
+        return NULL;
+    }
+    mexMakeArrayPersistent(array);
+    TRACK_NEW(TRACK_MXARRAY, array);
+    holder->array = array;
+    holder->data = mxGetData(array);
+    holder->n_bytes = mxGetNumberOfElements(array) * mxGetElementSize(array);
+    return (PyObject*) holder;
+}
+
+// MARSHALLING FUNCTIONS ///////////////////////////////////////////////////////
+
+/**
+ * Returns a read-only memoryview of the data in a PyBytes object. MEX
+ * thread only.
+ */
+PyObject* memoryview_from_bytes(const mxArray* m_bytes) {
+    // As in MATLAB, we get our own copy, which becomes the holder's.
+    mxArray* data = mxGetProperty(m_bytes, 0, "data");
+    PyObject *holder, *view;
+    
+    if (data == NULL || mxGetClassID(data) != mxUINT8_CLASS || mxIsComplex(data)) {
+        mexErrMsgTxt("PyBytes data must be a real uint8 array.");
+    }
+    holder = new_array_holder(data);
+    if (holder == NULL) {
+        return NULL;
+    }
+    
+    view = PyMemoryView_FromObject(holder);
+    Py_DECREF(holder);
+    return view;
+}
+
+/**
+ * Converts a bytearray, buffer or memoryview to a uint8 column vector,
+ * copying its data once. Consumes the reference, as py2mat does; objects
+ * whose data isn't contiguous are boxed instead.
+ */
+mxArray* py2mat_bytes(PyObject* py_value) {
+    Py_buffer view;
+    const void* data;
+    Py_ssize_t n_bytes;
+    mxArray* m_bytes;
+    
+    if (PyObject_CheckBuffer(py_value)) {
+        if (PyObject_GetBuffer(py_value, &view, PyBUF_CONTIG_RO) < 0) {
+            PyErr_Clear();
+            return box_pyobject(py_value);
+        }
+        m_bytes = mxCreateNumericMatrix(view.len, 1, mxUINT8_CLASS, mxREAL);
+        memcpy(mxGetData(m_bytes), view.buf, view.len);
+        PyBuffer_Release(&view);
+    } else {
+        // Old-style buffers only.
+        if (PyObject_AsReadBuffer(py_value, &data, &n_bytes) < 0) {
+            PyErr_Clear();
+            return box_pyobject(py_value);
+        }
+        m_bytes = mxCreateNumericMatrix(n_bytes, 1, mxUINT8_CLASS, mxREAL);
+        memcpy(mxGetData(m_bytes), data, n_bytes);
+    }
+    
+    Py_DECREF(py_value);
+    return m_bytes;
+}
@@ -0,0 +1,46 @@
+/**
+ * pymex_bytes.h: Binary data as uint8 arrays and read-only memoryviews.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_BYTES_H
+#define PYMEX_BYTES_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// MATLAB class marking a uint8 array as binary data; see PyBytes.m.
+#define PY_BYTES_CLASS_NAME "PyBytes"
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+void init_bytes_type(PyObject* module);
+PyObject* new_array_holder(mxArray* array);
+PyObject* memoryview_from_bytes(const mxArray* m_bytes);
+mxArray* py2mat_bytes(PyObject* py_value);
+
+#endif
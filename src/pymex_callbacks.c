@@ -0,0 +1,446 @@
+/**
+ * pymex_callbacks.c: Queue for MATLAB calls made from other Python threads.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// MATLAB's API may only be used on the thread that MATLAB calls the MEX
+// file from, but Python code running inside pymex is free to start threads
+// of its own (data loaders, logging handlers, thread pools), and those
+// threads may call pymex.feval, pymex.mateval, pymex.matwrite or pymex.get.
+// Rather than running such calls directly, we push them onto a queue and
+// hand back a pymex.Future. The queue is run on the MEX thread at the start
+// of every pymex_fns call, and by py_pump or pymex.pump, which also release
+// the GIL while waiting so that other threads get to make progress.
+//
+// The queue is an intrusive multiple-producer, single-consumer list after
+// Vyukov: pushing is a single atomic exchange, and popping (on the MEX
+// thread only) needs no atomics at all, so checking for an empty queue on
+// every MEX call costs a couple of loads. A pump waiting on an empty queue
+// sleeps on a condition variable, which producers signal only when they
+// see a pump waiting.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "pymex_callbacks.h"
+#include <pythread.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Longest that pumps and waits on the MEX thread sleep, with the GIL
+// released, between looks at the queue. A push normally wakes them sooner.
+#define PUMP_SLEEP_MS 1
+
+#ifdef WINDOWS
+#define ATOMIC_EXCHANGE_PTR(target, value) InterlockedExchangePointer((PVOID volatile*) (target), (value))
+#define MEMORY_BARRIER() MemoryBarrier()
+#else
+#define ATOMIC_EXCHANGE_PTR(target, value) __sync_lock_test_and_set((target), (value))
+#define MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    PyObject_HEAD
+    // Held from creation until the future completes, so that other threads
+    // can wait for it by acquiring it.
+    PyThread_type_lock lock;
+    volatile int done;
+    PyObject* result;
+    PyObject *exc_type, *exc_value, *exc_tb;
+} future_t;
+
+typedef struct callback_s {
+    struct callback_s* volatile next;
+    PyCFunction fn;
+    int flags;
+    PyObject* args;
+    PyObject* kwargs;
+    future_t* future;
+} callback_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+// Queued callbacks are allocated with malloc, since they are made on other
+// threads and outlive the MEX call that drains them.
+
+static long mex_thread_ident = -1;
+
+// The queue always holds at least the sentinel. Producers push at the head;
+// the MEX thread pops from the tail.
+static callback_t queue_sentinel;
+static callback_t* volatile queue_head = &queue_sentinel;
+static callback_t* queue_tail = &queue_sentinel;
+
+static volatile int pump_waiting = 0;
+#ifndef WINDOWS
+static pthread_mutex_t wakeup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+#endif
+
+static PyTypeObject future_type = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+// TIME ////////////////////////////////////////////////////////////////////////
+
+static double now_seconds() {
+    #ifdef WINDOWS
+        return GetTickCount64() / 1000.0;
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+    #endif
+}
+
+// QUEUE ///////////////////////////////////////////////////////////////////////
+
+static void push_callback(callback_t* node) {
+    callback_t* prev;
+    
+    node->next = NULL;
+    MEMORY_BARRIER();
+    prev = ATOMIC_EXCHANGE_PTR(&queue_head, node);
+    // Until this store, the consumer sees the queue end at prev, and picks
+    // node up on a later pump.
+    prev->next = node;
+}
+
+/**
+ * Wakes the MEX thread if it is waiting for callbacks.
+ */
+static void signal_callbacks() {
+    MEMORY_BARRIER();
+    if (!pump_waiting) {
+        return;
+    }
+    #ifndef WINDOWS
+        pthread_mutex_lock(&wakeup_lock);
+        pthread_cond_signal(&wakeup);
+        pthread_mutex_unlock(&wakeup_lock);
+    #endif
+}
+
+static bool queue_looks_empty() {
+    return queue_tail == &queue_sentinel && queue_sentinel.next == NULL;
+}
+
+/**
+ * Sleeps until a callback is pushed, or for at most PUMP_SLEEP_MS. Call
+ * with the GIL released.
+ */
+static void wait_for_callbacks() {
+    #ifdef WINDOWS
+        Sleep(PUMP_SLEEP_MS);
+    #else
+        struct timespec deadline;
+        
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += PUMP_SLEEP_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        
+        pthread_mutex_lock(&wakeup_lock);
+        pump_waiting = 1;
+        MEMORY_BARRIER();
+        // A producer that missed pump_waiting has already pushed, and a
+        // push still in progress is caught by the timeout.
+        if (queue_looks_empty()) {
+            pthread_cond_timedwait(&wakeup, &wakeup_lock, &deadline);
+        }
+        pump_waiting = 0;
+        pthread_mutex_unlock(&wakeup_lock);
+    #endif
+}
+
+/**
+ * Takes the oldest callback off the queue, or returns NULL if there is none
+ * (or if the only one is still being pushed). MEX thread only.
+ */
+static callback_t* pop_callback() {
+    callback_t *tail = queue_tail, *next = tail->next;
+    
+    if (tail == &queue_sentinel) {
+        if (next == NULL) {
+            return NULL;
+        }
+        queue_tail = tail = next;
+        next = next->next;
+    }
+    if (next != NULL) {
+        queue_tail = next;
+        return tail;
+    }
+    
+    // tail is the last node; it can only be popped once the sentinel is
+    // queued behind it.
+    if (tail != queue_head) {
+        return NULL;
+    }
+    push_callback(&queue_sentinel);
+    next = tail->next;
+    if (next != NULL) {
+        queue_tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+// FUTURES /////////////////////////////////////////////////////////////////////
+
+/**
+ * Records the result of a callback (or, if result is NULL, the pending
+ * exception) and wakes anyone waiting. Steals the reference to result.
+ */
+static void complete_future(future_t* future, PyObject* result) {
+    if (result == NULL) {
+        PyErr_Fetch(&future->exc_type, &future->exc_value, &future->exc_tb);
+        PyErr_NormalizeException(&future->exc_type, &future->exc_value, &future->exc_tb);
+    }
+    future->result = result;
+    future->done = 1;
+    PyThread_release_lock(future->lock);
+}
+
+static void wait_for_future(future_t* future) {
+    if (future->done) {
+        return;
+    }
+    
+    if (on_mex_thread()) {
+        // Nobody else will run the queue, so we do.
+        while (!future->done) {
+            if (pump_callbacks() == 0 && !future->done) {
+                Py_BEGIN_ALLOW_THREADS
+                wait_for_callbacks();
+                Py_END_ALLOW_THREADS
+            }
+        }
+    } else {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(future->lock, WAIT_LOCK);
+        PyThread_release_lock(future->lock);
+        Py_END_ALLOW_THREADS
+    }
+}
+
+static PyObject* future_done(future_t* self, PyObject* unused) {
+    return PyBool_FromLong(self->done);
+}
+
+static PyObject* future_result(future_t* self, PyObject* unused) {
+    wait_for_future(self);
+    if (self->exc_type != NULL) {
+        Py_INCREF(self->exc_type);
+        Py_XINCREF(self->exc_value);
+        Py_XINCREF(self->exc_tb);
+        PyErr_Restore(self->exc_type, self->exc_value, self->exc_tb);
+        return NULL;
+    }
+    Py_INCREF(self->result);
+    return self->result;
+}
+
+static PyObject* future_exception(future_t* self, PyObject* unused) {
+    PyObject* exc = Py_None;
+    
+    wait_for_future(self);
+    if (self->exc_value != NULL) {
+        exc = self->exc_value;
+    }
+    Py_INCREF(exc);
+    return exc;
+}
+
+static void future_dealloc(future_t* self) {
+    if (!self->done) {
+        PyThread_release_lock(self->lock);
+    }
+    PyThread_free_lock(self->lock);
+    Py_XDECREF(self->result);
+    Py_XDECREF(self->exc_type);
+    Py_XDECREF(self->exc_value);
+    Py_XDECREF(self->exc_tb);
+    PyObject_Del(self);
+}
+
+static PyMethodDef future_methods[] = {
+    {"done", (PyCFunction) future_done, METH_NOARGS,
+        "Returns True if the MATLAB call has run."},
+    {"result", (PyCFunction) future_result, METH_NOARGS,
+        "Waits for the MATLAB call to run, and returns its value or raises its exception."},
+    {"exception", (PyCFunction) future_exception, METH_NOARGS,
+        "Waits for the MATLAB call to run, and returns its exception, or None."},
+    {NULL, NULL, 0, NULL}
+};
+
+static future_t* new_future() {
+    future_t* future = PyObject_New(future_t, &future_type);
+    
+    future->lock = PyThread_allocate_lock();
+    PyThread_acquire_lock(future->lock, WAIT_LOCK);
+    future->done = 0;
+    future->result = NULL;
+    future->exc_type = future->exc_value = future->exc_tb = NULL;
+    return future;
+}
+
+// CALLBACKS ///////////////////////////////////////////////////////////////////
+
+/**
+ * Remembers the calling thread as the MEX thread, and adds the Future type
+ * to the pymex module.
+ */
+void init_callbacks(PyObject* module) {
+    mex_thread_ident = PyThread_get_thread_ident();
+    
+    future_type.tp_name = "pymex.Future";
+    future_type.tp_basicsize = sizeof(future_t);
+    future_type.tp_dealloc = (destructor) future_dealloc;
+    future_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    future_type.tp_doc = "Result of a MATLAB call made from a thread other than MATLAB's.";
+    future_type.tp_methods = future_methods;
+    if (PyType_Ready(&future_type) < 0) {
+        return;
+    }
+    Py_INCREF(&future_type);
+    PyModule_AddObject(module, "Future", (PyObject*) &future_type);
+}
+
+bool on_mex_thread() {
+    return PyThread_get_thread_ident() == mex_thread_ident;
+}
+
+/**
+ * Queues a call to fn (a pymex method with the given METH_ flags) to be run
+ * on the MEX thread, and returns a new reference to a future for its
+ * result. Must be called with the GIL held.
+ */
+PyObject* enqueue_callback(PyCFunction fn, int flags, PyObject* args, PyObject* kwargs) {
+    callback_t* node = malloc(sizeof(callback_t));
+    
+    if (node == NULL) {
+        return PyErr_NoMemory();
+    }
+    node->fn = fn;
+    node->flags = flags;
+    node->args = args;
+    Py_XINCREF(args);
+    node->kwargs = kwargs;
+    Py_XINCREF(kwargs);
+    node->future = new_future();
+    Py_INCREF(node->future);
+    
+    push_callback(node);
+    signal_callbacks();
+    return (PyObject*) node->future;
+}
+
+static PyObject* destroy_array(PyObject* self, PyObject* ptr) {
+    mxDestroyArray((mxArray*) PyLong_AsVoidPtr(ptr));
+    Py_RETURN_NONE;
+}
+
+/**
+ * Frees a persistent array held by a Python object, from whichever thread
+ * dropped the last reference to it. The MATLAB API is only safe to use on
+ * the MEX thread, so from any other the array is queued to be freed there.
+ */
+void destroy_array_on_mex_thread(mxArray* array) {
+    PyObject *ptr, *future;
+    
+    if (on_mex_thread()) {
+        mxDestroyArray(array);
+    } else {
+        // Nobody waits on this one.
+        ptr = PyLong_FromVoidPtr(array);
+        future = enqueue_callback(destroy_array, METH_O, ptr, NULL);
+        Py_XDECREF(future);
+        Py_XDECREF(ptr);
+    }
+}
+
+static void release_callback(callback_t* node) {
+    Py_XDECREF(node->args);
+    Py_XDECREF(node->kwargs);
+    Py_DECREF(node->future);
+    free(node);
+}
+
+/**
+ * Runs every callback queued so far, returning how many ran. Callbacks may
+ * call back into pymex_fns, and so run the queue themselves. MEX thread
+ * only, with the GIL held.
+ */
+int pump_callbacks() {
+    callback_t* node;
+    PyObject* result;
+    int n_run = 0;
+    
+    while ((node = pop_callback()) != NULL) {
+        if (node->flags & METH_KEYWORDS) {
+            result = ((PyCFunctionWithKeywords) node->fn)(NULL, node->args, node->kwargs);
+        } else {
+            result = node->fn(NULL, node->args);
+        }
+        complete_future(node->future, result);
+        release_callback(node);
+        ++n_run;
+    }
+    return n_run;
+}
+
+/**
+ * Runs queued callbacks until at least one has run or timeout seconds have
+ * passed, with the GIL released while waiting. Returns how many ran.
+ */
+int pump_callbacks_for(double timeout) {
+    double deadline = now_seconds() + timeout;
+    int n_run = pump_callbacks();
+    
+    while (n_run == 0 && now_seconds() < deadline) {
+        Py_BEGIN_ALLOW_THREADS
+        wait_for_callbacks();
+        Py_END_ALLOW_THREADS
+        n_run = pump_callbacks();
+    }
+    return n_run;
+}
+
+/**
+ * Fails every queued callback, so that threads waiting on them wake up
+ * before Python is finalized.
+ */
+void cancel_callbacks() {
+    callback_t* node;
+    
+    while ((node = pop_callback()) != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "MATLAB callback cancelled; pymex is shutting down.");
+        complete_future(node->future, NULL);
+        release_callback(node);
+    }
+}
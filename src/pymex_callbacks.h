@@ -0,0 +1,44 @@
+/**
+ * pymex_callbacks.h: Queue for MATLAB calls made from other Python threads.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_CALLBACKS_H
+#define PYMEX_CALLBACKS_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+void init_callbacks(PyObject* module);
+bool on_mex_thread();
+PyObject* enqueue_callback(PyCFunction fn, int flags, PyObject* args, PyObject* kwargs);
+void destroy_array_on_mex_thread(mxArray* array);
+int pump_callbacks();
+int pump_callbacks_for(double timeout);
+void cancel_callbacks();
+
+#endif
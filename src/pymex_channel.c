@@ -0,0 +1,661 @@
+/**
+ * pymex_channel.c: Shared-memory ring buffers streaming frames from MATLAB to Python.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// A pymex.Channel is a single-producer, single-consumer ring buffer of
+// fixed-shape numeric frames, for streaming data from MATLAB into Python
+// without converting or boxing anything per frame. The writer (usually
+// MATLAB, via py_channel_write) copies a whole batch of frames in with one
+// MEX call and publishes them with a single store of the write index; the
+// reader (usually a Python thread) takes views of the frames straight out
+// of the ring with acquire() or frames(), and hands them back in bulk with
+// release(). In steady state neither side allocates per frame.
+//
+// Each side owns one index, and the two sit on separate cache lines at the
+// start of the mapping, with the frames following from the next page. A
+// side that finds nothing to do either returns at once or, if blocking,
+// sleeps with the GIL released until the other side signals it.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "pymex_channel.h"
+#include <structmember.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+#endif
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define CACHE_LINE_BYTES 64
+// Frames start this far into the mapping, so that they are page-aligned.
+#define CHANNEL_HEADER_BYTES 4096
+// Longest a blocked side sleeps before looking again, should a signal be
+// missed.
+#define CHANNEL_WAIT_MS 10
+
+#ifdef WINDOWS
+#define MEMORY_BARRIER() MemoryBarrier()
+#else
+#define MEMORY_BARRIER() __sync_synchronize()
+#endif
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    // Frames committed by the writer.
+    volatile uint64_t write_index;
+    char pad0[CACHE_LINE_BYTES - sizeof(uint64_t)];
+    // Frames released by the reader.
+    volatile uint64_t read_index;
+    char pad1[CACHE_LINE_BYTES - sizeof(uint64_t)];
+} ring_indices_t;
+
+typedef struct {
+    char typecode;
+    const char* class_name;
+    mxClassID class_id;
+    size_t element_bytes;
+} channel_type_t;
+
+typedef struct {
+    PyObject_HEAD
+    ring_indices_t* indices;
+    char* data;
+    size_t map_bytes;
+    Py_ssize_t capacity;
+    Py_ssize_t record_bytes;
+    Py_ssize_t record_elements;
+    const channel_type_t* type;
+    char typecode;
+    PyObject* shape;
+    char closed;
+    // Set by a side about to sleep, so that the other knows to wake it.
+    volatile int reader_waiting;
+    volatile int writer_waiting;
+    #ifndef WINDOWS
+        pthread_mutex_t lock;
+        pthread_cond_t changed;
+    #endif
+} channel_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+// Typecodes are those of the struct module, which NumPy also accepts.
+static const channel_type_t CHANNEL_TYPES[] = {
+    {'d', "double", mxDOUBLE_CLASS, 8},
+    {'f', "single", mxSINGLE_CLASS, 4},
+    {'b', "int8", mxINT8_CLASS, 1},
+    {'B', "uint8", mxUINT8_CLASS, 1},
+    {'h', "int16", mxINT16_CLASS, 2},
+    {'H', "uint16", mxUINT16_CLASS, 2},
+    {'i', "int32", mxINT32_CLASS, 4},
+    {'I', "uint32", mxUINT32_CLASS, 4},
+    {'q', "int64", mxINT64_CLASS, 8},
+    {'Q', "uint64", mxUINT64_CLASS, 8},
+    {'?', "logical", mxLOGICAL_CLASS, 1},
+};
+
+#define N_CHANNEL_TYPES (sizeof(CHANNEL_TYPES) / sizeof(CHANNEL_TYPES[0]))
+
+static PyTypeObject channel_type = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+// MAPPINGS ////////////////////////////////////////////////////////////////////
+
+static void* map_pages(size_t n_bytes) {
+    #ifdef WINDOWS
+        return VirtualAlloc(NULL, n_bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    #else
+        void* pages = mmap(NULL, n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        return pages == MAP_FAILED ? NULL : pages;
+    #endif
+}
+
+static void unmap_pages(void* pages, size_t n_bytes) {
+    #ifdef WINDOWS
+        VirtualFree(pages, 0, MEM_RELEASE);
+    #else
+        munmap(pages, n_bytes);
+    #endif
+}
+
+// WAITING /////////////////////////////////////////////////////////////////////
+
+static Py_ssize_t frames_ready(channel_t* ch) {
+    uint64_t w = ch->indices->write_index;
+    MEMORY_BARRIER();
+    return (Py_ssize_t) (w - ch->indices->read_index);
+}
+
+static Py_ssize_t space_free(channel_t* ch) {
+    uint64_t r = ch->indices->read_index;
+    MEMORY_BARRIER();
+    return ch->capacity - (Py_ssize_t) (ch->indices->write_index - r);
+}
+
+/**
+ * Sleeps until the other side signals, or for at most CHANNEL_WAIT_MS,
+ * unless the channel becomes ready first. Call with the GIL released.
+ */
+static void wait_on_channel(channel_t* ch, volatile int* waiting, Py_ssize_t (*ready)(channel_t*)) {
+    #ifdef WINDOWS
+        if (ready(ch) == 0 && !ch->closed) {
+            Sleep(1);
+        }
+    #else
+        struct timespec deadline;
+        
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += CHANNEL_WAIT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        
+        pthread_mutex_lock(&ch->lock);
+        *waiting = 1;
+        MEMORY_BARRIER();
+        if (ready(ch) == 0 && !ch->closed) {
+            pthread_cond_timedwait(&ch->changed, &ch->lock, &deadline);
+        }
+        *waiting = 0;
+        pthread_mutex_unlock(&ch->lock);
+    #endif
+}
+
+/**
+ * Wakes the other side if it is waiting. Call after moving an index.
+ */
+static void wake_channel(channel_t* ch, volatile int* waiting) {
+    MEMORY_BARRIER();
+    if (!*waiting) {
+        return;
+    }
+    #ifndef WINDOWS
+        pthread_mutex_lock(&ch->lock);
+        pthread_cond_broadcast(&ch->changed);
+        pthread_mutex_unlock(&ch->lock);
+    #endif
+}
+
+// READING AND WRITING /////////////////////////////////////////////////////////
+
+/**
+ * Copies n_frames frames into the ring, committing each run that fits with
+ * one store of the write index. If block is true, waits (with the GIL
+ * released) for the reader to make room; otherwise returns as soon as the
+ * ring is full. Returns the number of frames written.
+ */
+static Py_ssize_t channel_write(channel_t* ch, const char* frames, Py_ssize_t n_frames, bool block) {
+    uint64_t w = ch->indices->write_index;
+    Py_ssize_t n_written = 0, n, offset, first;
+    size_t rb = ch->record_bytes;
+    
+    while (n_written < n_frames && !ch->closed) {
+        n = space_free(ch);
+        if (n == 0) {
+            if (!block) {
+                break;
+            }
+            Py_BEGIN_ALLOW_THREADS
+            wait_on_channel(ch, &ch->writer_waiting, space_free);
+            Py_END_ALLOW_THREADS
+            continue;
+        }
+        if (n > n_frames - n_written) {
+            n = n_frames - n_written;
+        }
+        
+        // The run may wrap around the end of the ring.
+        offset = (Py_ssize_t) (w & (ch->capacity - 1));
+        first = n < ch->capacity - offset ? n : ch->capacity - offset;
+        memcpy(ch->data + offset * rb, frames + n_written * rb, first * rb);
+        memcpy(ch->data, frames + (n_written + first) * rb, (n - first) * rb);
+        
+        // The frames must be visible before the index that publishes them.
+        MEMORY_BARRIER();
+        w += n;
+        ch->indices->write_index = w;
+        n_written += n;
+        wake_channel(ch, &ch->reader_waiting);
+    }
+    
+    return n_written;
+}
+
+/**
+ * Finds the frames the reader may look at next: at most max_frames (if
+ * positive), and never wrapping around the end of the ring. If block is
+ * true and nothing is ready, waits until something is or the channel is
+ * closed. Returns the number of frames, and their offset in *offset.
+ */
+static Py_ssize_t channel_acquire(channel_t* ch, Py_ssize_t max_frames, bool block, Py_ssize_t* offset) {
+    Py_ssize_t n;
+    
+    while ((n = frames_ready(ch)) == 0 && block && !ch->closed) {
+        Py_BEGIN_ALLOW_THREADS
+        wait_on_channel(ch, &ch->reader_waiting, frames_ready);
+        Py_END_ALLOW_THREADS
+    }
+    
+    *offset = (Py_ssize_t) (ch->indices->read_index & (ch->capacity - 1));
+    if (n > ch->capacity - *offset) {
+        n = ch->capacity - *offset;
+    }
+    if (max_frames > 0 && n > max_frames) {
+        n = max_frames;
+    }
+    return n;
+}
+
+// CREATION ////////////////////////////////////////////////////////////////////
+
+static const channel_type_t* find_channel_type(char typecode, const char* class_name) {
+    size_t idx;
+    
+    for (idx = 0; idx < N_CHANNEL_TYPES; ++idx) {
+        if (class_name != NULL ? strcmp(CHANNEL_TYPES[idx].class_name, class_name) == 0 :
+                CHANNEL_TYPES[idx].typecode == typecode) {
+            return &CHANNEL_TYPES[idx];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Makes a channel of capacity frames (rounded up to a power of two), each
+ * an array of the given shape and type. Returns a new reference, or NULL
+ * with an exception set.
+ */
+static PyObject* new_channel(const channel_type_t* type, int ndims, const Py_ssize_t* dims,
+        Py_ssize_t capacity) {
+    channel_t* ch;
+    Py_ssize_t record_elements = 1, rounded = 1;
+    int idx;
+    
+    if (ndims < 1 || ndims > MAX_CHANNEL_DIMS) {
+        PyErr_Format(PyExc_ValueError, "Frames must have between 1 and %d dimensions.", MAX_CHANNEL_DIMS);
+        return NULL;
+    }
+    for (idx = 0; idx < ndims; ++idx) {
+        if (dims[idx] < 1) {
+            PyErr_SetString(PyExc_ValueError, "Frame dimensions must be positive.");
+            return NULL;
+        }
+        record_elements *= dims[idx];
+    }
+    if (capacity < 1) {
+        PyErr_SetString(PyExc_ValueError, "Capacity must be positive.");
+        return NULL;
+    }
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+    
+    ch = PyObject_New(channel_t, &channel_type);
+    if (ch == NULL) {
+        return NULL;
+    }
+    ch->indices = NULL;
+    ch->type = type;
+    ch->typecode = type->typecode;
+    ch->capacity = rounded;
+    ch->record_elements = record_elements;
+    ch->record_bytes = record_elements * type->element_bytes;
+    ch->closed = 0;
+    ch->reader_waiting = ch->writer_waiting = 0;
+    ch->shape = PyTuple_New(ndims);
+    for (idx = 0; idx < ndims; ++idx) {
+        PyTuple_SET_ITEM(ch->shape, idx, PyInt_FromSsize_t(dims[idx]));
+    }
+    #ifndef WINDOWS
+        pthread_mutex_init(&ch->lock, NULL);
+        pthread_cond_init(&ch->changed, NULL);
+    #endif
+    
+    ch->map_bytes = CHANNEL_HEADER_BYTES + (size_t) rounded * ch->record_bytes;
+    ch->indices = map_pages(ch->map_bytes);
+    if (ch->indices == NULL) {
+        Py_DECREF(ch);
+        return PyErr_NoMemory();
+    }
+    ch->data = (char*) ch->indices + CHANNEL_HEADER_BYTES;
+    ch->indices->write_index = 0;
+    ch->indices->read_index = 0;
+    
+    return (PyObject*) ch;
+}
+
+/**
+ * Makes a channel of frames of the given MATLAB class (e.g. "double").
+ */
+PyObject* new_channel_for_class(const char* class_name, int ndims, const Py_ssize_t* dims,
+        Py_ssize_t capacity) {
+    const channel_type_t* type = find_channel_type(0, class_name);
+    
+    if (type == NULL) {
+        PyErr_Format(PyExc_TypeError, "Channels can't hold frames of class %s.", class_name);
+        return NULL;
+    }
+    return new_channel(type, ndims, dims, capacity);
+}
+
+/**
+ * Writes every frame of a MATLAB array to a channel: the array's class must
+ * match the channel's, and its elements must make a whole number of
+ * frames, in the order MATLAB stores them (so a stack of frames along the
+ * last dimension works). Returns the number of frames written, or -1 with
+ * an exception set.
+ */
+Py_ssize_t write_channel_frames(PyObject* channel, const mxArray* frames, bool block) {
+    channel_t* ch;
+    size_t n_elements;
+    
+    if (!PyObject_TypeCheck(channel, &channel_type)) {
+        PyErr_SetString(PyExc_TypeError, "Expected a pymex.Channel.");
+        return -1;
+    }
+    ch = (channel_t*) channel;
+    
+    n_elements = mxGetNumberOfElements(frames);
+    if (mxGetClassID(frames) != ch->type->class_id || mxIsComplex(frames) || mxIsSparse(frames)) {
+        PyErr_Format(PyExc_TypeError, "Channel expects real, full %s frames.", ch->type->class_name);
+        return -1;
+    }
+    if (n_elements % ch->record_elements != 0) {
+        PyErr_Format(PyExc_ValueError, "Frames must have a multiple of %zd elements.",
+            ch->record_elements);
+        return -1;
+    }
+    if (ch->closed) {
+        PyErr_SetString(PyExc_ValueError, "Channel is closed.");
+        return -1;
+    }
+    
+    return channel_write(ch, mxGetData(frames), n_elements / ch->record_elements, block);
+}
+
+// PYTHON METHODS //////////////////////////////////////////////////////////////
+
+static PyObject* channel_new(PyTypeObject* type, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"shape", "typecode", "capacity", NULL};
+    Py_ssize_t dims[MAX_CHANNEL_DIMS], capacity = DEFAULT_CHANNEL_CAPACITY;
+    const channel_type_t* channel_type_entry;
+    PyObject *shape, *seq;
+    char typecode = 'd';
+    int ndims, idx;
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|cn", kwlist, &shape, &typecode, &capacity)) {
+        return NULL;
+    }
+    channel_type_entry = find_channel_type(typecode, NULL);
+    if (channel_type_entry == NULL) {
+        PyErr_Format(PyExc_ValueError, "Unsupported typecode '%c'.", typecode);
+        return NULL;
+    }
+    
+    if (PyInt_Check(shape) || PyLong_Check(shape)) {
+        ndims = 1;
+        dims[0] = PyInt_AsSsize_t(shape);
+    } else {
+        seq = PySequence_Fast(shape, "Shape must be an integer or a sequence of integers.");
+        if (seq == NULL) {
+            return NULL;
+        }
+        ndims = (int) PySequence_Fast_GET_SIZE(seq);
+        for (idx = 0; idx < ndims && idx < MAX_CHANNEL_DIMS; ++idx) {
+            dims[idx] = PyInt_AsSsize_t(PySequence_Fast_GET_ITEM(seq, idx));
+        }
+        Py_DECREF(seq);
+    }
+    if (PyErr_Occurred() != NULL) {
+        return NULL;
+    }
+    
+    return new_channel(channel_type_entry, ndims, dims, capacity);
+}
+
+static void channel_dealloc(channel_t* self) {
+    if (self->indices != NULL) {
+        unmap_pages(self->indices, self->map_bytes);
+    }
+    #ifndef WINDOWS
+        pthread_mutex_destroy(&self->lock);
+        pthread_cond_destroy(&self->changed);
+    #endif
+    Py_XDECREF(self->shape);
+    PyObject_Del(self);
+}
+
+static PyObject* channel_write_method(channel_t* self, PyObject* args, PyObject* kwargs) {
+    static char* kwlist[] = {"data", "block", NULL};
+    PyObject *data, *block = Py_True;
+    const void* buf;
+    Py_ssize_t n_bytes;
+    
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist, &data, &block)) {
+        return NULL;
+    }
+    if (PyObject_AsReadBuffer(data, &buf, &n_bytes) < 0) {
+        return NULL;
+    }
+    if (n_bytes % self->record_bytes != 0) {
+        PyErr_Format(PyExc_ValueError, "Data must be a multiple of %zd bytes.", self->record_bytes);
+        return NULL;
+    }
+    if (self->closed) {
+        PyErr_SetString(PyExc_ValueError, "Channel is closed.");
+        return NULL;
+    }
+    
+    return PyInt_FromSsize_t(channel_write(self, buf, n_bytes / self->record_bytes,
+        PyObject_IsTrue(block)));
+}
+
+static bool parse_acquire_args(PyObject* args, PyObject* kwargs, Py_ssize_t* max_frames, bool* block) {
+    static char* kwlist[] = {"max_frames", "block", NULL};
+    PyObject* py_block = Py_True;
+    
+    *max_frames = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|nO", kwlist, max_frames, &py_block)) {
+        return false;
+    }
+    *block = PyObject_IsTrue(py_block);
+    return true;
+}
+
+static PyObject* channel_acquire_method(channel_t* self, PyObject* args, PyObject* kwargs) {
+    Py_ssize_t max_frames, n, offset;
+    bool block;
+    
+    if (!parse_acquire_args(args, kwargs, &max_frames, &block)) {
+        return NULL;
+    }
+    n = channel_acquire(self, max_frames, block, &offset);
+    // The buffer keeps the channel, and so the ring, alive.
+    return PyBuffer_FromReadWriteObject((PyObject*) self, offset * self->record_bytes,
+        n * self->record_bytes);
+}
+
+static PyObject* import_numpy_ndarray() {
+    PyObject *numpy = PyImport_ImportModule("numpy"), *ndarray;
+    
+    if (numpy == NULL) {
+        return NULL;
+    }
+    ndarray = PyObject_GetAttrString(numpy, "ndarray");
+    Py_DECREF(numpy);
+    return ndarray;
+}
+
+static PyObject* channel_frames_method(channel_t* self, PyObject* args, PyObject* kwargs) {
+    Py_ssize_t max_frames, n, offset, stride;
+    PyObject *ndarray, *buffer, *shape, *strides, *call_args, *frames;
+    bool block;
+    int ndims, idx;
+    
+    if (!parse_acquire_args(args, kwargs, &max_frames, &block)) {
+        return NULL;
+    }
+    ndarray = import_numpy_ndarray();
+    if (ndarray == NULL) {
+        return NULL;
+    }
+    
+    n = channel_acquire(self, max_frames, block, &offset);
+    buffer = PyBuffer_FromReadWriteObject((PyObject*) self, offset * self->record_bytes,
+        n * self->record_bytes);
+    
+    // Frames are stacked along the first axis; within a frame, elements are
+    // in MATLAB's column-major order.
+    ndims = (int) PyTuple_GET_SIZE(self->shape);
+    shape = PyTuple_New(ndims + 1);
+    strides = PyTuple_New(ndims + 1);
+    PyTuple_SET_ITEM(shape, 0, PyInt_FromSsize_t(n));
+    PyTuple_SET_ITEM(strides, 0, PyInt_FromSsize_t(self->record_bytes));
+    stride = self->type->element_bytes;
+    for (idx = 0; idx < ndims; ++idx) {
+        Py_INCREF(PyTuple_GET_ITEM(self->shape, idx));
+        PyTuple_SET_ITEM(shape, idx + 1, PyTuple_GET_ITEM(self->shape, idx));
+        PyTuple_SET_ITEM(strides, idx + 1, PyInt_FromSsize_t(stride));
+        stride *= PyInt_AsSsize_t(PyTuple_GET_ITEM(self->shape, idx));
+    }
+    
+    // ndarray(shape, dtype, buffer, offset, strides)
+    call_args = Py_BuildValue("(NNNiN)", shape, PyString_FromStringAndSize(&self->typecode, 1),
+        buffer, 0, strides);
+    frames = PyObject_CallObject(ndarray, call_args);
+    Py_DECREF(call_args);
+    Py_DECREF(ndarray);
+    return frames;
+}
+
+static PyObject* channel_release_method(channel_t* self, PyObject* args) {
+    Py_ssize_t n;
+    
+    if (!PyArg_ParseTuple(args, "n", &n)) {
+        return NULL;
+    }
+    if (n < 0 || n > frames_ready(self)) {
+        PyErr_SetString(PyExc_ValueError, "Can't release more frames than are ready.");
+        return NULL;
+    }
+    
+    // Reading the frames must be finished before the writer can reuse them.
+    MEMORY_BARRIER();
+    self->indices->read_index += n;
+    wake_channel(self, &self->writer_waiting);
+    
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject* channel_available_method(channel_t* self, PyObject* unused) {
+    return PyInt_FromSsize_t(frames_ready(self));
+}
+
+static PyObject* channel_close_method(channel_t* self, PyObject* unused) {
+    self->closed = 1;
+    wake_channel(self, &self->reader_waiting);
+    wake_channel(self, &self->writer_waiting);
+    
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyMethodDef channel_methods[] = {
+    {"write", (PyCFunction) channel_write_method, METH_VARARGS | METH_KEYWORDS,
+        "write(data, block=True): copies whole frames from a buffer into the channel, returning how many were written."},
+    {"acquire", (PyCFunction) channel_acquire_method, METH_VARARGS | METH_KEYWORDS,
+        "acquire(max_frames=0, block=True): returns a buffer over the next frames (none if the channel is closed and empty); they stay valid until released."},
+    {"frames", (PyCFunction) channel_frames_method, METH_VARARGS | METH_KEYWORDS,
+        "frames(max_frames=0, block=True): as acquire, but returns a NumPy array viewing the frames, stacked along the first axis."},
+    {"release", (PyCFunction) channel_release_method, METH_VARARGS,
+        "release(n): hands the next n frames back to the writer."},
+    {"available", (PyCFunction) channel_available_method, METH_NOARGS,
+        "available(): returns the number of frames ready to read."},
+    {"close", (PyCFunction) channel_close_method, METH_NOARGS,
+        "close(): stops further writes, and wakes a blocked reader once the channel is empty."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef channel_members[] = {
+    {"shape", T_OBJECT, offsetof(channel_t, shape), READONLY, "Shape of each frame."},
+    {"typecode", T_CHAR, offsetof(channel_t, typecode), READONLY, "struct module typecode of the elements."},
+    {"capacity", T_PYSSIZET, offsetof(channel_t, capacity), READONLY, "Number of frames the ring holds."},
+    {"record_bytes", T_PYSSIZET, offsetof(channel_t, record_bytes), READONLY, "Size of each frame in bytes."},
+    {"closed", T_BOOL, offsetof(channel_t, closed), READONLY, "True once close() has been called."},
+    {NULL}
+};
+
+// BUFFER PROTOCOL /////////////////////////////////////////////////////////////
+// Exposes the whole ring, so that buffers over parts of it can hold a
+// reference to the channel.
+
+static Py_ssize_t channel_getbuffer(channel_t* self, Py_ssize_t segment, void** ptr) {
+    if (segment != 0) {
+        PyErr_SetString(PyExc_SystemError, "Channels have a single segment.");
+        return -1;
+    }
+    *ptr = self->data;
+    return self->capacity * self->record_bytes;
+}
+
+static Py_ssize_t channel_segcount(channel_t* self, Py_ssize_t* len) {
+    if (len != NULL) {
+        *len = self->capacity * self->record_bytes;
+    }
+    return 1;
+}
+
+static PyBufferProcs channel_as_buffer;
+
+// INITIALIZATION //////////////////////////////////////////////////////////////
+
+/**
+ * Adds the Channel type to the pymex module.
+ */
+void init_channel_type(PyObject* module) {
+    channel_as_buffer.bf_getreadbuffer = (readbufferproc) channel_getbuffer;
+    channel_as_buffer.bf_getwritebuffer = (writebufferproc) channel_getbuffer;
+    channel_as_buffer.bf_getsegcount = (segcountproc) channel_segcount;
+    
+    channel_type.tp_name = "pymex.Channel";
+    channel_type.tp_basicsize = sizeof(channel_t);
+    channel_type.tp_dealloc = (destructor) channel_dealloc;
+    channel_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    channel_type.tp_doc = "Channel(shape, typecode='d', capacity=1024): ring buffer of fixed-shape frames.";
+    channel_type.tp_methods = channel_methods;
+    channel_type.tp_members = channel_members;
+    channel_type.tp_as_buffer = &channel_as_buffer;
+    channel_type.tp_new = channel_new;
+    if (PyType_Ready(&channel_type) < 0) {
+        return;
+    }
+    Py_INCREF(&channel_type);
+    PyModule_AddObject(module, "Channel", (PyObject*) &channel_type);
+}
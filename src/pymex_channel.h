@@ -0,0 +1,46 @@
+/**
+ * pymex_channel.h: Shared-memory ring buffers streaming frames from MATLAB to Python.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_CHANNEL_H
+#define PYMEX_CHANNEL_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define DEFAULT_CHANNEL_CAPACITY 1024
+#define MAX_CHANNEL_DIMS 8
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+void init_channel_type(PyObject* module);
+PyObject* new_channel_for_class(const char* class_name, int ndims, const Py_ssize_t* dims,
+    Py_ssize_t capacity);
+Py_ssize_t write_channel_frames(PyObject* channel, const mxArray* frames, bool block);
+
+#endif
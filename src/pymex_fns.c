@@ -25,7 +25,19 @@
 #include <Python.h>
 #include <mex.h>
 #include <stdio.h>
+#include "pymex_bytes.h"
+#include "pymex_callbacks.h"
+#include "pymex_channel.h"
+#include "pymex_map.h"
 #include "pymex_marshal.h"
+#include "pymex_memo.h"
+#include "pymex_operators.h"
+#include "pymex_parallel.h"
+#include "pymex_plan.h"
+#include "pymex_release.h"
+#include "pymex_struct.h"
+#include "pymex_trace.h"
+#include "pymex_track.h"
 #ifdef LINUX
     #include <dlfcn.h>
     #define debug(s) //
@@ -47,15 +59,38 @@ typedef enum {
     GETATTR = 6,
     CALL = 7,
     GETITEM = 8,
-    MUL = 9,
-    EQ = 10,
-    LT = 11,
-    GT = 12,
-    LE = 13,
-    GE = 14,
-    NE = 15,
+    BINOP = 9,
+    UNOP = 10,
+    SETATTR = 11,
+    SETITEM = 12,
+    FLUSH = 13,
+    TRACK = 14,
+    BUILTIN = 15,
+    EVALEXPR = 16,
+    PREPARE = 17,
+    CALLPLAN = 18,
+    FHANDLE = 19,
+    PUMP = 20,
+    CHANNEL = 21,
+    CHANWRITE = 22,
+    MEMOIZE = 23,
+    MEMOCALL = 24,
+    MAP = 25,
+    TRACE = 26,
 } function_t;
 
+// Span names for each opcode, as they appear in traces.
+static const char* FUNCTION_NAMES[] = {
+    "eval", "import", "decref", "str", "put", "get", "getattr", "call",
+    "getitem", "binop", "unop", "setattr", "setitem", "flush", "track",
+    "builtin", "evalexpr", "prepare", "callplan", "fhandle", "pump",
+    "channel", "chanwrite", "memoize", "memocall", "map", "trace"
+};
+#define N_FUNCTIONS (sizeof(FUNCTION_NAMES) / sizeof(FUNCTION_NAMES[0]))
+
+// Number of compiled expressions kept by eval_expr before starting over.
+#define CODE_CACHE_SIZE 256
+
 // GLOBALS /////////////////////////////////////////////////////////////////////
 
 bool has_initialized = false;
@@ -64,6 +99,16 @@ PyObject* MatlabError = NULL;
 
 mxArray *MEX_NULL = NULL;
 
+// Maps module names to (module, boxed handle) pairs, where the handle is a
+// persistent PyObject array that import hands out copies of.
+PyObject* module_cache = NULL;
+
+// Maps expression strings to compiled code, and holds the bindings passed
+// to eval_expr while it runs.
+PyObject* code_cache = NULL;
+PyObject* scratch_locals = NULL;
+bool scratch_in_use = false;
+
 // PROTOTYPES //////////////////////////////////////////////////////////////////
 
 void import(int, mxArray**, int, const mxArray**);
@@ -75,30 +120,87 @@ void get(int, mxArray**, int, const mxArray**);
 void getattr(int, mxArray**, int, const mxArray**);
 void call(int, mxArray**, int, const mxArray**);
 void getitem(int, mxArray**, int, const mxArray**);
-void mul(int, mxArray**, int, const mxArray**);
-void cmp(int, int, mxArray**, int, const mxArray**);
+void binop(int, mxArray**, int, const mxArray**);
+void unop(int, mxArray**, int, const mxArray**);
+void setattr(int, mxArray**, int, const mxArray**);
+void setitem(int, mxArray**, int, const mxArray**);
+void flush(int, mxArray**, int, const mxArray**);
+void track(int, mxArray**, int, const mxArray**);
+void builtin(int, mxArray**, int, const mxArray**);
+void eval_expr(int, mxArray**, int, const mxArray**);
+void prepare(int, mxArray**, int, const mxArray**);
+void callplan(int, mxArray**, int, const mxArray**);
+void fhandle(int, mxArray**, int, const mxArray**);
+void pump(int, mxArray**, int, const mxArray**);
+void channel(int, mxArray**, int, const mxArray**);
+void chanwrite(int, mxArray**, int, const mxArray**);
+void memoize(int, mxArray**, int, const mxArray**);
+void memocall(int, mxArray**, int, const mxArray**);
+void map(int, mxArray**, int, const mxArray**);
+void trace(int, mxArray**, int, const mxArray**);
 
 // PYTHON METHODS AND FUNCTIONS ////////////////////////////////////////////////
 // These functions are exposed to the embedded Python runtime via the
 // Py_InitModule function called inside mexFunction(), below.
 
+/**
+ * Raises MatlabError with the message of a MATLAB exception, as returned
+ * by the *WithTrap functions.
+ */
+static void set_matlab_error(mxArray* exception) {
+    mxArray* m_err_msg = mxGetProperty(exception, 0, "message");
+    if (m_err_msg != NULL) {
+        char* c_err_msg;
+        get_matlab_str(m_err_msg, &c_err_msg);
+        PyErr_SetString(MatlabError, c_err_msg);
+    } else {
+        PyErr_SetString(MatlabError, "Unknown MATLAB error occured.");
+    }
+}
+
+/**
+ * Names a call to feval in traces after the function called, if it was
+ * given by name, or else after the class of the first argument.
+ */
+static const char* feval_span_name(mxArray** prhs, int nrhs) {
+    static char name[64];
+    char* fn_name;
+    
+    if (nrhs >= 1 && mxIsChar(prhs[0])) {
+        fn_name = mxArrayToString(prhs[0]);
+        snprintf(name, sizeof(name), "feval %s", fn_name);
+        mxFree(fn_name);
+    } else {
+        snprintf(name, sizeof(name), "feval %s",
+            nrhs >= 1 ? mxGetClassName(prhs[0]) : "");
+    }
+    return name;
+}
+
+// The MATLAB API may only be called on the MEX thread, so each of the
+// following first checks where it is being called from, and from any other
+// thread queues the call and returns a pymex.Future instead; see
+// pymex_callbacks.c.
+
 static PyObject* pymex_mateval(PyObject* self, PyObject* str) {
+    mxArray* result;
+    int span;
+    
+    if (!on_mex_thread()) {
+        return enqueue_callback(pymex_mateval, METH_O, str, NULL);
+    }
+    
     // Because METH_0 is defined for this method, we need not parse the
     // args tuple; the single argument str is unpacked from it for us.
-    mxArray* result = mexEvalStringWithTrap(PyString_AS_STRING(str));
+    span = TRACE_BEGIN(TRACE_MATLAB, "mateval");
+    result = mexEvalStringWithTrap(PyString_AS_STRING(str));
+    TRACE_END(span);
     
     if (result == NULL) {
         Py_INCREF(Py_None);
         return Py_None;
     } else {
-        mxArray* m_err_msg = mxGetProperty(result, 0, "message");
-        if (m_err_msg != NULL) {
-            char* c_err_msg;
-            get_matlab_str(m_err_msg, &c_err_msg);
-            PyErr_SetString(MatlabError, c_err_msg);
-        } else {
-            PyErr_SetString(MatlabError, "Unknown MATLAB error occured.");
-        }
+        set_matlab_error(result);
         
         // A NULL must make its way all the way back to the Python
         // interpreter for the PyErr_SetString call to raise an exception.
@@ -110,6 +212,10 @@ static PyObject* pymex_mateval(PyObject* self, PyObject* str) {
 static PyObject* pymex_matwrite(PyObject* self, PyObject* str) {
 
     char *c_str;
+    
+    if (!on_mex_thread()) {
+        return enqueue_callback(pymex_matwrite, METH_O, str, NULL);
+    }
    
     if (str == NULL) {
         PyErr_SetString(PyExc_TypeError, "Got null instead of a string.");
@@ -123,6 +229,7 @@ static PyObject* pymex_matwrite(PyObject* self, PyObject* str) {
     
     mexPrintf(c_str);
     
+    Py_INCREF(Py_None);
     return Py_None;
 
 }
@@ -137,6 +244,10 @@ static PyObject* pymex_get(PyObject* self, PyObject* args, PyObject* kwargs) {
     mxArray* mat_var;
     PyObject* py_var;
     
+    if (!on_mex_thread()) {
+        return enqueue_callback((PyCFunction) pymex_get, METH_VARARGS | METH_KEYWORDS, args, kwargs);
+    }
+    
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|s", kwlist, &name, &workspace)) {
     //if (!PyArg_ParseTupleAndKeywords(args, kwargs, "ss", kwlist, &name, &workspace)) {
         mexWarnMsgTxt("PyArg_ParseTupleAndKeywords failed.");
@@ -168,10 +279,13 @@ static PyObject* pymex_get(PyObject* self, PyObject* args, PyObject* kwargs) {
 
 static PyObject* pymex_feval(PyObject* self, PyObject* args, PyObject* kwargs) {
     
-    int nargout, nrhs, result, idx;
-    mxArray **prhs, **plhs;
+    int nargout, nrhs, idx, span;
+    mxArray **prhs, **plhs, *exception;
     PyObject *item, *retval, *kw_name;
 
+    if (!on_mex_thread()) {
+        return enqueue_callback((PyCFunction) pymex_feval, METH_VARARGS | METH_KEYWORDS, args, kwargs);
+    }
     
     // Parse keywords.
     // FIXME: invalid kwargs are silently ignored.
@@ -200,11 +314,15 @@ static PyObject* pymex_feval(PyObject* self, PyObject* args, PyObject* kwargs) {
         prhs[idx] = py2mat(item);
     }
 
-    // Do the actual call.
-    result = mexCallMATLAB(nargout, plhs, nrhs, prhs, "feval");
-
-    // Handle errors.
-    // TODO.
+    // Do the actual call. MATLAB errors are trapped and raised in Python,
+    // so that they can't unwind past a queued callback.
+    span = tracing_enabled ? trace_begin(TRACE_MATLAB, feval_span_name(prhs, nrhs)) : -1;
+    exception = mexCallMATLABWithTrap(nargout, plhs, nrhs, prhs, "feval");
+    TRACE_END(span);
+    if (exception != NULL) {
+        set_matlab_error(exception);
+        return NULL;
+    }
 
     // Unpack the return value(s).
     if (nargout > 1) {
@@ -229,6 +347,150 @@ static PyObject* pymex_feval(PyObject* self, PyObject* args, PyObject* kwargs) {
 
 }
 
+static PyObject* pymex_register_converter(PyObject* self, PyObject* args) {
+    PyObject *type, *converter;
+    
+    if (!PyArg_ParseTuple(args, "OO", &type, &converter)) {
+        return NULL;
+    }
+    if (!PyType_Check(type)) {
+        PyErr_SetString(PyExc_TypeError, "Expected a new-style class.");
+        return NULL;
+    }
+    if (converter != Py_None && !PyCallable_Check(converter)) {
+        PyErr_SetString(PyExc_TypeError, "Expected a callable or None.");
+        return NULL;
+    }
+    
+    register_py2mat_converter((PyTypeObject*) type, converter);
+    
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/**
+ * Sets the number of threads used to copy array payloads when marshalling
+ * large cell arrays, returning the previous number. Zero uses one thread
+ * per CPU, and one turns parallel copying off.
+ */
+static PyObject* pymex_set_marshal_threads(PyObject* self, PyObject* args) {
+    int n_threads, previous = get_marshal_threads();
+    
+    if (!PyArg_ParseTuple(args, "i", &n_threads)) {
+        return NULL;
+    }
+    if (n_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "Number of threads must be non-negative.");
+        return NULL;
+    }
+    
+    set_marshal_threads(n_threads);
+    return PyInt_FromLong(previous);
+}
+
+/**
+ * Sets whether scalar structs are sent to Python as lazy StructProxy
+ * objects rather than as dicts, returning the previous setting.
+ */
+static PyObject* pymex_set_lazy_structs(PyObject* self, PyObject* flag) {
+    bool previous = lazy_structs;
+    int enable = PyObject_IsTrue(flag);
+    
+    if (enable < 0) {
+        return NULL;
+    }
+    lazy_structs = enable;
+    return PyBool_FromLong(previous);
+}
+
+/**
+ * Runs MATLAB calls queued by other threads, waiting up to timeout seconds
+ * (with the GIL released) for the first, and returns how many ran.
+ */
+static PyObject* pymex_pump(PyObject* self, PyObject* args) {
+    double timeout = 0.0;
+    
+    if (!PyArg_ParseTuple(args, "|d", &timeout)) {
+        return NULL;
+    }
+    if (!on_mex_thread()) {
+        PyErr_SetString(PyExc_RuntimeError, "pymex.pump can only be called from MATLAB's thread.");
+        return NULL;
+    }
+    
+    return PyInt_FromLong(pump_callbacks_for(timeout));
+}
+
+/**
+ * Copies a buffer of numbers into a new MATLAB array, returned boxed as an
+ * mxArray; see mat_from_buffer in pymex_marshal.c.
+ */
+static PyObject* pymex_to_matlab_array(PyObject* self, PyObject* args) {
+    PyObject *data, *shape, *item;
+    const char *typecode, *order = "C";
+    const void* buf;
+    Py_ssize_t n_bytes, ndim, idx;
+    mwSize dims[MAX_BUFFER_DIMS];
+    mxArray* m_value;
+    
+    if (!on_mex_thread()) {
+        return enqueue_callback(pymex_to_matlab_array, METH_VARARGS, args, NULL);
+    }
+    if (!PyArg_ParseTuple(args, "OsO|s", &data, &typecode, &shape, &order)) {
+        return NULL;
+    }
+    if (PyObject_AsReadBuffer(data, &buf, &n_bytes) < 0) {
+        return NULL;
+    }
+    
+    shape = PySequence_Fast(shape, "Expected the shape as a sequence of integers.");
+    if (shape == NULL) {
+        return NULL;
+    }
+    ndim = PySequence_Fast_GET_SIZE(shape);
+    if (ndim > MAX_BUFFER_DIMS) {
+        Py_DECREF(shape);
+        PyErr_SetString(PyExc_ValueError, "Buffer has too many dimensions.");
+        return NULL;
+    }
+    for (idx = 0; idx < ndim; ++idx) {
+        item = PySequence_Fast_GET_ITEM(shape, idx);
+        dims[idx] = (mwSize) PyInt_AsSsize_t(item);
+        if (PyErr_Occurred()) {
+            Py_DECREF(shape);
+            return NULL;
+        }
+    }
+    Py_DECREF(shape);
+    
+    m_value = mat_from_buffer(buf, n_bytes, typecode, ndim, dims, order[0] != 'F');
+    if (m_value == NULL) {
+        return NULL;
+    }
+    return box_persistent_mxarray(m_value);
+}
+
+/**
+ * Copies a boxed numeric or logical mxArray into a new bytearray; see
+ * buffer_from_mat in pymex_marshal.c.
+ */
+static PyObject* pymex_from_matlab_array(PyObject* self, PyObject* args) {
+    PyObject* array;
+    const char* order = "C";
+    
+    if (!on_mex_thread()) {
+        return enqueue_callback(pymex_from_matlab_array, METH_VARARGS, args, NULL);
+    }
+    if (!PyArg_ParseTuple(args, "O|s", &array, &order)) {
+        return NULL;
+    }
+    if (!is_boxed_mxarray(array)) {
+        PyErr_SetString(PyExc_TypeError, "Expected an mxArray.");
+        return NULL;
+    }
+    return buffer_from_mat(unbox_mxarray(array), order[0] != 'F');
+}
+
 static PyMethodDef PymexMethods[] = {
     {"mateval", pymex_mateval, METH_O,
         "Evaluates MATLAB code inside the PyMEX host."},
@@ -238,6 +500,18 @@ static PyMethodDef PymexMethods[] = {
         "Returns the value of a MATLAB variable."},
     {"feval", (PyCFunctionWithKeywords)pymex_feval, METH_VARARGS | METH_KEYWORDS,
         "Calls MATLAB's feval with a function handle or string."},
+    {"register_converter", pymex_register_converter, METH_VARARGS,
+        "register_converter(type, fn): values of exactly this type are sent to MATLAB as fn(value) would be. Pass None to undo."},
+    {"set_marshal_threads", pymex_set_marshal_threads, METH_VARARGS,
+        "set_marshal_threads(n): copies large cell arrays on n threads (0 for one per CPU), returning the previous count."},
+    {"set_lazy_structs", pymex_set_lazy_structs, METH_O,
+        "set_lazy_structs(flag): sends scalar structs as read-only StructProxy mappings that convert fields on first use, rather than as dicts; returns the previous setting."},
+    {"pump", pymex_pump, METH_VARARGS,
+        "pump(timeout=0): runs MATLAB calls queued by other threads, waiting up to timeout seconds for one; returns how many ran."},
+    {"to_matlab_array", pymex_to_matlab_array, METH_VARARGS,
+        "to_matlab_array(data, typecode, shape, order='C'): copies a buffer of numbers with an array or NumPy type code ('d', 'i', 'D' for complex and so on) into a new MATLAB array of that shape, returned as an mxArray."},
+    {"from_matlab_array", pymex_from_matlab_array, METH_VARARGS,
+        "from_matlab_array(array, order='C'): copies a numeric or logical mxArray into a new bytearray, in C or Fortran order, with complex parts interleaved."},
     // Terminate the array with a NULL method entry.
     {NULL, NULL, 0, NULL}
 };
@@ -269,9 +543,104 @@ char* getpref(char* pref_group, char* pref_name, char* default_value) {
     }
 }
 
+/**
+ * Returns (borrowed) the globals of the context m_context, as made by
+ * py_context, or those of __main__ if m_context is NULL.
+ */
+PyObject* context_dict(const mxArray* m_context) {
+    PyObject* context;
+    
+    if (m_context == NULL) {
+        return PyModule_GetDict(__main__);
+    }
+    context = is_boxed_pyobject(m_context) ? unbox_pyobject(m_context) : NULL;
+    if (context == NULL || !PyModule_Check(context)) {
+        mexErrMsgTxt("Expected a context, as made by py_context.");
+    }
+    return PyModule_GetDict(context);
+}
+
+/**
+ * Returns a handle to the module with the given name, importing it only if
+ * it isn't already in sys.modules.
+ *
+ * Boxing a PyObject means constructing a MATLAB object, which costs far
+ * more than the lookup, so the boxed handle is kept in module_cache and
+ * copies of it are returned. The cached handle is used only while
+ * sys.modules still maps the name to the same module.
+ */
+mxArray* import_boxed_module(const char* name) {
+    PyObject *modules, *module, *entry;
+    mxArray *boxed, *stale = NULL;
+    
+    if (module_cache == NULL) {
+        module_cache = PyDict_New();
+    }
+    
+    // Borrowed reference.
+    modules = PyImport_GetModuleDict();
+    module = PyDict_GetItemString(modules, name);
+    
+    if (module == NULL || module == Py_None) {
+        module = PyImport_ImportModule(name);
+        if (module == NULL) {
+            PyErr_Print();
+            mexErrMsgTxt("Python exception inside py_import.");
+        }
+        // sys.modules now holds a reference, so we can borrow it like
+        // we do above.
+        Py_DECREF(module);
+    }
+    
+    entry = PyDict_GetItemString(module_cache, name);
+    if (entry != NULL) {
+        if (PyTuple_GET_ITEM(entry, 0) == module) {
+            return mxDuplicateArray((mxArray*) PyLong_AsVoidPtr(PyTuple_GET_ITEM(entry, 1)));
+        }
+        // The module was reloaded or removed since we cached it.
+        stale = (mxArray*) PyLong_AsVoidPtr(PyTuple_GET_ITEM(entry, 1));
+    }
+    
+    // py2mat steals the reference, which the boxed handle then owns.
+    Py_INCREF(module);
+    boxed = py2mat(module);
+    mexMakeArrayPersistent(boxed);
+    
+    entry = Py_BuildValue("(ON)", module, PyLong_FromVoidPtr(boxed));
+    PyDict_SetItemString(module_cache, name, entry);
+    Py_DECREF(entry);
+    mxDestroyArray(stale);
+    
+    return mxDuplicateArray(boxed);
+}
+
 // MEX ENTRY POINTS ////////////////////////////////////////////////////////////
 
+/**
+ * Destroys the boxed handles held by module_cache, which would otherwise
+ * outlive the interpreter they point into.
+ */
+static void clear_module_cache() {
+    PyObject *name, *entry;
+    Py_ssize_t pos = 0;
+    mxArray* boxed;
+    
+    if (module_cache == NULL) {
+        return;
+    }
+    while (PyDict_Next(module_cache, &pos, &name, &entry)) {
+        boxed = (mxArray*) PyLong_AsVoidPtr(PyTuple_GET_ITEM(entry, 1));
+        TRACK_RELEASE(PyTuple_GET_ITEM(entry, 0));
+        mxDestroyArray(boxed);
+    }
+    Py_CLEAR(module_cache);
+}
+
 void cleanup() {
+    cancel_callbacks();
+    shutdown_marshal_pool();
+    clear_module_cache();
+    drain_release_queue();
     Py_Finalize();
 }
 
@@ -279,14 +648,16 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 
     PyObject *pymex_module, *dict, *init_result;
     char buf[200];
+    int span, outer_opcode;
     
     // Create the various variables we'll need in the switch below.
     function_t function = *(unsigned char*)(mxGetData(prhs[0]));
 
 	// Check whether we have already called Py_Initialize, and do it if need be.    
     if (!has_initialized) {
-        PyObject *_pymex_module, *_pymex_dict;
-        char *python_home_pref, *program_name_pref;
+        PyObject *_pymex_module, *_pymex_dict, *import_cache;
+        char *python_home_pref, *program_name_pref, *marshal_threads_pref;
+        char *import_index_pref, *preload_pref;
         
         debug("Initializing Python...");
         
@@ -303,6 +674,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
         if (program_name_pref == NULL) {
             mexWarnMsgTxt("Could not get program_name pref; skipping.");
         } else if (strcmp(program_name_pref, "") != 0) {
+            // Python holds on to this string, so it must outlive the call.
+            mexMakeMemoryPersistent(program_name_pref);
             Py_SetProgramName(program_name_pref);
         }
             
@@ -311,9 +684,17 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
         if (python_home_pref == NULL) {
             mexWarnMsgTxt("Could not get pythonhome pref; skipping.");
         } else if (strcmp(python_home_pref, "") != 0) {
+            mexMakeMemoryPersistent(python_home_pref);
             Py_SetPythonHome(python_home_pref);
         }
             
+        // Size the pool used to copy large cell arrays; 0 is one per CPU.
+        marshal_threads_pref = getpref("pymex", "marshal_threads", "0");
+        if (marshal_threads_pref != NULL) {
+            set_marshal_threads(atoi(marshal_threads_pref));
+        }
+        lazy_structs = atoi(getpref("pymex", "lazy_structs", "0")) != 0;
+        
         // Initialize Python environment.
         Py_Initialize();
         
@@ -336,6 +717,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
             PyExc_StandardError, NULL);
         PyDict_SetItemString(dict, "MatlabError", MatlabError);
         
+        // Calls from other Python threads are queued for this one.
+        init_callbacks(pymex_module);
+        init_channel_type(pymex_module);
+        init_struct_proxy_type(pymex_module);
+        init_bytes_type(pymex_module);
+        init_memo_type(pymex_module);
+        
         // FIXME: this is a dirty hack to ensure '' is on sys.path,
         //        and has the side effect of leaking "sys" into globals().
         debug("Fixing sys.path...");
@@ -380,11 +768,53 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
         // Finally, set aside an empty array for returning as MATLAB's answer
         // to null.
         MEX_NULL = mxCreateNumericMatrix(0, 0, mxDOUBLE_CLASS, mxREAL);
+        mexMakeArrayPersistent(MEX_NULL);
         
+        // Optionally find modules from a shared index of sys.path, and import
+        // the modules every session needs now, so that each worker of a pool
+        // doesn't search for them one file at a time.
+        import_index_pref = getpref("pymex", "import_index", "");
+        preload_pref = getpref("pymex", "preload", "");
+        if (strcmp(import_index_pref, "") != 0 || strcmp(preload_pref, "") != 0) {
+            debug("Preloading modules...");
+            import_cache = PyImport_ImportModule("_pymex.import_cache");
+            init_result = import_cache == NULL ? NULL : PyObject_CallMethod(import_cache,
+                "startup", "ss", import_index_pref, preload_pref);
+            Py_XDECREF(import_cache);
+            if (init_result == NULL) {
+                PyErr_Print();
+                mexWarnMsgTxt("Could not preload modules; see above.");
+            }
+            Py_XDECREF(init_result);
+        }
         
+        has_initialized = true;
         debug("Done initializing Python!");
     }
     
+    // Remember which opcode we're in, so that anything boxed during this
+    // call can be attributed to it. Calls made from inside another (via
+    // pymex.feval) hand the outer opcode back when they return.
+    outer_opcode = track_opcode;
+    track_opcode = function;
+    
+    // Spans left open by an earlier call that errored are closed here, and
+    // everything from here on is attributed to this opcode.
+    trace_enter_mex();
+    span = TRACE_BEGIN(TRACE_OPCODE,
+        function < N_FUNCTIONS ? FUNCTION_NAMES[function] : "unknown");
+    
+    // Any other call may run Python code that expects released objects to
+    // be gone, so settle up with the queue before doing anything else.
+    // Consecutive DECREFs (e.g. from clearing a cell of PyObjects) skip
+    // this, so that they accumulate into a single batch. FLUSH drains the
+    // queue itself, so that it can report how much was pending. MATLAB
+    // calls queued by other Python threads are run at the same point.
+    if (function != DECREF && function != FLUSH) {
+        drain_release_queue();
+        pump_callbacks();
+    }
+    
     // Assume that nrhs >= 1, and that prhs[0] is of type int8 (classID == 8).
     switch(function) {
         case EVAL:
@@ -423,32 +853,76 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
             getitem(nlhs, plhs, nrhs - 1, prhs + 1);
             break;
             
-        case MUL:
-            mul(nlhs, plhs, nrhs - 1, prhs + 1);
+        case BINOP:
+            binop(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case UNOP:
+            unop(nlhs, plhs, nrhs - 1, prhs + 1);
             break;
             
-        case EQ:
-            cmp(Py_EQ, nlhs, plhs, nrhs - 1, prhs + 1);
+        case SETATTR:
+            setattr(nlhs, plhs, nrhs - 1, prhs + 1);
             break;
             
-        case LT:
-            cmp(Py_LT, nlhs, plhs, nrhs - 1, prhs + 1);
+        case SETITEM:
+            setitem(nlhs, plhs, nrhs - 1, prhs + 1);
             break;
             
-        case GT:
-            cmp(Py_GT, nlhs, plhs, nrhs - 1, prhs + 1);
+        case FLUSH:
+            flush(nlhs, plhs, nrhs - 1, prhs + 1);
             break;
             
-        case LE:
-            cmp(Py_LE, nlhs, plhs, nrhs - 1, prhs + 1);
+        case TRACK:
+            track(nlhs, plhs, nrhs - 1, prhs + 1);
             break;
             
-        case GE:
-            cmp(Py_GE, nlhs, plhs, nrhs - 1, prhs + 1);
+        case BUILTIN:
+            builtin(nlhs, plhs, nrhs - 1, prhs + 1);
             break;
             
-        case NE:
-            cmp(Py_NE, nlhs, plhs, nrhs - 1, prhs + 1);
+        case EVALEXPR:
+            eval_expr(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case PREPARE:
+            prepare(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case CALLPLAN:
+            callplan(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case FHANDLE:
+            fhandle(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case PUMP:
+            pump(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case CHANNEL:
+            channel(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case CHANWRITE:
+            chanwrite(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case MEMOIZE:
+            memoize(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case MEMOCALL:
+            memocall(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case MAP:
+            map(nlhs, plhs, nrhs - 1, prhs + 1);
+            break;
+            
+        case TRACE:
+            trace(nlhs, plhs, nrhs - 1, prhs + 1);
             break;
             
         default:
@@ -456,6 +930,9 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
             mexErrMsgTxt(buf);
             break;
     }
+    
+    TRACE_END(span);
+    track_opcode = outer_opcode;
 }
 
 // DEBUG FUNCTIONS /////////////////////////////////////////////////////////////
@@ -468,33 +945,64 @@ void print(PyObject* py_obj) {
 
 // MEX FUNCTIONS ///////////////////////////////////////////////////////////////
 
+/**
+ * MATLAB signature: [module, root] = import(name)
+ *                   [obj1, obj2, ...] = import(name, attr1, attr2, ...)
+ * 
+ * With one argument, returns the named module, and for dotted names, also
+ * the root package (as Python's import statement binds it). With more
+ * arguments, acts as "from name import attr1, attr2, ...", where each
+ * attribute may also be a submodule.
+ */
 void import(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     
-    PyObject *py_name, *py_module;
+    char *name, *attr_name, *full_name, *dot;
+    PyObject *module, *value;
+    int n_out = nlhs > 1 ? nlhs : 1, idx;
     
-    // We expect there to be a single argument, containing the name
+    // We expect there to be at least one argument, containing the name
     // of the module to import.
     if (nrhs < 1) {
         mexErrMsgTxt("Not enough arguments.");
         return;
     }
     
-    py_name = mat2py(prhs[0], false);
-    py_module = PyImport_Import(py_name); // New reference, so no incref needed.
-    Py_DECREF(py_name);
+    get_matlab_str(prhs[0], &name);
+    plhs[0] = import_boxed_module(name);
     
-    if (py_module == NULL) {
-        if (PyErr_Occurred() != NULL) {
-            PyErr_Print();
-            mexErrMsgTxt("Python exception inside py_import.");
+    if (nrhs == 1) {
+        if (nlhs >= 2) {
+            dot = strchr(name, '.');
+            if (dot != NULL) {
+                *dot = '\0';
+            }
+            plhs[1] = import_boxed_module(name);
         }
+        return;
     }
     
-    if (nlhs == 0) {
-        // FIXME: Find a way to DECREF this later!
-        // Py_DECREF(py_module);
-    } else {
-        plhs[0] = py2mat(py_module);
+    // From-import; the module handle itself isn't returned.
+    module = unbox_pyobject(plhs[0]);
+    mxDestroyArray(plhs[0]);
+    plhs[0] = NULL;
+    
+    for (idx = 0; idx < nrhs - 1 && idx < n_out; ++idx) {
+        get_matlab_str(prhs[idx + 1], &attr_name);
+        value = PyObject_GetAttrString(module, attr_name);
+        
+        if (value != NULL) {
+            plhs[idx] = py2mat(value);
+        } else if (PyErr_ExceptionMatches(PyExc_AttributeError)) {
+            // Not yet imported submodules aren't attributes of their
+            // package, so try that next.
+            PyErr_Clear();
+            full_name = mxCalloc(strlen(name) + strlen(attr_name) + 2, sizeof(char));
+            sprintf(full_name, "%s.%s", name, attr_name);
+            plhs[idx] = import_boxed_module(full_name);
+        } else {
+            PyErr_Print();
+            mexErrMsgTxt("Python exception inside py_import.");
+        }
     }
 }
 
@@ -503,18 +1011,18 @@ void eval(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     char* arg_buf;
     PyObject *retval, *py_dict;
     
-    // We expect there to be a single argument for now,
-    // consisting of a string to be run.
-    if (nrhs < 1) {
-        mexErrMsgTxt("Not enough arguments.");
+    // We expect a string to be run, and optionally the context to run it
+    // in.
+    if (nrhs < 1 || nrhs > 2) {
+        mexErrMsgTxt("Expected a statement and optionally a context.");
         return;
     }
     
     get_matlab_str(prhs[0], &arg_buf);
     
-    // Grab a borrowed reference to the __main__ module dict,
-    // so that we can use it for globals() and locals().
-    py_dict = PyModule_GetDict(__main__);
+    // Grab a borrowed reference to the __main__ module dict (or the
+    // context's), so that we can use it for globals() and locals().
+    py_dict = context_dict(nrhs == 2 ? prhs[1] : NULL);
     
     // Now evaluate the string as a Python line.
     // This is a new reference, so we already own it.
@@ -532,19 +1040,62 @@ void eval(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
         plhs[0] = py2mat(retval);
     } else {
         // DECREF the new reference, since we won't be keeping it after all.
-        Py_XDECREF(plhs[0]);
+        Py_XDECREF(retval);
     }
     
 }
 
+/**
+ * MATLAB signature: decref(object) or decref(pointers)
+ * 
+ * Releases the reference held by a PyObject, or by each of an array of raw
+ * uint64 py_pointer values. The release is queued rather than performed
+ * immediately; see pymex_release.c.
+ */
 void decref(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     
+    const py_pointer_box_t* ptrs;
+    PyObject* py_obj;
+    mwSize n_ptrs, idx;
+    
     if (nrhs != 1) {
         mexErrMsgTxt("Expected exactly one argument.");
         return;
     }
     
-    Py_XDECREF(unbox_pyobject(prhs[0]));
+    if (mxGetClassID(prhs[0]) == mxUINT64_CLASS) {
+        // Raw pointers, as passed by PyObject.delete. This avoids a
+        // round trip through mxGetProperty for each one.
+        // Each is a py_pointer_box_t, which may be wider than a pointer.
+        ptrs = (const py_pointer_box_t*) mxGetData(prhs[0]);
+        n_ptrs = mxGetNumberOfElements(prhs[0]);
+        for (idx = 0; idx < n_ptrs; ++idx) {
+            py_obj = (PyObject*) (size_t) ptrs[idx];
+            TRACK_RELEASE(py_obj);
+            enqueue_release(py_obj);
+        }
+    } else {
+        py_obj = unbox_pyobject(prhs[0]);
+        TRACK_RELEASE(py_obj);
+        enqueue_release(py_obj);
+    }
+    
+}
+
+/**
+ * MATLAB signature: n = flush()
+ * 
+ * Immediately releases all queued references, returning how many there were.
+ */
+void flush(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    
+    size_t n_pending = pending_release_count();
+    
+    drain_release_queue();
+    
+    if (nlhs >= 1) {
+        plhs[0] = mxCreateDoubleScalar((double) n_pending);
+    }
     
 }
 
@@ -575,8 +1126,8 @@ void put(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     char* val_name;
     mxArray const *m_val;
     
-    if (nrhs != 2) {
-        mexErrMsgTxt("Expected exactly two arguments.");
+    if (nrhs != 2 && nrhs != 3) {
+        mexErrMsgTxt("Expected a name, a value and optionally a context.");
         return;
     }
     
@@ -588,7 +1139,7 @@ void put(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     new_obj = mat2py(m_val, false);
     
     if (new_obj != NULL) {
-        dict = PyModule_GetDict(__main__);
+        dict = context_dict(nrhs == 3 ? prhs[2] : NULL);
         if (dict == NULL) {
             mexErrMsgTxt("Could not get dict(__main__).");
             return;
@@ -604,7 +1155,7 @@ void put(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 }
 
 /**
- * MATLAB signature: obj = py_get(name)
+ * MATLAB signature: obj = py_get(name) or obj = py_get(name, context)
  * 
  * Returns the contents of a Python variable as a MATLAB array.
  */
@@ -615,18 +1166,18 @@ void get(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     
     plhs[0] = MEX_NULL;
     
-    if (nrhs != 1) {
-        mexErrMsgTxt("Expected exactly one argument.");
+    if (nrhs != 1 && nrhs != 2) {
+        mexErrMsgTxt("Expected a name and optionally a context.");
     }
     
     // Fetch the name of the value we are supposed to pull from Python's
-    // __main__.
+    // __main__ (or the context).
     get_matlab_str(prhs[0], &val_name);
     // Convert the value name to a Python str.
     py_val_name = PyString_FromString(val_name);
     
     // Find __main__'s dict.
-    dict = PyModule_GetDict(__main__);
+    dict = context_dict(nrhs == 2 ? prhs[1] : NULL);
     __builtins__dict = PyEval_GetBuiltins();
     
     // Does the variable exist?
@@ -653,6 +1204,129 @@ void get(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
     
 }
 
+/**
+ * MATLAB signature: obj = builtin(name)
+ * 
+ * Returns one of Python's builtins. Unlike get, this does not look in
+ * __main__ first, so that a global of the same name cannot shadow it.
+ */
+void builtin(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    PyObject *builtins_dict, *value;
+    char* name;
+    
+    if (nrhs != 1) {
+        mexErrMsgTxt("Expected exactly one argument.");
+    }
+    
+    get_matlab_str(prhs[0], &name);
+    
+    // Both the dict and the item are borrowed.
+    builtins_dict = PyEval_GetBuiltins();
+    value = PyDict_GetItemString(builtins_dict, name);
+    if (value == NULL) {
+        mexErrMsgTxt("No such Python builtin.");
+    }
+    
+    Py_INCREF(value);
+    plhs[0] = py2mat(value);
+}
+
+/**
+ * MATLAB signature: value = eval_expr(expr, bindings[, context])
+ * 
+ * Evaluates a Python expression and returns its value. The fields of the
+ * scalar struct bindings are visible to the expression as local variables;
+ * globals are those of __main__ (or of the context), which are left
+ * untouched. As with Python's
+ * own eval(), lambdas and generator expressions only see the globals.
+ * Compiled code is cached by the text of the expression.
+ */
+void eval_expr(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    PyObject *py_expr, *code, *globals, *locals, *values, *value, *result;
+    int n_fields, idx_field;
+    bool owns_scratch;
+    
+    if (nrhs < 1 || nrhs > 3 || !mxIsChar(prhs[0])) {
+        mexErrMsgTxt("Expected an expression and optionally a struct of bindings and a context.");
+    }
+    if (nrhs >= 2 && (!mxIsStruct(prhs[1]) || mxGetNumberOfElements(prhs[1]) != 1)) {
+        mexErrMsgTxt("Bindings must be a scalar struct.");
+    }
+    globals = context_dict(nrhs == 3 ? prhs[2] : NULL);
+    
+    if (code_cache == NULL) {
+        code_cache = PyDict_New();
+        scratch_locals = PyDict_New();
+    }
+    
+    // Convert the bindings before taking anything else, since mat2py can
+    // unwind out of this call with mexErrMsgTxt.
+    n_fields = nrhs >= 2 ? mxGetNumberOfFields(prhs[1]) : 0;
+    values = PyTuple_New(n_fields);
+    for (idx_field = 0; idx_field < n_fields; ++idx_field) {
+        value = mat2py(mxGetFieldByNumber(prhs[1], 0, idx_field), false);
+        if (value == NULL) {
+            Py_DECREF(values);
+            mexErrMsgTxt("Could not convert the bindings.");
+        }
+        PyTuple_SET_ITEM(values, idx_field, value);
+    }
+    
+    // Look for already compiled code before compiling it ourselves.
+    py_expr = mat2py(prhs[0], false);
+    code = PyDict_GetItem(code_cache, py_expr);
+    if (code != NULL) {
+        Py_INCREF(code);
+    } else {
+        code = Py_CompileString(PyString_AsString(py_expr), "<py_eval>", Py_eval_input);
+        if (code == NULL) {
+            Py_DECREF(py_expr);
+            Py_DECREF(values);
+            PyErr_Print();
+            mexErrMsgTxt("Python exception inside eval.");
+        }
+        if (PyDict_Size(code_cache) >= CODE_CACHE_SIZE) {
+            PyDict_Clear(code_cache);
+        }
+        PyDict_SetItem(code_cache, py_expr, code);
+    }
+    Py_DECREF(py_expr);
+    
+    // The expression may call back into MATLAB and from there into
+    // eval_expr again, in which case the inner call needs its own locals.
+    owns_scratch = !scratch_in_use;
+    if (owns_scratch) {
+        locals = scratch_locals;
+        Py_INCREF(locals);
+        scratch_in_use = true;
+    } else {
+        locals = PyDict_New();
+    }
+    
+    for (idx_field = 0; idx_field < n_fields; ++idx_field) {
+        PyDict_SetItemString(locals, mxGetFieldNameByNumber(prhs[1], idx_field),
+            PyTuple_GET_ITEM(values, idx_field));
+    }
+    Py_DECREF(values);
+    
+    result = PyEval_EvalCode((PyCodeObject*) code, globals, locals);
+    
+    // Don't hold on to the bindings past this call.
+    PyDict_Clear(locals);
+    Py_DECREF(locals);
+    Py_DECREF(code);
+    if (owns_scratch) {
+        scratch_in_use = false;
+    }
+    
+    if (result == NULL) {
+        PyErr_Print();
+        mexErrMsgTxt("Python exception inside eval.");
+    }
+    
+    plhs[0] = py2mat(result);
+}
+
 /**
  * MATLAB signature: value = getattr(object, name)
  * 
@@ -749,70 +1423,518 @@ void call(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 }
 
 /**
- * MATLAB signature: value = getitem(object, key)
+ * MATLAB signature: plan = prepare(object, example_args...)
+ * 
+ * Prepares a call plan for a Python callable, specialized to the MATLAB
+ * classes of the example arguments; see pymex_plan.c.
+ */
+void prepare(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    PyObject *callee, *plan;
+    
+    if (nrhs < 1) {
+        mexErrMsgTxt("Not enough arguments.");
+    }
+    
+    callee = mat2py(prhs[0], false);
+    if (!PyCallable_Check(callee)) {
+        Py_DECREF(callee);
+        mexErrMsgTxt("Object is not callable.");
+    }
+    
+    plan = prepare_call_plan(callee, nrhs - 1, prhs + 1);
+    Py_DECREF(callee);
+    plhs[0] = py2mat(plan);
+}
+
+/**
+ * MATLAB signature: value = callplan(plan, args...)
+ * 
+ * Calls a Python callable through a plan made by prepare.
+ */
+void callplan(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    PyObject* plan;
+    
+    if (nrhs < 1 || !is_boxed_pyobject(prhs[0])) {
+        mexErrMsgTxt("Expected a call plan.");
+    }
+    
+    // Borrowed; the boxed plan holds a reference for us.
+    plan = unbox_pyobject(prhs[0]);
+    plhs[0] = call_with_plan(plan, nrhs - 1, prhs + 1);
+    if (plhs[0] == NULL) {
+        PyErr_Print();
+        mexErrMsgTxt("Python exception during call.");
+    }
+}
+
+/**
+ * MATLAB signature: out = map(object, data, dim, output)
+ * 
+ * Calls a Python callable on each slice of data along dim (its columns,
+ * its rows or, for a cell array, its elements), all in this one call, and
+ * collects the results into an array of class output or a cell array; see
+ * pymex_map.c.
+ */
+void map(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    PyObject* callee;
+    char* output;
+    
+    if (nrhs != 4 || !mxIsChar(prhs[3])) {
+        mexErrMsgTxt("Expected a callable, an array, a dimension and an output class.");
+    }
+    
+    callee = mat2py(prhs[0], false);
+    if (!PyCallable_Check(callee)) {
+        Py_DECREF(callee);
+        mexErrMsgTxt("Object is not callable.");
+    }
+    get_matlab_str(prhs[3], &output);
+    
+    plhs[0] = map_slices(callee, prhs[1], (int) mxGetScalar(prhs[2]), output);
+    Py_DECREF(callee);
+    if (plhs[0] == NULL) {
+        PyErr_Print();
+        mexErrMsgTxt("Python exception inside map.");
+    }
+}
+
+/**
+ * MATLAB signature: plan = fhandle(object, vectorized)
+ * 
+ * Prepares a plan for calling a Python callable as a MATLAB function
+ * handle, to be called with callplan; see prepare_function_plan.
+ */
+void fhandle(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    PyObject *callee, *plan;
+    
+    if (nrhs < 1) {
+        mexErrMsgTxt("Not enough arguments.");
+    }
+    
+    callee = mat2py(prhs[0], false);
+    if (!PyCallable_Check(callee)) {
+        Py_DECREF(callee);
+        mexErrMsgTxt("Object is not callable.");
+    }
+    
+    plan = prepare_function_plan(callee, nrhs > 1 && mxIsLogicalScalarTrue(prhs[1]));
+    Py_DECREF(callee);
+    plhs[0] = py2mat(plan);
+}
+
+/**
+ * MATLAB signature: n = pump(timeout)
+ * 
+ * Runs MATLAB calls queued by other Python threads, waiting up to timeout
+ * seconds (default 0) for the first, and returns how many ran. Python
+ * threads run freely while we wait.
+ */
+void pump(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    double timeout = nrhs > 0 ? mxGetScalar(prhs[0]) : 0.0;
+    
+    plhs[0] = mxCreateDoubleScalar(pump_callbacks_for(timeout));
+}
+
+/**
+ * MATLAB signature: ch = channel(shape, class_name, capacity)
+ * 
+ * Makes a pymex.Channel holding up to capacity frames of the given shape
+ * and MATLAB class; see pymex_channel.c.
+ */
+void channel(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    Py_ssize_t dims[MAX_CHANNEL_DIMS], capacity;
+    char class_name[32];
+    PyObject* ch;
+    size_t ndims, idx;
+    
+    if (nrhs < 2 || !mxIsDouble(prhs[0]) || !mxIsChar(prhs[1])) {
+        mexErrMsgTxt("Expected a frame shape and a class name.");
+    }
+    ndims = mxGetNumberOfElements(prhs[0]);
+    if (ndims > MAX_CHANNEL_DIMS) {
+        mexErrMsgTxt("Too many frame dimensions.");
+    }
+    for (idx = 0; idx < ndims; ++idx) {
+        dims[idx] = (Py_ssize_t) mxGetPr(prhs[0])[idx];
+    }
+    mxGetString(prhs[1], class_name, sizeof(class_name));
+    capacity = nrhs > 2 ? (Py_ssize_t) mxGetScalar(prhs[2]) : DEFAULT_CHANNEL_CAPACITY;
+    
+    ch = new_channel_for_class(class_name, (int) ndims, dims, capacity);
+    if (ch == NULL) {
+        PyErr_Print();
+        mexErrMsgTxt("Could not make channel.");
+    }
+    plhs[0] = py2mat(ch);
+}
+
+/**
+ * MATLAB signature: n = chanwrite(ch, frames, block)
+ * 
+ * Copies every frame in frames into a channel with a single commit, as
+ * long as there is room, and returns how many were written. Unless block
+ * is false, waits for the reader to make room for all of them.
+ */
+void chanwrite(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    Py_ssize_t n_written;
+    
+    if (nrhs < 2 || !is_boxed_pyobject(prhs[0])) {
+        mexErrMsgTxt("Expected a channel and frames.");
+    }
+    
+    // Borrowed; the boxed channel holds a reference for us.
+    n_written = write_channel_frames(unbox_pyobject(prhs[0]), prhs[1],
+        nrhs < 3 || mxIsLogicalScalarTrue(prhs[2]));
+    if (n_written < 0) {
+        PyErr_Print();
+        mexErrMsgTxt("Could not write to channel.");
+    }
+    plhs[0] = mxCreateDoubleScalar((double) n_written);
+}
+
+/**
+ * MATLAB signature: memo = memoize(object, budget)
+ * 
+ * Wraps a Python callable in a pymex.Memo keeping up to budget bytes of
+ * results, to be called with memocall; see pymex_memo.c.
+ */
+void memoize(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    PyObject *callee, *memo;
+    double budget;
+    
+    if (nrhs < 2) {
+        mexErrMsgTxt("Not enough arguments.");
+    }
+    
+    callee = mat2py(prhs[0], false);
+    if (!PyCallable_Check(callee)) {
+        Py_DECREF(callee);
+        mexErrMsgTxt("Object is not callable.");
+    }
+    budget = mxGetScalar(prhs[1]);
+    if (!(budget >= 0)) {
+        Py_DECREF(callee);
+        mexErrMsgTxt("Budget must be a nonnegative number of bytes.");
+    }
+    
+    memo = new_memo(callee, (size_t) budget);
+    Py_DECREF(callee);
+    plhs[0] = py2mat(memo);
+}
+
+/**
+ * MATLAB signature: value = memocall(memo, args...)
+ * 
+ * Calls a Python callable through a memo made by memoize.
+ */
+void memocall(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    if (nrhs < 1 || !is_boxed_pyobject(prhs[0])) {
+        mexErrMsgTxt("Expected a memo.");
+    }
+    
+    // Borrowed; the boxed memo holds a reference for us.
+    plhs[0] = call_with_memo(unbox_pyobject(prhs[0]), nrhs - 1, prhs + 1);
+    if (plhs[0] == NULL) {
+        PyErr_Print();
+        mexErrMsgTxt("Python exception during call.");
+    }
+}
+
+/**
+ * MATLAB signature: value = getitem(object, key, ...)
  * 
  * Accesses an item from the Python object "object", emulating `object[key]`
- * notation. 
+ * notation. Ranges and ':' are translated into slices, and multiple keys
+ * into a tuple (see py_key_from_subscripts), so that `obj{0:9, ':'}`
+ * becomes `obj[0:10, :]`. The result is boxed rather than copied if Python
+ * returns a view, so it stays a view until it is marshalled.
  */
 void getitem(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 
-    PyObject *target = mat2py(prhs[0], false), *key = mat2py(prhs[1], false);
-    PyObject *py_value;
+    PyObject *target, *key, *py_value;
+    
+    if (nrhs < 2) {
+        mexErrMsgTxt("Expected at least two arguments.");
+    }
+    
+    target = mat2py(prhs[0], false);
+    key = py_key_from_subscripts(nrhs - 1, prhs + 1);
     
     py_value = PyObject_GetItem(target, key);
+    Py_XDECREF(target);
+    Py_XDECREF(key);
     
     if (py_value == NULL) {
+        if (PyErr_Occurred() != NULL) {
+            PyErr_Print();
+        }
         mexErrMsgTxt("Exception getting item.");
     }
     
-    if (PyErr_Occurred() != NULL) {
-        PyErr_Print();
-        mexErrMsgTxt("Python exception during call.");
-    }
-    
     // New reference!
     plhs[0] = py2mat(py_value);
     
 }
 
-void mul(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
-    PyObject *a, *b;
+/**
+ * MATLAB signature: value = binop(op, a, b)
+ * 
+ * Applies the binary arithmetic or comparison operator op (see operator_t in
+ * pymex_operators.h) to a and b, either of which may be a PyObject or a
+ * native MATLAB value.
+ */
+void binop(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    const operator_entry_t *entry;
+    PyObject *a, *b, *py_result;
+    char buf[100];
     
-    if (nrhs != 2) {
-        mexErrMsgTxt("Expected exactly two arguments.");
+    if (nrhs != 3) {
+        mexErrMsgTxt("Expected exactly three arguments.");
+    }
+    
+    entry = get_operator(*(unsigned char*)mxGetData(prhs[0]));
+    if (entry == NULL ||
+            (entry->kind != OPKIND_BINARY && entry->kind != OPKIND_COMPARE)) {
+        mexErrMsgTxt("Invalid binary operator.");
+    }
+    
+    // Plain scalars on both sides never need to visit Python.
+    if (fast_scalar_binop(entry, prhs[1], prhs[2], &plhs[0])) {
+        return;
     }
     
-    a = mat2py(prhs[0], false);
-    b = mat2py(prhs[1], false);
+    a = mat2py(prhs[1], false);
+    b = mat2py(prhs[2], false);
     
-    plhs[0] = py2mat(PyNumber_Multiply(a, b));
+    // New reference, or NULL on error.
+    py_result = apply_binary_operator(entry, a, b);
+    // mat2py gave us new references to both operands, which we are now
+    // done with.
     Py_XDECREF(a);
     Py_XDECREF(b);
     
-    if (PyErr_Occurred() != NULL) {
-        PyErr_Print();
-        mexErrMsgTxt("Python exception inside mul.");
+    if (py_result == NULL) {
+        if (PyErr_Occurred() != NULL) {
+            PyErr_Print();
+        }
+        sprintf(buf, "Python exception inside %s.", entry->name);
+        mexErrMsgTxt(buf);
+    }
+    
+    plhs[0] = fast_scalar_result(py_result);
+    if (plhs[0] == NULL) {
+        plhs[0] = py2mat(py_result);
     }
     
 }
 
-void cmp(int op, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
-    PyObject *a, *b;
+/**
+ * MATLAB signature: value = unop(op, a)
+ * 
+ * Applies the unary operator op to a. The "len" and "numel" operators return
+ * a MATLAB double rather than marshalling through Python; "numel" reports
+ * objects without a length as having a single element, as MATLAB expects.
+ */
+void unop(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    const operator_entry_t *entry;
+    PyObject *a, *py_result;
+    Py_ssize_t size;
+    char buf[100];
     
     if (nrhs != 2) {
         mexErrMsgTxt("Expected exactly two arguments.");
     }
     
-    a = mat2py(prhs[0], false);
-    b = mat2py(prhs[1], false);
+    entry = get_operator(*(unsigned char*)mxGetData(prhs[0]));
+    if (entry == NULL ||
+            (entry->kind != OPKIND_UNARY && entry->kind != OPKIND_SIZE)) {
+        mexErrMsgTxt("Invalid unary operator.");
+    }
+    
+    if (fast_scalar_unop(entry, prhs[1], &plhs[0])) {
+        return;
+    }
+    
+    a = mat2py(prhs[1], false);
+    
+    if (entry->kind == OPKIND_SIZE) {
+        size = PyObject_Size(a);
+        Py_XDECREF(a);
+        if (size < 0) {
+            if (entry == get_operator(OP_NUMEL) &&
+                    PyErr_ExceptionMatches(PyExc_TypeError)) {
+                PyErr_Clear();
+                size = 1;
+            } else {
+                PyErr_Print();
+                sprintf(buf, "Python exception inside %s.", entry->name);
+                mexErrMsgTxt(buf);
+            }
+        }
+        plhs[0] = mxCreateDoubleScalar((double) size);
+        return;
+    }
     
-    plhs[0] = py2mat(PyObject_RichCompare(a, b, op));
+    py_result = apply_unary_operator(entry, a);
     Py_XDECREF(a);
-    Py_XDECREF(b);
     
-    if (PyErr_Occurred() != NULL) {
+    if (py_result == NULL) {
+        if (PyErr_Occurred() != NULL) {
+            PyErr_Print();
+        }
+        sprintf(buf, "Python exception inside %s.", entry->name);
+        mexErrMsgTxt(buf);
+    }
+    
+    plhs[0] = fast_scalar_result(py_result);
+    if (plhs[0] == NULL) {
+        plhs[0] = py2mat(py_result);
+    }
+    
+}
+
+/**
+ * MATLAB signature: setattr(object, name, value)
+ * 
+ * Emulates `object.name = value`.
+ */
+void setattr(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    PyObject *obj, *value;
+    char* attr_name;
+    int status;
+    
+    if (nrhs != 3) {
+        mexErrMsgTxt("Expected exactly three arguments.");
+    }
+    
+    obj = mat2py(prhs[0], false);
+    get_matlab_str(prhs[1], &attr_name);
+    value = mat2py(prhs[2], false);
+    
+    // SetAttr does not steal either reference.
+    status = PyObject_SetAttrString(obj, attr_name, value);
+    Py_XDECREF(obj);
+    Py_XDECREF(value);
+    
+    if (status != 0) {
         PyErr_Print();
-        mexErrMsgTxt("Python exception inside cmp.");
+        mexErrMsgTxt("Python exception inside setattr.");
+    }
+    
+}
+
+/**
+ * MATLAB signature: setitem(object, key, ..., value)
+ * 
+ * Emulates `object[key] = value`, translating keys as in getitem.
+ */
+void setitem(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    PyObject *target, *key, *value;
+    int status;
+    
+    if (nrhs < 3) {
+        mexErrMsgTxt("Expected at least three arguments.");
+    }
+    
+    target = mat2py(prhs[0], false);
+    key = py_key_from_subscripts(nrhs - 2, prhs + 1);
+    value = mat2py(prhs[nrhs - 1], false);
+    
+    // SetItem does not steal any of these references.
+    status = PyObject_SetItem(target, key, value);
+    Py_XDECREF(target);
+    Py_XDECREF(key);
+    Py_XDECREF(value);
+    
+    if (status != 0) {
+        PyErr_Print();
+        mexErrMsgTxt("Python exception inside setitem.");
+    }
+    
+}
+
+/**
+ * MATLAB signature: result = track(command)
+ * 
+ * Controls tracking of objects handed across the MEX boundary (see
+ * pymex_track.c). The command is one of:
+ *
+ *  - "on" / "off": enables or disables tracking. Objects boxed while
+ *    tracking is off are never recorded, but releases of objects recorded
+ *    earlier still are.
+ *  - "reset": forgets all recorded objects.
+ *  - "dump": returns a struct array of live recorded objects.
+ */
+void track(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    char* command;
+    
+    if (nrhs != 1) {
+        mexErrMsgTxt("Expected exactly one argument.");
+    }
+    
+    get_matlab_str(prhs[0], &command);
+    
+    if (strcmp(command, "on") == 0) {
+        tracking_enabled = true;
+    } else if (strcmp(command, "off") == 0) {
+        tracking_enabled = false;
+    } else if (strcmp(command, "reset") == 0) {
+        track_reset();
+    } else if (strcmp(command, "dump") == 0) {
+        plhs[0] = track_dump();
+    } else {
+        mexErrMsgTxt("Unknown tracking command.");
+    }
+    
+}
+
+/**
+ * MATLAB signature: n_events = trace(command)
+ *                   n_events = trace('save', filename)
+ * 
+ * Controls tracing of boundary crossings (see pymex_trace.c). The command is
+ * one of:
+ *
+ *  - "on" / "off": enables or disables tracing of opcodes, marshalling and
+ *    calls back into MATLAB.
+ *  - "frames": as "on", but also records each Python call.
+ *  - "reset": discards all recorded events.
+ *  - "save": writes the recorded events to filename as a Chrome trace, and
+ *    returns how many there were.
+ */
+void trace(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+    char *command, *filename;
+    long n_events;
+    
+    if (nrhs < 1) {
+        mexErrMsgTxt("Expected a tracing command.");
+    }
+    
+    get_matlab_str(prhs[0], &command);
+    
+    if (strcmp(command, "on") == 0) {
+        trace_set_python_frames(false);
+        tracing_enabled = true;
+    } else if (strcmp(command, "frames") == 0) {
+        trace_set_python_frames(true);
+        tracing_enabled = true;
+    } else if (strcmp(command, "off") == 0) {
+        trace_set_python_frames(false);
+        tracing_enabled = false;
+    } else if (strcmp(command, "reset") == 0) {
+        trace_reset();
+    } else if (strcmp(command, "save") == 0) {
+        if (nrhs != 2) {
+            mexErrMsgTxt("Expected a filename to save the trace to.");
+        }
+        get_matlab_str(prhs[1], &filename);
+        n_events = trace_save(filename);
+        if (n_events < 0) {
+            mexErrMsgTxt("Could not open the trace file for writing.");
+        }
+        plhs[0] = mxCreateDoubleScalar((double) n_events);
+    } else {
+        mexErrMsgTxt("Unknown tracing command.");
     }
     
 }
@@ -0,0 +1,942 @@
+/**
+ * pymex_kernels.c: Vectorized kernels for array layout and type conversions.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// MATLAB stores arrays column-major, keeps the real and imaginary parts of
+// complex arrays in separate buffers, uses one byte per logical and two per
+// character. Converting to and from the layouts Python code expects is a
+// handful of simple loops, which are written here once per instruction set
+// and chosen between at run time.
+//
+// Each public function looks up its implementation in the table for the
+// active level. Every level's table is complete: where an instruction set
+// has nothing to add for a kernel (AVX-512 for transposes, for instance),
+// the entry is the next level down's.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include "pymex_kernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+    #define KERNELS_SSE2
+    #include <emmintrin.h>
+#endif
+
+// AVX2 and AVX-512 kernels are compiled with per-function target attributes,
+// so that the rest of pymex needn't be built for those instruction sets.
+#if defined(KERNELS_SSE2) && defined(__GNUC__)
+    #define KERNELS_AVX
+    #include <immintrin.h>
+    #define TARGET_AVX2 __attribute__((target("avx2")))
+    #define TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#endif
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Transposes work through tiles of this many elements on a side, so that
+// both the rows read and the columns written stay in cache.
+#define TRANSPOSE_TILE 32
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+// Strided 2-D transpose: element (i, j) moves from src[i + j * ld_src] to
+// dst[j + i * ld_dst], for i < rows and j < cols.
+typedef void (*transpose_fn_t)(void* dst, size_t ld_dst, const void* src, size_t ld_src, size_t rows, size_t cols);
+
+typedef struct {
+    transpose_fn_t transpose_1;
+    transpose_fn_t transpose_2;
+    transpose_fn_t transpose_4;
+    transpose_fn_t transpose_8;
+    void (*interleave_4)(float* dst, const float* re, const float* im, size_t n);
+    void (*interleave_8)(double* dst, const double* re, const double* im, size_t n);
+    void (*split_4)(float* re, float* im, const float* src, size_t n);
+    void (*split_8)(double* re, double* im, const double* src, size_t n);
+    void (*pack_logicals)(unsigned char* bits, const unsigned char* src, size_t n);
+    void (*unpack_logicals)(unsigned char* dst, const unsigned char* bits, size_t n);
+    bool (*widen_chars)(unsigned short* dst, const unsigned char* src, size_t n);
+    bool (*narrow_chars)(unsigned char* dst, const unsigned short* src, size_t n);
+    void (*widen_floats)(double* dst, const float* src, size_t n);
+    void (*narrow_doubles)(float* dst, const double* src, size_t n);
+} kernel_table_t;
+
+// SCALAR KERNELS //////////////////////////////////////////////////////////////
+// These are also the tails of the vectorized kernels, and the reference the
+// standalone benchmark compares against.
+
+/**
+ * Defines a blocked scalar transpose for elements of the given type.
+ */
+#define DEFINE_SCALAR_TRANSPOSE(name, type) \
+    static void name(void* dst, size_t ld_dst, const void* src, size_t ld_src, size_t rows, size_t cols) { \
+        type* d = dst; \
+        const type* s = src; \
+        size_t ib, jb, i, j, i_end, j_end; \
+        for (jb = 0; jb < cols; jb += TRANSPOSE_TILE) { \
+            j_end = jb + TRANSPOSE_TILE < cols ? jb + TRANSPOSE_TILE : cols; \
+            for (ib = 0; ib < rows; ib += TRANSPOSE_TILE) { \
+                i_end = ib + TRANSPOSE_TILE < rows ? ib + TRANSPOSE_TILE : rows; \
+                for (j = jb; j < j_end; ++j) { \
+                    for (i = ib; i < i_end; ++i) { \
+                        d[j + i * ld_dst] = s[i + j * ld_src]; \
+                    } \
+                } \
+            } \
+        } \
+    }
+
+DEFINE_SCALAR_TRANSPOSE(transpose_1_scalar, unsigned char)
+DEFINE_SCALAR_TRANSPOSE(transpose_2_scalar, unsigned short)
+DEFINE_SCALAR_TRANSPOSE(transpose_4_scalar, unsigned int)
+DEFINE_SCALAR_TRANSPOSE(transpose_8_scalar, unsigned long long)
+
+static void interleave_4_scalar(float* dst, const float* re, const float* im, size_t n) {
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[2 * idx] = re[idx];
+        dst[2 * idx + 1] = im[idx];
+    }
+}
+
+static void interleave_8_scalar(double* dst, const double* re, const double* im, size_t n) {
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[2 * idx] = re[idx];
+        dst[2 * idx + 1] = im[idx];
+    }
+}
+
+static void split_4_scalar(float* re, float* im, const float* src, size_t n) {
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        re[idx] = src[2 * idx];
+        im[idx] = src[2 * idx + 1];
+    }
+}
+
+static void split_8_scalar(double* re, double* im, const double* src, size_t n) {
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        re[idx] = src[2 * idx];
+        im[idx] = src[2 * idx + 1];
+    }
+}
+
+static void pack_logicals_scalar(unsigned char* bits, const unsigned char* src, size_t n) {
+    size_t idx;
+    
+    memset(bits, 0, (n + 7) / 8);
+    for (idx = 0; idx < n; ++idx) {
+        if (src[idx]) {
+            bits[idx / 8] |= (unsigned char) (1 << (idx % 8));
+        }
+    }
+}
+
+static void unpack_logicals_scalar(unsigned char* dst, const unsigned char* bits, size_t n) {
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[idx] = (bits[idx / 8] >> (idx % 8)) & 1;
+    }
+}
+
+static bool widen_chars_scalar(unsigned short* dst, const unsigned char* src, size_t n) {
+    unsigned char high = 0;
+    size_t idx;
+    
+    for (idx = 0; idx < n; ++idx) {
+        dst[idx] = src[idx];
+        high |= src[idx];
+    }
+    return (high & 0x80) == 0;
+}
+
+static bool narrow_chars_scalar(unsigned char* dst, const unsigned short* src, size_t n) {
+    unsigned short high = 0;
+    size_t idx;
+    
+    for (idx = 0; idx < n; ++idx) {
+        dst[idx] = (unsigned char) src[idx];
+        high |= src[idx];
+    }
+    return (high & 0xff80) == 0;
+}
+
+static void widen_floats_scalar(double* dst, const float* src, size_t n) {
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[idx] = src[idx];
+    }
+}
+
+static void narrow_doubles_scalar(float* dst, const double* src, size_t n) {
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[idx] = (float) src[idx];
+    }
+}
+
+static const kernel_table_t SCALAR_KERNELS = {
+    transpose_1_scalar, transpose_2_scalar, transpose_4_scalar, transpose_8_scalar,
+    interleave_4_scalar, interleave_8_scalar, split_4_scalar, split_8_scalar,
+    pack_logicals_scalar, unpack_logicals_scalar,
+    widen_chars_scalar, narrow_chars_scalar,
+    widen_floats_scalar, narrow_doubles_scalar
+};
+
+// BLOCKED TRANSPOSE DRIVER ////////////////////////////////////////////////////
+
+/**
+ * Defines a transpose that walks tiles as the scalar one does, handing
+ * block x block squares to micro (a statement using d, ld_dst, s, ld_src,
+ * i and j) and finishing ragged edges with scalar code.
+ */
+#define DEFINE_BLOCKED_TRANSPOSE(name, attrs, type, block, micro) \
+    attrs static void name(void* dst, size_t ld_dst, const void* src, size_t ld_src, size_t rows, size_t cols) { \
+        type* d = dst; \
+        const type* s = src; \
+        size_t ib, jb, i, j, i_end, j_end, i_full, j_full; \
+        for (jb = 0; jb < cols; jb += TRANSPOSE_TILE) { \
+            j_end = jb + TRANSPOSE_TILE < cols ? jb + TRANSPOSE_TILE : cols; \
+            j_full = jb + (j_end - jb) / block * block; \
+            for (ib = 0; ib < rows; ib += TRANSPOSE_TILE) { \
+                i_end = ib + TRANSPOSE_TILE < rows ? ib + TRANSPOSE_TILE : rows; \
+                i_full = ib + (i_end - ib) / block * block; \
+                for (j = jb; j < j_full; j += block) { \
+                    for (i = ib; i < i_full; i += block) { \
+                        micro; \
+                    } \
+                } \
+                for (j = jb; j < j_end; ++j) { \
+                    for (i = j < j_full ? i_full : ib; i < i_end; ++i) { \
+                        d[j + i * ld_dst] = s[i + j * ld_src]; \
+                    } \
+                } \
+            } \
+        } \
+    }
+
+// SSE2 KERNELS ////////////////////////////////////////////////////////////////
+
+#ifdef KERNELS_SSE2
+
+// 4x4 block of 32-bit elements; the shuffles don't care that they aren't
+// really floats.
+#define SSE2_TRANSPOSE_4x4(d, ld_dst, s, ld_src, i, j) do { \
+        __m128 c0 = _mm_loadu_ps((const float*) &s[i + (j) * ld_src]); \
+        __m128 c1 = _mm_loadu_ps((const float*) &s[i + (j + 1) * ld_src]); \
+        __m128 c2 = _mm_loadu_ps((const float*) &s[i + (j + 2) * ld_src]); \
+        __m128 c3 = _mm_loadu_ps((const float*) &s[i + (j + 3) * ld_src]); \
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3); \
+        _mm_storeu_ps((float*) &d[j + (i) * ld_dst], c0); \
+        _mm_storeu_ps((float*) &d[j + (i + 1) * ld_dst], c1); \
+        _mm_storeu_ps((float*) &d[j + (i + 2) * ld_dst], c2); \
+        _mm_storeu_ps((float*) &d[j + (i + 3) * ld_dst], c3); \
+    } while (0)
+
+// 2x2 block of 64-bit elements.
+#define SSE2_TRANSPOSE_2x2(d, ld_dst, s, ld_src, i, j) do { \
+        __m128d c0 = _mm_loadu_pd((const double*) &s[i + (j) * ld_src]); \
+        __m128d c1 = _mm_loadu_pd((const double*) &s[i + (j + 1) * ld_src]); \
+        _mm_storeu_pd((double*) &d[j + (i) * ld_dst], _mm_unpacklo_pd(c0, c1)); \
+        _mm_storeu_pd((double*) &d[j + (i + 1) * ld_dst], _mm_unpackhi_pd(c0, c1)); \
+    } while (0)
+
+DEFINE_BLOCKED_TRANSPOSE(transpose_4_sse2, , unsigned int, 4,
+    SSE2_TRANSPOSE_4x4(d, ld_dst, s, ld_src, i, j))
+DEFINE_BLOCKED_TRANSPOSE(transpose_8_sse2, , unsigned long long, 2,
+    SSE2_TRANSPOSE_2x2(d, ld_dst, s, ld_src, i, j))
+
+static void interleave_4_sse2(float* dst, const float* re, const float* im, size_t n) {
+    size_t idx;
+    __m128 r, i;
+    
+    for (idx = 0; idx + 4 <= n; idx += 4) {
+        r = _mm_loadu_ps(re + idx);
+        i = _mm_loadu_ps(im + idx);
+        _mm_storeu_ps(dst + 2 * idx, _mm_unpacklo_ps(r, i));
+        _mm_storeu_ps(dst + 2 * idx + 4, _mm_unpackhi_ps(r, i));
+    }
+    interleave_4_scalar(dst + 2 * idx, re + idx, im + idx, n - idx);
+}
+
+static void interleave_8_sse2(double* dst, const double* re, const double* im, size_t n) {
+    size_t idx;
+    __m128d r, i;
+    
+    for (idx = 0; idx + 2 <= n; idx += 2) {
+        r = _mm_loadu_pd(re + idx);
+        i = _mm_loadu_pd(im + idx);
+        _mm_storeu_pd(dst + 2 * idx, _mm_unpacklo_pd(r, i));
+        _mm_storeu_pd(dst + 2 * idx + 2, _mm_unpackhi_pd(r, i));
+    }
+    interleave_8_scalar(dst + 2 * idx, re + idx, im + idx, n - idx);
+}
+
+static void split_4_sse2(float* re, float* im, const float* src, size_t n) {
+    size_t idx;
+    __m128 a, b;
+    
+    for (idx = 0; idx + 4 <= n; idx += 4) {
+        a = _mm_loadu_ps(src + 2 * idx);
+        b = _mm_loadu_ps(src + 2 * idx + 4);
+        _mm_storeu_ps(re + idx, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(im + idx, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    split_4_scalar(re + idx, im + idx, src + 2 * idx, n - idx);
+}
+
+static void split_8_sse2(double* re, double* im, const double* src, size_t n) {
+    size_t idx;
+    __m128d a, b;
+    
+    for (idx = 0; idx + 2 <= n; idx += 2) {
+        a = _mm_loadu_pd(src + 2 * idx);
+        b = _mm_loadu_pd(src + 2 * idx + 2);
+        _mm_storeu_pd(re + idx, _mm_unpacklo_pd(a, b));
+        _mm_storeu_pd(im + idx, _mm_unpackhi_pd(a, b));
+    }
+    split_8_scalar(re + idx, im + idx, src + 2 * idx, n - idx);
+}
+
+static void pack_logicals_sse2(unsigned char* bits, const unsigned char* src, size_t n) {
+    size_t idx;
+    __m128i zero = _mm_setzero_si128();
+    int mask;
+    
+    for (idx = 0; idx + 16 <= n; idx += 16) {
+        // movemask collects one bit per byte, lowest byte first.
+        mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i*) (src + idx)), zero));
+        bits[idx / 8] = (unsigned char) mask;
+        bits[idx / 8 + 1] = (unsigned char) (mask >> 8);
+    }
+    pack_logicals_scalar(bits + idx / 8, src + idx, n - idx);
+}
+
+static void unpack_logicals_sse2(unsigned char* dst, const unsigned char* bits, size_t n) {
+    const __m128i select = _mm_set_epi8(
+        -128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i v;
+    size_t idx;
+    
+    for (idx = 0; idx + 16 <= n; idx += 16) {
+        // Spread each byte of bits across eight lanes, then test one bit
+        // per lane.
+        v = _mm_unpacklo_epi64(
+            _mm_set1_epi8((char) bits[idx / 8]), _mm_set1_epi8((char) bits[idx / 8 + 1]));
+        v = _mm_cmpeq_epi8(_mm_and_si128(v, select), select);
+        _mm_storeu_si128((__m128i*) (dst + idx), _mm_and_si128(v, one));
+    }
+    unpack_logicals_scalar(dst + idx, bits + idx / 8, n - idx);
+}
+
+static bool widen_chars_sse2(unsigned short* dst, const unsigned char* src, size_t n) {
+    __m128i zero = _mm_setzero_si128(), high = zero, v;
+    size_t idx;
+    
+    for (idx = 0; idx + 16 <= n; idx += 16) {
+        v = _mm_loadu_si128((const __m128i*) (src + idx));
+        high = _mm_or_si128(high, v);
+        _mm_storeu_si128((__m128i*) (dst + idx), _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i*) (dst + idx + 8), _mm_unpackhi_epi8(v, zero));
+    }
+    return widen_chars_scalar(dst + idx, src + idx, n - idx) && _mm_movemask_epi8(high) == 0;
+}
+
+static bool narrow_chars_sse2(unsigned char* dst, const unsigned short* src, size_t n) {
+    __m128i high = _mm_setzero_si128(), a, b;
+    size_t idx;
+    
+    for (idx = 0; idx + 16 <= n; idx += 16) {
+        a = _mm_loadu_si128((const __m128i*) (src + idx));
+        b = _mm_loadu_si128((const __m128i*) (src + idx + 8));
+        high = _mm_or_si128(high, _mm_or_si128(a, b));
+        // Saturation only matters for non-ASCII input, which we report.
+        _mm_storeu_si128((__m128i*) (dst + idx), _mm_packus_epi16(a, b));
+    }
+    high = _mm_and_si128(high, _mm_set1_epi16((short) 0xff80));
+    return narrow_chars_scalar(dst + idx, src + idx, n - idx) &&
+        _mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xffff;
+}
+
+static void widen_floats_sse2(double* dst, const float* src, size_t n) {
+    size_t idx;
+    __m128 v;
+    
+    for (idx = 0; idx + 4 <= n; idx += 4) {
+        v = _mm_loadu_ps(src + idx);
+        _mm_storeu_pd(dst + idx, _mm_cvtps_pd(v));
+        _mm_storeu_pd(dst + idx + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+    widen_floats_scalar(dst + idx, src + idx, n - idx);
+}
+
+static void narrow_doubles_sse2(float* dst, const double* src, size_t n) {
+    size_t idx;
+    
+    for (idx = 0; idx + 4 <= n; idx += 4) {
+        _mm_storeu_ps(dst + idx, _mm_movelh_ps(
+            _mm_cvtpd_ps(_mm_loadu_pd(src + idx)),
+            _mm_cvtpd_ps(_mm_loadu_pd(src + idx + 2))));
+    }
+    narrow_doubles_scalar(dst + idx, src + idx, n - idx);
+}
+
+static const kernel_table_t SSE2_KERNELS = {
+    transpose_1_scalar, transpose_2_scalar, transpose_4_sse2, transpose_8_sse2,
+    interleave_4_sse2, interleave_8_sse2, split_4_sse2, split_8_sse2,
+    pack_logicals_sse2, unpack_logicals_sse2,
+    widen_chars_sse2, narrow_chars_sse2,
+    widen_floats_sse2, narrow_doubles_sse2
+};
+
+#endif
+
+// AVX2 KERNELS ////////////////////////////////////////////////////////////////
+
+#ifdef KERNELS_AVX
+
+// 4x4 block of 64-bit elements.
+#define AVX2_TRANSPOSE_4x4(d, ld_dst, s, ld_src, i, j) do { \
+        __m256d c0 = _mm256_loadu_pd((const double*) &s[i + (j) * ld_src]); \
+        __m256d c1 = _mm256_loadu_pd((const double*) &s[i + (j + 1) * ld_src]); \
+        __m256d c2 = _mm256_loadu_pd((const double*) &s[i + (j + 2) * ld_src]); \
+        __m256d c3 = _mm256_loadu_pd((const double*) &s[i + (j + 3) * ld_src]); \
+        __m256d t0 = _mm256_unpacklo_pd(c0, c1); \
+        __m256d t1 = _mm256_unpackhi_pd(c0, c1); \
+        __m256d t2 = _mm256_unpacklo_pd(c2, c3); \
+        __m256d t3 = _mm256_unpackhi_pd(c2, c3); \
+        _mm256_storeu_pd((double*) &d[j + (i) * ld_dst], _mm256_permute2f128_pd(t0, t2, 0x20)); \
+        _mm256_storeu_pd((double*) &d[j + (i + 1) * ld_dst], _mm256_permute2f128_pd(t1, t3, 0x20)); \
+        _mm256_storeu_pd((double*) &d[j + (i + 2) * ld_dst], _mm256_permute2f128_pd(t0, t2, 0x31)); \
+        _mm256_storeu_pd((double*) &d[j + (i + 3) * ld_dst], _mm256_permute2f128_pd(t1, t3, 0x31)); \
+    } while (0)
+
+DEFINE_BLOCKED_TRANSPOSE(transpose_8_avx2, TARGET_AVX2, unsigned long long, 4,
+    AVX2_TRANSPOSE_4x4(d, ld_dst, s, ld_src, i, j))
+
+TARGET_AVX2 static void interleave_4_avx2(float* dst, const float* re, const float* im, size_t n) {
+    size_t idx;
+    __m256 r, i, lo, hi;
+    
+    for (idx = 0; idx + 8 <= n; idx += 8) {
+        r = _mm256_loadu_ps(re + idx);
+        i = _mm256_loadu_ps(im + idx);
+        // unpack works within 128-bit lanes, so put the lanes back in order.
+        lo = _mm256_unpacklo_ps(r, i);
+        hi = _mm256_unpackhi_ps(r, i);
+        _mm256_storeu_ps(dst + 2 * idx, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(dst + 2 * idx + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    interleave_4_scalar(dst + 2 * idx, re + idx, im + idx, n - idx);
+}
+
+TARGET_AVX2 static void interleave_8_avx2(double* dst, const double* re, const double* im, size_t n) {
+    size_t idx;
+    __m256d r, i, lo, hi;
+    
+    for (idx = 0; idx + 4 <= n; idx += 4) {
+        r = _mm256_loadu_pd(re + idx);
+        i = _mm256_loadu_pd(im + idx);
+        lo = _mm256_unpacklo_pd(r, i);
+        hi = _mm256_unpackhi_pd(r, i);
+        _mm256_storeu_pd(dst + 2 * idx, _mm256_permute2f128_pd(lo, hi, 0x20));
+        _mm256_storeu_pd(dst + 2 * idx + 4, _mm256_permute2f128_pd(lo, hi, 0x31));
+    }
+    interleave_8_scalar(dst + 2 * idx, re + idx, im + idx, n - idx);
+}
+
+TARGET_AVX2 static void split_4_avx2(float* re, float* im, const float* src, size_t n) {
+    size_t idx;
+    __m256 a, b;
+    
+    for (idx = 0; idx + 8 <= n; idx += 8) {
+        a = _mm256_loadu_ps(src + 2 * idx);
+        b = _mm256_loadu_ps(src + 2 * idx + 8);
+        // Within lanes this leaves pairs in the order 0, 2, 1, 3.
+        _mm256_storeu_ps(re + idx, _mm256_castpd_ps(_mm256_permute4x64_pd(
+            _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0))));
+        _mm256_storeu_ps(im + idx, _mm256_castpd_ps(_mm256_permute4x64_pd(
+            _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+    split_4_scalar(re + idx, im + idx, src + 2 * idx, n - idx);
+}
+
+TARGET_AVX2 static void split_8_avx2(double* re, double* im, const double* src, size_t n) {
+    size_t idx;
+    __m256d a, b, lo, hi;
+    
+    for (idx = 0; idx + 4 <= n; idx += 4) {
+        a = _mm256_loadu_pd(src + 2 * idx);
+        b = _mm256_loadu_pd(src + 2 * idx + 4);
+        // Within lanes this leaves the elements in the order 0, 2, 1, 3.
+        lo = _mm256_unpacklo_pd(a, b);
+        hi = _mm256_unpackhi_pd(a, b);
+        _mm256_storeu_pd(re + idx, _mm256_permute4x64_pd(lo, _MM_SHUFFLE(3, 1, 2, 0)));
+        _mm256_storeu_pd(im + idx, _mm256_permute4x64_pd(hi, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    split_8_scalar(re + idx, im + idx, src + 2 * idx, n - idx);
+}
+
+TARGET_AVX2 static void pack_logicals_avx2(unsigned char* bits, const unsigned char* src, size_t n) {
+    size_t idx;
+    __m256i zero = _mm256_setzero_si256();
+    unsigned int mask;
+    
+    for (idx = 0; idx + 32 <= n; idx += 32) {
+        mask = ~(unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i*) (src + idx)), zero));
+        bits[idx / 8] = (unsigned char) mask;
+        bits[idx / 8 + 1] = (unsigned char) (mask >> 8);
+        bits[idx / 8 + 2] = (unsigned char) (mask >> 16);
+        bits[idx / 8 + 3] = (unsigned char) (mask >> 24);
+    }
+    pack_logicals_sse2(bits + idx / 8, src + idx, n - idx);
+}
+
+TARGET_AVX2 static void unpack_logicals_avx2(unsigned char* dst, const unsigned char* bits, size_t n) {
+    const __m256i spread = _mm256_setr_epi8(
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+        2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i select = _mm256_set1_epi64x(0x8040201008040201LL);
+    const __m256i one = _mm256_set1_epi8(1);
+    __m256i v;
+    int word;
+    size_t idx;
+    
+    for (idx = 0; idx + 32 <= n; idx += 32) {
+        memcpy(&word, bits + idx / 8, sizeof(word));
+        // Every lane holds all four bytes, so the in-lane shuffle can reach
+        // any of them.
+        v = _mm256_shuffle_epi8(_mm256_set1_epi32(word), spread);
+        v = _mm256_cmpeq_epi8(_mm256_and_si256(v, select), select);
+        _mm256_storeu_si256((__m256i*) (dst + idx), _mm256_and_si256(v, one));
+    }
+    unpack_logicals_sse2(dst + idx, bits + idx / 8, n - idx);
+}
+
+TARGET_AVX2 static bool widen_chars_avx2(unsigned short* dst, const unsigned char* src, size_t n) {
+    __m128i high = _mm_setzero_si128(), v;
+    size_t idx;
+    
+    for (idx = 0; idx + 16 <= n; idx += 16) {
+        v = _mm_loadu_si128((const __m128i*) (src + idx));
+        high = _mm_or_si128(high, v);
+        _mm256_storeu_si256((__m256i*) (dst + idx), _mm256_cvtepu8_epi16(v));
+    }
+    return widen_chars_scalar(dst + idx, src + idx, n - idx) && _mm_movemask_epi8(high) == 0;
+}
+
+TARGET_AVX2 static bool narrow_chars_avx2(unsigned char* dst, const unsigned short* src, size_t n) {
+    __m256i high = _mm256_setzero_si256(), a, b;
+    size_t idx;
+    
+    for (idx = 0; idx + 32 <= n; idx += 32) {
+        a = _mm256_loadu_si256((const __m256i*) (src + idx));
+        b = _mm256_loadu_si256((const __m256i*) (src + idx + 16));
+        high = _mm256_or_si256(high, _mm256_or_si256(a, b));
+        // packus interleaves the lanes of a and b; put them back in order.
+        _mm256_storeu_si256((__m256i*) (dst + idx),
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    high = _mm256_and_si256(high, _mm256_set1_epi16((short) 0xff80));
+    return narrow_chars_scalar(dst + idx, src + idx, n - idx) && _mm256_testz_si256(high, high);
+}
+
+TARGET_AVX2 static void widen_floats_avx2(double* dst, const float* src, size_t n) {
+    size_t idx;
+    
+    for (idx = 0; idx + 4 <= n; idx += 4) {
+        _mm256_storeu_pd(dst + idx, _mm256_cvtps_pd(_mm_loadu_ps(src + idx)));
+    }
+    widen_floats_scalar(dst + idx, src + idx, n - idx);
+}
+
+TARGET_AVX2 static void narrow_doubles_avx2(float* dst, const double* src, size_t n) {
+    size_t idx;
+    
+    for (idx = 0; idx + 4 <= n; idx += 4) {
+        _mm_storeu_ps(dst + idx, _mm256_cvtpd_ps(_mm256_loadu_pd(src + idx)));
+    }
+    narrow_doubles_scalar(dst + idx, src + idx, n - idx);
+}
+
+static const kernel_table_t AVX2_KERNELS = {
+    transpose_1_scalar, transpose_2_scalar, transpose_4_sse2, transpose_8_avx2,
+    interleave_4_avx2, interleave_8_avx2, split_4_avx2, split_8_avx2,
+    pack_logicals_avx2, unpack_logicals_avx2,
+    widen_chars_avx2, narrow_chars_avx2,
+    widen_floats_avx2, narrow_doubles_avx2
+};
+
+// AVX-512 KERNELS /////////////////////////////////////////////////////////////
+
+TARGET_AVX512 static void interleave_4_avx512(float* dst, const float* re, const float* im, size_t n) {
+    const __m512i lo_idx = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+    const __m512i hi_idx = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+    size_t idx;
+    __m512 r, i;
+    
+    for (idx = 0; idx + 16 <= n; idx += 16) {
+        r = _mm512_loadu_ps(re + idx);
+        i = _mm512_loadu_ps(im + idx);
+        _mm512_storeu_ps(dst + 2 * idx, _mm512_permutex2var_ps(r, lo_idx, i));
+        _mm512_storeu_ps(dst + 2 * idx + 16, _mm512_permutex2var_ps(r, hi_idx, i));
+    }
+    interleave_4_avx2(dst + 2 * idx, re + idx, im + idx, n - idx);
+}
+
+TARGET_AVX512 static void interleave_8_avx512(double* dst, const double* re, const double* im, size_t n) {
+    const __m512i lo_idx = _mm512_setr_epi64(0, 8, 1, 9, 2, 10, 3, 11);
+    const __m512i hi_idx = _mm512_setr_epi64(4, 12, 5, 13, 6, 14, 7, 15);
+    size_t idx;
+    __m512d r, i;
+    
+    for (idx = 0; idx + 8 <= n; idx += 8) {
+        r = _mm512_loadu_pd(re + idx);
+        i = _mm512_loadu_pd(im + idx);
+        _mm512_storeu_pd(dst + 2 * idx, _mm512_permutex2var_pd(r, lo_idx, i));
+        _mm512_storeu_pd(dst + 2 * idx + 8, _mm512_permutex2var_pd(r, hi_idx, i));
+    }
+    interleave_8_avx2(dst + 2 * idx, re + idx, im + idx, n - idx);
+}
+
+TARGET_AVX512 static void split_4_avx512(float* re, float* im, const float* src, size_t n) {
+    const __m512i even = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    const __m512i odd = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+    size_t idx;
+    __m512 a, b;
+    
+    for (idx = 0; idx + 16 <= n; idx += 16) {
+        a = _mm512_loadu_ps(src + 2 * idx);
+        b = _mm512_loadu_ps(src + 2 * idx + 16);
+        _mm512_storeu_ps(re + idx, _mm512_permutex2var_ps(a, even, b));
+        _mm512_storeu_ps(im + idx, _mm512_permutex2var_ps(a, odd, b));
+    }
+    split_4_avx2(re + idx, im + idx, src + 2 * idx, n - idx);
+}
+
+TARGET_AVX512 static void split_8_avx512(double* re, double* im, const double* src, size_t n) {
+    const __m512i even = _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14);
+    const __m512i odd = _mm512_setr_epi64(1, 3, 5, 7, 9, 11, 13, 15);
+    size_t idx;
+    __m512d a, b;
+    
+    for (idx = 0; idx + 8 <= n; idx += 8) {
+        a = _mm512_loadu_pd(src + 2 * idx);
+        b = _mm512_loadu_pd(src + 2 * idx + 8);
+        _mm512_storeu_pd(re + idx, _mm512_permutex2var_pd(a, even, b));
+        _mm512_storeu_pd(im + idx, _mm512_permutex2var_pd(a, odd, b));
+    }
+    split_8_avx2(re + idx, im + idx, src + 2 * idx, n - idx);
+}
+
+TARGET_AVX512 static void pack_logicals_avx512(unsigned char* bits, const unsigned char* src, size_t n) {
+    unsigned long long mask;
+    __m512i v;
+    size_t idx;
+    
+    for (idx = 0; idx + 64 <= n; idx += 64) {
+        v = _mm512_loadu_si512(src + idx);
+        mask = _mm512_test_epi8_mask(v, v);
+        // x86 is little-endian, so this lays the bits out lowest first.
+        memcpy(bits + idx / 8, &mask, sizeof(mask));
+    }
+    pack_logicals_avx2(bits + idx / 8, src + idx, n - idx);
+}
+
+TARGET_AVX512 static void unpack_logicals_avx512(unsigned char* dst, const unsigned char* bits, size_t n) {
+    unsigned long long mask;
+    size_t idx;
+    
+    for (idx = 0; idx + 64 <= n; idx += 64) {
+        memcpy(&mask, bits + idx / 8, sizeof(mask));
+        _mm512_storeu_si512(dst + idx, _mm512_maskz_set1_epi8(mask, 1));
+    }
+    unpack_logicals_avx2(dst + idx, bits + idx / 8, n - idx);
+}
+
+TARGET_AVX512 static bool widen_chars_avx512(unsigned short* dst, const unsigned char* src, size_t n) {
+    __m256i high = _mm256_setzero_si256(), v;
+    size_t idx;
+    
+    for (idx = 0; idx + 32 <= n; idx += 32) {
+        v = _mm256_loadu_si256((const __m256i*) (src + idx));
+        high = _mm256_or_si256(high, v);
+        _mm512_storeu_si512(dst + idx, _mm512_cvtepu8_epi16(v));
+    }
+    return widen_chars_avx2(dst + idx, src + idx, n - idx) && _mm256_movemask_epi8(high) == 0;
+}
+
+TARGET_AVX512 static bool narrow_chars_avx512(unsigned char* dst, const unsigned short* src, size_t n) {
+    __m512i high = _mm512_setzero_si512(), v;
+    size_t idx;
+    
+    for (idx = 0; idx + 32 <= n; idx += 32) {
+        v = _mm512_loadu_si512(src + idx);
+        high = _mm512_or_si512(high, v);
+        _mm256_storeu_si256((__m256i*) (dst + idx), _mm512_cvtepi16_epi8(v));
+    }
+    return narrow_chars_avx2(dst + idx, src + idx, n - idx) &&
+        _mm512_test_epi16_mask(high, _mm512_set1_epi16((short) 0xff80)) == 0;
+}
+
+TARGET_AVX512 static void widen_floats_avx512(double* dst, const float* src, size_t n) {
+    size_t idx;
+    
+    for (idx = 0; idx + 8 <= n; idx += 8) {
+        _mm512_storeu_pd(dst + idx, _mm512_cvtps_pd(_mm256_loadu_ps(src + idx)));
+    }
+    widen_floats_avx2(dst + idx, src + idx, n - idx);
+}
+
+TARGET_AVX512 static void narrow_doubles_avx512(float* dst, const double* src, size_t n) {
+    size_t idx;
+    
+    for (idx = 0; idx + 8 <= n; idx += 8) {
+        _mm256_storeu_ps(dst + idx, _mm512_cvtpd_ps(_mm512_loadu_pd(src + idx)));
+    }
+    narrow_doubles_avx2(dst + idx, src + idx, n - idx);
+}
+
+static const kernel_table_t AVX512_KERNELS = {
+    transpose_1_scalar, transpose_2_scalar, transpose_4_sse2, transpose_8_avx2,
+    interleave_4_avx512, interleave_8_avx512, split_4_avx512, split_8_avx512,
+    pack_logicals_avx512, unpack_logicals_avx512,
+    widen_chars_avx512, narrow_chars_avx512,
+    widen_floats_avx512, narrow_doubles_avx512
+};
+
+#endif
+
+// DISPATCH ////////////////////////////////////////////////////////////////////
+
+static const kernel_table_t* kernels = NULL;
+static simd_level_t active_level = SIMD_SCALAR;
+
+/**
+ * Returns the best level that both this build and the running CPU support.
+ */
+simd_level_t detect_simd_level() {
+    #if defined(KERNELS_AVX)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+            return SIMD_AVX512;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return SIMD_AVX2;
+        }
+        return SIMD_SSE2;
+    #elif defined(KERNELS_SSE2)
+        return SIMD_SSE2;
+    #else
+        return SIMD_SCALAR;
+    #endif
+}
+
+/**
+ * Switches every kernel to the given level, or to the best supported one
+ * below it. Returns the level actually used.
+ */
+simd_level_t set_simd_level(simd_level_t level) {
+    simd_level_t best = detect_simd_level();
+    
+    active_level = level > best ? best : level;
+    switch (active_level) {
+        #ifdef KERNELS_AVX
+        case SIMD_AVX512:
+            kernels = &AVX512_KERNELS;
+            break;
+        case SIMD_AVX2:
+            kernels = &AVX2_KERNELS;
+            break;
+        #endif
+        #ifdef KERNELS_SSE2
+        case SIMD_SSE2:
+            kernels = &SSE2_KERNELS;
+            break;
+        #endif
+        default:
+            active_level = SIMD_SCALAR;
+            kernels = &SCALAR_KERNELS;
+    }
+    return active_level;
+}
+
+simd_level_t get_simd_level() {
+    if (kernels == NULL) {
+        set_simd_level(N_SIMD_LEVELS);
+    }
+    return active_level;
+}
+
+const char* simd_level_name(simd_level_t level) {
+    static const char* names[N_SIMD_LEVELS] = {"scalar", "SSE2", "AVX2", "AVX-512"};
+    return level < N_SIMD_LEVELS ? names[level] : "unknown";
+}
+
+static const kernel_table_t* get_kernels() {
+    if (kernels == NULL) {
+        set_simd_level(N_SIMD_LEVELS);
+    }
+    return kernels;
+}
+
+// LAYOUT TRANSFORMS ///////////////////////////////////////////////////////////
+
+static void transpose_strided(
+    void* dst, size_t ld_dst, const void* src, size_t ld_src,
+    size_t rows, size_t cols, size_t el_size
+) {
+    const kernel_table_t* k = get_kernels();
+    size_t i, j;
+    
+    switch (el_size) {
+        case 1: k->transpose_1(dst, ld_dst, src, ld_src, rows, cols); break;
+        case 2: k->transpose_2(dst, ld_dst, src, ld_src, rows, cols); break;
+        case 4: k->transpose_4(dst, ld_dst, src, ld_src, rows, cols); break;
+        case 8: k->transpose_8(dst, ld_dst, src, ld_src, rows, cols); break;
+        default:
+            // Odd sizes, such as interleaved complex doubles.
+            for (j = 0; j < cols; ++j) {
+                for (i = 0; i < rows; ++i) {
+                    memcpy((char*) dst + (j + i * ld_dst) * el_size,
+                        (const char*) src + (i + j * ld_src) * el_size, el_size);
+                }
+            }
+    }
+}
+
+/**
+ * Copies a rows x cols matrix from column-major to row-major order. Calling
+ * it with rows and cols swapped converts back.
+ */
+void transpose_2d(void* dst, const void* src, size_t rows, size_t cols, size_t el_size) {
+    transpose_strided(dst, cols, src, rows, rows, cols, el_size);
+}
+
+/**
+ * Copies an N-D array from MATLAB's column-major (Fortran) order to C
+ * order, that is, reversing the order of its axes in memory. Calling it
+ * with dims reversed converts back.
+ *
+ * Axes other than the first and last are walked one index at a time, with
+ * each step a strided 2-D transpose of the first axis against the last.
+ */
+void transpose_nd(void* dst, const void* src, size_t ndim, const size_t* dims, size_t el_size) {
+    size_t rows, cols, n_middle = 1, idx_middle, rest, src_offset, dst_offset, stride, axis;
+    
+    if (ndim < 2) {
+        memcpy(dst, src, (ndim == 0 ? 1 : dims[0]) * el_size);
+        return;
+    }
+    
+    rows = dims[0];
+    cols = dims[ndim - 1];
+    for (axis = 1; axis < ndim - 1; ++axis) {
+        n_middle *= dims[axis];
+    }
+    
+    for (idx_middle = 0; idx_middle < n_middle; ++idx_middle) {
+        // Middle axes are contiguous after the first in column-major order.
+        src_offset = idx_middle * rows;
+        
+        // In C order, axis k has stride dims[k + 1] * ... * dims[ndim - 1].
+        dst_offset = 0;
+        rest = idx_middle;
+        stride = n_middle * cols;
+        for (axis = 1; axis < ndim - 1; ++axis) {
+            stride /= dims[axis];
+            dst_offset += (rest % dims[axis]) * stride;
+            rest /= dims[axis];
+        }
+        
+        transpose_strided(
+            (char*) dst + dst_offset * el_size, n_middle * cols,
+            (const char*) src + src_offset * el_size, rows * n_middle,
+            rows, cols, el_size
+        );
+    }
+}
+
+/**
+ * Interleaves separate real and imaginary parts, as MATLAB stores them, into
+ * (re, im) pairs. el_size is that of one part, 4 or 8 bytes.
+ */
+void interleave_complex(void* dst, const void* re, const void* im, size_t n, size_t el_size) {
+    if (el_size == 4) {
+        get_kernels()->interleave_4(dst, re, im, n);
+    } else {
+        get_kernels()->interleave_8(dst, re, im, n);
+    }
+}
+
+void split_complex(void* re, void* im, const void* src, size_t n, size_t el_size) {
+    if (el_size == 4) {
+        get_kernels()->split_4(re, im, src, n);
+    } else {
+        get_kernels()->split_8(re, im, src, n);
+    }
+}
+
+// LOGICALS ////////////////////////////////////////////////////////////////////
+
+/**
+ * Packs n logicals into (n + 7) / 8 bytes, the first logical going to the
+ * lowest bit of the first byte (numpy.packbits with bitorder="little").
+ * Any non-zero byte counts as true.
+ */
+void pack_logicals(unsigned char* bits, const mxLogical* src, size_t n) {
+    get_kernels()->pack_logicals(bits, (const unsigned char*) src, n);
+}
+
+void unpack_logicals(mxLogical* dst, const unsigned char* bits, size_t n) {
+    get_kernels()->unpack_logicals((unsigned char*) dst, bits, n);
+}
+
+// CASTS ///////////////////////////////////////////////////////////////////////
+
+/**
+ * Widens bytes to MATLAB characters. Returns false if any byte was outside
+ * ASCII, in which case the caller should fall back on a conversion that
+ * knows about encodings (the characters are still written).
+ */
+bool widen_chars(mxChar* dst, const char* src, size_t n) {
+    return get_kernels()->widen_chars((unsigned short*) dst, (const unsigned char*) src, n);
+}
+
+/**
+ * Narrows MATLAB characters to bytes. Returns false if any character was
+ * outside ASCII, in which case dst holds nothing useful.
+ */
+bool narrow_chars(char* dst, const mxChar* src, size_t n) {
+    return get_kernels()->narrow_chars((unsigned char*) dst, (const unsigned short*) src, n);
+}
+
+void widen_floats(double* dst, const float* src, size_t n) {
+    get_kernels()->widen_floats(dst, src, n);
+}
+
+void narrow_doubles(float* dst, const double* src, size_t n) {
+    get_kernels()->narrow_doubles(dst, src, n);
+}
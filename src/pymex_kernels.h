@@ -0,0 +1,70 @@
+/**
+ * pymex_kernels.h: Vectorized kernels for array layout and type conversions.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_KERNELS_H
+#define PYMEX_KERNELS_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Instruction sets the kernels can use, in increasing order. AVX512 means
+// AVX-512F and AVX-512BW together.
+typedef enum {
+    SIMD_SCALAR = 0,
+    SIMD_SSE2 = 1,
+    SIMD_AVX2 = 2,
+    SIMD_AVX512 = 3,
+    
+    N_SIMD_LEVELS = 4
+} simd_level_t;
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+simd_level_t detect_simd_level();
+simd_level_t get_simd_level();
+simd_level_t set_simd_level(simd_level_t level);
+const char* simd_level_name(simd_level_t level);
+
+// Layout transforms.
+void transpose_2d(void* dst, const void* src, size_t rows, size_t cols, size_t el_size);
+void transpose_nd(void* dst, const void* src, size_t ndim, const size_t* dims, size_t el_size);
+void interleave_complex(void* dst, const void* re, const void* im, size_t n, size_t el_size);
+void split_complex(void* re, void* im, const void* src, size_t n, size_t el_size);
+
+// Logical arrays to and from bits, least significant bit first.
+void pack_logicals(unsigned char* bits, const mxLogical* src, size_t n);
+void unpack_logicals(mxLogical* dst, const unsigned char* bits, size_t n);
+
+// Widening and narrowing casts.
+bool widen_chars(mxChar* dst, const char* src, size_t n);
+bool narrow_chars(char* dst, const mxChar* src, size_t n);
+void widen_floats(double* dst, const float* src, size_t n);
+void narrow_doubles(float* dst, const double* src, size_t n);
+
+#endif
@@ -0,0 +1,488 @@
+/**
+ * pymex_map.c: Applies a Python callable to each slice of an array.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// MAP calls a Python callable once for each slice of a MATLAB array, from a
+// C loop inside one MEX call, and writes what it returns straight into a
+// preallocated MATLAB array. The slices of a 2-D numeric or logical array
+// are its columns (dim 2) or its rows (dim 1); those of a cell array are
+// its elements, whatever the dimension.
+//
+// Slices of one element are passed as Python scalars, as mat2py would pass
+// them. Longer slices are passed as read-only memoryviews, with the format
+// of the array's class ('d' for double, 'i' for int32 and so on), so that
+// np.asarray(slice) is a view rather than a copy. They are views of one copy
+// of the array, owned by a pymex._BytesHolder (see pymex_bytes.c), so that
+// they stay valid if Python keeps them. Mapping over rows, that copy is
+// transposed (see pymex_kernels.c), so that each row is contiguous too.
+//
+// For a numeric or logical output class, each result must be a number or
+// a sequence of K numbers (the same K for every slice), which becomes
+// column j (or, mapping over rows, row j) of a K x N (or N x K) array,
+// rounded and saturated as MATLAB converts doubles to integers. For 'cell',
+// each result is converted with py2mat into a cell array shaped like the
+// slices.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "pymex_map.h"
+#include "pymex_bytes.h"
+#include "pymex_kernels.h"
+#include "pymex_marshal.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    mxClassID class;
+    const char* name;
+    // As for the struct module and memoryview.format.
+    const char* format;
+} class_info_t;
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+static const class_info_t CLASSES[] = {
+    {mxDOUBLE_CLASS, "double", "d"},
+    {mxSINGLE_CLASS, "single", "f"},
+    {mxLOGICAL_CLASS, "logical", "?"},
+    {mxINT8_CLASS, "int8", "b"},
+    {mxUINT8_CLASS, "uint8", "B"},
+    {mxINT16_CLASS, "int16", "h"},
+    {mxUINT16_CLASS, "uint16", "H"},
+    {mxINT32_CLASS, "int32", "i"},
+    {mxUINT32_CLASS, "uint32", "I"},
+    {mxINT64_CLASS, "int64", "q"},
+    {mxUINT64_CLASS, "uint64", "Q"}
+};
+
+#define N_CLASSES (sizeof(CLASSES) / sizeof(CLASSES[0]))
+
+// CLASSES /////////////////////////////////////////////////////////////////////
+
+static const class_info_t* class_by_id(mxClassID class) {
+    size_t idx;
+    
+    for (idx = 0; idx < N_CLASSES; ++idx) {
+        if (CLASSES[idx].class == class) {
+            return &CLASSES[idx];
+        }
+    }
+    return NULL;
+}
+
+static const class_info_t* class_by_name(const char* name) {
+    size_t idx;
+    
+    for (idx = 0; idx < N_CLASSES; ++idx) {
+        if (strcmp(CLASSES[idx].name, name) == 0) {
+            return &CLASSES[idx];
+        }
+    }
+    return NULL;
+}
+
+// SLICES //////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns element idx of data, of the given class, as a Python scalar.
+ */
+static PyObject* scalar_at(mxClassID class, const void* data, size_t idx) {
+    switch (class) {
+        case mxDOUBLE_CLASS:
+            return PyFloat_FromDouble(((const double*) data)[idx]);
+        case mxSINGLE_CLASS:
+            return PyFloat_FromDouble(((const float*) data)[idx]);
+        case mxLOGICAL_CLASS:
+            return PyBool_FromLong(((const mxLogical*) data)[idx]);
+        case mxINT8_CLASS:
+            return PyInt_FromLong(((const int8_t*) data)[idx]);
+        case mxUINT8_CLASS:
+            return PyInt_FromLong(((const uint8_t*) data)[idx]);
+        case mxINT16_CLASS:
+            return PyInt_FromLong(((const int16_t*) data)[idx]);
+        case mxUINT16_CLASS:
+            return PyInt_FromLong(((const uint16_t*) data)[idx]);
+        case mxINT32_CLASS:
+            return PyInt_FromLong(((const int32_t*) data)[idx]);
+        case mxUINT32_CLASS:
+            return PyInt_FromSize_t(((const uint32_t*) data)[idx]);
+        case mxINT64_CLASS:
+            return PyLong_FromLongLong(((const int64_t*) data)[idx]);
+        case mxUINT64_CLASS:
+            return PyLong_FromUnsignedLongLong(((const uint64_t*) data)[idx]);
+        default:
+            PyErr_SetString(PyExc_TypeError, "Unsupported class.");
+            return NULL;
+    }
+}
+
+/**
+ * Returns a read-only memoryview of n contiguous elements from buf, which
+ * the holder keeps alive.
+ */
+static PyObject* slice_view(PyObject* holder, char* buf, Py_ssize_t n, Py_ssize_t el_size, const char* format) {
+    Py_buffer view;
+    Py_ssize_t shape = n, stride = el_size;
+    
+    // The memoryview copies the shape and strides of a 1-D buffer, and
+    // releases the holder when it goes.
+    memset(&view, 0, sizeof(view));
+    Py_INCREF(holder);
+    view.obj = holder;
+    view.buf = buf;
+    view.len = n * el_size;
+    view.itemsize = el_size;
+    view.readonly = 1;
+    view.ndim = 1;
+    view.format = (char*) format;
+    view.shape = &shape;
+    view.strides = &stride;
+    return PyMemoryView_FromBuffer(&view);
+}
+
+// RESULTS /////////////////////////////////////////////////////////////////////
+
+/**
+ * Reads one element of a buffer with a struct-module format as a double.
+ */
+static bool read_element(const char* format, const char* ptr, double* value) {
+    #define READ_AS(type) { type el; memcpy(&el, ptr, sizeof(el)); *value = (double) el; return true; }
+    
+    // Native byte order and alignment are all we can be given.
+    if (*format == '@' || *format == '=') {
+        ++format;
+    }
+    if (format[0] == '\0' || format[1] != '\0') {
+        return false;
+    }
+    switch (*format) {
+        case 'd': READ_AS(double)
+        case 'f': READ_AS(float)
+        case '?': READ_AS(unsigned char)
+        case 'b': READ_AS(signed char)
+        case 'B': READ_AS(unsigned char)
+        case 'h': READ_AS(short)
+        case 'H': READ_AS(unsigned short)
+        case 'i': READ_AS(int)
+        case 'I': READ_AS(unsigned int)
+        case 'l': READ_AS(long)
+        case 'L': READ_AS(unsigned long)
+        case 'q': READ_AS(long long)
+        case 'Q': READ_AS(unsigned long long)
+        default:
+            return false;
+    }
+    
+    #undef READ_AS
+}
+
+/**
+ * Reads the numbers in a result, which is a number, a sequence of numbers
+ * or a 1-D buffer, into values, which has room for capacity of them.
+ * Returns how many there are (which may be more than capacity, in which
+ * case only the first capacity are read), or -1 with a Python error set.
+ */
+static Py_ssize_t read_numbers(PyObject* result, double* values, Py_ssize_t capacity) {
+    Py_buffer view;
+    PyObject* items;
+    Py_ssize_t n, idx;
+    const char* format;
+    bool ok = true;
+    
+    if (PyFloat_Check(result) || PyInt_Check(result) || PyLong_Check(result)) {
+        if (capacity > 0) {
+            values[0] = PyFloat_AsDouble(result);
+        }
+        return 1;
+    }
+    
+    // Strings are sequences, and buffers too, but not of numbers.
+    if (PyString_Check(result) || PyUnicode_Check(result)) {
+        PyErr_SetString(PyExc_TypeError, "Results must be numbers or sequences of numbers, not strings.");
+        return -1;
+    }
+    
+    if (PyObject_CheckBuffer(result)) {
+        if (PyObject_GetBuffer(result, &view, PyBUF_RECORDS_RO) < 0) {
+            return -1;
+        }
+        n = view.ndim == 0 ? 1 : view.shape[0];
+        if (view.ndim > 1 || view.format == NULL) {
+            ok = false;
+        }
+        
+        // Contiguous doubles and singles are read in one go.
+        idx = 0;
+        if (ok && view.ndim == 1 && view.strides[0] == view.itemsize && capacity > 0) {
+            format = view.format + (view.format[0] == '@' || view.format[0] == '=');
+            if (strcmp(format, "d") == 0) {
+                idx = n < capacity ? n : capacity;
+                memcpy(values, view.buf, idx * sizeof(double));
+            } else if (strcmp(format, "f") == 0) {
+                idx = n < capacity ? n : capacity;
+                widen_floats(values, view.buf, idx);
+            }
+        }
+        for (; ok && idx < n && idx < capacity; ++idx) {
+            ok = read_element(view.format, (const char*) view.buf + idx * (view.ndim == 0 ? 0 : view.strides[0]),
+                &values[idx]);
+        }
+        PyBuffer_Release(&view);
+        if (!ok) {
+            PyErr_SetString(PyExc_TypeError, "Results must be numbers, or 1-D buffers of a numeric format.");
+            return -1;
+        }
+        return n;
+    }
+    
+    if (PySequence_Check(result)) {
+        items = PySequence_Fast(result, "Results must be numbers or sequences of numbers.");
+        if (items == NULL) {
+            return -1;
+        }
+        n = PySequence_Fast_GET_SIZE(items);
+        for (idx = 0; idx < n && idx < capacity; ++idx) {
+            values[idx] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(items, idx));
+            if (values[idx] == -1.0 && PyErr_Occurred()) {
+                Py_DECREF(items);
+                return -1;
+            }
+        }
+        Py_DECREF(items);
+        return n;
+    }
+    
+    // Anything else with a __float__, such as a NumPy scalar.
+    if (PyNumber_Check(result)) {
+        if (capacity > 0) {
+            values[0] = PyFloat_AsDouble(result);
+            if (values[0] == -1.0 && PyErr_Occurred()) {
+                return -1;
+            }
+        }
+        return 1;
+    }
+    
+    PyErr_SetString(PyExc_TypeError, "Results must be numbers or sequences of numbers.");
+    return -1;
+}
+
+/**
+ * Stores value as element idx of data, of the given class, rounding and
+ * saturating as MATLAB does when converting a double to an integer.
+ */
+static void store_at(mxClassID class, void* data, size_t idx, double value) {
+    #define STORE_INT(type, lo, hi) { \
+            double rounded = value != value ? 0.0 : round(value); \
+            ((type*) data)[idx] = rounded <= (double) lo ? lo : rounded >= (double) hi ? hi : (type) rounded; \
+        } break
+    
+    switch (class) {
+        case mxDOUBLE_CLASS:
+            ((double*) data)[idx] = value;
+            break;
+        case mxSINGLE_CLASS:
+            ((float*) data)[idx] = (float) value;
+            break;
+        case mxLOGICAL_CLASS:
+            ((mxLogical*) data)[idx] = value != 0.0;
+            break;
+        case mxINT8_CLASS: STORE_INT(int8_t, INT8_MIN, INT8_MAX);
+        case mxUINT8_CLASS: STORE_INT(uint8_t, 0, UINT8_MAX);
+        case mxINT16_CLASS: STORE_INT(int16_t, INT16_MIN, INT16_MAX);
+        case mxUINT16_CLASS: STORE_INT(uint16_t, 0, UINT16_MAX);
+        case mxINT32_CLASS: STORE_INT(int32_t, INT32_MIN, INT32_MAX);
+        case mxUINT32_CLASS: STORE_INT(uint32_t, 0, UINT32_MAX);
+        case mxINT64_CLASS: STORE_INT(int64_t, INT64_MIN, INT64_MAX);
+        case mxUINT64_CLASS: STORE_INT(uint64_t, 0, UINT64_MAX);
+        default:
+            break;
+    }
+    
+    #undef STORE_INT
+}
+
+// MAPPING /////////////////////////////////////////////////////////////////////
+
+/**
+ * Calls callee on each slice of m_data along dim (1 or 2; ignored for cell
+ * arrays), and returns the results as an array of the class named by
+ * output, or as a cell array if output is "cell". Returns NULL with a
+ * Python error set if a call raises or a result doesn't fit.
+ */
+mxArray* map_slices(PyObject* callee, const mxArray* m_data, int dim, const char* output) {
+    const class_info_t *in_class = NULL, *out_class = NULL;
+    bool is_cell = mxIsCell(m_data), to_cell = strcmp(output, "cell") == 0, by_rows = false;
+    size_t n_slices, slice_len = 1, el_size = 0, idx, idx_value;
+    Py_ssize_t n_values = -1;
+    mwSize n_dims = mxGetNumberOfDimensions(m_data), slice_dims[2];
+    const mwSize* dims = mxGetDimensions(m_data);
+    char* base = NULL;
+    PyObject *holder = NULL, *args = NULL, *arg, *old_arg, *result;
+    mxArray *out = NULL, *copy, *m_el;
+    double* values = NULL;
+    
+    if (!to_cell && (out_class = class_by_name(output)) == NULL) {
+        PyErr_Format(PyExc_ValueError, "Unknown output class '%s'; expected 'cell', 'logical' or a numeric class.", output);
+        return NULL;
+    }
+    
+    if (is_cell) {
+        n_slices = mxGetNumberOfElements(m_data);
+    } else {
+        in_class = class_by_id(mxGetClassID(m_data));
+        if (in_class == NULL || mxIsComplex(m_data) || mxIsSparse(m_data) || n_dims != 2) {
+            PyErr_SetString(PyExc_TypeError, "Can only map over cell arrays and real 2-D numeric or logical arrays.");
+            return NULL;
+        }
+        if (dim != 1 && dim != 2) {
+            PyErr_SetString(PyExc_ValueError, "Can only map over dimension 1 (rows) or 2 (columns).");
+            return NULL;
+        }
+        by_rows = dim == 1;
+        el_size = mxGetElementSize(m_data);
+        n_slices = dims[by_rows ? 0 : 1];
+        slice_len = dims[by_rows ? 1 : 0];
+        
+        // Scalars are copied out as they are passed; views need a copy of
+        // their own, which for rows is the transpose.
+        if (slice_len == 1) {
+            base = mxGetData(m_data);
+        } else {
+            if (!by_rows) {
+                copy = mxDuplicateArray(m_data);
+            } else {
+                copy = in_class->class == mxLOGICAL_CLASS ? mxCreateLogicalMatrix(dims[1], dims[0])
+                    : mxCreateNumericMatrix(dims[1], dims[0], in_class->class, mxREAL);
+                transpose_2d(mxGetData(copy), mxGetData(m_data), dims[0], dims[1], el_size);
+            }
+            base = mxGetData(copy);
+            holder = new_array_holder(copy);
+            if (holder == NULL) {
+                return NULL;
+            }
+        }
+        
+        // Results (if numbers) are laid out as the slices are.
+        slice_dims[0] = by_rows ? n_slices : 1;
+        slice_dims[1] = by_rows ? 1 : n_slices;
+        n_dims = 2;
+        dims = slice_dims;
+    }
+    
+    if (to_cell) {
+        out = mxCreateCellArray(n_dims, dims);
+    } else if (n_slices == 0) {
+        out = mxCreateNumericArray(n_dims, dims, out_class->class, mxREAL);
+    }
+    
+    args = PyTuple_New(1);
+    for (idx = 0; idx < n_slices; ++idx) {
+        if (is_cell) {
+            m_el = mxGetCell(m_data, idx);
+            if (m_el == NULL) {
+                Py_INCREF(Py_None);
+                arg = Py_None;
+            } else {
+                arg = mat2py(m_el, false);
+            }
+        } else if (holder == NULL) {
+            arg = scalar_at(in_class->class, base, idx);
+        } else {
+            arg = slice_view(holder, base + idx * slice_len * el_size, slice_len, el_size, in_class->format);
+        }
+        if (arg == NULL) {
+            goto fail;
+        }
+        
+        // Reuse the argument tuple, unless the callee kept hold of it.
+        if (Py_REFCNT(args) > 1) {
+            Py_DECREF(args);
+            args = PyTuple_New(1);
+        }
+        old_arg = PyTuple_GET_ITEM(args, 0);
+        PyTuple_SET_ITEM(args, 0, arg);
+        Py_XDECREF(old_arg);
+        
+        result = PyObject_Call(callee, args, NULL);
+        if (result == NULL) {
+            goto fail;
+        }
+        if (to_cell) {
+            mxSetCell(out, idx, py2mat(result));
+            continue;
+        }
+        
+        // The first result tells us how many numbers to expect from each.
+        if (out == NULL) {
+            n_values = read_numbers(result, NULL, 0);
+            if (n_values < 0) {
+                Py_DECREF(result);
+                goto fail;
+            }
+            values = mxMalloc((n_values > 0 ? n_values : 1) * sizeof(double));
+            if (n_values == 1) {
+                out = mxCreateNumericArray(n_dims, dims, out_class->class, mxREAL);
+            } else if (by_rows) {
+                out = mxCreateNumericMatrix(n_slices, n_values, out_class->class, mxREAL);
+            } else {
+                out = mxCreateNumericMatrix(n_values, n_slices, out_class->class, mxREAL);
+            }
+        }
+        if (read_numbers(result, values, n_values) != n_values) {
+            if (!PyErr_Occurred()) {
+                PyErr_Format(PyExc_ValueError, "The result for slice %zu has a different number of values "
+                    "than the first (%zd); map to 'cell' instead.", idx + 1, n_values);
+            }
+            Py_DECREF(result);
+            goto fail;
+        }
+        Py_DECREF(result);
+        if (out_class->class == mxSINGLE_CLASS && !by_rows) {
+            narrow_doubles((float*) mxGetData(out) + idx * n_values, values, n_values);
+            continue;
+        }
+        for (idx_value = 0; idx_value < (size_t) n_values; ++idx_value) {
+            store_at(out_class->class, mxGetData(out),
+                by_rows ? idx_value * n_slices + idx : idx * n_values + idx_value, values[idx_value]);
+        }
+    }
+    
+    Py_DECREF(args);
+    Py_XDECREF(holder);
+    if (values != NULL) {
+        mxFree(values);
+    }
+    return out;
+    
+fail:
+    Py_XDECREF(args);
+    Py_XDECREF(holder);
+    if (values != NULL) {
+        mxFree(values);
+    }
+    if (out != NULL) {
+        mxDestroyArray(out);
+    }
+    return NULL;
+}
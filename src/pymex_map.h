@@ -0,0 +1,38 @@
+/**
+ * pymex_map.h: Applies a Python callable to each slice of an array.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_MAP_H
+#define PYMEX_MAP_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+mxArray* map_slices(PyObject* callee, const mxArray* m_data, int dim, const char* output);
+
+#endif
@@ -23,6 +23,13 @@
 // INCLUDES ////////////////////////////////////////////////////////////////////
 
 #include "pymex_marshal.h"
+#include "pymex_kernels.h"
+#include "pymex_parallel.h"
+#include "pymex_bytes.h"
+#include "pymex_struct.h"
+#include "pymex_table.h"
+#include "pymex_trace.h"
+#include "pymex_track.h"
 
 // CONSTANTS ///////////////////////////////////////////////////////////////////
 
@@ -31,15 +38,14 @@ const char* PY_OBJECT_PTR_FIELD = "py_pointer";
 
 const mxClassID POINTER_CLASS = mxUINT64_CLASS;
 
+// Initial number of slots in the py2mat converter table.
+#define CONVERTER_TABLE_MIN_SIZE 64
+
 // GLOBALS /////////////////////////////////////////////////////////////////////
 
 PyObject *py_mxArray = NULL;
 PyObject *py_struct = NULL;
 
-// TYPEDEFS ////////////////////////////////////////////////////////////////////
-
-#define py_pointer_box_t unsigned long long int
-
 // UTILITY FUNCTIONS ///////////////////////////////////////////////////////////
 
 /**
@@ -112,11 +118,21 @@ PyObject* py_obj_from_mat_scalar(const mxArray* m_scalar) {
 }
 
 /**
- * Recursively converts dimensions of a cell array to Python lists.
+ * Converts one element of a cell array. If prepared is non-NULL and holds
+ * an already-copied array for this element, that copy is boxed as-is.
  */
-PyObject* py_list_from_cell_array(
+static PyObject* py_from_cell_element(
+    const mxArray* cell_array, mwIndex idx, mxArray** prepared
+) {
+    if (prepared != NULL && prepared[idx] != NULL) {
+        return box_persistent_mxarray(prepared[idx]);
+    }
+    return mat2py(mxGetCell(cell_array, idx), false);
+}
+
+static PyObject* list_from_cell_array(
     const mxArray* cell_array, int idx_dim, mwSize nsubs, mwIndex* subs,
-    mwIndex* dims, bool flatten1
+    mwIndex* dims, bool flatten1, mxArray** prepared
 ) {
     
     PyObject *py_list, *new_el;
@@ -137,15 +153,14 @@ PyObject* py_list_from_cell_array(
         
         // Decide to recurse of return base case.
         if (idx_dim == nsubs - 1) {
-            new_el = mat2py(
-                mxGetCell(cell_array, mxCalcSingleSubscript(
-                    cell_array, nsubs, subs
-                )), false
+            new_el = py_from_cell_element(
+                cell_array, mxCalcSingleSubscript(cell_array, nsubs, subs),
+                prepared
             );
         } else {
             // Jump ahead one level.
-            new_el = py_list_from_cell_array(
-                cell_array, idx_dim + 1, nsubs, subs, dims, flatten1
+            new_el = list_from_cell_array(
+                cell_array, idx_dim + 1, nsubs, subs, dims, flatten1, prepared
             );
         }
         
@@ -165,14 +180,13 @@ PyObject* py_list_from_cell_array(
     for (idx_el = 0; idx_el < dims[idx_dim]; idx_el++) {
         subs[idx_dim] = idx_el;
         if (idx_dim != nsubs - 1) {
-            new_el = py_list_from_cell_array(
-                cell_array, idx_dim + 1, nsubs, subs, dims, flatten1
+            new_el = list_from_cell_array(
+                cell_array, idx_dim + 1, nsubs, subs, dims, flatten1, prepared
             );
         } else {
-            new_el = mat2py(
-                mxGetCell(cell_array, mxCalcSingleSubscript(
-                    cell_array, nsubs, subs
-                )), false
+            new_el = py_from_cell_element(
+                cell_array, mxCalcSingleSubscript(cell_array, nsubs, subs),
+                prepared
             );
             if (new_el == NULL) {
                 mexWarnMsgTxt("Unsupported value in cell array; substituting with None.");
@@ -186,11 +200,373 @@ PyObject* py_list_from_cell_array(
     
 }
 
+/**
+ * Recursively converts dimensions of a cell array to Python lists.
+ */
+PyObject* py_list_from_cell_array(
+    const mxArray* cell_array, int idx_dim, mwSize nsubs, mwIndex* subs,
+    mwIndex* dims, bool flatten1
+) {
+    return list_from_cell_array(cell_array, idx_dim, nsubs, subs, dims, flatten1, NULL);
+}
+
+// PARALLEL CELL MARSHALLING ///////////////////////////////////////////////////
+// Numeric arrays inside a cell are boxed as copies, and for large cells
+// those copies are nearly all of the work. When there is enough to copy,
+// mat2py walks the cell once under the GIL to allocate every copy, has the
+// marshalling pool (see pymex_parallel.c) fill them with the GIL released,
+// and only then builds the Python lists around them.
+
+/**
+ * True for cell elements that mat2py would box as a copy of their payload.
+ */
+static bool is_bulk_element(const mxArray* m_value) {
+    return m_value != NULL && (mxIsNumeric(m_value) || mxIsLogical(m_value)) &&
+        !mxIsSparse(m_value) && mxGetNumberOfElements(m_value) > 1;
+}
+
+static size_t payload_bytes(const mxArray* m_value) {
+    size_t n_bytes = mxGetNumberOfElements(m_value) * mxGetElementSize(m_value);
+    return mxIsComplex(m_value) ? 2 * n_bytes : n_bytes;
+}
+
+/**
+ * Allocates an array shaped like m_value, and appends the copies that fill
+ * it to jobs. The new array comes back zeroed, but large allocations are
+ * usually zero pages mapped on first touch, so that cost mostly lands on
+ * the worker doing the copy.
+ */
+static mxArray* prepare_bulk_copy(const mxArray* m_value, copy_job_t* jobs, size_t* n_jobs) {
+    mxArray* copy;
+    size_t n_bytes = mxGetNumberOfElements(m_value) * mxGetElementSize(m_value);
+    
+    if (mxIsLogical(m_value)) {
+        copy = mxCreateLogicalArray(
+            mxGetNumberOfDimensions(m_value), mxGetDimensions(m_value)
+        );
+    } else {
+        copy = mxCreateNumericArray(
+            mxGetNumberOfDimensions(m_value), mxGetDimensions(m_value),
+            mxGetClassID(m_value), mxIsComplex(m_value) ? mxCOMPLEX : mxREAL
+        );
+    }
+    
+    jobs[*n_jobs].dst = mxGetData(copy);
+    jobs[*n_jobs].src = mxGetData(m_value);
+    jobs[*n_jobs].n_bytes = n_bytes;
+    (*n_jobs)++;
+    if (mxIsComplex(m_value)) {
+        jobs[*n_jobs].dst = mxGetImagData(copy);
+        jobs[*n_jobs].src = mxGetImagData(m_value);
+        jobs[*n_jobs].n_bytes = n_bytes;
+        (*n_jobs)++;
+    }
+    return copy;
+}
+
+/**
+ * Converts a cell array as py_list_from_cell_array does, copying numeric
+ * payloads on the marshalling pool if there are enough of them.
+ */
+static PyObject* py_list_from_cell_array_parallel(const mxArray* cell_array, bool flatten1) {
+    size_t n_els = mxGetNumberOfElements(cell_array);
+    size_t idx, n_jobs = 0, total_bytes = 0;
+    mxArray *element, **prepared;
+    copy_job_t* jobs;
+    PyThreadState* thread_state;
+    PyObject* py_list;
+    
+    // Tally first, so that small cells don't pay for the bookkeeping.
+    for (idx = 0; idx < n_els; ++idx) {
+        element = mxGetCell(cell_array, idx);
+        if (is_bulk_element(element)) {
+            total_bytes += payload_bytes(element);
+        }
+    }
+    if (!parallel_copy_worthwhile(total_bytes)) {
+        return py_list_from_cell_array(
+            cell_array, 0, mxGetNumberOfDimensions(cell_array), NULL, NULL, flatten1
+        );
+    }
+    
+    prepared = mxCalloc(n_els, sizeof(mxArray*));
+    jobs = mxCalloc(2 * n_els, sizeof(copy_job_t));
+    for (idx = 0; idx < n_els; ++idx) {
+        element = mxGetCell(cell_array, idx);
+        if (is_bulk_element(element)) {
+            prepared[idx] = prepare_bulk_copy(element, jobs, &n_jobs);
+        }
+    }
+    
+    // Python may have other threads of its own that can run meanwhile.
+    if (PyEval_ThreadsInitialized()) {
+        thread_state = PyEval_SaveThread();
+        parallel_copy(jobs, n_jobs);
+        PyEval_RestoreThread(thread_state);
+    } else {
+        parallel_copy(jobs, n_jobs);
+    }
+    
+    py_list = list_from_cell_array(
+        cell_array, 0, mxGetNumberOfDimensions(cell_array), NULL, NULL,
+        flatten1, prepared
+    );
+    mxFree(jobs);
+    mxFree(prepared);
+    return py_list;
+}
+
+// PY2MAT CONVERTERS ///////////////////////////////////////////////////////////
+// Each of these converts one kind of Python value, DECREFing it as py2mat
+// does. They assume the type has already been checked.
+
+static mxArray* py2mat_str(PyObject* py_value) {
+    mxArray* mat_value;
+    char *bufs[1];
+    mwSize dims[2];
+    
+    bufs[0] = PyString_AsString(py_value);
+    dims[0] = 1;
+    dims[1] = strlen(bufs[0]);
+    
+    // ASCII strings widen the same in any locale, so copy those directly.
+    if (dims[1] > 0) {
+        mat_value = mxCreateCharArray(2, dims);
+        if (widen_chars(mxGetChars(mat_value), bufs[0], dims[1])) {
+            Py_DECREF(py_value);
+            return mat_value;
+        }
+        mxDestroyArray(mat_value);
+    }
+    
+    mat_value = mxCreateCharMatrixFromStrings(1, (const char**) bufs);
+    Py_DECREF(py_value);
+    return mat_value;
+}
+
+static mxArray* py2mat_bool(PyObject* py_value) {
+    mxArray* mat_value = mxCreateLogicalScalar(PyObject_IsTrue(py_value));
+    Py_DECREF(py_value);
+    return mat_value;
+}
+
+static mxArray* py2mat_float(PyObject* py_value) {
+    mxArray* mat_value = mxCreateDoubleScalar(PyFloat_AsDouble(py_value));
+    Py_DECREF(py_value);
+    return mat_value;
+}
+
+static mxArray* py2mat_long(PyObject* py_value) {
+    long long int value = PyLong_AsLongLong(py_value);
+    mxArray* mat_value;
+    
+    // Longs that don't fit in an int64 are boxed, rather than truncated.
+    if (value == -1 && PyErr_Occurred() != NULL) {
+        PyErr_Clear();
+        return box_pyobject(py_value);
+    }
+    mat_value = mxCreateNumericMatrix(1, 1, mxINT64_CLASS, mxREAL);
+    *(long long int*)mxGetData(mat_value) = value;
+    Py_DECREF(py_value);
+    return mat_value;
+}
+
+static mxArray* py2mat_int(PyObject* py_value) {
+    mxArray* mat_value = mxCreateNumericMatrix(1, 1, mxINT32_CLASS, mxREAL);
+    // MATLAB's int32 is four bytes wide, unlike long on LP64 platforms.
+    *(int*)mxGetData(mat_value) = (int) PyInt_AsLong(py_value);
+    Py_DECREF(py_value);
+    return mat_value;
+}
+
+static mxArray* py2mat_list(PyObject* py_value) {
+    // Make a 1xn cell array, and then pack everything into it by
+    // calling py2mat recursively. This will make ugly structures
+    // for nested Python lists, but it's kind of unavoidable due to
+    // the ability of Python lists to be jagged.
+    mxArray* mat_value;
+    PyObject* item;
+    int idx_cell;
+    int len = PyList_Size(py_value);
+    
+    mat_value = mxCreateCellMatrix(1, len);
+    for (idx_cell = 0; idx_cell < len; idx_cell++) {
+        // py2mat consumes a reference, but GetItem only lends one.
+        item = PyList_GetItem(py_value, idx_cell);
+        Py_INCREF(item);
+        mxSetCell(mat_value, idx_cell, py2mat(item));
+    }
+    Py_DECREF(py_value);
+    return mat_value;
+}
+
+static mxArray* py2mat_struct(PyObject* py_value) {
+    mxArray* mat_value;
+    PyObject *items, *item;
+    int idx, len;
+    char **field_names;
+    
+    items = PyDict_Items(py_value);
+    len = PyList_Size(items);
+
+    field_names = mxCalloc(len, sizeof(char*));
+    for (idx = 0; idx < len; ++idx) {
+        field_names[idx] = PyString_AsString(PyTuple_GetItem(PyList_GetItem(items, idx), 0));
+    }
+    
+    mat_value = mxCreateStructMatrix(1, 1, len, (const char**) field_names);
+    for (idx = 0; idx < len; ++idx) {
+        item = PyTuple_GetItem(PyList_GetItem(items, idx), 1);
+        Py_INCREF(item);
+        mxSetField(mat_value, 0, field_names[idx], py2mat(item));
+    }
+
+    Py_DECREF(items);
+    Py_DECREF(py_value);
+    return mat_value;
+}
+
+static mxArray* py2mat_mxarray(PyObject* py_value) {
+    // The boxed array is still referenced by the Python object, so this
+    // doesn't DECREF.
+    return unbox_mxarray(py_value);
+}
+
+// CONVERTER TABLE /////////////////////////////////////////////////////////////
+// py2mat looks up converters by exact type in an open-addressed hash table,
+// rather than trying each Py*_Check (and PyObject_IsInstance) in turn. The
+// table holds the built-in conversions, plus any registered from Python
+// with pymex.register_converter. Subclasses never match an entry, and go
+// through py2mat_slow, which checks types the old way.
+
+typedef mxArray* (*py2mat_fn_t)(PyObject* py_value);
+
+typedef struct {
+    PyTypeObject* type;
+    py2mat_fn_t builtin;
+    // Takes precedence over builtin if set.
+    PyObject* py_converter;
+} converter_entry_t;
+
+// Bumped whenever a converter is registered, so that anything caching how
+// a type converts (such as call plans) knows to look again.
+unsigned long converter_generation = 0;
+
+static converter_entry_t* converter_table = NULL;
+static size_t converter_table_size = 0;
+static size_t converter_table_used = 0;
+
+static size_t hash_type(const PyTypeObject* type) {
+    // Type objects are at least 16-byte aligned, so drop the low bits.
+    size_t ptr = (size_t) type;
+    return (ptr >> 4) ^ (ptr >> 12);
+}
+
+/**
+ * Returns the slot holding type, or the empty slot where it would go.
+ */
+static converter_entry_t* find_converter_slot(const PyTypeObject* type) {
+    size_t mask = converter_table_size - 1;
+    size_t idx = hash_type(type) & mask;
+    
+    while (converter_table[idx].type != NULL && converter_table[idx].type != type) {
+        idx = (idx + 1) & mask;
+    }
+    return &converter_table[idx];
+}
+
+static converter_entry_t* lookup_converter(const PyTypeObject* type) {
+    converter_entry_t* entry;
+    
+    if (converter_table == NULL) {
+        return NULL;
+    }
+    entry = find_converter_slot(type);
+    return entry->type == NULL ? NULL : entry;
+}
+
+/**
+ * Returns the entry for type, adding an empty one (and growing the table
+ * to stay at most half full) if need be.
+ */
+static converter_entry_t* insert_converter(PyTypeObject* type) {
+    converter_entry_t *entry, *old_table = converter_table;
+    size_t old_size = converter_table_size, idx;
+    
+    if ((converter_table_used + 1) * 2 > converter_table_size) {
+        converter_table_size = old_size == 0 ? CONVERTER_TABLE_MIN_SIZE : 2 * old_size;
+        // The table outlives individual MEX calls, so don't use mxCalloc.
+        converter_table = calloc(converter_table_size, sizeof(converter_entry_t));
+        for (idx = 0; idx < old_size; ++idx) {
+            if (old_table[idx].type != NULL) {
+                *find_converter_slot(old_table[idx].type) = old_table[idx];
+            }
+        }
+        free(old_table);
+    }
+    
+    entry = find_converter_slot(type);
+    if (entry->type == NULL) {
+        entry->type = type;
+        Py_INCREF(type);
+        converter_table_used++;
+    }
+    return entry;
+}
+
+/**
+ * Makes py2mat convert values of exactly the given type by calling
+ * converter on them and converting whatever that returns. Passing Py_None
+ * as the converter undoes this, restoring the built-in conversion (if
+ * there is one).
+ */
+void register_py2mat_converter(PyTypeObject* type, PyObject* converter) {
+    converter_entry_t* entry = insert_converter(type);
+    
+    converter_generation++;
+    Py_XDECREF(entry->py_converter);
+    if (converter == Py_None) {
+        entry->py_converter = NULL;
+    } else {
+        entry->py_converter = converter;
+        Py_INCREF(converter);
+    }
+}
+
+/**
+ * Returns true if values of exactly this type are converted by a converter
+ * registered from Python.
+ */
+bool has_registered_converter(const PyTypeObject* type) {
+    converter_entry_t* entry = lookup_converter(type);
+    return entry != NULL && entry->py_converter != NULL;
+}
+
+static void register_builtin_converter(PyTypeObject* type, py2mat_fn_t fn) {
+    insert_converter(type)->builtin = fn;
+}
+
+static mxArray* convert_with_python(converter_entry_t* entry, PyObject* py_value) {
+    PyObject* converted;
+    
+    converted = PyObject_CallFunctionObjArgs(entry->py_converter, py_value, NULL);
+    Py_DECREF(py_value);
+    if (converted == NULL) {
+        PyErr_Print();
+        mexErrMsgTxt("Python exception inside a registered converter.");
+    }
+    
+    // Converting the result again would recurse forever.
+    if (Py_TYPE(converted) == entry->type) {
+        Py_DECREF(converted);
+        mexErrMsgTxt("Registered converter returned a value of the type it converts.");
+    }
+    return py2mat(converted);
+}
+
 // INIT FUNCTIONS //////////////////////////////////////////////////////////////
 
 void init_marshal_types() {
-    // TODO: move init_py_mxArray here.
-
     PyObject *pymex_module, *pymex_dict, *mtypes_module, *mtypes_dict;
     // Assume the pymex module has already been imported, so we can
     // borrow the reference.
@@ -200,115 +576,130 @@ void init_marshal_types() {
     mtypes_dict = PyModule_GetDict(mtypes_module);
 
     py_struct = PyDict_GetItemString(mtypes_dict, "struct");
-
+    init_py_mxArray();
+    
+    register_builtin_converter(&PyString_Type, py2mat_str);
+    register_builtin_converter(&PyBool_Type, py2mat_bool);
+    register_builtin_converter(&PyFloat_Type, py2mat_float);
+    register_builtin_converter(&PyLong_Type, py2mat_long);
+    register_builtin_converter(&PyInt_Type, py2mat_int);
+    register_builtin_converter(&PyList_Type, py2mat_list);
+    if (PyType_Check(py_struct)) {
+        register_builtin_converter((PyTypeObject*) py_struct, py2mat_struct);
+    }
+    if (PyType_Check(py_mxArray)) {
+        register_builtin_converter((PyTypeObject*) py_mxArray, py2mat_mxarray);
+    }
+    register_builtin_converter(&struct_proxy_type, py2mat_struct_proxy);
+    register_builtin_converter(&PyByteArray_Type, py2mat_bytes);
+    register_builtin_converter(&PyBuffer_Type, py2mat_bytes);
+    register_builtin_converter(&PyMemoryView_Type, py2mat_bytes);
 }
 
 // MARSHALLING FUNCTIONS ///////////////////////////////////////////////////////
 
 /**
- * Given a Python object, creates and returns a MATLAB array for that object.
- * Types (float, int, str, ...) that have 1:1 reprsentations in MATLAB will be
- * converted, while any more complicated types will be boxed using the
- * MATLAB class PyObject.
- *
- * Note that this function DECREFs any value that isn't boxed into a PyObject
- * MATLAB class.
+ * Converts a MATLAB char array to a Python string by narrowing it directly
+ * into the string's buffer. Returns NULL if any character is outside ASCII,
+ * leaving those to mxGetString and the current locale.
  */
-mxArray* py2mat(const PyObject* py_value) {
-    mxArray* mat_value;
+static PyObject* py_str_from_ascii_chars(const mxArray* m_str) {
+    size_t n = mxGetNumberOfElements(m_str);
+    PyObject* py_str = PyString_FromStringAndSize(NULL, n);
+    char *buf, *nul;
     
-    if (py_value == NULL) {
-        mexErrMsgTxt("Python value to marshal was NULL. This shouldn't happen.");
+    if (py_str == NULL) {
+        return NULL;
+    }
+    buf = PyString_AS_STRING(py_str);
+    if (!narrow_chars(buf, mxGetChars(m_str), n)) {
+        Py_DECREF(py_str);
+        return NULL;
     }
     
+    // mxGetString stops at the first NUL, so we do too.
+    nul = memchr(buf, '\0', n);
+    if (nul != NULL) {
+        _PyString_Resize(&py_str, nul - buf);
+    }
+    return py_str;
+}
+
+/**
+ * Converts a MATLAB char array to a Python string, directly if it is ASCII
+ * and otherwise through mxGetString and the current locale. Either way the
+ * string ends at the first NUL.
+ */
+PyObject* py_str_from_mat(const mxArray* m_str) {
+    PyObject* py_str = py_str_from_ascii_chars(m_str);
+    char* buf;
     
+    if (py_str != NULL) {
+        return py_str;
+    }
+    get_matlab_str(m_str, &buf);
+    py_str = PyString_FromString(buf);
+    mxFree(buf);
+    return py_str;
+}
+
+/**
+ * Converts values whose exact type isn't in the converter table, including
+ * subclasses of types that are. Consumes the reference, as py2mat does.
+ */
+static mxArray* py2mat_slow(PyObject* py_value) {
     if (is_boxed_mxarray(py_value)) {
-        mat_value = unbox_mxarray(py_value);
-        // Py_XDECREF(py_value);
-        return mat_value;
+        return py2mat_mxarray(py_value);
     }
     
-    // TODO: Right now, we aren't converting any types, but are just boxing
-    //       them up.
     if (PyString_Check(py_value)) {
-        char *bufs[1];
-        bufs[0] = PyString_AsString(py_value);
-        mat_value = mxCreateCharMatrixFromStrings(1, bufs);
-        Py_XDECREF(py_value);
+        return py2mat_str(py_value);
     } else if (PyBool_Check(py_value)) {
-        bool c_value = PyObject_IsTrue(py_value);
-        mat_value = mxCreateLogicalScalar(c_value);
-        Py_XDECREF(py_value);
+        return py2mat_bool(py_value);
     } else if (PyFloat_Check(py_value)) {
-        mat_value = mxCreateDoubleScalar(PyFloat_AsDouble(py_value));
-        Py_XDECREF(py_value);
+        return py2mat_float(py_value);
     } else if (PyLong_Check(py_value)) {
-        long long int int_value = PyLong_AsLongLong(py_value);
-        mwSize dims[2] = {1, 1};
-        mat_value = mxCreateNumericArray(2, dims, mxINT64_CLASS, mxREAL);
-        *(long long int*)mxGetData(mat_value) = int_value;        
-        Py_XDECREF(py_value);    
+        return py2mat_long(py_value);
     } else if (PyInt_Check(py_value)) {
-        long int int_value = PyInt_AsLong(py_value);
-        mwSize dims[2] = {1, 1};
-        mat_value = mxCreateNumericArray(2, dims, mxINT32_CLASS, mxREAL);
-        *(long int*)mxGetData(mat_value) = int_value;
-        Py_XDECREF(py_value);
+        return py2mat_int(py_value);
     } else if (PyList_Check(py_value)) {
-        // Make a 1xn cell array, and then pack everything into it by
-        // calling py2mat recursively. This will make ugly structures
-        // for nested Python lists, but it's kind of unavoidable due to
-        // the ability of Python lists to be jagged.
-        
-        int idx_cell;
-        int len = PyList_Size(py_value);
-        mat_value = mxCreateCellMatrix(1, len);
-        for (idx_cell = 0; idx_cell < len; idx_cell++) {
-            mxSetCell(mat_value, idx_cell, py2mat(PyList_GetItem(py_value, idx_cell)));
-        }
-        Py_XDECREF(py_value);
+        return py2mat_list(py_value);
     } else if (py_struct != NULL && PyObject_IsInstance(py_value, py_struct)) {
-        int idx;
-        PyObject *items;
-        int len;
-        char **field_names;
-
-
-        items = PyDict_Items(py_value);
-        len = PyList_Size(items);
-
-        field_names = mxCalloc(len, sizeof(char*));
-        for (idx = 0; idx < len; ++idx) {
-            field_names[idx] = PyString_AsString(PyTuple_GetItem(PyList_GetItem(items, idx), 0));
-        }
-        
-        mat_value = mxCreateStructMatrix(1, 1, len, field_names);
-        for (idx = 0; idx < len; ++idx) {
-            mxSetField(mat_value, 0, field_names[idx], py2mat(PyTuple_GetItem(PyList_GetItem(items, idx), 1)));
-        }
+        return py2mat_struct(py_value);
+    } else if (PyByteArray_Check(py_value) || PyMemoryView_Check(py_value)) {
+        return py2mat_bytes(py_value);
+    } else if (is_dataframe(py_value)) {
+        // pandas is only known once something imports it, so DataFrames
+        // join the table on first sight.
+        register_builtin_converter(Py_TYPE(py_value), table_from_dataframe);
+        return table_from_dataframe(py_value);
+    }
+    
+    return box_pyobject(py_value);
+}
 
-        Py_XDECREF(items);
-        Py_XDECREF(py_value);
-    } else {
-        mat_value = box_pyobject(py_value);
+static mxArray* py2mat_untraced(const PyObject* py_value) {
+    converter_entry_t* entry;
+    
+    if (py_value == NULL) {
+        mexErrMsgTxt("Python value to marshal was NULL. This shouldn't happen.");
     }
     
-    return mat_value;
+    entry = lookup_converter(Py_TYPE(py_value));
+    if (entry != NULL) {
+        if (entry->py_converter != NULL) {
+            return convert_with_python(entry, (PyObject*) py_value);
+        } else if (entry->builtin != NULL) {
+            return entry->builtin((PyObject*) py_value);
+        }
+    }
     
+    return py2mat_slow((PyObject*) py_value);
 }
 
-/**
- * Given a MATLAB array, creates and returns a pointer to an appropriate
- * PyObject. If a new object cannot be created, returns NULL.
- *
- * @param flatten1: If true, dimensions of length one will be removed.
- *     [Default: false]
- */
-PyObject* mat2py(const mxArray* m_value, bool flatten1) {
+static PyObject* mat2py_untraced(const mxArray* m_value, bool flatten1) {
     
     PyObject* new_obj = NULL;
-    char* buf;
-    int nsubs;
     int n_fields;
     int idx_field;
     char* key;
@@ -329,10 +720,12 @@ PyObject* mat2py(const mxArray* m_value, bool flatten1) {
     switch (mxGetClassID(m_value)) {
         
         case mxCELL_CLASS:
-            nsubs = mxGetNumberOfDimensions(m_value);
-            return py_list_from_cell_array(m_value, 0, nsubs, NULL, NULL, flatten1);
+            return py_list_from_cell_array_parallel(m_value, flatten1);
         
         case mxSTRUCT_CLASS:
+            if (lazy_structs && mxGetNumberOfElements(m_value) == 1) {
+                return new_struct_proxy(m_value);
+            }
             // TODO: enforce 1x1 shape.
             // Treat MATLAB structures as Python dicts.
             // Note that this breaks roundtrips (Python dicts are supersets
@@ -361,7 +754,7 @@ PyObject* mat2py(const mxArray* m_value, bool flatten1) {
 
         case mxINT32_CLASS:
             if (ensure_mat_scalar(m_value)) {
-                new_obj = PyInt_FromLong(*(long int*)mxGetData(m_value));
+                new_obj = PyInt_FromLong(*(int*)mxGetData(m_value));
                 return new_obj;
             } else break;
             
@@ -372,19 +765,454 @@ PyObject* mat2py(const mxArray* m_value, bool flatten1) {
             } else break;
             
         case mxCHAR_CLASS:
-            get_matlab_str(m_value, &buf);
-            // new, so already owned.
-            new_obj = PyString_FromString(buf);
-            return new_obj;
+            return py_str_from_mat(m_value);
             
     }
     
+    // Binary data arrives as a memoryview, without conversion.
+    if (mxIsClass(m_value, PY_BYTES_CLASS_NAME)) {
+        return memoryview_from_bytes(m_value);
+    }
+    
+    // Tables convert to DataFrames when pandas is available.
+    if (mxIsClass(m_value, "table")) {
+        new_obj = dataframe_from_table(m_value);
+        if (new_obj != NULL) {
+            return new_obj;
+        }
+    }
+    
     // If we got here, then we need to box it up.
     return box_mxarray(m_value);
     
 }
 
 
+// When tracing, each top-level conversion is one span, named for the type
+// converted; the elements of a cell or struct are part of their container's
+// span rather than spans of their own.
+
+/**
+ * Given a Python object, creates and returns a MATLAB array for that object.
+ * Types (float, int, str, ...) that have 1:1 reprsentations in MATLAB will be
+ * converted, while any more complicated types will be boxed using the
+ * MATLAB class PyObject.
+ *
+ * Note that this function DECREFs any value that isn't boxed into a PyObject
+ * MATLAB class.
+ */
+mxArray* py2mat(const PyObject* py_value) {
+    char name[64];
+    mxArray* m_value;
+    int span;
+    
+    if (!tracing_enabled || py_value == NULL || trace_innermost_is(TRACE_MARSHAL)) {
+        return py2mat_untraced(py_value);
+    }
+    
+    snprintf(name, sizeof(name), "py2mat %s", Py_TYPE(py_value)->tp_name);
+    span = trace_begin(TRACE_MARSHAL, name);
+    m_value = py2mat_untraced(py_value);
+    TRACE_END(span);
+    return m_value;
+}
+
+/**
+ * Given a MATLAB array, creates and returns a pointer to an appropriate
+ * PyObject. If a new object cannot be created, returns NULL.
+ *
+ * @param flatten1: If true, dimensions of length one will be removed.
+ *     [Default: false]
+ */
+PyObject* mat2py(const mxArray* m_value, bool flatten1) {
+    char name[64];
+    PyObject* py_value;
+    int span;
+    
+    if (!tracing_enabled || m_value == NULL || trace_innermost_is(TRACE_MARSHAL)) {
+        return mat2py_untraced(m_value, flatten1);
+    }
+    
+    snprintf(name, sizeof(name), "mat2py %s", mxGetClassName(m_value));
+    span = trace_begin(TRACE_MARSHAL, name);
+    py_value = mat2py_untraced(m_value, flatten1);
+    TRACE_END(span);
+    return py_value;
+}
+
+// INDEX MARSHALLING ///////////////////////////////////////////////////////////
+// Subscripts passed to GETITEM and SETITEM are translated with these rather
+// than with mat2py, so that MATLAB ranges arrive in Python as slice objects
+// instead of as boxed numeric arrays. This lets NumPy-backed objects return
+// views, and costs O(1) Python allocations regardless of the range length.
+
+/**
+ * Reads element idx of a real numeric MATLAB array as an integer.
+ * Returns false if the element is not integral (e.g. 1.5).
+ */
+static bool get_index_element(const mxArray* m_key, mwIndex idx, long long int* out) {
+    void* data = mxGetData(m_key);
+    double d;
+    
+    switch (mxGetClassID(m_key)) {
+        case mxDOUBLE_CLASS:
+            d = ((double*) data)[idx];
+            break;
+        case mxSINGLE_CLASS:
+            d = ((float*) data)[idx];
+            break;
+        case mxINT8_CLASS:
+            *out = ((signed char*) data)[idx];
+            return true;
+        case mxUINT8_CLASS:
+            *out = ((unsigned char*) data)[idx];
+            return true;
+        case mxINT16_CLASS:
+            *out = ((short*) data)[idx];
+            return true;
+        case mxUINT16_CLASS:
+            *out = ((unsigned short*) data)[idx];
+            return true;
+        case mxINT32_CLASS:
+            *out = ((int*) data)[idx];
+            return true;
+        case mxUINT32_CLASS:
+            *out = ((unsigned int*) data)[idx];
+            return true;
+        case mxINT64_CLASS:
+            *out = ((long long int*) data)[idx];
+            return true;
+        case mxUINT64_CLASS:
+            *out = (long long int) ((unsigned long long int*) data)[idx];
+            return true;
+        default:
+            return false;
+    }
+    
+    // Floating point; only integral values are valid indices.
+    *out = (long long int) d;
+    return (double) *out == d;
+}
+
+/**
+ * Builds slice(start, stop, step), using None for stop when has_stop is
+ * false and for step when it is 1.
+ */
+static PyObject* make_slice(long long int start, bool has_stop, long long int stop, long long int step) {
+    PyObject *py_start, *py_stop, *py_step, *slice;
+    
+    py_start = PyLong_FromLongLong(start);
+    if (has_stop) {
+        py_stop = PyLong_FromLongLong(stop);
+    } else {
+        py_stop = Py_None;
+        Py_INCREF(Py_None);
+    }
+    if (step != 1) {
+        py_step = PyLong_FromLongLong(step);
+    } else {
+        py_step = Py_None;
+        Py_INCREF(Py_None);
+    }
+    
+    // PySlice_New takes its own references.
+    slice = PySlice_New(py_start, py_stop, py_step);
+    Py_DECREF(py_start);
+    Py_DECREF(py_stop);
+    Py_DECREF(py_step);
+    return slice;
+}
+
+/**
+ * Converts a single MATLAB subscript into a Python index:
+ *
+ *  - ':' becomes slice(None, None, None),
+ *  - integral numeric scalars become ints,
+ *  - arithmetic progressions (as produced by MATLAB's colon operator,
+ *    including those built from `end`) become slices,
+ *  - other integral numeric vectors become lists of ints.
+ *
+ * Anything else is marshalled with mat2py, so that strings and PyObjects
+ * can still be used as keys. MATLAB subscripts are inclusive while Python
+ * stops are exclusive, so a range a:s:b maps to slice(a, b + s, s).
+ *
+ * Returns a new reference.
+ */
+PyObject* py_index_from_mat(const mxArray* m_key) {
+    mwSize n_els, idx;
+    long long int first, second, last, step, el, stop;
+    bool integral = true;
+    PyObject *py_list;
+    
+    if (mxIsChar(m_key)) {
+        if (mxGetNumberOfElements(m_key) == 1 && *mxGetChars(m_key) == ':') {
+            return PySlice_New(NULL, NULL, NULL);
+        }
+        return mat2py(m_key, false);
+    }
+    
+    // Logical masks, complex values, PyObjects and so forth aren't indices
+    // we know how to translate.
+    if (!mxIsNumeric(m_key) || mxIsComplex(m_key) || mxIsSparse(m_key)) {
+        return mat2py(m_key, false);
+    }
+    
+    n_els = mxGetNumberOfElements(m_key);
+    if (n_els == 0) {
+        return make_slice(0, true, 0, 1);
+    }
+    
+    if (!get_index_element(m_key, 0, &first)) {
+        return mat2py(m_key, false);
+    }
+    if (n_els == 1) {
+        return PyLong_FromLongLong(first);
+    }
+    
+    // Check whether we have a progression with a constant, nonzero step.
+    // This touches each element once, but doesn't allocate anything.
+    get_index_element(m_key, 1, &second);
+    step = second - first;
+    last = first;
+    for (idx = 1; idx < n_els; ++idx) {
+        if (!get_index_element(m_key, idx, &el)) {
+            integral = false;
+            break;
+        }
+        if (el - last != step) {
+            step = 0;
+        }
+        last = el;
+    }
+    
+    if (!integral) {
+        return mat2py(m_key, false);
+    }
+    
+    // Python treats negative indices as counting from the end, so a range
+    // that crosses zero can't be written as a single slice.
+    if (step != 0 && (first < 0) == (last < 0)) {
+        stop = last + step;
+        // A stop that crosses zero would wrap around; None means "run off
+        // the end" in the direction of the step, which is what we want.
+        return make_slice(first, (stop < 0) == (last < 0), stop, step);
+    }
+    
+    // Fall back to fancy indexing with a list of ints.
+    py_list = PyList_New(n_els);
+    for (idx = 0; idx < n_els; ++idx) {
+        get_index_element(m_key, idx, &el);
+        PyList_SET_ITEM(py_list, idx, PyLong_FromLongLong(el));
+    }
+    return py_list;
+}
+
+/**
+ * Converts the subscripts of a MATLAB brace-indexing expression into a single
+ * Python key: the bare index if there is only one subscript, or a tuple of
+ * indices otherwise (as in `obj[a, b]`).
+ *
+ * Returns a new reference.
+ */
+PyObject* py_key_from_subscripts(int nsubs, const mxArray* subs[]) {
+    PyObject *key;
+    int idx;
+    
+    if (nsubs == 1) {
+        return py_index_from_mat(subs[0]);
+    }
+    
+    key = PyTuple_New(nsubs);
+    for (idx = 0; idx < nsubs; ++idx) {
+        // SET_ITEM steals the new reference.
+        PyTuple_SET_ITEM(key, idx, py_index_from_mat(subs[idx]));
+    }
+    return key;
+}
+
+// TYPED BUFFERS ///////////////////////////////////////////////////////////////
+// Raw numeric buffers, described by a NumPy type code and a shape, are copied
+// into MATLAB arrays of the matching class and back, converting between C
+// and column-major order and between interleaved and split complex parts
+// with the kernels in pymex_kernels.c. Type codes are those of the struct
+// and array modules, plus NumPy's 'F' and 'D' for complex single and double.
+
+typedef struct {
+    char code;
+    mxClassID class_id;
+    bool complex;
+} typecode_t;
+
+static const typecode_t TYPECODES[] = {
+    {'d', mxDOUBLE_CLASS, false},
+    {'f', mxSINGLE_CLASS, false},
+    {'D', mxDOUBLE_CLASS, true},
+    {'F', mxSINGLE_CLASS, true},
+    {'?', mxLOGICAL_CLASS, false},
+    {'b', mxINT8_CLASS, false},
+    {'B', mxUINT8_CLASS, false},
+    {'h', mxINT16_CLASS, false},
+    {'H', mxUINT16_CLASS, false},
+    {'i', mxINT32_CLASS, false},
+    {'I', mxUINT32_CLASS, false},
+    {'q', mxINT64_CLASS, false},
+    {'Q', mxUINT64_CLASS, false}
+};
+
+#define N_TYPECODES (sizeof(TYPECODES) / sizeof(TYPECODES[0]))
+
+static const typecode_t* find_typecode(const char* typecode) {
+    char code = typecode[0];
+    size_t idx;
+    
+    // long is as wide as int or as long long, depending on the platform.
+    if (code == 'l' || code == 'L') {
+        code = sizeof(long) == sizeof(long long) ? code + ('q' - 'l') : code + ('i' - 'l');
+    }
+    if (code == '\0' || typecode[1] != '\0') {
+        return NULL;
+    }
+    for (idx = 0; idx < N_TYPECODES; ++idx) {
+        if (TYPECODES[idx].code == code) {
+            return &TYPECODES[idx];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Copies one part (real or imaginary) of an array between C order, with the
+ * given dims, and column-major order. transpose_nd goes from column-major
+ * to C order, and back when given the dims reversed.
+ */
+static void reorder_part(void* dst, const void* src, mwSize ndim, const mwSize* dims,
+                         size_t el_size, bool to_column_major) {
+    size_t nd_dims[MAX_BUFFER_DIMS];
+    mwSize idx;
+    
+    for (idx = 0; idx < ndim; ++idx) {
+        nd_dims[idx] = to_column_major ? dims[ndim - 1 - idx] : dims[idx];
+    }
+    transpose_nd(dst, src, ndim, nd_dims, el_size);
+}
+
+/**
+ * Copies n_bytes of data, holding elements of the given type code in an
+ * array of shape dims (in C order if c_order is set, else column-major),
+ * into a new MATLAB array of that shape. A 1-D buffer becomes a row vector.
+ * Returns NULL with a Python error set if the type code has no MATLAB
+ * class, or if the buffer is the wrong size for its shape.
+ */
+mxArray* mat_from_buffer(const void* data, size_t n_bytes, const char* typecode,
+                         mwSize ndim, const mwSize* dims, bool c_order) {
+    const typecode_t* type = find_typecode(typecode);
+    mwSize row_dims[2], idx;
+    size_t n = 1, el_size, part_bytes;
+    mxArray* m_value;
+    char* parts;
+    
+    if (type == NULL) {
+        PyErr_Format(PyExc_ValueError, "Type code '%s' has no MATLAB class.", typecode);
+        return NULL;
+    }
+    if (ndim > MAX_BUFFER_DIMS) {
+        PyErr_SetString(PyExc_ValueError, "Buffer has too many dimensions.");
+        return NULL;
+    }
+    for (idx = 0; idx < ndim; ++idx) {
+        n *= dims[idx];
+    }
+    
+    if (ndim < 2) {
+        row_dims[0] = 1;
+        row_dims[1] = n;
+        ndim = 2;
+        dims = row_dims;
+        // Rows are the same in either order.
+        c_order = false;
+    }
+    
+    if (type->class_id == mxLOGICAL_CLASS) {
+        m_value = mxCreateLogicalArray(ndim, dims);
+    } else {
+        m_value = mxCreateNumericArray(ndim, dims, type->class_id, type->complex ? mxCOMPLEX : mxREAL);
+    }
+    el_size = mxGetElementSize(m_value);
+    part_bytes = n * el_size;
+    if (n_bytes != (type->complex ? 2 * part_bytes : part_bytes)) {
+        mxDestroyArray(m_value);
+        PyErr_SetString(PyExc_ValueError, "Buffer size doesn't match its shape and type.");
+        return NULL;
+    }
+    
+    if (!type->complex) {
+        if (c_order) {
+            reorder_part(mxGetData(m_value), data, ndim, dims, el_size, true);
+        } else {
+            memcpy(mxGetData(m_value), data, part_bytes);
+        }
+    } else if (!c_order) {
+        split_complex(mxGetData(m_value), mxGetImagData(m_value), data, n, el_size);
+    } else {
+        // Split first, so that each part transposes with the kernel for
+        // its own element size.
+        parts = mxMalloc(2 * part_bytes);
+        split_complex(parts, parts + part_bytes, data, n, el_size);
+        reorder_part(mxGetData(m_value), parts, ndim, dims, el_size, true);
+        reorder_part(mxGetImagData(m_value), parts + part_bytes, ndim, dims, el_size, true);
+        mxFree(parts);
+    }
+    return m_value;
+}
+
+/**
+ * Copies a numeric or logical MATLAB array into a new bytearray, in C order
+ * if c_order is set (else column-major) and with complex parts interleaved;
+ * the inverse of mat_from_buffer. Returns NULL with a Python error set for
+ * any other kind of array.
+ */
+PyObject* buffer_from_mat(const mxArray* m_value, bool c_order) {
+    mwSize ndim = mxGetNumberOfDimensions(m_value);
+    const mwSize* dims = mxGetDimensions(m_value);
+    size_t n = mxGetNumberOfElements(m_value), el_size = mxGetElementSize(m_value);
+    size_t part_bytes = n * el_size;
+    bool complex = mxIsComplex(m_value);
+    PyObject* py_buffer;
+    char *buf, *parts;
+    
+    if (!(mxIsNumeric(m_value) || mxIsLogical(m_value)) || mxIsSparse(m_value)) {
+        PyErr_SetString(PyExc_TypeError, "Expected a full numeric or logical MATLAB array.");
+        return NULL;
+    }
+    if (ndim > MAX_BUFFER_DIMS) {
+        PyErr_SetString(PyExc_ValueError, "Array has too many dimensions.");
+        return NULL;
+    }
+    
+    py_buffer = PyByteArray_FromStringAndSize(NULL, complex ? 2 * part_bytes : part_bytes);
+    if (py_buffer == NULL) {
+        return NULL;
+    }
+    buf = PyByteArray_AS_STRING(py_buffer);
+    
+    if (!complex) {
+        if (c_order) {
+            reorder_part(buf, mxGetData(m_value), ndim, dims, el_size, false);
+        } else {
+            memcpy(buf, mxGetData(m_value), part_bytes);
+        }
+    } else if (!c_order) {
+        interleave_complex(buf, mxGetData(m_value), mxGetImagData(m_value), n, el_size);
+    } else {
+        parts = mxMalloc(2 * part_bytes);
+        reorder_part(parts, mxGetData(m_value), ndim, dims, el_size, false);
+        reorder_part(parts + part_bytes, mxGetImagData(m_value), ndim, dims, el_size, false);
+        interleave_complex(buf, parts, parts + part_bytes, n, el_size);
+        mxFree(parts);
+    }
+    return py_buffer;
+}
+
 // BOXING AND UNBOXING ////////////////////////////////////////////////////////
 // These functions are for encapsulating un-interpreted values when
 // marshalling. Uninterpreted Python objects are wrapped in the PyObject
@@ -419,16 +1247,15 @@ PyObject* unbox_pyobject(const mxArray* mat_array) {
         mexErrMsgTxt("Field py_pointer did not contain a pointer.");
         return NULL;
     } else {
-        // Get the pointer to the data, which should be a pointer
-        // to the PyObject* (giving a type of PyObject**).
-        // Since we want the 0th element of the field, then dereferencing
-        // is fine.
+        // Get the pointer to the data, which holds the PyObject* boxed as
+        // a py_pointer_box_t. Since we want the 0th element of the field,
+        // then dereferencing is fine.
         data = mxGetData(field);
         if (data == NULL) {
             mexErrMsgTxt("Data was NULL.");
             return NULL;
         } else {
-            return *((PyObject**) data);
+            return (PyObject*) (size_t) *((py_pointer_box_t*) data);
         }
     }
 }
@@ -442,6 +1269,7 @@ mxArray* box_pyobject(const PyObject* py_object) {
     rhs[0] = mxCreateNumericMatrix(1, 1, POINTER_CLASS, mxREAL);
     ((py_pointer_box_t*)mxGetData(rhs[0]))[0] = (py_pointer_box_t) py_object;
     mexCallMATLAB(1, lhs, 1, rhs, "PyObject.new");
+    TRACK_NEW(TRACK_PYOBJECT, py_object);
     return lhs[0];
 }
 
@@ -469,16 +1297,18 @@ mxArray* unbox_mxarray(const PyObject* py_object) {
     return ptr_val;
 }
 
-PyObject* box_mxarray(const mxArray* m_array) {
+/**
+ * Boxes an array that has already been copied for Python's use, taking
+ * ownership of it.
+ */
+PyObject* box_persistent_mxarray(mxArray* dup_array) {
     
     PyObject *boxed_value = NULL;
-    mxArray* dup_array;
 
     init_py_mxArray();
 
-    // We need a duplicate of the array that we can persist.
-    dup_array = mxDuplicateArray(m_array);
     mexMakeArrayPersistent(dup_array);
+    TRACK_NEW(TRACK_MXARRAY, dup_array);
 
     // Now we call the constructor for the Python class mxArray
     // with the cell box as an argument.
@@ -486,4 +1316,9 @@ PyObject* box_mxarray(const mxArray* m_array) {
     // The boxed value is a new reference, so we already own it.
     return boxed_value;
     
-}
\ No newline at end of file
+}
+
+PyObject* box_mxarray(const mxArray* m_array) {
+    // We need a duplicate of the array that we can persist.
+    return box_persistent_mxarray(mxDuplicateArray(m_array));
+}
@@ -31,17 +31,35 @@
 #include <Python.h>
 #include <mex.h>
 
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Buffers passed to mat_from_buffer may have no more dimensions than this,
+// which is NumPy's limit.
+#define MAX_BUFFER_DIMS 32
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+// PyObject pointers are boxed in MATLAB as uint64, whatever their width.
+#define py_pointer_box_t unsigned long long int
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+extern unsigned long converter_generation;
+
 // PROTOTYPES //////////////////////////////////////////////////////////////////
 
 void init_marshal_types();
 
 void get_matlab_str(const mxArray* m_str, char** c_str);
+PyObject* py_str_from_mat(const mxArray* m_str);
 
 PyObject* py_obj_from_mat_scalar(const mxArray* m_scalar);
 mxArray* mat_scalar_from_py_obj(const PyObject* py_obj);
 
 PyObject* mat2py(const mxArray* m_value, bool flatten1);
 //mxArray* py2mat(const PyObject* py_value);
+void register_py2mat_converter(PyTypeObject* type, PyObject* converter);
+bool has_registered_converter(const PyTypeObject* type);
 mxArray* py2mat(const PyObject* py_value);
 
 PyObject* py_list_from_cell_array(
@@ -49,6 +67,13 @@ PyObject* py_list_from_cell_array(
     mwIndex* dims, bool flatten1
 );
 
+PyObject* py_index_from_mat(const mxArray* m_key);
+PyObject* py_key_from_subscripts(int nsubs, const mxArray* subs[]);
+
+mxArray* mat_from_buffer(const void* data, size_t n_bytes, const char* typecode,
+                         mwSize ndim, const mwSize* dims, bool c_order);
+PyObject* buffer_from_mat(const mxArray* m_value, bool c_order);
+
 bool is_boxed_pyobject(const mxArray* mat_array);
 PyObject* unbox_pyobject(const mxArray* mat_array);
 mxArray* box_pyobject(const PyObject* py_object);
@@ -56,5 +81,6 @@ mxArray* box_pyobject(const PyObject* py_object);
 bool is_boxed_mxarray(const PyObject* py_object);
 mxArray* unbox_mxarray(const PyObject* py_object);
 PyObject* box_mxarray(const mxArray* m_array);
+PyObject* box_persistent_mxarray(mxArray* dup_array);
 
 #endif
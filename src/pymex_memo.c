@@ -0,0 +1,635 @@
+/**
+ * pymex_memo.c: Memoizing calls to pure Python functions.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// A pymex.Memo wraps a Python callable that is assumed to be pure, and
+// remembers what it returned for each distinct set of MATLAB arguments. The
+// arguments are hashed as they are, before anything is converted: class,
+// shape and raw data, with XXH64, recursing into cells and structs. On a
+// hit, the cached MATLAB result is duplicated and returned, so neither the
+// arguments nor the result are converted, and Python isn't called at all.
+//
+// Results are kept as persistent copies, most recently used first, and the
+// least recently used are evicted to keep their total size within the
+// memo's budget. Results that are boxed PyObjects are kept as the Python
+// objects themselves, and boxed afresh on each hit, so every hit shares
+// the one object. Calls with arguments
+// that can't be hashed (PyObjects, function handles and other MATLAB
+// objects) and results that hold MATLAB objects go straight through.
+//
+// Keys are 64-bit hashes, together with the number of bytes hashed; two
+// argument lists that differ but agree in both would share a result, which
+// for XXH64 is vanishingly unlikely.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "pymex_memo.h"
+#include "pymex_callbacks.h"
+#include "pymex_marshal.h"
+#include "pymex_track.h"
+#include <structmember.h>
+#include <stdint.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define INITIAL_BUCKETS 64
+
+// Stands in for the bookkeeping of an entry when counting against the
+// budget, so that many tiny results can't grow the table without bound.
+#define ENTRY_OVERHEAD 128
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    uint64_t hash;
+    uint64_t n_bytes;
+} memo_key_t;
+
+typedef struct memo_entry {
+    memo_key_t key;
+    // Persistent copy of the result, or NULL if it was a boxed PyObject.
+    mxArray* value;
+    PyObject* py_value;
+    size_t cost;
+    // Recency list, most recent first.
+    struct memo_entry* prev;
+    struct memo_entry* next;
+    // Next entry in the same bucket.
+    struct memo_entry* chain;
+} memo_entry_t;
+
+typedef struct {
+    PyObject_HEAD
+    PyObject* callee;
+    memo_entry_t** buckets;
+    size_t n_buckets;
+    memo_entry_t* newest;
+    memo_entry_t* oldest;
+    Py_ssize_t n_entries;
+    Py_ssize_t budget;
+    Py_ssize_t n_bytes;
+    Py_ssize_t hits;
+    Py_ssize_t misses;
+    Py_ssize_t evictions;
+    // Calls that went straight through, uncached.
+    Py_ssize_t bypassed;
+} memo_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+static PyTypeObject memo_type = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+// HASHING /////////////////////////////////////////////////////////////////////
+// XXH64, after Yann Collet's reference implementation. Each buffer hashed
+// for a key is seeded with the hash of everything before it.
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    return rotl64(acc, 31) * PRIME64_1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static uint64_t xxh64(const void* data, size_t n, uint64_t seed) {
+    const unsigned char *p = data, *end = p + n;
+    uint64_t h, v1, v2, v3, v4;
+    
+    if (n >= 32) {
+        v1 = seed + PRIME64_1 + PRIME64_2;
+        v2 = seed + PRIME64_2;
+        v3 = seed;
+        v4 = seed - PRIME64_1;
+        do {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+    h += (uint64_t) n;
+    
+    for (; p + 8 <= end; p += 8) {
+        h ^= xxh64_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t) read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+    
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static void hash_bytes(memo_key_t* key, const void* data, size_t n) {
+    key->hash = xxh64(data, n, key->hash);
+    key->n_bytes += n;
+}
+
+/**
+ * Hashes the class, complexity and shape of an array.
+ */
+static void hash_header(memo_key_t* key, const mxArray* m_value) {
+    uint64_t header[3];
+    
+    header[0] = (uint64_t) mxGetClassID(m_value);
+    header[1] = (mxIsComplex(m_value) ? 1 : 0) | (mxIsSparse(m_value) ? 2 : 0);
+    header[2] = (uint64_t) mxGetNumberOfDimensions(m_value);
+    hash_bytes(key, header, sizeof(header));
+    hash_bytes(key, mxGetDimensions(m_value), mxGetNumberOfDimensions(m_value) * sizeof(mwSize));
+}
+
+/**
+ * Adds an array to a key. Returns false if the array (or anything in it) is
+ * an object, which can't be hashed by content.
+ */
+static bool hash_array(memo_key_t* key, const mxArray* m_value) {
+    size_t n, idx, nnz;
+    int n_fields, field;
+    const char* name;
+    
+    if (m_value == NULL) {
+        // Unset cells, which MATLAB reads as [].
+        hash_bytes(key, "", 1);
+        return true;
+    }
+    
+    n = mxGetNumberOfElements(m_value);
+    hash_header(key, m_value);
+    switch (mxGetClassID(m_value)) {
+        case mxCELL_CLASS:
+            for (idx = 0; idx < n; ++idx) {
+                if (!hash_array(key, mxGetCell(m_value, idx))) {
+                    return false;
+                }
+            }
+            return true;
+        
+        case mxSTRUCT_CLASS:
+            n_fields = mxGetNumberOfFields(m_value);
+            for (field = 0; field < n_fields; ++field) {
+                name = mxGetFieldNameByNumber(m_value, field);
+                hash_bytes(key, name, strlen(name) + 1);
+            }
+            for (idx = 0; idx < n; ++idx) {
+                for (field = 0; field < n_fields; ++field) {
+                    if (!hash_array(key, mxGetFieldByNumber(m_value, idx, field))) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        
+        case mxUNKNOWN_CLASS:
+        case mxFUNCTION_CLASS:
+        case mxOBJECT_CLASS:
+            return false;
+        
+        default:
+            break;
+    }
+    
+    if (mxIsSparse(m_value)) {
+        nnz = mxGetJc(m_value)[mxGetN(m_value)];
+        hash_bytes(key, mxGetJc(m_value), (mxGetN(m_value) + 1) * sizeof(mwIndex));
+        hash_bytes(key, mxGetIr(m_value), nnz * sizeof(mwIndex));
+        n = nnz;
+    }
+    hash_bytes(key, mxGetData(m_value), n * mxGetElementSize(m_value));
+    if (mxIsComplex(m_value)) {
+        hash_bytes(key, mxGetImagData(m_value), n * mxGetElementSize(m_value));
+    }
+    return true;
+}
+
+/**
+ * Size of the data held by an array, counted against a memo's budget.
+ * Returns false if the array holds objects, which aren't cached.
+ */
+static bool array_cost(const mxArray* m_value, size_t* cost) {
+    size_t n, idx;
+    int field;
+    
+    if (m_value == NULL) {
+        return true;
+    }
+    n = mxGetNumberOfElements(m_value);
+    *cost += sizeof(mwSize) * mxGetNumberOfDimensions(m_value);
+    switch (mxGetClassID(m_value)) {
+        case mxCELL_CLASS:
+            for (idx = 0; idx < n; ++idx) {
+                if (!array_cost(mxGetCell(m_value, idx), cost)) {
+                    return false;
+                }
+            }
+            return true;
+        
+        case mxSTRUCT_CLASS:
+            for (idx = 0; idx < n; ++idx) {
+                for (field = 0; field < mxGetNumberOfFields(m_value); ++field) {
+                    if (!array_cost(mxGetFieldByNumber(m_value, idx, field), cost)) {
+                        return false;
+                    }
+                }
+            }
+            return true;
+        
+        case mxUNKNOWN_CLASS:
+        case mxFUNCTION_CLASS:
+        case mxOBJECT_CLASS:
+            return false;
+        
+        default:
+            break;
+    }
+    
+    if (mxIsSparse(m_value)) {
+        n = mxGetNzmax(m_value);
+        *cost += (n + mxGetN(m_value) + 1) * sizeof(mwIndex);
+    }
+    *cost += n * mxGetElementSize(m_value) * (mxIsComplex(m_value) ? 2 : 1);
+    return true;
+}
+
+// TABLE ///////////////////////////////////////////////////////////////////////
+
+static memo_entry_t** find_slot(memo_t* memo, const memo_key_t* key) {
+    memo_entry_t** slot = &memo->buckets[key->hash & (memo->n_buckets - 1)];
+    
+    while (*slot != NULL && ((*slot)->key.hash != key->hash || (*slot)->key.n_bytes != key->n_bytes)) {
+        slot = &(*slot)->chain;
+    }
+    return slot;
+}
+
+static void unlink_entry(memo_t* memo, memo_entry_t* entry) {
+    if (entry->prev != NULL) {
+        entry->prev->next = entry->next;
+    } else {
+        memo->newest = entry->next;
+    }
+    if (entry->next != NULL) {
+        entry->next->prev = entry->prev;
+    } else {
+        memo->oldest = entry->prev;
+    }
+}
+
+static void push_newest(memo_t* memo, memo_entry_t* entry) {
+    entry->prev = NULL;
+    entry->next = memo->newest;
+    if (memo->newest != NULL) {
+        memo->newest->prev = entry;
+    } else {
+        memo->oldest = entry;
+    }
+    memo->newest = entry;
+}
+
+static void free_entry(memo_entry_t* entry) {
+    if (entry->value != NULL) {
+        TRACK_RELEASE(entry->value);
+        destroy_array_on_mex_thread(entry->value);
+    }
+    Py_XDECREF(entry->py_value);
+    free(entry);
+}
+
+static void remove_entry(memo_t* memo, memo_entry_t* entry) {
+    memo_entry_t** slot = find_slot(memo, &entry->key);
+    
+    *slot = entry->chain;
+    unlink_entry(memo, entry);
+    memo->n_entries--;
+    memo->n_bytes -= entry->cost;
+    free_entry(entry);
+}
+
+static void grow_table(memo_t* memo) {
+    memo_entry_t **old = memo->buckets, *entry, *next;
+    size_t n_old = memo->n_buckets, idx;
+    
+    memo->n_buckets = 2 * n_old;
+    memo->buckets = calloc(memo->n_buckets, sizeof(memo_entry_t*));
+    for (idx = 0; idx < n_old; ++idx) {
+        for (entry = old[idx]; entry != NULL; entry = next) {
+            next = entry->chain;
+            entry->chain = memo->buckets[entry->key.hash & (memo->n_buckets - 1)];
+            memo->buckets[entry->key.hash & (memo->n_buckets - 1)] = entry;
+        }
+    }
+    free(old);
+}
+
+/**
+ * Size of a boxed result, counted against a memo's budget: its nbytes if
+ * it has one (as numpy arrays do), else the length of its buffer, else
+ * what sys.getsizeof says, which for containers counts only the container.
+ */
+static size_t pyobject_cost(PyObject* py_value) {
+    PyObject* nbytes = PyObject_GetAttrString(py_value, "nbytes");
+    Py_buffer view;
+    Py_ssize_t n_bytes;
+    size_t size;
+    
+    if (nbytes != NULL) {
+        n_bytes = PyNumber_AsSsize_t(nbytes, NULL);
+        Py_DECREF(nbytes);
+        if (n_bytes >= 0 && !PyErr_Occurred()) {
+            return (size_t) n_bytes;
+        }
+    }
+    PyErr_Clear();
+    if (PyObject_CheckBuffer(py_value) && PyObject_GetBuffer(py_value, &view, PyBUF_RECORDS_RO) == 0) {
+        n_bytes = view.len;
+        PyBuffer_Release(&view);
+        return (size_t) n_bytes;
+    }
+    PyErr_Clear();
+    size = _PySys_GetSizeOf(py_value);
+    if (PyErr_Occurred()) {
+        PyErr_Clear();
+        return 0;
+    }
+    return size;
+}
+
+/**
+ * Caches a result under key, unless it holds objects or is bigger than the
+ * whole budget, then evicts the oldest results until the rest fit. MEX
+ * thread only.
+ */
+static void insert_result(memo_t* memo, const memo_key_t* key, const mxArray* m_result) {
+    memo_entry_t* entry;
+    size_t cost = ENTRY_OVERHEAD;
+    PyObject* py_value = NULL;
+    
+    if (is_boxed_pyobject(m_result)) {
+        py_value = unbox_pyobject(m_result);
+        cost += pyobject_cost(py_value);
+    } else if (!array_cost(m_result, &cost)) {
+        memo->bypassed++;
+        return;
+    }
+    if (cost > (size_t) memo->budget) {
+        memo->bypassed++;
+        return;
+    }
+    // The callee may have called back into this memo with the same
+    // arguments.
+    if (*find_slot(memo, key) != NULL) {
+        return;
+    }
+    
+    entry = calloc(1, sizeof(memo_entry_t));
+    entry->key = *key;
+    entry->cost = cost;
+    if (py_value != NULL) {
+        entry->py_value = py_value;
+        Py_INCREF(py_value);
+    } else {
+        entry->value = mxDuplicateArray(m_result);
+        mexMakeArrayPersistent(entry->value);
+        TRACK_NEW(TRACK_MXARRAY, entry->value);
+    }
+    
+    if ((size_t) memo->n_entries >= memo->n_buckets) {
+        grow_table(memo);
+    }
+    *find_slot(memo, key) = entry;
+    push_newest(memo, entry);
+    memo->n_entries++;
+    memo->n_bytes += cost;
+    
+    while (memo->n_bytes > memo->budget && memo->oldest != entry) {
+        remove_entry(memo, memo->oldest);
+        memo->evictions++;
+    }
+}
+
+// MEMO OBJECTS ////////////////////////////////////////////////////////////////
+
+static void clear_entries(memo_t* memo) {
+    memo_entry_t *entry = memo->newest, *next;
+    
+    for (; entry != NULL; entry = next) {
+        next = entry->next;
+        free_entry(entry);
+    }
+    memset(memo->buckets, 0, memo->n_buckets * sizeof(memo_entry_t*));
+    memo->newest = memo->oldest = NULL;
+    memo->n_entries = 0;
+    memo->n_bytes = 0;
+}
+
+static void memo_dealloc(memo_t* self) {
+    clear_entries(self);
+    free(self->buckets);
+    Py_XDECREF(self->callee);
+    PyObject_Del(self);
+}
+
+static PyObject* memo_clear(memo_t* self, PyObject* unused) {
+    clear_entries(self);
+    Py_RETURN_NONE;
+}
+
+static PyObject* memo_get_hit_rate(memo_t* self, void* closure) {
+    Py_ssize_t n_calls = self->hits + self->misses;
+    return PyFloat_FromDouble(n_calls == 0 ? 0.0 : (double) self->hits / n_calls);
+}
+
+static PyObject* memo_repr(memo_t* self) {
+    char buf[128];
+    PyOS_snprintf(buf, sizeof(buf), "<pymex.Memo: %zd results, %zd of %zd bytes, %zd hits, %zd misses>",
+        self->n_entries, self->n_bytes, self->budget, self->hits, self->misses);
+    return PyString_FromString(buf);
+}
+
+static PyMethodDef memo_methods[] = {
+    {"clear", (PyCFunction) memo_clear, METH_NOARGS, "Forgets every cached result."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyMemberDef memo_members[] = {
+    {"callee", T_OBJECT, offsetof(memo_t, callee), READONLY, "The memoized callable."},
+    {"budget", T_PYSSIZET, offsetof(memo_t, budget), READONLY, "Bytes that cached results may take up."},
+    {"bytes", T_PYSSIZET, offsetof(memo_t, n_bytes), READONLY, "Bytes that cached results take up."},
+    {"entries", T_PYSSIZET, offsetof(memo_t, n_entries), READONLY, "Number of cached results."},
+    {"hits", T_PYSSIZET, offsetof(memo_t, hits), READONLY, "Calls answered from the cache."},
+    {"misses", T_PYSSIZET, offsetof(memo_t, misses), READONLY, "Calls that had to call the callee."},
+    {"evictions", T_PYSSIZET, offsetof(memo_t, evictions), READONLY, "Results evicted to stay within budget."},
+    {"bypassed", T_PYSSIZET, offsetof(memo_t, bypassed), READONLY,
+        "Calls whose arguments or result couldn't be cached."},
+    {NULL}
+};
+
+static PyGetSetDef memo_getset[] = {
+    {"hit_rate", (getter) memo_get_hit_rate, NULL, "Fraction of cacheable calls that were hits.", NULL},
+    {NULL}
+};
+
+void init_memo_type(PyObject* module) {
+    memo_type.tp_name = "pymex.Memo";
+    memo_type.tp_basicsize = sizeof(memo_t);
+    memo_type.tp_dealloc = (destructor) memo_dealloc;
+    memo_type.tp_repr = (reprfunc) memo_repr;
+    memo_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    memo_type.tp_doc = "Cache of the results of a pure Python callable, keyed by MATLAB arguments.";
+    memo_type.tp_methods = memo_methods;
+    memo_type.tp_members = memo_members;
+    memo_type.tp_getset = memo_getset;
+    if (PyType_Ready(&memo_type) < 0) {
+        return;
+    }
+    Py_INCREF(&memo_type);
+    PyModule_AddObject(module, "Memo", (PyObject*) &memo_type);
+}
+
+/**
+ * Returns a new memo for callee, keeping up to budget bytes of results.
+ */
+PyObject* new_memo(PyObject* callee, size_t budget) {
+    memo_t* memo = PyObject_New(memo_t, &memo_type);
+    
+    if (memo == NULL) {
+        return NULL;
+    }
+    memo->callee = callee;
+    Py_INCREF(callee);
+    // The memo outlives this MEX call, so it can't use mxMalloc.
+    memo->n_buckets = INITIAL_BUCKETS;
+    memo->buckets = calloc(memo->n_buckets, sizeof(memo_entry_t*));
+    memo->newest = memo->oldest = NULL;
+    memo->n_entries = 0;
+    memo->budget = (Py_ssize_t) budget;
+    memo->n_bytes = 0;
+    memo->hits = memo->misses = memo->evictions = memo->bypassed = 0;
+    return (PyObject*) memo;
+}
+
+// CALLING /////////////////////////////////////////////////////////////////////
+
+/**
+ * Calls a memo's callee with the given MATLAB arguments, or returns what it
+ * returned for the same arguments before. Returns NULL with a Python
+ * exception set on error. MEX thread only.
+ */
+mxArray* call_with_memo(PyObject* py_memo, int n_args, const mxArray* args[]) {
+    memo_t* memo;
+    memo_key_t key = {0, 0};
+    memo_entry_t* entry;
+    bool cacheable = true;
+    PyObject *py_args, *result;
+    mxArray* m_result;
+    int idx;
+    
+    if (Py_TYPE(py_memo) != &memo_type) {
+        PyErr_SetString(PyExc_TypeError, "Expected a pymex.Memo.");
+        return NULL;
+    }
+    memo = (memo_t*) py_memo;
+    
+    hash_bytes(&key, &n_args, sizeof(n_args));
+    for (idx = 0; idx < n_args && cacheable; ++idx) {
+        cacheable = hash_array(&key, args[idx]);
+    }
+    
+    if (cacheable) {
+        entry = *find_slot(memo, &key);
+        if (entry != NULL) {
+            memo->hits++;
+            unlink_entry(memo, entry);
+            push_newest(memo, entry);
+            if (entry->value != NULL) {
+                return mxDuplicateArray(entry->value);
+            }
+            Py_INCREF(entry->py_value);
+            return py2mat(entry->py_value);
+        }
+        memo->misses++;
+    } else {
+        memo->bypassed++;
+    }
+    
+    py_args = PyTuple_New(n_args);
+    for (idx = 0; idx < n_args; ++idx) {
+        PyTuple_SET_ITEM(py_args, idx, mat2py(args[idx], false));
+    }
+    // The memo may be released by the callee; keep it until we're done.
+    Py_INCREF(py_memo);
+    result = PyObject_Call(memo->callee, py_args, NULL);
+    Py_DECREF(py_args);
+    if (result == NULL) {
+        Py_DECREF(py_memo);
+        return NULL;
+    }
+    
+    m_result = py2mat(result);
+    if (cacheable) {
+        insert_result(memo, &key, m_result);
+    }
+    Py_DECREF(py_memo);
+    return m_result;
+}
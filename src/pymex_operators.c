@@ -0,0 +1,356 @@
+/**
+ * pymex_operators.c: Table of Python operators exposed to PyObject.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include "pymex_operators.h"
+#include "pymex_marshal.h"
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Largest magnitude at which every integer is exactly representable as a
+// double. Beyond this, mixed int/float comparisons go through Python.
+#define EXACT_DOUBLE_INT_MAX 9007199254740992LL
+
+// WRAPPERS ////////////////////////////////////////////////////////////////////
+// Adapt Python C API functions whose signatures do not match binaryfunc or
+// unaryfunc.
+
+static PyObject* number_power(PyObject* a, PyObject* b) {
+    return PyNumber_Power(a, b, Py_None);
+}
+
+static PyObject* object_not(PyObject* a) {
+    int result = PyObject_Not(a);
+    if (result < 0) {
+        return NULL;
+    }
+    return PyBool_FromLong(result);
+}
+
+// OPERATOR TABLE //////////////////////////////////////////////////////////////
+// Indexed by operator_t; the order here must match the enum exactly.
+
+static const operator_entry_t OPERATORS[N_OPERATORS] = {
+    {"add",      OPKIND_BINARY,  PyNumber_Add,         0,        NULL},
+    {"sub",      OPKIND_BINARY,  PyNumber_Subtract,    0,        NULL},
+    {"mul",      OPKIND_BINARY,  PyNumber_Multiply,    0,        NULL},
+    {"truediv",  OPKIND_BINARY,  PyNumber_TrueDivide,  0,        NULL},
+    {"floordiv", OPKIND_BINARY,  PyNumber_FloorDivide, 0,        NULL},
+    {"mod",      OPKIND_BINARY,  PyNumber_Remainder,   0,        NULL},
+    {"pow",      OPKIND_BINARY,  number_power,         0,        NULL},
+    {"and",      OPKIND_BINARY,  PyNumber_And,         0,        NULL},
+    {"or",       OPKIND_BINARY,  PyNumber_Or,          0,        NULL},
+    {"xor",      OPKIND_BINARY,  PyNumber_Xor,         0,        NULL},
+    {"lshift",   OPKIND_BINARY,  PyNumber_Lshift,      0,        NULL},
+    {"rshift",   OPKIND_BINARY,  PyNumber_Rshift,      0,        NULL},
+    {"lt",       OPKIND_COMPARE, NULL,                 Py_LT,    NULL},
+    {"le",       OPKIND_COMPARE, NULL,                 Py_LE,    NULL},
+    {"eq",       OPKIND_COMPARE, NULL,                 Py_EQ,    NULL},
+    {"ne",       OPKIND_COMPARE, NULL,                 Py_NE,    NULL},
+    {"gt",       OPKIND_COMPARE, NULL,                 Py_GT,    NULL},
+    {"ge",       OPKIND_COMPARE, NULL,                 Py_GE,    NULL},
+    {"neg",      OPKIND_UNARY,   NULL,                 0,        PyNumber_Negative},
+    {"pos",      OPKIND_UNARY,   NULL,                 0,        PyNumber_Positive},
+    {"abs",      OPKIND_UNARY,   NULL,                 0,        PyNumber_Absolute},
+    {"invert",   OPKIND_UNARY,   NULL,                 0,        PyNumber_Invert},
+    {"not",      OPKIND_UNARY,   NULL,                 0,        object_not},
+    {"len",      OPKIND_SIZE,    NULL,                 0,        NULL},
+    {"numel",    OPKIND_SIZE,    NULL,                 0,        NULL},
+};
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    bool is_float;
+    double d;
+    long long int i;
+} fast_scalar_t;
+
+// UTILITY FUNCTIONS ///////////////////////////////////////////////////////////
+
+/**
+ * Attempts to read a MATLAB argument as a plain real scalar, either from a
+ * native numeric or logical 1x1 array, or from a PyObject wrapping an exact
+ * Python float, int, long or bool. Returns false if the argument is anything
+ * else, in which case the caller should take the generic path.
+ */
+static bool get_fast_scalar(const mxArray* m_value, fast_scalar_t* out) {
+    PyObject* py_value;
+
+    if (is_boxed_pyobject(m_value)) {
+        py_value = unbox_pyobject(m_value);
+        if (PyFloat_CheckExact(py_value)) {
+            out->is_float = true;
+            out->d = PyFloat_AS_DOUBLE(py_value);
+            return true;
+        } else if (PyInt_CheckExact(py_value) || PyBool_Check(py_value)) {
+            out->is_float = false;
+            out->i = PyInt_AS_LONG(py_value);
+            return true;
+        } else if (PyLong_CheckExact(py_value)) {
+            out->is_float = false;
+            out->i = PyLong_AsLongLong(py_value);
+            if (out->i == -1 && PyErr_Occurred() != NULL) {
+                // Too big for a C long long; let Python deal with it.
+                PyErr_Clear();
+                return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    if (mxIsComplex(m_value) || mxIsSparse(m_value) ||
+            mxGetNumberOfElements(m_value) != 1) {
+        return false;
+    }
+
+    // These mirror the scalar conversions performed by mat2py.
+    switch (mxGetClassID(m_value)) {
+        case mxDOUBLE_CLASS:
+            out->is_float = true;
+            out->d = *(double*)mxGetData(m_value);
+            return true;
+
+        case mxLOGICAL_CLASS:
+            out->is_float = false;
+            out->i = mxIsLogicalScalarTrue(m_value) ? 1 : 0;
+            return true;
+
+        case mxINT32_CLASS:
+            out->is_float = false;
+            out->i = *(int*)mxGetData(m_value);
+            return true;
+
+        case mxINT64_CLASS:
+            out->is_float = false;
+            out->i = *(long long int*)mxGetData(m_value);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static double fast_scalar_as_double(const fast_scalar_t* scalar) {
+    return scalar->is_float ? scalar->d : (double) scalar->i;
+}
+
+static bool exactly_representable(const fast_scalar_t* scalar) {
+    return scalar->is_float ||
+        (scalar->i <= EXACT_DOUBLE_INT_MAX && scalar->i >= -EXACT_DOUBLE_INT_MAX);
+}
+
+// OPERATOR FUNCTIONS //////////////////////////////////////////////////////////
+
+/**
+ * Returns the table entry for the given operator code, or NULL if the code
+ * is out of range.
+ */
+const operator_entry_t* get_operator(int op) {
+    if (op < 0 || op >= N_OPERATORS) {
+        return NULL;
+    }
+    return &OPERATORS[op];
+}
+
+/**
+ * Applies a binary or comparison operator to two Python objects, returning
+ * a new reference, or NULL with a Python exception set.
+ */
+PyObject* apply_binary_operator(const operator_entry_t* entry, PyObject* a, PyObject* b) {
+    if (entry->kind == OPKIND_COMPARE) {
+        return PyObject_RichCompare(a, b, entry->richcmp_op);
+    } else {
+        return entry->binary_fn(a, b);
+    }
+}
+
+/**
+ * Applies a unary operator to a Python object, returning a new reference,
+ * or NULL with a Python exception set.
+ */
+PyObject* apply_unary_operator(const operator_entry_t* entry, PyObject* a) {
+    return entry->unary_fn(a);
+}
+
+/**
+ * Evaluates a binary operator directly in C when both operands are plain
+ * real scalars, so that neither the operands nor the result need to be
+ * marshalled through Python. Only cases where C arithmetic agrees exactly
+ * with Python's float semantics are handled; anything that could raise
+ * (division by zero, domain errors) or that depends on Python's integer
+ * promotion rules returns false and is left to the generic path.
+ *
+ * @param result: Assigned a new MATLAB scalar if and only if true is
+ *     returned.
+ */
+bool fast_scalar_binop(const operator_entry_t* entry, const mxArray* m_a, const mxArray* m_b, mxArray** result) {
+    fast_scalar_t a, b;
+    double x, y, r;
+    bool c;
+
+    if (entry->kind != OPKIND_BINARY && entry->kind != OPKIND_COMPARE) {
+        return false;
+    }
+    if (!get_fast_scalar(m_a, &a) || !get_fast_scalar(m_b, &b)) {
+        return false;
+    }
+
+    if (entry->kind == OPKIND_COMPARE) {
+        if (!a.is_float && !b.is_float) {
+            switch (entry->richcmp_op) {
+                case Py_LT: c = a.i <  b.i; break;
+                case Py_LE: c = a.i <= b.i; break;
+                case Py_EQ: c = a.i == b.i; break;
+                case Py_NE: c = a.i != b.i; break;
+                case Py_GT: c = a.i >  b.i; break;
+                case Py_GE: c = a.i >= b.i; break;
+                default: return false;
+            }
+        } else {
+            if (!exactly_representable(&a) || !exactly_representable(&b)) {
+                return false;
+            }
+            x = fast_scalar_as_double(&a);
+            y = fast_scalar_as_double(&b);
+            switch (entry->richcmp_op) {
+                case Py_LT: c = x <  y; break;
+                case Py_LE: c = x <= y; break;
+                case Py_EQ: c = x == y; break;
+                case Py_NE: c = x != y; break;
+                case Py_GT: c = x >  y; break;
+                case Py_GE: c = x >= y; break;
+                default: return false;
+            }
+        }
+        *result = mxCreateLogicalScalar(c);
+        return true;
+    }
+
+    // Integer-only arithmetic can promote to long or floor-divide in Python,
+    // so we only short-circuit once a float is involved.
+    if (!a.is_float && !b.is_float) {
+        return false;
+    }
+    x = fast_scalar_as_double(&a);
+    y = fast_scalar_as_double(&b);
+
+    switch (entry - OPERATORS) {
+        case OP_ADD:
+            r = x + y;
+            break;
+
+        case OP_SUB:
+            r = x - y;
+            break;
+
+        case OP_MUL:
+            r = x * y;
+            break;
+
+        case OP_TRUEDIV:
+            if (y == 0.0) {
+                return false;
+            }
+            r = x / y;
+            break;
+
+        case OP_POW:
+            // Python raises for negative bases and overflows, and special
+            // cases infinities, so stick to the well-behaved region.
+            if (x <= 0.0 || !isfinite(x) || !isfinite(y)) {
+                return false;
+            }
+            r = pow(x, y);
+            if (!isfinite(r)) {
+                return false;
+            }
+            break;
+
+        default:
+            return false;
+    }
+
+    *result = mxCreateDoubleScalar(r);
+    return true;
+}
+
+/**
+ * As fast_scalar_binop, but for unary operators.
+ */
+bool fast_scalar_unop(const operator_entry_t* entry, const mxArray* m_a, mxArray** result) {
+    fast_scalar_t a;
+
+    if (entry->kind != OPKIND_UNARY || !get_fast_scalar(m_a, &a)) {
+        return false;
+    }
+
+    switch (entry - OPERATORS) {
+        case OP_NOT:
+            *result = mxCreateLogicalScalar(
+                a.is_float ? a.d == 0.0 : a.i == 0
+            );
+            return true;
+
+        case OP_NEG:
+            if (!a.is_float) return false;
+            *result = mxCreateDoubleScalar(-a.d);
+            return true;
+
+        case OP_POS:
+            if (!a.is_float) return false;
+            *result = mxCreateDoubleScalar(a.d);
+            return true;
+
+        case OP_ABS:
+            if (!a.is_float) return false;
+            *result = mxCreateDoubleScalar(fabs(a.d));
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * If the result of an operator is an exact Python float or bool, converts it
+ * straight to a MATLAB scalar, skipping py2mat's boxed-mxArray check. On
+ * success, the reference to py_value is consumed; otherwise, NULL is returned
+ * and the caller still owns py_value.
+ */
+mxArray* fast_scalar_result(PyObject* py_value) {
+    mxArray* mat_value;
+
+    if (PyFloat_CheckExact(py_value)) {
+        mat_value = mxCreateDoubleScalar(PyFloat_AS_DOUBLE(py_value));
+    } else if (PyBool_Check(py_value)) {
+        mat_value = mxCreateLogicalScalar(py_value == Py_True);
+    } else {
+        return NULL;
+    }
+
+    Py_DECREF(py_value);
+    return mat_value;
+}
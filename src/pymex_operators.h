@@ -0,0 +1,99 @@
+/**
+ * pymex_operators.h: Table of Python operators exposed to PyObject.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_OPERATORS_H
+#define PYMEX_OPERATORS_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Keep in sync with py_operator_t.m.
+typedef enum {
+    // Binary arithmetic operators.
+    OP_ADD = 0,
+    OP_SUB = 1,
+    OP_MUL = 2,
+    OP_TRUEDIV = 3,
+    OP_FLOORDIV = 4,
+    OP_MOD = 5,
+    OP_POW = 6,
+    OP_AND = 7,
+    OP_OR = 8,
+    OP_XOR = 9,
+    OP_LSHIFT = 10,
+    OP_RSHIFT = 11,
+    // Rich comparisons.
+    OP_LT = 12,
+    OP_LE = 13,
+    OP_EQ = 14,
+    OP_NE = 15,
+    OP_GT = 16,
+    OP_GE = 17,
+    // Unary operators.
+    OP_NEG = 18,
+    OP_POS = 19,
+    OP_ABS = 20,
+    OP_INVERT = 21,
+    OP_NOT = 22,
+    OP_LEN = 23,
+    OP_NUMEL = 24,
+
+    N_OPERATORS = 25
+} operator_t;
+
+typedef enum {
+    OPKIND_BINARY,
+    OPKIND_COMPARE,
+    OPKIND_UNARY,
+    OPKIND_SIZE
+} operator_kind_t;
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    const char* name;
+    operator_kind_t kind;
+    // Exactly one of the following is used, depending on kind.
+    binaryfunc binary_fn;
+    int richcmp_op;
+    unaryfunc unary_fn;
+} operator_entry_t;
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+const operator_entry_t* get_operator(int op);
+
+PyObject* apply_binary_operator(const operator_entry_t* entry, PyObject* a, PyObject* b);
+PyObject* apply_unary_operator(const operator_entry_t* entry, PyObject* a);
+
+bool fast_scalar_binop(const operator_entry_t* entry, const mxArray* m_a, const mxArray* m_b, mxArray** result);
+bool fast_scalar_unop(const operator_entry_t* entry, const mxArray* m_a, mxArray** result);
+mxArray* fast_scalar_result(PyObject* py_value);
+
+#endif
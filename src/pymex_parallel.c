@@ -0,0 +1,268 @@
+/**
+ * pymex_parallel.c: Worker pool for copying array payloads in parallel.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Marshalling large containers mostly comes down to copying numeric
+// payloads, which needs neither the GIL nor the MEX API. The caller
+// allocates every destination array up front, then hands the list of
+// copies to parallel_copy, which splits them into chunks and shares the
+// chunks out between a persistent pool of worker threads and the caller.
+// Workers only ever call memcpy.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include "pymex_parallel.h"
+
+#ifndef WINDOWS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+// Pool state is allocated with malloc and outlives MEX calls, like the
+// release queue.
+
+// Requested number of threads, counting the caller; 0 means one per CPU.
+static int requested_threads = 0;
+
+#ifndef WINDOWS
+
+static pthread_t workers[MAX_MARSHAL_THREADS];
+static int n_workers = 0;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_done = PTHREAD_COND_INITIALIZER;
+static bool pool_stopping = false;
+
+// The current batch. Workers notice a new batch by the generation changing,
+// and report back by decrementing batch_pending.
+static unsigned long batch_generation = 0;
+static int batch_pending = 0;
+static copy_job_t* batch_chunks = NULL;
+static size_t batch_n_chunks = 0;
+static size_t batch_next_chunk = 0;
+
+#endif
+
+// CONFIGURATION ///////////////////////////////////////////////////////////////
+
+/**
+ * Sets how many threads (including the calling thread) share copies. Zero
+ * picks one per online CPU, and one disables the pool.
+ */
+void set_marshal_threads(int n_threads) {
+    if (n_threads < 0) {
+        n_threads = 0;
+    } else if (n_threads > MAX_MARSHAL_THREADS) {
+        n_threads = MAX_MARSHAL_THREADS;
+    }
+    requested_threads = n_threads;
+    
+    // Let surplus workers go; missing ones are started on the next batch.
+    if (get_marshal_threads() - 1 < n_workers) {
+        shutdown_marshal_pool();
+    }
+}
+
+/**
+ * Returns the number of threads a large copy will be split between.
+ */
+int get_marshal_threads() {
+    #ifdef WINDOWS
+        return 1;
+    #else
+        long n_cpus;
+        
+        if (requested_threads > 0) {
+            return requested_threads;
+        }
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_cpus < 1) {
+            return 1;
+        }
+        return n_cpus > MAX_MARSHAL_THREADS ? MAX_MARSHAL_THREADS : (int) n_cpus;
+    #endif
+}
+
+bool parallel_copy_worthwhile(size_t n_bytes) {
+    return n_bytes >= PARALLEL_COPY_MIN_BYTES && get_marshal_threads() > 1;
+}
+
+// WORKER POOL /////////////////////////////////////////////////////////////////
+
+#ifndef WINDOWS
+
+static void run_chunks() {
+    size_t idx;
+    
+    while ((idx = __sync_fetch_and_add(&batch_next_chunk, 1)) < batch_n_chunks) {
+        memcpy(batch_chunks[idx].dst, batch_chunks[idx].src, batch_chunks[idx].n_bytes);
+    }
+}
+
+/**
+ * Worker thread body. The argument is the batch generation current when the
+ * worker was started, so that a batch begun before the worker first takes
+ * the lock isn't mistaken for one already done.
+ */
+static void* worker_main(void* arg) {
+    unsigned long seen = (unsigned long) arg;
+    
+    pthread_mutex_lock(&pool_lock);
+    for (;;) {
+        while (!pool_stopping && batch_generation == seen) {
+            pthread_cond_wait(&work_ready, &pool_lock);
+        }
+        if (pool_stopping) {
+            break;
+        }
+        seen = batch_generation;
+        pthread_mutex_unlock(&pool_lock);
+        
+        run_chunks();
+        
+        pthread_mutex_lock(&pool_lock);
+        if (--batch_pending == 0) {
+            pthread_cond_signal(&work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+static void ensure_workers(int n_wanted) {
+    while (n_workers < n_wanted) {
+        if (pthread_create(&workers[n_workers], NULL, worker_main,
+                (void*) batch_generation) != 0) {
+            // Run with however many we managed to start.
+            mexWarnMsgTxt("Could not start a marshalling thread; copying with fewer threads.");
+            return;
+        }
+        n_workers++;
+    }
+}
+
+#endif
+
+/**
+ * Joins every worker thread. Safe to call when none are running; the pool
+ * is restarted on demand.
+ */
+void shutdown_marshal_pool() {
+    #ifndef WINDOWS
+        int idx;
+        
+        if (n_workers == 0) {
+            return;
+        }
+        
+        pthread_mutex_lock(&pool_lock);
+        pool_stopping = true;
+        pthread_cond_broadcast(&work_ready);
+        pthread_mutex_unlock(&pool_lock);
+        
+        for (idx = 0; idx < n_workers; ++idx) {
+            pthread_join(workers[idx], NULL);
+        }
+        n_workers = 0;
+        pool_stopping = false;
+    #endif
+}
+
+// COPYING /////////////////////////////////////////////////////////////////////
+
+static void serial_copy(const copy_job_t* jobs, size_t n_jobs) {
+    size_t idx;
+    
+    for (idx = 0; idx < n_jobs; ++idx) {
+        memcpy(jobs[idx].dst, jobs[idx].src, jobs[idx].n_bytes);
+    }
+}
+
+/**
+ * Performs every copy in jobs, splitting them across the pool when the
+ * total is large enough to be worth it. Returns once all copies are done.
+ *
+ * Nothing here touches Python, so callers may release the GIL around it.
+ */
+void parallel_copy(const copy_job_t* jobs, size_t n_jobs) {
+    #ifdef WINDOWS
+        serial_copy(jobs, n_jobs);
+    #else
+        size_t idx, offset, n_bytes, total_bytes = 0, n_chunks = 0;
+        copy_job_t* chunks;
+        
+        for (idx = 0; idx < n_jobs; ++idx) {
+            total_bytes += jobs[idx].n_bytes;
+            n_chunks += (jobs[idx].n_bytes + PARALLEL_COPY_CHUNK_BYTES - 1) / PARALLEL_COPY_CHUNK_BYTES;
+        }
+        
+        if (!parallel_copy_worthwhile(total_bytes)) {
+            serial_copy(jobs, n_jobs);
+            return;
+        }
+        
+        chunks = malloc(n_chunks * sizeof(copy_job_t));
+        if (chunks == NULL) {
+            serial_copy(jobs, n_jobs);
+            return;
+        }
+        n_chunks = 0;
+        for (idx = 0; idx < n_jobs; ++idx) {
+            for (offset = 0; offset < jobs[idx].n_bytes; offset += n_bytes) {
+                n_bytes = jobs[idx].n_bytes - offset;
+                if (n_bytes > PARALLEL_COPY_CHUNK_BYTES) {
+                    n_bytes = PARALLEL_COPY_CHUNK_BYTES;
+                }
+                chunks[n_chunks].dst = (char*) jobs[idx].dst + offset;
+                chunks[n_chunks].src = (const char*) jobs[idx].src + offset;
+                chunks[n_chunks].n_bytes = n_bytes;
+                n_chunks++;
+            }
+        }
+        
+        ensure_workers(get_marshal_threads() - 1);
+        
+        pthread_mutex_lock(&pool_lock);
+        batch_chunks = chunks;
+        batch_n_chunks = n_chunks;
+        batch_next_chunk = 0;
+        batch_pending = n_workers;
+        batch_generation++;
+        pthread_cond_broadcast(&work_ready);
+        pthread_mutex_unlock(&pool_lock);
+        
+        // The calling thread takes chunks too, rather than sitting idle.
+        run_chunks();
+        
+        pthread_mutex_lock(&pool_lock);
+        while (batch_pending > 0) {
+            pthread_cond_wait(&work_done, &pool_lock);
+        }
+        batch_chunks = NULL;
+        batch_n_chunks = 0;
+        pthread_mutex_unlock(&pool_lock);
+        
+        free(chunks);
+    #endif
+}
@@ -0,0 +1,62 @@
+/**
+ * pymex_parallel.h: Worker pool for copying array payloads in parallel.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_PARALLEL_H
+#define PYMEX_PARALLEL_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Total payload below which copies are done on the calling thread, since
+// waking the pool costs more than it saves.
+#define PARALLEL_COPY_MIN_BYTES (16 << 20)
+
+// Copies are split into pieces of at most this size, so that one large
+// array is still shared across the pool.
+#define PARALLEL_COPY_CHUNK_BYTES (4 << 20)
+
+#define MAX_MARSHAL_THREADS 256
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    void* dst;
+    const void* src;
+    size_t n_bytes;
+} copy_job_t;
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+void set_marshal_threads(int n_threads);
+int get_marshal_threads();
+bool parallel_copy_worthwhile(size_t n_bytes);
+void parallel_copy(const copy_job_t* jobs, size_t n_jobs);
+void shutdown_marshal_pool();
+
+#endif
@@ -0,0 +1,620 @@
+/**
+ * pymex_plan.c: Prepared, type-specialized call plans.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// A call plan records, for a Python callable that will be called many times
+// with the same kind of arguments, which converter to use for each argument
+// and for the return value. Each conversion is then guarded by a single test
+// of the MATLAB class (or Python type), skipping the chain of checks in
+// mat2py and py2mat; anything that fails its guard takes the generic path,
+// so a plan never changes the result of a call, only its cost.
+//
+// Function-handle plans (prepare_function_plan) are the exception: they
+// stand in for MATLAB functions passed to optimizers and ODE solvers, so
+// they pass real double arrays as lists of floats and return numbers and
+// sequences of numbers as doubles, instead of boxing them. Their argument
+// converters are learned from the first call rather than from examples.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "pymex_plan.h"
+#include "pymex_marshal.h"
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define CALL_PLAN_CAPSULE_NAME "pymex.call_plan"
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef enum {
+    CONV_GENERIC = 0,
+    CONV_DOUBLE_SCALAR,
+    CONV_LOGICAL_SCALAR,
+    CONV_INT32_SCALAR,
+    CONV_INT64_SCALAR,
+    CONV_STRING,
+    CONV_PYOBJECT,
+    // Function-handle plans only: real double arrays as lists of floats,
+    // and numbers or sequences of numbers as doubles.
+    CONV_DOUBLES
+} converter_t;
+
+typedef struct {
+    PyObject* callee;
+    // Negative until a function-handle plan is first called.
+    int n_args;
+    converter_t* arg_convs;
+    // Unknown (NULL) until the first call returns, and learned again if a
+    // converter is registered later.
+    PyTypeObject* ret_type;
+    converter_t ret_conv;
+    unsigned long ret_generation;
+    // Argument tuple, reused between calls when nothing else kept it.
+    PyObject* args;
+    // Lists passed for CONV_DOUBLES arguments (and for the points of a
+    // vectorized plan), refilled on later calls when nothing else kept them.
+    PyObject** arg_lists;
+    bool numeric_arrays;
+    bool vectorized;
+} call_plan_t;
+
+// CONVERTERS //////////////////////////////////////////////////////////////////
+
+static bool is_real_scalar(const mxArray* m_value, mxClassID class_id) {
+    return mxGetClassID(m_value) == class_id && mxGetNumberOfElements(m_value) == 1 &&
+        !mxIsComplex(m_value);
+}
+
+static bool is_real_double_array(const mxArray* m_value) {
+    return mxIsDouble(m_value) && !mxIsComplex(m_value) && !mxIsSparse(m_value);
+}
+
+static bool is_number(PyObject* py_value) {
+    return PyFloat_Check(py_value) || PyInt_Check(py_value) || PyLong_Check(py_value);
+}
+
+/**
+ * Returns py_value as a new reference to a list or tuple of numbers, or
+ * NULL (with no exception set) if it isn't a sequence of numbers.
+ */
+static PyObject* as_number_sequence(PyObject* py_value) {
+    PyObject* seq;
+    Py_ssize_t idx;
+    
+    if (PyString_Check(py_value) || PyUnicode_Check(py_value) || !PySequence_Check(py_value)) {
+        return NULL;
+    }
+    seq = PySequence_Fast(py_value, "");
+    if (seq == NULL) {
+        PyErr_Clear();
+        return NULL;
+    }
+    for (idx = 0; idx < PySequence_Fast_GET_SIZE(seq); ++idx) {
+        if (!is_number(PySequence_Fast_GET_ITEM(seq, idx))) {
+            Py_DECREF(seq);
+            return NULL;
+        }
+    }
+    return seq;
+}
+
+/**
+ * Copies a sequence from as_number_sequence into out. Returns false, with
+ * an exception set, if a value doesn't fit in a double.
+ */
+static bool copy_numbers(PyObject* seq, double* out) {
+    Py_ssize_t idx;
+    
+    for (idx = 0; idx < PySequence_Fast_GET_SIZE(seq); ++idx) {
+        out[idx] = PyFloat_AsDouble(PySequence_Fast_GET_ITEM(seq, idx));
+    }
+    return PyErr_Occurred() == NULL;
+}
+
+/**
+ * Returns a list of the n doubles at data. The list in *cache is refilled
+ * and returned if nothing else refers to it; otherwise a new list replaces
+ * it. Returns a new reference.
+ */
+static PyObject* double_list(PyObject** cache, const double* data, Py_ssize_t n) {
+    PyObject *list = *cache, *item;
+    Py_ssize_t idx;
+    
+    if (list == NULL || Py_REFCNT(list) > 1 || PyList_GET_SIZE(list) != n) {
+        list = PyList_New(n);
+        for (idx = 0; idx < n; ++idx) {
+            PyList_SET_ITEM(list, idx, PyFloat_FromDouble(data[idx]));
+        }
+        Py_XDECREF(*cache);
+        *cache = list;
+    } else {
+        for (idx = 0; idx < n; ++idx) {
+            item = PyList_GET_ITEM(list, idx);
+            // A float that only this list refers to can't be seen to
+            // change, so it is overwritten rather than reallocated.
+            if (PyFloat_CheckExact(item) && Py_REFCNT(item) == 1) {
+                ((PyFloatObject*) item)->ob_fval = data[idx];
+            } else {
+                PyList_SET_ITEM(list, idx, PyFloat_FromDouble(data[idx]));
+                Py_DECREF(item);
+            }
+        }
+    }
+    
+    Py_INCREF(list);
+    return list;
+}
+
+/**
+ * Picks the converter for an example argument.
+ */
+static converter_t arg_converter_for(const mxArray* m_value, bool numeric_arrays) {
+    if (numeric_arrays && is_real_double_array(m_value) && mxGetNumberOfElements(m_value) != 1) {
+        return CONV_DOUBLES;
+    }
+    if (is_boxed_pyobject(m_value)) {
+        return CONV_PYOBJECT;
+    }
+    if (mxIsChar(m_value) && mxGetM(m_value) == 1) {
+        return CONV_STRING;
+    }
+    if (mxGetNumberOfElements(m_value) != 1 || mxIsComplex(m_value)) {
+        return CONV_GENERIC;
+    }
+    switch (mxGetClassID(m_value)) {
+        case mxDOUBLE_CLASS:    return CONV_DOUBLE_SCALAR;
+        case mxLOGICAL_CLASS:   return CONV_LOGICAL_SCALAR;
+        case mxINT32_CLASS:     return CONV_INT32_SCALAR;
+        case mxINT64_CLASS:     return CONV_INT64_SCALAR;
+        default:                return CONV_GENERIC;
+    }
+}
+
+/**
+ * Picks the converter for a value returned by the callee, or CONV_GENERIC
+ * if the type has no exact MATLAB counterpart or a registered converter. Subclasses are not
+ * specialized, since py2mat may treat them differently, except that
+ * function-handle plans take any number or sequence of numbers.
+ */
+static converter_t ret_converter_for(PyObject* py_value, bool numeric_arrays) {
+    PyObject* seq;
+    
+    // Converters registered from Python take precedence, as in py2mat.
+    if (has_registered_converter(Py_TYPE(py_value))) {
+        return CONV_GENERIC;
+    }
+    if (numeric_arrays && !PyBool_Check(py_value)) {
+        if (is_number(py_value)) {
+            return CONV_DOUBLES;
+        }
+        if ((seq = as_number_sequence(py_value)) != NULL) {
+            Py_DECREF(seq);
+            return CONV_DOUBLES;
+        }
+    }
+    if (PyFloat_CheckExact(py_value)) {
+        return CONV_DOUBLE_SCALAR;
+    } else if (PyBool_Check(py_value)) {
+        return CONV_LOGICAL_SCALAR;
+    } else if (PyInt_CheckExact(py_value)) {
+        return CONV_INT32_SCALAR;
+    } else if (PyLong_CheckExact(py_value)) {
+        return CONV_INT64_SCALAR;
+    } else if (PyString_CheckExact(py_value)) {
+        return CONV_STRING;
+    }
+    return CONV_GENERIC;
+}
+
+/**
+ * Converts an argument with the given converter, falling back to mat2py if
+ * the argument doesn't match it. CONV_DOUBLES reuses the list in
+ * *cache where it can. Returns a new reference.
+ */
+static PyObject* convert_arg(converter_t conv, const mxArray* m_value, PyObject** cache) {
+    PyObject* py_value;
+    
+    switch (conv) {
+        case CONV_DOUBLE_SCALAR:
+            if (is_real_scalar(m_value, mxDOUBLE_CLASS)) {
+                return PyFloat_FromDouble(*mxGetPr(m_value));
+            }
+            break;
+            
+        case CONV_LOGICAL_SCALAR:
+            if (is_real_scalar(m_value, mxLOGICAL_CLASS)) {
+                return PyBool_FromLong(*mxGetLogicals(m_value));
+            }
+            break;
+            
+        case CONV_INT32_SCALAR:
+            if (is_real_scalar(m_value, mxINT32_CLASS)) {
+                return PyInt_FromLong(*(int*) mxGetData(m_value));
+            }
+            break;
+            
+        case CONV_INT64_SCALAR:
+            if (is_real_scalar(m_value, mxINT64_CLASS)) {
+                return PyLong_FromLongLong(*(long long int*) mxGetData(m_value));
+            }
+            break;
+            
+        case CONV_STRING:
+            // The same conversion as mat2py, so that NULs and non-ASCII
+            // characters come out the same either way.
+            if (mxIsChar(m_value) && mxGetM(m_value) <= 1) {
+                return py_str_from_mat(m_value);
+            }
+            break;
+            
+        case CONV_PYOBJECT:
+            if (is_boxed_pyobject(m_value)) {
+                py_value = unbox_pyobject(m_value);
+                Py_INCREF(py_value);
+                return py_value;
+            }
+            break;
+            
+        case CONV_DOUBLES:
+            if (is_real_double_array(m_value)) {
+                return double_list(cache, mxGetPr(m_value), mxGetNumberOfElements(m_value));
+            }
+            break;
+            
+        default:
+            break;
+    }
+    
+    return mat2py(m_value, false);
+}
+
+/**
+ * Converts a return value with the plan's converter, which must already
+ * have been checked against its type. Consumes the reference.
+ */
+static mxArray* convert_ret(converter_t conv, PyObject* py_value) {
+    mxArray* m_value;
+    PyObject* seq;
+    
+    switch (conv) {
+        case CONV_DOUBLE_SCALAR:
+            m_value = mxCreateDoubleScalar(PyFloat_AS_DOUBLE(py_value));
+            break;
+            
+        case CONV_LOGICAL_SCALAR:
+            m_value = mxCreateLogicalScalar(py_value == Py_True);
+            break;
+            
+        case CONV_INT32_SCALAR:
+            m_value = mxCreateNumericMatrix(1, 1, mxINT32_CLASS, mxREAL);
+            *(int*) mxGetData(m_value) = (int) PyInt_AS_LONG(py_value);
+            break;
+            
+        case CONV_INT64_SCALAR:
+            m_value = mxCreateNumericMatrix(1, 1, mxINT64_CLASS, mxREAL);
+            *(long long int*) mxGetData(m_value) = PyLong_AsLongLong(py_value);
+            if (PyErr_Occurred() != NULL) {
+                // Too large for int64; py2mat boxes it instead.
+                PyErr_Clear();
+                mxDestroyArray(m_value);
+                return py2mat(py_value);
+            }
+            break;
+            
+        case CONV_STRING:
+            m_value = mxCreateString(PyString_AS_STRING(py_value));
+            break;
+            
+        case CONV_DOUBLES:
+            if (is_number(py_value)) {
+                m_value = mxCreateDoubleScalar(PyFloat_AsDouble(py_value));
+                if (PyErr_Occurred() != NULL) {
+                    PyErr_Clear();
+                    mxDestroyArray(m_value);
+                    return py2mat(py_value);
+                }
+                break;
+            }
+            // Only the type was guarded, so the contents may not match.
+            seq = as_number_sequence(py_value);
+            if (seq == NULL) {
+                return py2mat(py_value);
+            }
+            m_value = mxCreateDoubleMatrix(PySequence_Fast_GET_SIZE(seq), 1, mxREAL);
+            if (!copy_numbers(seq, mxGetPr(m_value))) {
+                PyErr_Clear();
+                mxDestroyArray(m_value);
+                Py_DECREF(seq);
+                return py2mat(py_value);
+            }
+            Py_DECREF(seq);
+            break;
+            
+        default:
+            return py2mat(py_value);
+    }
+    
+    Py_DECREF(py_value);
+    return m_value;
+}
+
+// PLAN LIFETIME ///////////////////////////////////////////////////////////////
+
+static void destroy_call_plan(PyObject* capsule) {
+    call_plan_t* plan = PyCapsule_GetPointer(capsule, CALL_PLAN_CAPSULE_NAME);
+    int idx;
+    
+    Py_XDECREF(plan->callee);
+    Py_XDECREF(plan->args);
+    for (idx = 0; idx < plan->n_args; ++idx) {
+        Py_XDECREF(plan->arg_lists[idx]);
+    }
+    free(plan->arg_lists);
+    free(plan->arg_convs);
+    free(plan);
+}
+
+static call_plan_t* new_call_plan(PyObject* callee) {
+    // The plan outlives this MEX call, so it can't use mxMalloc.
+    call_plan_t* plan = calloc(1, sizeof(call_plan_t));
+    
+    plan->callee = callee;
+    Py_INCREF(callee);
+    plan->n_args = -1;
+    plan->ret_conv = CONV_GENERIC;
+    return plan;
+}
+
+/**
+ * Fixes the number of arguments of a plan and their converters.
+ */
+static void specialize_call_plan(call_plan_t* plan, int n_args, const mxArray* examples[]) {
+    int idx;
+    
+    plan->n_args = n_args;
+    plan->arg_convs = calloc(n_args + 1, sizeof(converter_t));
+    plan->arg_lists = calloc(n_args + 1, sizeof(PyObject*));
+    for (idx = 0; idx < n_args; ++idx) {
+        plan->arg_convs[idx] = arg_converter_for(examples[idx], plan->numeric_arrays);
+    }
+    plan->args = PyTuple_New(n_args);
+}
+
+/**
+ * Creates a plan for calling callee with arguments like those in examples.
+ * The plan is returned as a capsule, so that it can be boxed and released
+ * like any other PyObject.
+ */
+PyObject* prepare_call_plan(PyObject* callee, int n_args, const mxArray* examples[]) {
+    call_plan_t* plan = new_call_plan(callee);
+    
+    specialize_call_plan(plan, n_args, examples);
+    return PyCapsule_New(plan, CALL_PLAN_CAPSULE_NAME, destroy_call_plan);
+}
+
+/**
+ * Creates a plan for calling callee as a MATLAB function handle; see the
+ * top of this file. If vectorized, the callee is called once per column of
+ * its last argument, as described for call_vectorized.
+ */
+PyObject* prepare_function_plan(PyObject* callee, bool vectorized) {
+    call_plan_t* plan = new_call_plan(callee);
+    
+    plan->numeric_arrays = true;
+    plan->vectorized = vectorized;
+    return PyCapsule_New(plan, CALL_PLAN_CAPSULE_NAME, destroy_call_plan);
+}
+
+// CALLING /////////////////////////////////////////////////////////////////////
+
+/**
+ * Calls a vectorized plan's callee once per column of the last argument,
+ * passing each column as a list of floats (or as a float, if the last
+ * argument is a row vector), and returns the results as the columns of a
+ * single double matrix. Each result must be a number or a sequence of
+ * numbers, all of the same length. Returns NULL with a Python exception
+ * set on error.
+ */
+static mxArray* call_vectorized(call_plan_t* plan, int n_args, const mxArray* args[]) {
+    const mxArray* m_points = args[n_args - 1];
+    bool planned = n_args == plan->n_args;
+    PyObject *py_args, *copy, *point, *result, *seq, *scratch = NULL;
+    PyObject** cache = planned ? &plan->arg_lists[n_args - 1] : &scratch;
+    mxArray* m_result = NULL;
+    const double* points;
+    double* out = NULL;
+    size_t n_dims, n_points, n_outputs = 0, idx_point, n_values;
+    bool ok = true;
+    int idx;
+    
+    if (!is_real_double_array(m_points)) {
+        PyErr_SetString(PyExc_TypeError,
+            "The last argument of a vectorized function must be a real double matrix.");
+        return NULL;
+    }
+    n_dims = mxGetM(m_points);
+    n_points = n_dims == 0 ? 0 : mxGetNumberOfElements(m_points) / n_dims;
+    points = mxGetPr(m_points);
+    
+    // The other arguments are converted once, for all points.
+    py_args = PyTuple_New(n_args);
+    for (idx = 0; idx < n_args - 1; ++idx) {
+        PyTuple_SET_ITEM(py_args, idx, convert_arg(
+            planned ? plan->arg_convs[idx] : CONV_GENERIC, args[idx],
+            planned ? &plan->arg_lists[idx] : NULL
+        ));
+    }
+    
+    for (idx_point = 0; ok && idx_point < n_points; ++idx_point) {
+        if (n_dims == 1) {
+            point = PyFloat_FromDouble(points[idx_point]);
+        } else {
+            point = double_list(cache, points + idx_point * n_dims, n_dims);
+        }
+        PyTuple_SET_ITEM(py_args, n_args - 1, point);
+        result = PyObject_Call(plan->callee, py_args, NULL);
+        
+        // Take the point back out of the tuple, so that its list can be
+        // refilled, unless the callee kept the tuple.
+        if (Py_REFCNT(py_args) == 1) {
+            PyTuple_SET_ITEM(py_args, n_args - 1, NULL);
+            Py_DECREF(point);
+        } else {
+            copy = PyTuple_New(n_args);
+            for (idx = 0; idx < n_args - 1; ++idx) {
+                Py_INCREF(PyTuple_GET_ITEM(py_args, idx));
+                PyTuple_SET_ITEM(copy, idx, PyTuple_GET_ITEM(py_args, idx));
+            }
+            Py_DECREF(py_args);
+            py_args = copy;
+        }
+        
+        if (result == NULL) {
+            ok = false;
+            break;
+        }
+        
+        seq = NULL;
+        if (is_number(result)) {
+            n_values = 1;
+        } else if ((seq = as_number_sequence(result)) != NULL) {
+            n_values = PySequence_Fast_GET_SIZE(seq);
+        } else {
+            PyErr_SetString(PyExc_TypeError,
+                "Vectorized functions must return numbers or sequences of numbers.");
+            Py_DECREF(result);
+            ok = false;
+            break;
+        }
+        
+        // The output is allocated once the first result gives its height,
+        // and every point's result is written straight into it.
+        if (m_result == NULL) {
+            n_outputs = n_values;
+            m_result = mxCreateDoubleMatrix(n_outputs, n_points, mxREAL);
+            out = mxGetPr(m_result);
+        }
+        if (n_values != n_outputs) {
+            PyErr_Format(PyExc_ValueError,
+                "Vectorized function returned %zu values for point %zu, but %zu for the first.",
+                n_values, idx_point + 1, n_outputs);
+            ok = false;
+        } else if (seq == NULL) {
+            out[idx_point] = PyFloat_AsDouble(result);
+            ok = PyErr_Occurred() == NULL;
+        } else {
+            ok = copy_numbers(seq, out + idx_point * n_outputs);
+        }
+        Py_XDECREF(seq);
+        Py_DECREF(result);
+    }
+    
+    Py_DECREF(py_args);
+    Py_XDECREF(scratch);
+    
+    if (!ok) {
+        if (m_result != NULL) {
+            mxDestroyArray(m_result);
+        }
+        return NULL;
+    }
+    if (m_result == NULL) {
+        m_result = mxCreateDoubleMatrix(0, n_points, mxREAL);
+    }
+    return m_result;
+}
+
+/**
+ * Calls a plan's callee with the given MATLAB arguments, returning the
+ * result as a MATLAB array, or NULL with a Python exception set.
+ */
+mxArray* call_with_plan(PyObject* py_plan, int n_args, const mxArray* args[]) {
+    call_plan_t* plan;
+    PyObject *py_args, *result, *item;
+    bool planned;
+    int idx;
+    
+    plan = PyCapsule_GetPointer(py_plan, CALL_PLAN_CAPSULE_NAME);
+    if (plan == NULL) {
+        return NULL;
+    }
+    
+    // Function-handle plans are specialized to their first call.
+    if (plan->n_args < 0) {
+        specialize_call_plan(plan, n_args, args);
+    }
+    if (plan->vectorized && n_args > 0) {
+        return call_vectorized(plan, n_args, args);
+    }
+    planned = n_args == plan->n_args;
+    
+    // If the callee held on to the last argument tuple (e.g. via *args), it
+    // now belongs to them, and we start a new one.
+    if (planned && Py_REFCNT(plan->args) == 1) {
+        py_args = plan->args;
+        Py_INCREF(py_args);
+    } else {
+        py_args = PyTuple_New(n_args);
+        if (planned) {
+            Py_DECREF(plan->args);
+            plan->args = py_args;
+            Py_INCREF(py_args);
+        }
+    }
+    
+    for (idx = 0; idx < n_args; ++idx) {
+        PyTuple_SET_ITEM(py_args, idx, convert_arg(
+            planned ? plan->arg_convs[idx] : CONV_GENERIC, args[idx],
+            planned ? &plan->arg_lists[idx] : NULL
+        ));
+    }
+    
+    result = PyObject_Call(plan->callee, py_args, NULL);
+    
+    // Empty the tuple so that it can be reused without keeping the
+    // arguments alive.
+    if (py_args == plan->args && Py_REFCNT(py_args) == 2) {
+        for (idx = 0; idx < n_args; ++idx) {
+            item = PyTuple_GET_ITEM(py_args, idx);
+            PyTuple_SET_ITEM(py_args, idx, NULL);
+            Py_DECREF(item);
+        }
+    }
+    Py_DECREF(py_args);
+    
+    if (result == NULL) {
+        return NULL;
+    }
+    
+    // The return type is learned from the first call.
+    if (plan->ret_type == NULL || plan->ret_generation != converter_generation) {
+        plan->ret_type = Py_TYPE(result);
+        plan->ret_conv = ret_converter_for(result, plan->numeric_arrays);
+        plan->ret_generation = converter_generation;
+    }
+    
+    if (Py_TYPE(result) == plan->ret_type) {
+        return convert_ret(plan->ret_conv, result);
+    }
+    if (plan->numeric_arrays) {
+        return convert_ret(ret_converter_for(result, true), result);
+    }
+    return py2mat(result);
+}
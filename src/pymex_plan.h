@@ -0,0 +1,40 @@
+/**
+ * pymex_plan.h: Prepared, type-specialized call plans.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_PLAN_H
+#define PYMEX_PLAN_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+PyObject* prepare_call_plan(PyObject* callee, int n_args, const mxArray* examples[]);
+PyObject* prepare_function_plan(PyObject* callee, bool vectorized);
+mxArray* call_with_plan(PyObject* py_plan, int n_args, const mxArray* args[]);
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ * pymex_release.c: Deferred, batched release of Python references.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include "pymex_release.h"
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+// The queue is allocated with malloc rather than mxMalloc, since it must
+// persist across MEX calls.
+
+static PyObject** release_queue = NULL;
+static size_t release_queue_len = 0;
+static size_t release_queue_capacity = 0;
+static bool draining = false;
+
+// QUEUE FUNCTIONS /////////////////////////////////////////////////////////////
+
+/**
+ * Takes ownership of a reference that would otherwise be DECREF'd right
+ * away, deferring the DECREF until the queue is next drained. If the queue
+ * has grown past RELEASE_QUEUE_THRESHOLD, it is drained immediately.
+ */
+void enqueue_release(PyObject* py_object) {
+    PyObject** new_queue;
+    size_t new_capacity;
+    
+    if (py_object == NULL) {
+        return;
+    }
+    
+    if (release_queue_len == release_queue_capacity) {
+        new_capacity = release_queue_capacity == 0 ? 256 : 2 * release_queue_capacity;
+        new_queue = realloc(release_queue, new_capacity * sizeof(PyObject*));
+        if (new_queue == NULL) {
+            // Out of memory; give up on deferring this one.
+            Py_DECREF(py_object);
+            return;
+        }
+        release_queue = new_queue;
+        release_queue_capacity = new_capacity;
+    }
+    
+    release_queue[release_queue_len++] = py_object;
+    
+    if (release_queue_len >= RELEASE_QUEUE_THRESHOLD) {
+        drain_release_queue();
+    }
+}
+
+/**
+ * DECREFs everything in the queue.
+ *
+ * Releasing a reference can run arbitrary __del__ code, which may call back
+ * into MATLAB and destroy more PyObjects, re-entering enqueue_release. Such
+ * references are appended to the queue and picked up by the same pass, so
+ * we index the queue afresh on every iteration rather than caching a pointer
+ * that realloc might invalidate.
+ */
+void drain_release_queue() {
+    size_t idx;
+    
+    if (draining || release_queue_len == 0) {
+        return;
+    }
+    
+    draining = true;
+    for (idx = 0; idx < release_queue_len; ++idx) {
+        Py_DECREF(release_queue[idx]);
+    }
+    release_queue_len = 0;
+    draining = false;
+}
+
+size_t pending_release_count() {
+    return release_queue_len;
+}
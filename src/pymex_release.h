@@ -0,0 +1,46 @@
+/**
+ * pymex_release.h: Deferred, batched release of Python references.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_RELEASE_H
+#define PYMEX_RELEASE_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Number of pending references at which the queue is drained immediately,
+// rather than waiting for the next non-DECREF call.
+#define RELEASE_QUEUE_THRESHOLD 4096
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+void enqueue_release(PyObject* py_object);
+void drain_release_queue();
+size_t pending_release_count();
+
+#endif
@@ -0,0 +1,399 @@
+/**
+ * pymex_struct.c: Lazy read-only Mapping proxies for MATLAB structs.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// A pymex.StructProxy stands in for a scalar MATLAB struct in Python when
+// lazy_structs is set. It keeps a persistent copy of the struct, and only
+// converts a field with mat2py when Python first reads it, caching the
+// result; fields that are themselves scalar structs become proxies onto
+// the same copy, so reading one setting from a deeply nested configuration
+// converts only that setting. Passed back to MATLAB, a proxy converts to
+// the struct it holds.
+//
+// Converting a field calls the MATLAB API, so from other threads reads of
+// fields not yet cached are queued for the MEX thread (see
+// pymex_callbacks.c) and wait there. Field names are read once, when the
+// proxy is made, so that listing them needs no MATLAB API at all.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "pymex_struct.h"
+#include "pymex_callbacks.h"
+#include "pymex_marshal.h"
+#include "pymex_track.h"
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    PyObject_HEAD
+    // Either the persistent copy itself, or a struct somewhere inside it.
+    mxArray* array;
+    // Capsule owning the persistent copy, shared by the proxy made for it
+    // and every proxy made for a struct inside it. Proxies cache the
+    // proxies for their fields, so pointing the latter back at the former
+    // instead would make cycles.
+    PyObject* holder;
+    // Names of the struct's fields, in order, as a tuple of strings.
+    PyObject* fields;
+    // Fields converted so far, by name.
+    PyObject* cache;
+} struct_proxy_t;
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define HOLDER_NAME "pymex.StructProxy.holder"
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+bool lazy_structs = false;
+
+PyTypeObject struct_proxy_type = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+// PROXIES /////////////////////////////////////////////////////////////////////
+
+/**
+ * Frees a proxied struct once nothing refers to it.
+ */
+static void release_holder(PyObject* holder) {
+    mxArray* array = PyCapsule_GetPointer(holder, HOLDER_NAME);
+    
+    TRACK_RELEASE(array);
+    destroy_array_on_mex_thread(array);
+}
+
+/**
+ * Returns a proxy for a struct inside the copy that holder owns. MEX thread
+ * only.
+ */
+static PyObject* new_proxy(mxArray* array, PyObject* holder) {
+    struct_proxy_t* proxy = PyObject_New(struct_proxy_t, &struct_proxy_type);
+    int n_fields = mxGetNumberOfFields(array), idx_field;
+    PyObject* name;
+    
+    if (proxy == NULL) {
+        return NULL;
+    }
+    proxy->array = array;
+    proxy->holder = holder;
+    Py_INCREF(holder);
+    proxy->cache = NULL;
+    proxy->fields = PyTuple_New(n_fields);
+    if (proxy->fields == NULL) {
+        Py_DECREF(proxy);
+        return NULL;
+    }
+    for (idx_field = 0; idx_field < n_fields; ++idx_field) {
+        name = PyString_FromString(mxGetFieldNameByNumber(array, idx_field));
+        if (name == NULL) {
+            Py_DECREF(proxy);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(proxy->fields, idx_field, name);
+    }
+    proxy->cache = PyDict_New();
+    if (proxy->cache == NULL) {
+        Py_DECREF(proxy);
+        return NULL;
+    }
+    return (PyObject*) proxy;
+}
+
+/**
+ * Returns a proxy for a scalar struct, holding a persistent copy of it.
+ * MEX thread only.
+ */
+PyObject* new_struct_proxy(const mxArray* m_struct) {
+    mxArray* copy = mxDuplicateArray(m_struct);
+    PyObject *holder, *proxy;
+    
+    mexMakeArrayPersistent(copy);
+    TRACK_NEW(TRACK_MXARRAY, copy);
+    holder = PyCapsule_New(copy, HOLDER_NAME, release_holder);
+    if (holder == NULL) {
+        TRACK_RELEASE(copy);
+        mxDestroyArray(copy);
+        return NULL;
+    }
+    proxy = new_proxy(copy, holder);
+    Py_DECREF(holder);
+    return proxy;
+}
+
+static void struct_proxy_dealloc(struct_proxy_t* self) {
+    Py_XDECREF(self->cache);
+    Py_XDECREF(self->fields);
+    Py_XDECREF(self->holder);
+    PyObject_Del(self);
+}
+
+/**
+ * Converts a field for Python: scalar structs become proxies that borrow
+ * the field from this one, and anything else goes through mat2py.
+ */
+static PyObject* convert_field(struct_proxy_t* self, mxArray* field) {
+    if (field == NULL) {
+        // Fields of structs built with mxCreateStructMatrix may be unset.
+        Py_RETURN_NONE;
+    }
+    if (mxIsStruct(field) && mxGetNumberOfElements(field) == 1) {
+        return new_proxy(field, self->holder);
+    }
+    return mat2py(field, false);
+}
+
+/**
+ * Returns the number of the named field, or -1 if there is none.
+ */
+static int field_number(struct_proxy_t* self, PyObject* key) {
+    Py_ssize_t idx_field;
+    
+    if (!PyString_Check(key)) {
+        return -1;
+    }
+    for (idx_field = 0; idx_field < PyTuple_GET_SIZE(self->fields); ++idx_field) {
+        if (strcmp(PyString_AS_STRING(PyTuple_GET_ITEM(self->fields, idx_field)),
+                PyString_AS_STRING(key)) == 0) {
+            return (int) idx_field;
+        }
+    }
+    return -1;
+}
+
+static PyObject* struct_proxy_subscript(struct_proxy_t* self, PyObject* key);
+
+static PyObject* read_field_on_mex_thread(PyObject* self, PyObject* args) {
+    PyObject *proxy, *key;
+    
+    if (!PyArg_ParseTuple(args, "OO", &proxy, &key)) {
+        return NULL;
+    }
+    return struct_proxy_subscript((struct_proxy_t*) proxy, key);
+}
+
+static PyObject* struct_proxy_subscript(struct_proxy_t* self, PyObject* key) {
+    PyObject *value, *args, *future;
+    int idx_field;
+    
+    value = PyDict_GetItem(self->cache, key);
+    if (value != NULL) {
+        Py_INCREF(value);
+        return value;
+    }
+    
+    idx_field = field_number(self, key);
+    if (idx_field < 0) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    
+    if (!on_mex_thread()) {
+        args = PyTuple_Pack(2, (PyObject*) self, key);
+        if (args == NULL) {
+            return NULL;
+        }
+        future = enqueue_callback(read_field_on_mex_thread, METH_VARARGS, args, NULL);
+        Py_DECREF(args);
+        if (future == NULL) {
+            return NULL;
+        }
+        value = PyObject_CallMethod(future, "result", NULL);
+        Py_DECREF(future);
+        return value;
+    }
+    
+    value = convert_field(self, mxGetFieldByNumber(self->array, 0, idx_field));
+    if (value != NULL && PyDict_SetItem(self->cache, key, value) < 0) {
+        Py_CLEAR(value);
+    }
+    return value;
+}
+
+static Py_ssize_t struct_proxy_length(struct_proxy_t* self) {
+    return PyTuple_GET_SIZE(self->fields);
+}
+
+static int struct_proxy_contains(struct_proxy_t* self, PyObject* key) {
+    return field_number(self, key) >= 0;
+}
+
+static PyObject* struct_proxy_keys(struct_proxy_t* self) {
+    return PySequence_List(self->fields);
+}
+
+/**
+ * Returns a list of the value, or with_keys the (name, value) pair, of
+ * every field, converting any not yet read.
+ */
+static PyObject* map_fields(struct_proxy_t* self, bool with_keys) {
+    PyObject *keys = struct_proxy_keys(self), *result, *key, *value, *item;
+    Py_ssize_t idx;
+    
+    if (keys == NULL) {
+        return NULL;
+    }
+    result = PyList_New(PyList_GET_SIZE(keys));
+    for (idx = 0; result != NULL && idx < PyList_GET_SIZE(keys); ++idx) {
+        key = PyList_GET_ITEM(keys, idx);
+        value = struct_proxy_subscript(self, key);
+        if (value == NULL) {
+            Py_CLEAR(result);
+            break;
+        }
+        if (with_keys) {
+            item = PyTuple_Pack(2, key, value);
+            Py_DECREF(value);
+            if (item == NULL) {
+                Py_CLEAR(result);
+                break;
+            }
+        } else {
+            item = value;
+        }
+        PyList_SET_ITEM(result, idx, item);
+    }
+    Py_DECREF(keys);
+    return result;
+}
+
+static PyObject* struct_proxy_values(struct_proxy_t* self) {
+    return map_fields(self, false);
+}
+
+static PyObject* struct_proxy_items(struct_proxy_t* self) {
+    return map_fields(self, true);
+}
+
+static PyObject* struct_proxy_get(struct_proxy_t* self, PyObject* args) {
+    PyObject *key, *default_value = Py_None;
+    
+    if (!PyArg_ParseTuple(args, "O|O", &key, &default_value)) {
+        return NULL;
+    }
+    if (!struct_proxy_contains(self, key)) {
+        Py_INCREF(default_value);
+        return default_value;
+    }
+    return struct_proxy_subscript(self, key);
+}
+
+static PyObject* struct_proxy_iter(struct_proxy_t* self) {
+    PyObject *keys = struct_proxy_keys(self), *iter;
+    
+    if (keys == NULL) {
+        return NULL;
+    }
+    iter = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iter;
+}
+
+static PyObject* struct_proxy_repr(struct_proxy_t* self) {
+    PyObject *keys = struct_proxy_keys(self), *keys_repr, *repr;
+    
+    if (keys == NULL) {
+        return NULL;
+    }
+    keys_repr = PyObject_Repr(keys);
+    Py_DECREF(keys);
+    if (keys_repr == NULL) {
+        return NULL;
+    }
+    repr = PyString_FromFormat("<pymex.StructProxy with fields %s>", PyString_AS_STRING(keys_repr));
+    Py_DECREF(keys_repr);
+    return repr;
+}
+
+/**
+ * Converts a proxy back to its struct, consuming the reference as py2mat
+ * does. If that was the last reference to the proxy for a whole copy, and
+ * no proxies for structs inside it remain either, nothing else can read
+ * the copy, so it is handed over as is; otherwise MATLAB gets a copy.
+ */
+mxArray* py2mat_struct_proxy(PyObject* py_value) {
+    struct_proxy_t* self = (struct_proxy_t*) py_value;
+    mxArray* array;
+    
+    if (Py_REFCNT(py_value) == 1 && Py_REFCNT(self->holder) == 1 &&
+            self->array == PyCapsule_GetPointer(self->holder, HOLDER_NAME)) {
+        array = self->array;
+        PyCapsule_SetDestructor(self->holder, NULL);
+        TRACK_RELEASE(array);
+    } else {
+        array = mxDuplicateArray(self->array);
+    }
+    Py_DECREF(py_value);
+    return array;
+}
+
+// TYPE ////////////////////////////////////////////////////////////////////////
+
+static PyMappingMethods struct_proxy_as_mapping = {
+    (lenfunc) struct_proxy_length,
+    (binaryfunc) struct_proxy_subscript,
+    NULL
+};
+
+static PySequenceMethods struct_proxy_as_sequence;
+
+static PyMethodDef struct_proxy_methods[] = {
+    {"keys", (PyCFunction) struct_proxy_keys, METH_NOARGS,
+        "keys(): names of the struct's fields, in order."},
+    {"values", (PyCFunction) struct_proxy_values, METH_NOARGS,
+        "values(): values of every field, converting any not yet read."},
+    {"items", (PyCFunction) struct_proxy_items, METH_NOARGS,
+        "items(): (name, value) pairs for every field, converting any not yet read."},
+    {"get", (PyCFunction) struct_proxy_get, METH_VARARGS,
+        "get(name, default=None): the named field, or default if there is none."},
+    {NULL, NULL, 0, NULL}
+};
+
+void init_struct_proxy_type(PyObject* module) {
+    PyObject *collections, *mapping, *result;
+    
+    struct_proxy_as_sequence.sq_contains = (objobjproc) struct_proxy_contains;
+    
+    struct_proxy_type.tp_name = "pymex.StructProxy";
+    struct_proxy_type.tp_basicsize = sizeof(struct_proxy_t);
+    struct_proxy_type.tp_dealloc = (destructor) struct_proxy_dealloc;
+    struct_proxy_type.tp_repr = (reprfunc) struct_proxy_repr;
+    struct_proxy_type.tp_as_mapping = &struct_proxy_as_mapping;
+    struct_proxy_type.tp_as_sequence = &struct_proxy_as_sequence;
+    struct_proxy_type.tp_iter = (getiterfunc) struct_proxy_iter;
+    struct_proxy_type.tp_flags = Py_TPFLAGS_DEFAULT;
+    struct_proxy_type.tp_doc = "Read-only view of a MATLAB struct, converting fields as they are read.";
+    struct_proxy_type.tp_methods = struct_proxy_methods;
+    if (PyType_Ready(&struct_proxy_type) < 0) {
+        return;
+    }
+    Py_INCREF(&struct_proxy_type);
+    PyModule_AddObject(module, "StructProxy", (PyObject*) &struct_proxy_type);
+    
+    // So that isinstance(proxy, collections.Mapping) holds.
+    collections = PyImport_ImportModule("collections");
+    mapping = collections == NULL ? NULL : PyObject_GetAttrString(collections, "Mapping");
+    result = mapping == NULL ? NULL : PyObject_CallMethod(mapping, "register", "O", &struct_proxy_type);
+    if (result == NULL) {
+        PyErr_Print();
+    }
+    Py_XDECREF(result);
+    Py_XDECREF(mapping);
+    Py_XDECREF(collections);
+}
@@ -0,0 +1,48 @@
+/**
+ * pymex_struct.h: Lazy read-only Mapping proxies for MATLAB structs.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_STRUCT_H
+#define PYMEX_STRUCT_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+// If set, mat2py marshals scalar structs as pymex.StructProxy objects rather
+// than as dicts.
+extern bool lazy_structs;
+
+extern PyTypeObject struct_proxy_type;
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+void init_struct_proxy_type(PyObject* module);
+PyObject* new_struct_proxy(const mxArray* m_struct);
+mxArray* py2mat_struct_proxy(PyObject* py_value);
+
+#endif
@@ -0,0 +1,414 @@
+/**
+ * pymex_table.c: Columnar conversion of MATLAB tables to pandas DataFrames.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// MATLAB tables are taken apart into one array per variable with a single
+// call to table2struct, and each variable moves to Python as a whole: a
+// numeric or logical column as its raw data, which pandas copies once into
+// the DataFrame; a categorical as its codes and categories; and anything
+// else (cellstrs above all) as a list built in one pass. DataFrames come
+// back the same way, through a single call to table(). The pandas side of
+// this is in _pymex/tables.py.
+//
+// Tables only convert if pandas can be imported, and only if every
+// variable is a single column; otherwise they are boxed as before.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "pymex_table.h"
+#include "pymex_marshal.h"
+#include <string.h>
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    const char* dtype;
+    mxClassID class_id;
+} column_type_t;
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define TABLES_MODULE "_pymex.tables"
+
+// NumPy dtype strings for each MATLAB class that moves as raw data.
+static const column_type_t COLUMN_TYPES[] = {
+    {"f8", mxDOUBLE_CLASS},
+    {"f4", mxSINGLE_CLASS},
+    {"b1", mxLOGICAL_CLASS},
+    {"i1", mxINT8_CLASS},
+    {"u1", mxUINT8_CLASS},
+    {"i2", mxINT16_CLASS},
+    {"u2", mxUINT16_CLASS},
+    {"i4", mxINT32_CLASS},
+    {"u4", mxUINT32_CLASS},
+    {"i8", mxINT64_CLASS},
+    {"u8", mxUINT64_CLASS},
+};
+
+#define N_COLUMN_TYPES (sizeof(COLUMN_TYPES) / sizeof(COLUMN_TYPES[0]))
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+// The tables module, once pandas has been found to import; Py_None if it
+// doesn't.
+static PyObject* tables_module = NULL;
+static PyObject* dataframe_type = NULL;
+
+// UTILITY FUNCTIONS ///////////////////////////////////////////////////////////
+
+/**
+ * Returns the tables module (borrowed), or NULL if pandas isn't available.
+ * Importing pandas is slow, so this is only tried once.
+ */
+static PyObject* get_tables_module() {
+    PyObject* pandas;
+    
+    if (tables_module == NULL) {
+        pandas = PyImport_ImportModule("pandas");
+        tables_module = pandas == NULL ? NULL : PyImport_ImportModule(TABLES_MODULE);
+        Py_XDECREF(pandas);
+        if (tables_module == NULL) {
+            PyErr_Clear();
+            tables_module = Py_None;
+            Py_INCREF(tables_module);
+        }
+    }
+    return tables_module == Py_None ? NULL : tables_module;
+}
+
+static const column_type_t* column_type_for_class(mxClassID class_id) {
+    size_t idx;
+    
+    for (idx = 0; idx < N_COLUMN_TYPES; ++idx) {
+        if (COLUMN_TYPES[idx].class_id == class_id) {
+            return &COLUMN_TYPES[idx];
+        }
+    }
+    return NULL;
+}
+
+static const column_type_t* column_type_for_dtype(const char* dtype) {
+    size_t idx;
+    
+    for (idx = 0; idx < N_COLUMN_TYPES; ++idx) {
+        if (strcmp(COLUMN_TYPES[idx].dtype, dtype) == 0) {
+            return &COLUMN_TYPES[idx];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Calls a one-output MATLAB function, returning its result.
+ */
+static mxArray* call_matlab(const char* fn, int nrhs, mxArray* prhs[]) {
+    mxArray* plhs[1] = {NULL};
+    
+    mexCallMATLAB(1, plhs, nrhs, prhs, fn);
+    return plhs[0];
+}
+
+static bool is_column(const mxArray* m_value, size_t n_rows) {
+    return mxGetM(m_value) == n_rows && mxGetN(m_value) == 1;
+}
+
+/**
+ * Returns a list with one converted value per element of a cell array.
+ */
+static PyObject* list_from_cell(const mxArray* m_cell) {
+    size_t n = mxGetNumberOfElements(m_cell), idx;
+    PyObject* list = PyList_New(n);
+    
+    for (idx = 0; list != NULL && idx < n; ++idx) {
+        PyList_SET_ITEM(list, idx, mat2py(mxGetCell(m_cell, idx), false));
+    }
+    return list;
+}
+
+// MATLAB TO PYTHON ////////////////////////////////////////////////////////////
+
+/**
+ * Converts one table variable of n_rows rows to a column tuple, as
+ * described in _pymex/tables.py, or returns NULL (without an exception) if
+ * it can't be. Objects (categoricals and strings) look 1x1 from here, so
+ * their shapes are checked after MATLAB converts them.
+ */
+static PyObject* column_from_variable(mxArray* m_var, size_t n_rows) {
+    const column_type_t* type = column_type_for_class(mxGetClassID(m_var));
+    mxArray *m_codes, *m_categories, *m_cellstr;
+    PyObject *buffer, *values;
+    
+    if (type != NULL) {
+        if (!is_column(m_var, n_rows) || mxIsComplex(m_var) || mxIsSparse(m_var)) {
+            return NULL;
+        }
+        // No copy here; the one copy is made by pandas.
+        buffer = PyBuffer_FromMemory(mxGetData(m_var), n_rows * mxGetElementSize(m_var));
+        return Py_BuildValue("(sNs)", "numeric", buffer, type->dtype);
+    }
+    
+    if (mxIsClass(m_var, "categorical")) {
+        // The codes are only read once the DataFrame is built, so they are
+        // left for MATLAB to free when the MEX call returns.
+        m_codes = call_matlab("double", 1, &m_var);
+        if (!is_column(m_codes, n_rows)) {
+            return NULL;
+        }
+        m_categories = call_matlab("categories", 1, &m_var);
+        values = list_from_cell(m_categories);
+        mxDestroyArray(m_categories);
+        buffer = PyBuffer_FromMemory(mxGetData(m_codes), n_rows * sizeof(double));
+        return Py_BuildValue("(sNN)", "categorical", buffer, values);
+    }
+    
+    if (mxIsCell(m_var)) {
+        if (!is_column(m_var, n_rows)) {
+            return NULL;
+        }
+        return Py_BuildValue("(sN)", "objects", list_from_cell(m_var));
+    }
+    
+    if (mxIsChar(m_var) || mxIsClass(m_var, "string")) {
+        // Strings and the rows of char matrices arrive as cellstrs.
+        m_cellstr = call_matlab("cellstr", 1, &m_var);
+        values = is_column(m_cellstr, n_rows) ? list_from_cell(m_cellstr) : NULL;
+        mxDestroyArray(m_cellstr);
+        return values == NULL ? NULL : Py_BuildValue("(sN)", "objects", values);
+    }
+    
+    return NULL;
+}
+
+/**
+ * Converts a MATLAB table to a pandas DataFrame, or returns NULL (without
+ * an exception) if pandas isn't available or a variable can't be
+ * converted, in which case the caller should box the table instead.
+ */
+PyObject* dataframe_from_table(const mxArray* m_table) {
+    PyObject *tables = get_tables_module(), *names = NULL, *columns = NULL, *row_names = NULL;
+    PyObject *column, *frame = NULL;
+    mxArray *args[3], *m_height, *m_struct, *m_props, *m_row_names;
+    int n_vars, idx_var;
+    size_t n_rows;
+    
+    if (tables == NULL) {
+        return NULL;
+    }
+    
+    args[0] = (mxArray*) m_table;
+    m_height = call_matlab("height", 1, args);
+    n_rows = (size_t) mxGetScalar(m_height);
+    mxDestroyArray(m_height);
+    
+    // One call gets every variable; MATLAB shares their data rather than
+    // copying it.
+    args[1] = mxCreateString("ToScalar");
+    args[2] = mxCreateLogicalScalar(true);
+    m_struct = call_matlab("table2struct", 3, args);
+    mxDestroyArray(args[1]);
+    mxDestroyArray(args[2]);
+    
+    args[1] = mxCreateString("Properties");
+    m_props = call_matlab("getfield", 2, args);
+    mxDestroyArray(args[1]);
+    args[0] = m_props;
+    args[1] = mxCreateString("RowNames");
+    m_row_names = call_matlab("getfield", 2, args);
+    mxDestroyArray(args[1]);
+    
+    n_vars = mxGetNumberOfFields(m_struct);
+    names = PyList_New(n_vars);
+    columns = PyList_New(n_vars);
+    for (idx_var = 0; idx_var < n_vars; ++idx_var) {
+        column = column_from_variable(mxGetFieldByNumber(m_struct, 0, idx_var), n_rows);
+        if (column == NULL) {
+            PyErr_Clear();
+            goto cleanup;
+        }
+        PyList_SET_ITEM(columns, idx_var, column);
+        PyList_SET_ITEM(names, idx_var, PyString_FromString(mxGetFieldNameByNumber(m_struct, idx_var)));
+    }
+    
+    if (mxIsEmpty(m_row_names)) {
+        row_names = Py_None;
+        Py_INCREF(row_names);
+    } else {
+        row_names = list_from_cell(m_row_names);
+    }
+    
+    frame = PyObject_CallMethod(tables, "dataframe_from_columns", "OOO", names, columns, row_names);
+    if (frame == NULL) {
+        PyErr_Print();
+        mexErrMsgTxt("Python exception converting a table to a DataFrame.");
+    }
+    
+cleanup:
+    // The DataFrame has its own copy of the columns by now.
+    Py_XDECREF(names);
+    Py_XDECREF(columns);
+    Py_XDECREF(row_names);
+    mxDestroyArray(m_row_names);
+    mxDestroyArray(m_props);
+    mxDestroyArray(m_struct);
+    return frame;
+}
+
+// PYTHON TO MATLAB ////////////////////////////////////////////////////////////
+
+/**
+ * Returns whether a value is a pandas DataFrame. pandas is never imported
+ * here just to find out; if nothing else has imported it, there can't be
+ * any DataFrames.
+ */
+bool is_dataframe(PyObject* py_value) {
+    PyObject* pandas;
+    
+    if (dataframe_type == NULL) {
+        pandas = PyDict_GetItemString(PyImport_GetModuleDict(), "pandas");
+        if (pandas == NULL) {
+            return false;
+        }
+        dataframe_type = PyObject_GetAttrString(pandas, "DataFrame");
+        if (dataframe_type == NULL) {
+            PyErr_Clear();
+            return false;
+        }
+    }
+    return PyObject_IsInstance(py_value, dataframe_type) == 1;
+}
+
+static mxArray* mat_cellstr_from_list(PyObject* list, bool row) {
+    Py_ssize_t n = PyList_Size(list), idx;
+    mxArray* m_cell = row ? mxCreateCellMatrix(1, n) : mxCreateCellMatrix(n, 1);
+    PyObject* item;
+    
+    for (idx = 0; idx < n; ++idx) {
+        // py2mat consumes a reference, but GetItem only lends one.
+        item = PyList_GET_ITEM(list, idx);
+        Py_INCREF(item);
+        mxSetCell(m_cell, idx, py2mat(item));
+    }
+    return m_cell;
+}
+
+/**
+ * Converts one column tuple, as described in _pymex/tables.py, to a
+ * MATLAB column vector.
+ */
+static mxArray* variable_from_column(PyObject* column, Py_ssize_t n_rows) {
+    const char *kind, *dtype;
+    const column_type_t* type;
+    PyObject *data, *values;
+    const void* buffer;
+    Py_ssize_t n_bytes, idx;
+    mxArray *m_var, *args[3];
+    
+    if (!PyArg_ParseTuple(column, "sO|O", &kind, &data, &values)) {
+        PyErr_Print();
+        mexErrMsgTxt("Malformed DataFrame column.");
+    }
+    
+    if (strcmp(kind, "objects") == 0) {
+        return mat_cellstr_from_list(data, false);
+    }
+    
+    if (PyObject_AsReadBuffer(data, &buffer, &n_bytes) < 0) {
+        PyErr_Print();
+        mexErrMsgTxt("DataFrame column has no readable buffer.");
+    }
+    if (strcmp(kind, "categorical") == 0) {
+        type = column_type_for_dtype("f8");
+    } else {
+        type = column_type_for_dtype(PyString_AsString(values));
+        if (type == NULL) {
+            mexErrMsgTxt("DataFrame column has an unsupported dtype.");
+        }
+    }
+    
+    if (type->class_id == mxLOGICAL_CLASS) {
+        m_var = mxCreateLogicalMatrix(n_rows, 1);
+    } else {
+        m_var = mxCreateNumericMatrix(n_rows, 1, type->class_id, mxREAL);
+    }
+    if ((size_t) n_bytes != n_rows * mxGetElementSize(m_var)) {
+        mexErrMsgTxt("DataFrame column is the wrong length.");
+    }
+    memcpy(mxGetData(m_var), buffer, n_bytes);
+    
+    if (strcmp(kind, "categorical") == 0) {
+        // categorical(codes, 1:n, names); code 0 (missing) is undefined.
+        args[0] = m_var;
+        args[1] = mxCreateDoubleMatrix(1, PyList_Size(values), mxREAL);
+        for (idx = 0; idx < PyList_Size(values); ++idx) {
+            mxGetPr(args[1])[idx] = idx + 1;
+        }
+        args[2] = mat_cellstr_from_list(values, false);
+        m_var = call_matlab("categorical", 3, args);
+        mxDestroyArray(args[0]);
+        mxDestroyArray(args[1]);
+        mxDestroyArray(args[2]);
+    }
+    return m_var;
+}
+
+/**
+ * Converts a DataFrame to a MATLAB table, consuming the reference as
+ * py2mat does.
+ */
+mxArray* table_from_dataframe(PyObject* py_value) {
+    PyObject *tables = get_tables_module(), *parts, *names, *columns, *row_names;
+    Py_ssize_t n_vars, n_rows, idx_var;
+    mxArray **args, *m_table;
+    int n_args;
+    
+    if (tables == NULL) {
+        mexErrMsgTxt("Could not import " TABLES_MODULE " to convert a DataFrame.");
+    }
+    n_rows = PyObject_Length(py_value);
+    parts = PyObject_CallMethod(tables, "columns_from_dataframe", "O", py_value);
+    Py_DECREF(py_value);
+    if (parts == NULL || !PyArg_ParseTuple(parts, "O!O!O", &PyList_Type, &names, &PyList_Type, &columns, &row_names)) {
+        PyErr_Print();
+        mexErrMsgTxt("Python exception converting a DataFrame to a table.");
+    }
+    
+    // table(var1, ..., varN, 'VariableNames', names[, 'RowNames', rows])
+    n_vars = PyList_Size(columns);
+    args = mxCalloc(n_vars + 4, sizeof(mxArray*));
+    for (idx_var = 0; idx_var < n_vars; ++idx_var) {
+        args[idx_var] = variable_from_column(PyList_GET_ITEM(columns, idx_var), n_rows);
+    }
+    n_args = (int) n_vars;
+    args[n_args++] = mxCreateString("VariableNames");
+    args[n_args++] = mat_cellstr_from_list(names, true);
+    if (row_names != Py_None) {
+        args[n_args++] = mxCreateString("RowNames");
+        args[n_args++] = mat_cellstr_from_list(row_names, false);
+    }
+    Py_DECREF(parts);
+    
+    m_table = call_matlab("table", n_args, args);
+    for (idx_var = 0; idx_var < n_args; ++idx_var) {
+        mxDestroyArray(args[idx_var]);
+    }
+    mxFree(args);
+    return m_table;
+}
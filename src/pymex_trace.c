@@ -0,0 +1,343 @@
+/**
+ * pymex_trace.c: Records boundary crossings as a Chrome trace.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "pymex_trace.h"
+#include "pymex_callbacks.h"
+#include <frameobject.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WINDOWS
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define TRACE_NAME_LEN 64
+#define TRACE_MAX_DEPTH 256
+// About 50 MB of events; past this, spans are counted but not kept.
+#define TRACE_MAX_EVENTS (1 << 19)
+#define TRACE_MIN_CAPACITY 4096
+
+static const char* CATEGORY_NAMES[] = {
+    "opcode", "marshal", "matlab", "python"
+};
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+/**
+ * A span that has begun but not yet ended. Spans nest strictly, since
+ * everything we record happens on the MEX thread.
+ */
+typedef struct {
+    char name[TRACE_NAME_LEN];
+    trace_category_t category;
+    double start;
+} trace_span_t;
+
+/**
+ * A finished span, written out as one complete ("X") trace event.
+ */
+typedef struct {
+    char name[TRACE_NAME_LEN];
+    trace_category_t category;
+    double start;
+    double duration;
+    int depth;
+} trace_event_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+bool tracing_enabled = false;
+
+static trace_span_t stack[TRACE_MAX_DEPTH];
+static int depth = 0;
+
+// Allocated with malloc, so that events persist across MEX calls.
+static trace_event_t* events = NULL;
+static size_t n_events = 0;
+static size_t capacity = 0;
+static size_t n_dropped = 0;
+
+// Timestamps are in microseconds since the trace was last reset.
+static double origin = -1;
+static double last_timestamp = 0;
+
+static bool python_frames = false;
+// Python calls that trace_begin turned away (for being too deep), whose
+// returns must not end the spans of the calls around them.
+static int n_unrecorded_frames = 0;
+
+// UTILITY FUNCTIONS ///////////////////////////////////////////////////////////
+
+static double now_microseconds() {
+    #ifdef WINDOWS
+        LARGE_INTEGER count, frequency;
+        QueryPerformanceCounter(&count);
+        QueryPerformanceFrequency(&frequency);
+        return count.QuadPart * 1e6 / frequency.QuadPart;
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+    #endif
+}
+
+static double timestamp() {
+    double now = now_microseconds();
+    
+    if (origin < 0) {
+        origin = now;
+    }
+    last_timestamp = now - origin;
+    return last_timestamp;
+}
+
+static void record_event(const trace_span_t* span, int span_depth, double end) {
+    trace_event_t* event;
+    
+    if (n_events == capacity) {
+        size_t new_capacity = capacity == 0 ? TRACE_MIN_CAPACITY : 2 * capacity;
+        trace_event_t* new_events;
+        
+        if (new_capacity > TRACE_MAX_EVENTS) {
+            n_dropped++;
+            return;
+        }
+        new_events = realloc(events, new_capacity * sizeof(trace_event_t));
+        if (new_events == NULL) {
+            n_dropped++;
+            return;
+        }
+        events = new_events;
+        capacity = new_capacity;
+    }
+    
+    event = &events[n_events++];
+    memcpy(event->name, span->name, TRACE_NAME_LEN);
+    event->category = span->category;
+    event->start = span->start;
+    event->duration = end - span->start;
+    event->depth = span_depth;
+}
+
+/**
+ * Pops spans until only `span` remain open, recording each as of `end`.
+ * Events are only kept while tracing is on, so that turning tracing off
+ * doesn't leave a span for the call that did so.
+ */
+static void pop_spans(int span, double end) {
+    while (depth > span) {
+        depth--;
+        if (tracing_enabled) {
+            record_event(&stack[depth], depth, end);
+        }
+    }
+}
+
+static void write_json_string(FILE* file, const char* str) {
+    fputc('"', file);
+    for (; *str != '\0'; ++str) {
+        if (*str == '"' || *str == '\\') {
+            fprintf(file, "\\%c", *str);
+        } else if ((unsigned char) *str < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned char) *str);
+        } else {
+            fputc(*str, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// PYTHON FRAMES ///////////////////////////////////////////////////////////////
+// Python frames are recorded with a profile function on the MEX thread, so
+// that they nest exactly with the opcode and MATLAB spans around them. (A
+// sampling thread couldn't see the MEX thread's frames without the GIL,
+// which the MEX thread holds for as long as Python code runs.)
+
+static void end_python_span() {
+    int idx;
+    
+    // Anything deeper (say, a MATLAB call that raised) ends with it.
+    for (idx = depth - 1; idx >= 0; --idx) {
+        if (stack[idx].category == TRACE_PYTHON) {
+            trace_end(idx);
+            return;
+        }
+    }
+}
+
+static int profile_frames(PyObject* self, PyFrameObject* frame, int what, PyObject* arg) {
+    char name[TRACE_NAME_LEN];
+    char* filename;
+    char* basename;
+    
+    switch (what) {
+        case PyTrace_CALL:
+            filename = PyString_AsString(frame->f_code->co_filename);
+            basename = strrchr(filename, '/');
+            snprintf(name, TRACE_NAME_LEN, "%s (%s:%d)",
+                PyString_AsString(frame->f_code->co_name),
+                basename == NULL ? filename : basename + 1,
+                frame->f_code->co_firstlineno);
+            if (trace_begin(TRACE_PYTHON, name) < 0) {
+                n_unrecorded_frames++;
+            }
+            break;
+            
+        case PyTrace_C_CALL:
+            if (trace_begin(TRACE_PYTHON, PyEval_GetFuncName(arg)) < 0) {
+                n_unrecorded_frames++;
+            }
+            break;
+            
+        case PyTrace_RETURN:
+        case PyTrace_C_RETURN:
+        case PyTrace_C_EXCEPTION:
+            if (n_unrecorded_frames > 0) {
+                n_unrecorded_frames--;
+            } else {
+                end_python_span();
+            }
+            break;
+    }
+    return 0;
+}
+
+// TRACING FUNCTIONS ///////////////////////////////////////////////////////////
+
+/**
+ * Opens a span, returning its index on the stack for trace_end. Called via
+ * TRACE_BEGIN. Returns -1 (and records nothing) from threads other than the
+ * MEX thread, or if spans are nested implausibly deep.
+ */
+int trace_begin(trace_category_t category, const char* name) {
+    trace_span_t* span;
+    
+    if (depth == TRACE_MAX_DEPTH || !on_mex_thread()) {
+        return -1;
+    }
+    
+    span = &stack[depth];
+    strncpy(span->name, name, TRACE_NAME_LEN - 1);
+    span->name[TRACE_NAME_LEN - 1] = '\0';
+    span->category = category;
+    span->start = timestamp();
+    return depth++;
+}
+
+/**
+ * Closes the span returned by trace_begin, along with any spans inside it
+ * that were left open. Spans that are already closed are ignored.
+ */
+void trace_end(int span) {
+    if (span < depth) {
+        pop_spans(span, timestamp());
+    }
+}
+
+bool trace_innermost_is(trace_category_t category) {
+    return depth > 0 && stack[depth - 1].category == category;
+}
+
+/**
+ * Called on entry to mexFunction. MATLAB only calls back into the MEX from
+ * inside a MATLAB span (feval or mateval); any other spans still open were
+ * abandoned when mexErrMsgTxt unwound an earlier call, and are closed as of
+ * the last thing we saw happen.
+ */
+void trace_enter_mex() {
+    int span = depth;
+    
+    while (span > 0 && stack[span - 1].category != TRACE_MATLAB) {
+        span--;
+    }
+    pop_spans(span, last_timestamp);
+}
+
+/**
+ * Starts or stops recording Python calls (including calls to builtins) as
+ * spans of their own. This costs far more than the other spans, since every
+ * Python call is recorded.
+ */
+void trace_set_python_frames(bool enabled) {
+    if (enabled != python_frames) {
+        PyEval_SetProfile(enabled ? profile_frames : NULL, NULL);
+        python_frames = enabled;
+        n_unrecorded_frames = 0;
+    }
+}
+
+/**
+ * Discards all recorded events, and restarts the clock. Open spans are
+ * kept, so that they can still end, but start over from the reset.
+ */
+void trace_reset() {
+    int idx;
+    
+    free(events);
+    events = NULL;
+    n_events = capacity = n_dropped = 0;
+    origin = now_microseconds();
+    last_timestamp = 0;
+    for (idx = 0; idx < depth; ++idx) {
+        stack[idx].start = 0;
+    }
+}
+
+/**
+ * Writes the recorded events to filename in the Chrome trace event format,
+ * which chrome://tracing and ui.perfetto.dev both load. Returns the number
+ * of events written, or -1 if the file couldn't be opened.
+ */
+long trace_save(const char* filename) {
+    FILE* file = fopen(filename, "w");
+    size_t idx;
+    
+    if (file == NULL) {
+        return -1;
+    }
+    
+    fprintf(file, "{\"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, "
+        "\"args\": {\"name\": \"MATLAB\"}},\n");
+    fprintf(file, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, "
+        "\"args\": {\"name\": \"MEX thread\"}}");
+    for (idx = 0; idx < n_events; ++idx) {
+        fprintf(file, ",\n{\"name\": ");
+        write_json_string(file, events[idx].name);
+        fprintf(file, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+            "\"pid\": 1, \"tid\": 1, \"args\": {\"depth\": %d}}",
+            CATEGORY_NAMES[events[idx].category],
+            events[idx].start, events[idx].duration, events[idx].depth);
+    }
+    fprintf(file, "\n],\n\"displayTimeUnit\": \"ms\",\n");
+    fprintf(file, "\"otherData\": {\"dropped\": %lu}}\n", (unsigned long) n_dropped);
+    fclose(file);
+    
+    return (long) n_events;
+}
@@ -0,0 +1,67 @@
+/**
+ * pymex_trace.h: Records boundary crossings as a Chrome trace.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_TRACE_H
+#define PYMEX_TRACE_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef enum {
+    TRACE_OPCODE = 0,
+    TRACE_MARSHAL = 1,
+    TRACE_MATLAB = 2,
+    TRACE_PYTHON = 3
+} trace_category_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+extern bool tracing_enabled;
+
+// MACROS //////////////////////////////////////////////////////////////////////
+// As with TRACK_NEW, call sites use these so that when tracing is off the
+// only cost is a branch. TRACE_BEGIN gives a span to pass to TRACE_END, or
+// -1 if nothing was recorded.
+
+#define TRACE_BEGIN(category, name) \
+    (tracing_enabled ? trace_begin((category), (name)) : -1)
+#define TRACE_END(span) \
+    do { if ((span) >= 0) trace_end(span); } while (0)
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+int trace_begin(trace_category_t category, const char* name);
+void trace_end(int span);
+bool trace_innermost_is(trace_category_t category);
+void trace_enter_mex();
+void trace_set_python_frames(bool enabled);
+void trace_reset();
+long trace_save(const char* filename);
+
+#endif
@@ -0,0 +1,235 @@
+/**
+ * pymex_track.c: Optional tracking of objects handed across the MEX boundary.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "pymex_track.h"
+#include <frameobject.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define TRACK_N_BUCKETS 4096
+#define TRACK_NAME_LEN 64
+#define TRACK_ORIGIN_LEN 256
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+/**
+ * One record per distinct pointer. Python objects may be boxed more than once
+ * (each box owning its own reference), so we count boxes rather than adding
+ * duplicate records.
+ */
+typedef struct track_record {
+    const void* ptr;
+    track_kind_t kind;
+    int opcode;
+    size_t size;
+    unsigned long count;
+    char type_name[TRACK_NAME_LEN];
+    char origin[TRACK_ORIGIN_LEN];
+    struct track_record* next;
+} track_record_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+bool tracking_enabled = false;
+int track_opcode = -1;
+size_t track_n_records = 0;
+
+// Chained hash table, keyed on pointer. Allocated with calloc/malloc so
+// that it persists across MEX calls.
+static track_record_t* buckets[TRACK_N_BUCKETS];
+
+// UTILITY FUNCTIONS ///////////////////////////////////////////////////////////
+
+static size_t bucket_of(const void* ptr) {
+    // Objects are at least 8-byte aligned, so discard the low bits.
+    return (((size_t) ptr) >> 4) % TRACK_N_BUCKETS;
+}
+
+/**
+ * Estimates the memory held by a Python object, preferring __sizeof__ (which
+ * NumPy overrides to include the data buffer) and falling back to the type's
+ * declared size.
+ */
+static size_t py_object_size(PyObject* py_object) {
+    PyObject* py_size;
+    size_t size;
+    
+    py_size = PyObject_CallMethod(py_object, "__sizeof__", NULL);
+    if (py_size != NULL) {
+        size = (size_t) PyInt_AsSsize_t(py_size);
+        Py_DECREF(py_size);
+        if (!PyErr_Occurred()) {
+            return size;
+        }
+    }
+    PyErr_Clear();
+    
+    size = Py_TYPE(py_object)->tp_basicsize;
+    if (Py_TYPE(py_object)->tp_itemsize != 0) {
+        size += Py_SIZE(py_object) * Py_TYPE(py_object)->tp_itemsize;
+    }
+    return size;
+}
+
+/**
+ * Describes where a boxed value came from: the innermost Python frame if
+ * we were called from Python code (e.g. via pymex.feval), or else the C
+ * source location that boxed it.
+ */
+static void describe_origin(char* buf, const char* file, int line) {
+    PyFrameObject* frame = PyEval_GetFrame();
+    
+    if (frame != NULL) {
+        snprintf(buf, TRACK_ORIGIN_LEN, "%s:%d",
+            PyString_AsString(frame->f_code->co_filename),
+            PyFrame_GetLineNumber(frame));
+    } else {
+        snprintf(buf, TRACK_ORIGIN_LEN, "%s:%d", file, line);
+    }
+}
+
+// TRACKING FUNCTIONS //////////////////////////////////////////////////////////
+
+/**
+ * Records that ptr (a PyObject* or a persistent mxArray*) has been handed
+ * across the boundary. Called via TRACK_NEW.
+ */
+void track_new(track_kind_t kind, const void* ptr, const char* file, int line) {
+    size_t bucket;
+    track_record_t* record;
+    
+    if (ptr == NULL) {
+        return;
+    }
+    
+    bucket = bucket_of(ptr);
+    for (record = buckets[bucket]; record != NULL; record = record->next) {
+        if (record->ptr == ptr) {
+            record->count++;
+            return;
+        }
+    }
+    
+    record = calloc(1, sizeof(track_record_t));
+    if (record == NULL) {
+        return;
+    }
+    record->ptr = ptr;
+    record->kind = kind;
+    record->opcode = track_opcode;
+    record->count = 1;
+    describe_origin(record->origin, file, line);
+    
+    if (kind == TRACK_PYOBJECT) {
+        PyObject* py_object = (PyObject*) ptr;
+        strncpy(record->type_name, Py_TYPE(py_object)->tp_name, TRACK_NAME_LEN - 1);
+        record->size = py_object_size(py_object);
+    } else {
+        const mxArray* m_array = (const mxArray*) ptr;
+        strncpy(record->type_name, mxGetClassName(m_array), TRACK_NAME_LEN - 1);
+        record->size = mxGetNumberOfElements(m_array) * mxGetElementSize(m_array);
+    }
+    
+    record->next = buckets[bucket];
+    buckets[bucket] = record;
+    track_n_records++;
+}
+
+/**
+ * Records that one box of ptr has been released. Called via TRACK_RELEASE,
+ * including after tracking has been turned off. Pointers we never saw (e.g.
+ * boxed before tracking was enabled) are ignored.
+ */
+void track_release(const void* ptr) {
+    size_t bucket = bucket_of(ptr);
+    track_record_t **link, *record;
+    
+    for (link = &buckets[bucket]; *link != NULL; link = &(*link)->next) {
+        record = *link;
+        if (record->ptr == ptr) {
+            if (--record->count == 0) {
+                *link = record->next;
+                free(record);
+                track_n_records--;
+            }
+            return;
+        }
+    }
+}
+
+/**
+ * Forgets about all currently tracked objects.
+ */
+void track_reset() {
+    size_t bucket;
+    track_record_t *record, *next;
+    
+    for (bucket = 0; bucket < TRACK_N_BUCKETS; ++bucket) {
+        for (record = buckets[bucket]; record != NULL; record = next) {
+            next = record->next;
+            free(record);
+        }
+        buckets[bucket] = NULL;
+    }
+    track_n_records = 0;
+}
+
+/**
+ * Returns a 1xN MATLAB struct array describing each live tracked object,
+ * with fields kind, type, opcode, origin, count and bytes. Grouping is left
+ * to py_track.m.
+ */
+mxArray* track_dump() {
+    static const char* field_names[] = {
+        "kind", "type", "opcode", "origin", "count", "bytes"
+    };
+    mxArray* m_dump;
+    mxArray* m_opcode;
+    track_record_t* record;
+    size_t bucket;
+    mwIndex idx = 0;
+    
+    m_dump = mxCreateStructMatrix(1, track_n_records, 6, field_names);
+    for (bucket = 0; bucket < TRACK_N_BUCKETS; ++bucket) {
+        for (record = buckets[bucket]; record != NULL; record = record->next) {
+            mxSetField(m_dump, idx, "kind", mxCreateString(
+                record->kind == TRACK_PYOBJECT ? "PyObject" : "mxArray"
+            ));
+            mxSetField(m_dump, idx, "type", mxCreateString(record->type_name));
+            m_opcode = mxCreateNumericMatrix(1, 1, mxINT8_CLASS, mxREAL);
+            *(signed char*) mxGetData(m_opcode) = (signed char) record->opcode;
+            mxSetField(m_dump, idx, "opcode", m_opcode);
+            mxSetField(m_dump, idx, "origin", mxCreateString(record->origin));
+            mxSetField(m_dump, idx, "count", mxCreateDoubleScalar((double) record->count));
+            mxSetField(m_dump, idx, "bytes",
+                mxCreateDoubleScalar((double) (record->size * record->count)));
+            idx++;
+        }
+    }
+    
+    return m_dump;
+}
@@ -0,0 +1,65 @@
+/**
+ * pymex_track.h: Optional tracking of objects handed across the MEX boundary.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_TRACK_H
+#define PYMEX_TRACK_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+#include <mex.h>
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef enum {
+    TRACK_PYOBJECT = 0,
+    TRACK_MXARRAY = 1
+} track_kind_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+extern bool tracking_enabled;
+extern int track_opcode;
+extern size_t track_n_records;
+
+// MACROS //////////////////////////////////////////////////////////////////////
+// Call sites use these rather than the functions below, so that when
+// tracking is off the only cost is a single predictable branch. Releases are
+// still recorded after tracking is turned off, for as long as any records
+// remain, so that objects recorded earlier don't look live forever.
+
+#define TRACK_NEW(kind, ptr) \
+    do { if (tracking_enabled) track_new((kind), (ptr), __FILE__, __LINE__); } while (0)
+#define TRACK_RELEASE(ptr) \
+    do { if (tracking_enabled || track_n_records != 0) track_release(ptr); } while (0)
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+void track_new(track_kind_t kind, const void* ptr, const char* file, int line);
+void track_release(const void* ptr);
+void track_reset();
+mxArray* track_dump();
+
+#endif
@@ -21,7 +21,15 @@
 %%
 
 function rebuild_pymex(varargin)
-    SRC_FILES = {'pymex_fns.c' 'pymex_marshal.c'};
+    % rebuild_pymex(...) compiles pymex_fns with MATLAB's mex or, when run
+    % under GNU Octave, with mkoctfile --mex; any arguments are passed on
+    % to the compiler. The Python headers and library are found by asking
+    % the interpreter named by getpref('pymex', 'python') (python2.7 by
+    % default), unless set directly with the 'include' and 'libdir'
+    % preferences.
+    % pymex_fns.c must come first, as it names the MEX file.
+    SRC_FILES = {'pymex_fns.c' 'pymex_bytes.c' 'pymex_callbacks.c' 'pymex_channel.c' 'pymex_kernels.c' 'pymex_map.c' 'pymex_marshal.c' 'pymex_memo.c' 'pymex_operators.c' 'pymex_parallel.c' 'pymex_plan.c' 'pymex_release.c' 'pymex_struct.c' 'pymex_table.c' 'pymex_trace.c' 'pymex_track.c'};
+    IS_OCTAVE = exist('OCTAVE_VERSION', 'builtin') ~= 0;
     
     function s = mk_args(format, args)
         s = '';
@@ -31,10 +39,24 @@ function rebuild_pymex(varargin)
         s = s(2:end);
     end
 
+    function value = python_config(pref, expr, default)
+        % Preferences win; otherwise, ask the interpreter itself.
+        value = getpref('pymex', pref, '');
+        if isempty(value)
+            python = getpref('pymex', 'python', 'python2.7');
+            [status, out] = system(sprintf('%s -c "import sysconfig; print(%s)"', python, expr));
+            if status == 0
+                value = strtrim(out);
+            else
+                value = default;
+            end
+        end
+    end
+
     if isunix
-        INCLUDE = getpref('pymex', 'include',  '/usr/include/python2.7');
-        LIBDIR = getpref('pymex', 'libdir', '');
-        LIBS = {'python2.7', 'dl'};
+        INCLUDE = python_config('include', 'sysconfig.get_paths()[''include'']', '/usr/include/python2.7');
+        LIBDIR = python_config('libdir', 'sysconfig.get_config_var(''LIBDIR'')', '');
+        LIBS = {'python2.7', 'dl', 'pthread'};
         CFLAGS = '--std=c99';
         LDFLAGS = '\$LDFLAGS -Xlinker -export-dynamic';
         DEFINES = {'LINUX'};
@@ -55,9 +77,28 @@ function rebuild_pymex(varargin)
     if ~isempty(LIBDIR)
         EXTRA_OPTS{end+1} = sprintf('-L%s', LIBDIR);
     end
+    
+    if IS_OCTAVE
+        % mkoctfile takes each flag as its own argument, and reads CFLAGS
+        % from the environment rather than from its arguments.
+        old_cflags = getenv('CFLAGS');
+        setenv('CFLAGS', [strtrim(mkoctfile('-p', 'CFLAGS')) ' ' CFLAGS]);
+        cleanup = onCleanup(@() setenv('CFLAGS', old_cflags));
+        args = [{'--mex', '-g', '-o', 'pymex_fns'}, SRC_FILES, ...
+            {sprintf('-I%s', INCLUDE)}, EXTRA_OPTS, ...
+            cellfun(@(x) sprintf('-l%s', x), LIBS, 'UniformOutput', false), ...
+            cellfun(@(x) sprintf('-D%s', x), DEFINES, 'UniformOutput', false)];
+        if isunix
+            args{end+1} = '-Wl,--export-dynamic';
+        end
+        mkoctfile(args{:});
+        return;
+    end
+    
     sprintf('LDFLAGS="%s"', LDFLAGS)
     mex( ...
         '-g', ...
+        '-output', 'pymex_fns', ...
         sprintf('CFLAGS="%s"', CFLAGS), ...
         SRC_FILES{:}, ...
         sprintf('LDFLAGS="%s"', LDFLAGS), ...
@@ -0,0 +1,596 @@
+/**
+ * bench_call.c: Compares prepared call plans against the generic CALL opcode.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Times calls into Python through the full MEX entry point, once with the
+// generic CALL opcode and once through a plan from PREPARE, and reports
+// calls per second for each. It then times a function-handle plan (from
+// FHANDLE) evaluated at many points, one call per point and vectorized.
+//
+// Usage: bench_call [--quick]
+//
+// With --quick, each case is instead called once each way (including with
+// arguments that fail the plan's guards), and the results are compared,
+// as are function-handle plans against known values. Shutting down is
+// checked to release the module handles IMPORT caches. The exit status is
+// nonzero if anything is off.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+#include "../pymex_track.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Must agree with function_t in pymex_fns.c.
+#define IMPORT_OPCODE 1
+#define CALL_OPCODE 7
+#define EVALEXPR_OPCODE 16
+#define PREPARE_OPCODE 17
+#define CALLPLAN_OPCODE 18
+#define FHANDLE_OPCODE 19
+
+#define MAX_ARGS 4
+#define MIN_SECONDS 0.2
+
+// Points per vectorized call, and dimension of each, for the timings.
+#define N_POINTS 1000
+#define POINT_DIMS 3
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    const char* name;
+    const char* module;
+    const char* attr;
+    int n_args;
+    void (*make_args)(mxArray* args[]);
+    // Arguments of other classes than the plan was prepared for, to check
+    // that the guards fall back correctly. May be NULL.
+    void (*make_other_args)(mxArray* args[]);
+} call_case_t;
+
+// CASE CONSTRUCTORS ///////////////////////////////////////////////////////////
+
+static mxArray* int32_scalar(int value) {
+    mxArray* array = mxCreateNumericMatrix(1, 1, mxINT32_CLASS, mxREAL);
+    *(int*) mxGetData(array) = value;
+    return array;
+}
+
+static void doubles(mxArray* args[]) {
+    args[0] = mxCreateDoubleScalar(3.0);
+    args[1] = mxCreateDoubleScalar(4.0);
+}
+
+static void int32s(mxArray* args[]) {
+    args[0] = int32_scalar(3);
+    args[1] = int32_scalar(4);
+}
+
+static void strings(mxArray* args[]) {
+    args[0] = mxCreateString("foo");
+    args[1] = mxCreateString("bar");
+}
+
+static void logicals(mxArray* args[]) {
+    args[0] = mxCreateLogicalScalar(true);
+    args[1] = mxCreateLogicalScalar(false);
+}
+
+static const call_case_t CASES[] = {
+    {"math.hypot(double, double)", "math", "hypot", 2, doubles, int32s},
+    {"operator.add(int32, int32)", "operator", "add", 2, int32s, doubles},
+    {"operator.concat(char, char)", "operator", "concat", 2, strings, NULL},
+    {"operator.and_(logical, logical)", "operator", "and_", 2, logicals, int32s},
+};
+
+#define N_CASES (sizeof(CASES) / sizeof(CASES[0]))
+
+// CALLS ///////////////////////////////////////////////////////////////////////
+
+static mxArray* generic_call(mxArray* callee, int n_args, mxArray* args[]) {
+    mxArray *rhs[2], *result;
+    int idx;
+    
+    rhs[0] = callee;
+    rhs[1] = mxCreateCellMatrix(1, n_args);
+    for (idx = 0; idx < n_args; ++idx) {
+        mxSetCell(rhs[1], idx, mxDuplicateArray(args[idx]));
+    }
+    result = bench_run_opcode(CALL_OPCODE, 2, rhs, NULL);
+    mxDestroyArray(rhs[1]);
+    return result;
+}
+
+static mxArray* plan_call(mxArray* plan, int n_args, mxArray* args[]) {
+    mxArray* rhs[MAX_ARGS + 1];
+    int idx;
+    
+    rhs[0] = plan;
+    for (idx = 0; idx < n_args; ++idx) {
+        rhs[idx + 1] = args[idx];
+    }
+    return bench_run_opcode(CALLPLAN_OPCODE, n_args + 1, rhs, NULL);
+}
+
+// BENCHMARKS //////////////////////////////////////////////////////////////////
+
+/**
+ * Returns calls per second, either through the plan (if non-NULL) or with
+ * the generic opcode.
+ */
+static double time_calls(mxArray* callee, mxArray* plan, int n_args, mxArray* args[]) {
+    mxArray *rhs[2], *m_opcode, *plhs[1];
+    const mxArray* prhs[MAX_ARGS + 2];
+    double start = bench_now(), elapsed;
+    long n_calls = 0;
+    int idx, nrhs;
+    
+    // Build the argument lists up front, so that only the calls are timed.
+    if (plan != NULL) {
+        m_opcode = bench_opcode(CALLPLAN_OPCODE);
+        prhs[0] = m_opcode;
+        prhs[1] = plan;
+        for (idx = 0; idx < n_args; ++idx) {
+            prhs[idx + 2] = args[idx];
+        }
+        nrhs = n_args + 2;
+    } else {
+        m_opcode = bench_opcode(CALL_OPCODE);
+        rhs[1] = mxCreateCellMatrix(1, n_args);
+        for (idx = 0; idx < n_args; ++idx) {
+            mxSetCell(rhs[1], idx, mxDuplicateArray(args[idx]));
+        }
+        prhs[0] = m_opcode;
+        prhs[1] = callee;
+        prhs[2] = rhs[1];
+        nrhs = 3;
+    }
+    
+    do {
+        for (idx = 0; idx < 256; ++idx) {
+            mexstub_call(mexFunction, 1, plhs, nrhs, prhs);
+            mxDestroyArray(plhs[0]);
+        }
+        n_calls += 256;
+        elapsed = bench_now() - start;
+    } while (elapsed < MIN_SECONDS);
+    
+    mxDestroyArray(m_opcode);
+    if (plan == NULL) {
+        mxDestroyArray(rhs[1]);
+    }
+    return n_calls / elapsed;
+}
+
+static void check_equal(const char* case_name, const char* what, mxArray* expected, mxArray* actual) {
+    if (expected == NULL || actual == NULL || !bench_arrays_equal(expected, actual)) {
+        fprintf(stderr, "FAIL: %s: %s\n", case_name, what);
+        bench_failures++;
+    }
+    mxDestroyArray(expected);
+    mxDestroyArray(actual);
+}
+
+// EVALEXPR ////////////////////////////////////////////////////////////////////
+
+/**
+ * Evaluates expr with the given bindings (or none), returning the result
+ * or NULL without counting a failure if it raised.
+ */
+static mxArray* try_eval_expr(const char* expr, mxArray* bindings) {
+    mxArray *args[2], *result;
+    bool failed;
+    
+    args[0] = mxCreateString(expr);
+    args[1] = bindings;
+    result = bench_run_opcode(EVALEXPR_OPCODE, bindings == NULL ? 1 : 2, args, &failed);
+    mxDestroyArray(args[0]);
+    return result;
+}
+static void check_eval_expr_recovers(void) {
+    static const char* fields[] = {"a", "b"};
+    mxArray *bindings = mxCreateStructMatrix(1, 1, 2, fields), *result;
+    
+    // Field b is left unset, so converting the bindings fails part way.
+    mxSetField(bindings, 0, "a", mxCreateDoubleScalar(1));
+    result = try_eval_expr("a", bindings);
+    if (result != NULL) {
+        fprintf(stderr, "FAIL: unset binding: no error\n");
+        bench_failures++;
+        mxDestroyArray(result);
+    }
+    mxDestroyArray(bindings);
+    
+    // Later calls still share the one scratch dict for their locals.
+    check_equal("scratch locals", "reused after a failed binding", mxCreateLogicalScalar(true),
+        try_eval_expr("__import__('__main__').__dict__.setdefault('seen', locals()) is locals()", NULL));
+    check_equal("scratch locals", "reused after a failed binding", mxCreateLogicalScalar(true),
+        try_eval_expr("seen is locals() and 'a' not in seen", NULL));
+}
+
+static void check_int64_overflow(void) {
+    mxArray *args[2], *plan, *result;
+    
+    // The plan learns int64 results from 2 ** 10, then gets one too large.
+    args[0] = try_eval_expr("lambda n: long(2) ** int(n)", NULL);
+    args[1] = mxCreateDoubleScalar(10);
+    plan = bench_run_opcode(PREPARE_OPCODE, 2, args, NULL);
+    mxDestroyArray(args[0]);
+    result = plan_call(plan, 1, &args[1]);
+    if (result == NULL || mxGetClassID(result) != mxINT64_CLASS || *(long long int*) mxGetData(result) != 1024) {
+        fprintf(stderr, "FAIL: int64 result: first call\n");
+        bench_failures++;
+    }
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    
+    mxGetPr(args[1])[0] = 70;
+    result = plan_call(plan, 1, &args[1]);
+    if (result == NULL || strcmp(mxGetClassName(result), "PyObject") != 0) {
+        fprintf(stderr, "FAIL: int64 result: overflow not boxed\n");
+        bench_failures++;
+    }
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    check_equal("int64 result", "no error left pending", mxCreateDoubleScalar(1), try_eval_expr("1.0", NULL));
+    mxDestroyArray(args[1]);
+    mxDestroyArray(plan);
+}
+
+static void check_registered_converter(void) {
+    mxArray *args[3], *plan, *result;
+    
+    // The plan learns float results first; a converter registered after
+    // that must still be honoured, as CALL would.
+    args[0] = try_eval_expr("__import__('math').hypot", NULL);
+    args[1] = mxCreateDoubleScalar(3);
+    args[2] = mxCreateDoubleScalar(4);
+    plan = bench_run_opcode(PREPARE_OPCODE, 3, args, NULL);
+    check_equal("registered converter", "before registering", mxCreateDoubleScalar(5),
+        plan_call(plan, 2, &args[1]));
+    
+    result = try_eval_expr("__import__('pymex').register_converter(float, lambda x: '%g!' % x)", NULL);
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    check_equal("registered converter", "plan ignores it", generic_call(args[0], 2, &args[1]),
+        plan_call(plan, 2, &args[1]));
+    check_equal("registered converter", "plan ignores it", mxCreateString("5!"),
+        plan_call(plan, 2, &args[1]));
+    result = try_eval_expr("__import__('pymex').register_converter(float, None)", NULL);
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    check_equal("registered converter", "after undoing it", mxCreateDoubleScalar(5),
+        plan_call(plan, 2, &args[1]));
+    
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+    mxDestroyArray(args[2]);
+    mxDestroyArray(plan);
+}
+
+static void check_embedded_nul(void) {
+    static const char CHARS[] = {'a', '\0', 'b'};
+    mwSize dims[2] = {1, 3};
+    mxArray *args[3], *plan;
+    int idx;
+    
+    // Plans convert strings as mat2py does, which stops at the first NUL.
+    args[0] = try_eval_expr("__import__('operator').concat", NULL);
+    args[1] = mxCreateString("x");
+    args[2] = mxCreateString("y");
+    plan = bench_run_opcode(PREPARE_OPCODE, 3, args, NULL);
+    
+    mxDestroyArray(args[1]);
+    args[1] = mxCreateCharArray(2, dims);
+    for (idx = 0; idx < 3; ++idx) {
+        mxGetChars(args[1])[idx] = CHARS[idx];
+    }
+    check_equal("embedded NUL", "plan differs from CALL", generic_call(args[0], 2, &args[1]),
+        plan_call(plan, 2, &args[1]));
+    check_equal("embedded NUL", "string not cut at the NUL", mxCreateString("ay"),
+        plan_call(plan, 2, &args[1]));
+    
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+    mxDestroyArray(args[2]);
+    mxDestroyArray(plan);
+}
+
+/**
+ * Imports a module no other check uses, with tracking on, so that
+ * check_module_cache_cleared can look for its cached handle after
+ * shutdown. Returns how many arrays were live with the handle cached.
+ */
+static size_t import_tracked_module(void) {
+    mxArray *name = mxCreateString("colorsys"), *module;
+    
+    tracking_enabled = true;
+    module = bench_run_opcode(IMPORT_OPCODE, 1, &name, NULL);
+    tracking_enabled = false;
+    mxDestroyArray(name);
+    if (module != NULL) {
+        mxDestroyArray(module);
+    }
+    return mexstub_live_arrays();
+}
+
+/**
+ * Checks that shutting down released and destroyed the cached module
+ * handles.
+ */
+static void check_module_cache_cleared(size_t live_with_handle) {
+    mxArray* dump = track_dump();
+    
+    if (mxGetNumberOfElements(dump) != 0) {
+        fprintf(stderr, "FAIL: module cache: %d tracked objects left after shutdown\n",
+            (int) mxGetNumberOfElements(dump));
+        bench_failures++;
+    }
+    mxDestroyArray(dump);
+    if (mexstub_live_arrays() >= live_with_handle) {
+        fprintf(stderr, "FAIL: module cache: handles not destroyed at shutdown\n");
+        bench_failures++;
+    }
+}
+
+// FUNCTION HANDLES ////////////////////////////////////////////////////////////
+
+static mxArray* double_matrix(size_t rows, size_t cols, const double* values) {
+    mxArray* array = mxCreateDoubleMatrix(rows, cols, mxREAL);
+    memcpy(mxGetPr(array), values, rows * cols * sizeof(double));
+    return array;
+}
+
+/**
+ * Returns a function-handle plan for the callable a Python expression
+ * evaluates to.
+ */
+static mxArray* function_plan(const char* expr, bool vectorized) {
+    mxArray *args[2], *callee, *plan;
+    
+    args[0] = mxCreateString(expr);
+    callee = bench_run_opcode(EVALEXPR_OPCODE, 1, args, NULL);
+    mxDestroyArray(args[0]);
+    if (callee == NULL) {
+        return NULL;
+    }
+    args[0] = callee;
+    args[1] = mxCreateLogicalScalar(vectorized);
+    plan = bench_run_opcode(FHANDLE_OPCODE, 2, args, NULL);
+    mxDestroyArray(args[1]);
+    mxDestroyArray(callee);
+    return plan;
+}
+
+static void check_function_plans(void) {
+    static const double x[] = {1, 2, 3}, y[] = {5, 6}, twice_x[] = {2, 4, 6};
+    static const double squares[] = {1, 4, 9}, points[] = {1, 2, 3, 4}, negated[] = {-1, -2, -3, -4};
+    mxArray *plan, *args[2];
+    
+    // The list passed for x is refilled on the second call, and must be
+    // replaced by a new one when it changes length.
+    plan = function_plan("lambda x: sum(v * v for v in x)", false);
+    args[0] = double_matrix(1, 3, x);
+    check_equal("sum of squares", "first call", mxCreateDoubleScalar(14), plan_call(plan, 1, args));
+    check_equal("sum of squares", "second call", mxCreateDoubleScalar(14), plan_call(plan, 1, args));
+    mxDestroyArray(args[0]);
+    args[0] = double_matrix(1, 2, y);
+    check_equal("sum of squares", "shorter argument", mxCreateDoubleScalar(61), plan_call(plan, 1, args));
+    mxDestroyArray(args[0]);
+    mxDestroyArray(plan);
+    
+    // A list the callee keeps must not be refilled.
+    plan = function_plan("lambda x, kept=[]: (kept.append(x), kept[0][0])[1]", false);
+    args[0] = double_matrix(1, 3, x);
+    check_equal("kept argument", "first call", mxCreateDoubleScalar(1), plan_call(plan, 1, args));
+    mxDestroyArray(args[0]);
+    args[0] = double_matrix(1, 2, y);
+    check_equal("kept argument", "second call", mxCreateDoubleScalar(1), plan_call(plan, 1, args));
+    mxDestroyArray(args[0]);
+    mxDestroyArray(plan);
+    
+    plan = function_plan("lambda x: [2 * v for v in x]", false);
+    args[0] = double_matrix(1, 3, x);
+    check_equal("doubling", "sequence result", double_matrix(3, 1, twice_x), plan_call(plan, 1, args));
+    mxDestroyArray(args[0]);
+    mxDestroyArray(plan);
+    
+    plan = function_plan("lambda x: x * x", true);
+    args[0] = double_matrix(1, 3, x);
+    check_equal("vectorized square", "row of points", double_matrix(1, 3, squares), plan_call(plan, 1, args));
+    mxDestroyArray(args[0]);
+    mxDestroyArray(plan);
+    
+    plan = function_plan("lambda t, y: [-v for v in y]", true);
+    args[0] = mxCreateDoubleScalar(0);
+    args[1] = double_matrix(2, 2, points);
+    check_equal("vectorized decay", "columns of points", double_matrix(2, 2, negated), plan_call(plan, 2, args));
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+    mxDestroyArray(plan);
+}
+
+/**
+ * Returns points per second through a function-handle plan, called with
+ * one point at a time or with all N_POINTS at once.
+ */
+static double time_function_plan(mxArray* plan, bool vectorized, mxArray* points) {
+    mxArray *m_opcode = bench_opcode(CALLPLAN_OPCODE), *plhs[1];
+    const mxArray* prhs[3];
+    double start = bench_now(), elapsed;
+    long n_evaluated = 0;
+    int idx;
+    
+    prhs[0] = m_opcode;
+    prhs[1] = plan;
+    prhs[2] = points;
+    do {
+        if (vectorized) {
+            mexstub_call(mexFunction, 1, plhs, 3, prhs);
+            mxDestroyArray(plhs[0]);
+        } else {
+            for (idx = 0; idx < N_POINTS; ++idx) {
+                mexstub_call(mexFunction, 1, plhs, 3, prhs);
+                mxDestroyArray(plhs[0]);
+            }
+        }
+        n_evaluated += N_POINTS;
+        elapsed = bench_now() - start;
+    } while (elapsed < MIN_SECONDS);
+    
+    mxDestroyArray(m_opcode);
+    return n_evaluated / elapsed;
+}
+
+static void bench_function_plans(void) {
+    const char* expr = "lambda y: [y[1], -y[0], 0.5 * y[2]]";
+    mxArray *plan, *vectorized_plan, *point, *points;
+    double point_rate, vectorized_rate;
+    size_t idx;
+    
+    plan = function_plan(expr, false);
+    vectorized_plan = function_plan(expr, true);
+    if (plan == NULL || vectorized_plan == NULL) {
+        return;
+    }
+    point = mxCreateDoubleMatrix(POINT_DIMS, 1, mxREAL);
+    points = mxCreateDoubleMatrix(POINT_DIMS, N_POINTS, mxREAL);
+    for (idx = 0; idx < POINT_DIMS * N_POINTS; ++idx) {
+        mxGetPr(points)[idx] = idx;
+    }
+    
+    point_rate = time_function_plan(plan, false, point);
+    vectorized_rate = time_function_plan(vectorized_plan, true, points);
+    printf("\n%-32s %14s %14s %8s\n", "function handle", "points/s", "vectorized/s", "speedup");
+    printf("%-32s %14.0f %14.0f %7.2fx\n", "3-vector ODE right-hand side", point_rate, vectorized_rate,
+        vectorized_rate / point_rate);
+    
+    mxDestroyArray(point);
+    mxDestroyArray(points);
+    mxDestroyArray(plan);
+    mxDestroyArray(vectorized_plan);
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    mxArray *import_args[2], *callee, *plan, *args[MAX_ARGS], *prepare_args[MAX_ARGS + 1];
+    double generic_rate, plan_rate;
+    size_t idx_case, live_with_handle = 0;
+    int idx;
+    
+    if (!bench_init_pymex()) {
+        return 1;
+    }
+    
+    if (!quick) {
+        printf("%-32s %14s %14s %8s\n", "case", "CALL/s", "CALLPLAN/s", "speedup");
+    }
+    
+    for (idx_case = 0; idx_case < N_CASES; ++idx_case) {
+        const call_case_t* c = &CASES[idx_case];
+        
+        // from module import attr
+        import_args[0] = mxCreateString(c->module);
+        import_args[1] = mxCreateString(c->attr);
+        callee = bench_run_opcode(IMPORT_OPCODE, 2, import_args, NULL);
+        mxDestroyArray(import_args[0]);
+        mxDestroyArray(import_args[1]);
+        if (callee == NULL) {
+            break;
+        }
+        
+        c->make_args(args);
+        prepare_args[0] = callee;
+        for (idx = 0; idx < c->n_args; ++idx) {
+            prepare_args[idx + 1] = args[idx];
+        }
+        plan = bench_run_opcode(PREPARE_OPCODE, c->n_args + 1, prepare_args, NULL);
+        if (plan == NULL) {
+            break;
+        }
+        
+        if (quick) {
+            // Twice through the plan, since the return converter is only
+            // chosen on the first call.
+            check_equal(c->name, "first call through plan differs from CALL",
+                generic_call(callee, c->n_args, args), plan_call(plan, c->n_args, args));
+            check_equal(c->name, "second call through plan differs from CALL",
+                generic_call(callee, c->n_args, args), plan_call(plan, c->n_args, args));
+            if (c->make_other_args != NULL) {
+                for (idx = 0; idx < c->n_args; ++idx) {
+                    mxDestroyArray(args[idx]);
+                }
+                c->make_other_args(args);
+                check_equal(c->name, "fallback through plan differs from CALL",
+                    generic_call(callee, c->n_args, args), plan_call(plan, c->n_args, args));
+            }
+        } else {
+            generic_rate = time_calls(callee, NULL, c->n_args, args);
+            plan_rate = time_calls(callee, plan, c->n_args, args);
+            printf("%-32s %14.0f %14.0f %7.2fx\n", c->name, generic_rate, plan_rate,
+                plan_rate / generic_rate);
+        }
+        
+        for (idx = 0; idx < c->n_args; ++idx) {
+            mxDestroyArray(args[idx]);
+        }
+        mxDestroyArray(plan);
+        mxDestroyArray(callee);
+    }
+    
+    if (quick) {
+        check_function_plans();
+        check_eval_expr_recovers();
+        check_int64_overflow();
+        check_registered_converter();
+        check_embedded_nul();
+        live_with_handle = import_tracked_module();
+    } else {
+        bench_function_plans();
+    }
+    
+    mexstub_shutdown();
+    if (quick) {
+        check_module_cache_cleared(live_with_handle);
+    }
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All call plan checks passed.\n");
+    }
+    return 0;
+}
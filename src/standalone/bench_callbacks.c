@@ -0,0 +1,229 @@
+/**
+ * bench_callbacks.c: Measures MATLAB calls queued from Python threads.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Has a Python thread call a MATLAB function through pymex.feval, which
+// queues the calls for the MEX thread, while the MEX thread runs the queue
+// with the PUMP opcode. Reports round trips per second when the thread
+// waits for each result in turn, and calls per second when it queues them
+// all before waiting.
+//
+// Usage: bench_callbacks [--quick]
+//
+// With --quick, a few calls are instead made from a thread, and their
+// results (including a MATLAB error and output written with matwrite) are
+// checked, as is that the MEX thread still calls MATLAB directly and that
+// the thread can read fields of a lazy struct and view PyBytes data
+// without itself calling MATLAB; the exit status is nonzero on a mismatch.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Must agree with function_t in pymex_fns.c.
+#define PUMP_OPCODE 20
+
+#define N_CALLS 20000
+#define PUMP_TIMEOUT 0.01
+// Give up on a worker thread after this long.
+#define MAX_SECONDS 30.0
+
+// Worker threads, defined in __main__. Each takes the number of calls to
+// make and leaves its results in the global results.
+static const char* SETUP =
+    "import pymex, threading\n"
+    "def sequential(n):\n"
+    "    global results\n"
+    "    results = [pymex.feval('twice', float(i)).result() for i in range(n)]\n"
+    "def batched(n):\n"
+    "    global results\n"
+    "    futures = [pymex.feval('twice', float(i)) for i in range(n)]\n"
+    "    results = [f.result() for f in futures]\n"
+    "def failing(n):\n"
+    "    global results\n"
+    "    results = [pymex.feval('no_such_function').exception()]\n"
+    "def writing(n):\n"
+    "    global results\n"
+    "    results = [pymex.matwrite('written from a worker thread\\n').result()]\n"
+    "def pumping(n):\n"
+    "    global results\n"
+    "    try:\n"
+    "        pymex.pump()\n"
+    "        results = []\n"
+    "    except RuntimeError as ex:\n"
+    "        results = [ex]\n"
+    "def reading(n):\n"
+    "    global results\n"
+    "    config = configs.pop()\n"
+    "    results = [config['gain'], config['nested']['gain'], config.keys(), len(config),\n"
+    "               'gain' in config, config.get('missing'), list(config), repr(config)]\n"
+    "def viewing(n):\n"
+    "    global results\n"
+    "    results = [memoryview(blobs.pop()).tobytes()]\n"
+    "def start(target, n):\n"
+    "    global worker\n"
+    "    worker = threading.Thread(target=target, args=(n,))\n"
+    "    worker.start()\n";
+
+// STUB MATLAB FUNCTIONS ///////////////////////////////////////////////////////
+
+static void fn_twice(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    plhs[0] = mxCreateDoubleScalar(2.0 * mxGetScalar(prhs[0]));
+}
+
+/**
+ * Returns struct('gain', 2, 'nested', struct('gain', 3)).
+ */
+static void fn_config(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    const char* field_names[] = {"gain", "nested"};
+    mxArray* nested = mxCreateStructMatrix(1, 1, 1, field_names);
+    
+    mxSetField(nested, 0, "gain", mxCreateDoubleScalar(3.0));
+    plhs[0] = mxCreateStructMatrix(1, 1, 2, field_names);
+    mxSetField(plhs[0], 0, "gain", mxCreateDoubleScalar(2.0));
+    mxSetField(plhs[0], 0, "nested", nested);
+}
+
+/**
+ * Returns the bytes of "pymex", marked as binary with PyBytes.
+ */
+static void fn_blob(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    static const char* props[] = {"data"};
+    mxArray* data = mxCreateNumericMatrix(5, 1, mxUINT8_CLASS, mxREAL);
+    
+    memcpy(mxGetData(data), "pymex", 5);
+    plhs[0] = mexstub_create_object("PyBytes", 1, props);
+    mxSetProperty(plhs[0], 0, "data", data);
+    mxDestroyArray(data);
+}
+
+// CALLS ///////////////////////////////////////////////////////////////////////
+
+/**
+ * Starts a worker making n calls, and pumps until it finishes. Returns the
+ * elapsed time, or a negative number if the worker didn't finish.
+ */
+static double run_worker(const char* target, int n) {
+    char code[128];
+    double start = bench_now();
+    mxArray *timeout = mxCreateDoubleScalar(PUMP_TIMEOUT), *result;
+    
+    snprintf(code, sizeof(code), "start(%s, %d)", target, n);
+    bench_run_eval(code);
+    while (bench_eval_true("worker.is_alive()")) {
+        if (bench_now() - start > MAX_SECONDS) {
+            fprintf(stderr, "FAIL: %s: worker did not finish\n", target);
+            bench_failures++;
+            mxDestroyArray(timeout);
+            return -1.0;
+        }
+        result = bench_run_opcode(PUMP_OPCODE, 1, &timeout, NULL);
+        if (result != NULL) {
+            mxDestroyArray(result);
+        }
+    }
+    mxDestroyArray(timeout);
+    return bench_now() - start;
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    double sequential_seconds, batched_seconds;
+    size_t off_thread_calls;
+    
+    if (!bench_init_pymex()) {
+        return 1;
+    }
+    mexstub_register("twice", fn_twice);
+    mexstub_register("config", fn_config);
+    mexstub_register("blob", fn_blob);
+    if (!bench_exec_python(SETUP)) {
+        return 1;
+    }
+    
+    if (quick) {
+        bench_check_true("call on the MEX thread", "pymex.feval('twice', 2.0) == 4.0");
+        if (run_worker("sequential", 100) >= 0) {
+            bench_check_true("sequential calls", "results == [2.0 * i for i in range(100)]");
+        }
+        if (run_worker("batched", 100) >= 0) {
+            bench_check_true("batched calls", "results == [2.0 * i for i in range(100)]");
+        }
+        if (run_worker("failing", 1) >= 0) {
+            bench_check_true("MATLAB error", "isinstance(results[0], pymex.MatlabError)");
+        }
+        if (run_worker("writing", 1) >= 0) {
+            bench_check_true("matwrite", "results == [None]");
+        }
+        if (run_worker("pumping", 1) >= 0) {
+            bench_check_true("pump off the MEX thread", "isinstance(results[0], RuntimeError)");
+        }
+        // Fields of a lazy struct read from the worker are converted on
+        // the MEX thread, and the worker drops the last reference to it.
+        bench_run_eval("old_lazy = pymex.set_lazy_structs(True)");
+        bench_run_eval("configs = [pymex.feval('config')]");
+        bench_run_eval("old_lazy = pymex.set_lazy_structs(old_lazy)");
+        bench_check_true("lazy struct", "isinstance(configs[0], pymex.StructProxy)");
+        off_thread_calls = mexstub_off_thread_calls();
+        if (run_worker("reading", 1) >= 0) {
+            bench_check_true("lazy struct off the MEX thread",
+                "results[:7] == [2.0, 3.0, ['gain', 'nested'], 2, True, None, ['gain', 'nested']]");
+            bench_check_true("lazy struct repr", "'gain' in results[7]");
+        }
+        // Views of PyBytes data taken from the worker read the holder's
+        // buffer without asking MATLAB where it is.
+        bench_run_eval("blobs = [pymex.feval('blob')]");
+        if (run_worker("viewing", 1) >= 0) {
+            bench_check_true("memoryview off the MEX thread", "results == ['pymex']");
+        }
+        if (mexstub_off_thread_calls() != off_thread_calls) {
+            fprintf(stderr, "FAIL: worker called MATLAB off the MEX thread %lu time(s)\n",
+                (unsigned long) (mexstub_off_thread_calls() - off_thread_calls));
+            bench_failures++;
+        }
+    } else {
+        sequential_seconds = run_worker("sequential", N_CALLS);
+        batched_seconds = run_worker("batched", N_CALLS);
+        printf("%-24s %14s\n", "worker", "calls/s");
+        printf("%-24s %14.0f\n", "sequential (round trip)", N_CALLS / sequential_seconds);
+        printf("%-24s %14.0f\n", "batched", N_CALLS / batched_seconds);
+    }
+    
+    mexstub_shutdown();
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All callback checks passed.\n");
+    }
+    return 0;
+}
@@ -0,0 +1,285 @@
+/**
+ * bench_channel.c: Measures streaming frames to Python through a channel.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Streams fixed-size frames of doubles from "MATLAB" (this driver) to a
+// Python consumer, once by calling the consumer with each frame through
+// the generic CALL opcode, and once by writing batches of frames to a
+// pymex.Channel read by a Python thread, and reports frames per second.
+//
+// Usage: bench_channel [--quick]
+//
+// With --quick, a small channel is instead written and read back through
+// every path (wrapping around the ring, a full ring without blocking,
+// class mismatches, closing, writes from Python and a threaded reader),
+// and the frames are compared; the exit status is nonzero on a mismatch.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Must agree with function_t in pymex_fns.c.
+#define CALL_OPCODE 7
+#define CHANNEL_OPCODE 21
+#define CHANWRITE_OPCODE 22
+
+#define FRAME_ELEMENTS 64
+#define BATCH_FRAMES 256
+#define CHANNEL_CAPACITY 4096
+#define N_CALL_FRAMES 20000
+#define N_CHANNEL_FRAMES 1000000
+
+// Consumers, defined in __main__. Each keeps a running count and sum of
+// the frames it sees.
+static const char* SETUP =
+    "import array, pymex, threading\n"
+    "total = [0, 0.0]\n"
+    "def consume_one(frame):\n"
+    "    total[0] += 1\n"
+    "def consume(ch):\n"
+    "    while True:\n"
+    "        frames = ch.acquire()\n"
+    "        if not len(frames):\n"
+    "            return\n"
+    "        n = len(frames) // ch.record_bytes\n"
+    "        total[0] += n\n"
+    "        total[1] += sum(array.array(ch.typecode, str(frames)))\n"
+    "        ch.release(n)\n"
+    "def start(ch):\n"
+    "    global reader\n"
+    "    total[:] = [0, 0.0]\n"
+    "    reader = threading.Thread(target=consume, args=(ch,))\n"
+    "    reader.start()\n";
+
+// CALLS ///////////////////////////////////////////////////////////////////////
+
+static mxArray* make_channel(size_t rows, size_t cols, const char* class_name, double capacity) {
+    mxArray* args[3];
+    mxArray* ch;
+    
+    args[0] = mxCreateDoubleMatrix(1, 2, mxREAL);
+    mxGetPr(args[0])[0] = rows;
+    mxGetPr(args[0])[1] = cols;
+    args[1] = mxCreateString(class_name);
+    args[2] = mxCreateDoubleScalar(capacity);
+    ch = bench_run_opcode(CHANNEL_OPCODE, 3, args, NULL);
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+    mxDestroyArray(args[2]);
+    return ch;
+}
+
+/**
+ * Writes frames to a channel, returning the number written, or -1 on
+ * error (which counts as a failure unless expected).
+ */
+static double write_frames(mxArray* ch, mxArray* frames, bool block, bool expect_error) {
+    mxArray *args[3], *result;
+    double n_written = -1;
+    bool failed;
+    
+    args[0] = ch;
+    args[1] = frames;
+    args[2] = mxCreateLogicalScalar(block);
+    result = bench_run_opcode(CHANWRITE_OPCODE, 3, args, &failed);
+    if (failed != expect_error) {
+        fprintf(stderr, "FAIL: write %s\n", failed ? mexstub_last_error() : "should have failed");
+        bench_failures++;
+    }
+    if (result != NULL) {
+        n_written = mxGetScalar(result);
+        mxDestroyArray(result);
+    }
+    mxDestroyArray(args[2]);
+    return n_written;
+}
+
+/**
+ * Makes n_frames frames of n_elements doubles, numbered consecutively from
+ * first.
+ */
+static mxArray* counting_frames(size_t n_elements, size_t n_frames, double first) {
+    mxArray* frames = mxCreateDoubleMatrix(n_elements, n_frames, mxREAL);
+    size_t idx;
+    
+    for (idx = 0; idx < n_elements * n_frames; ++idx) {
+        mxGetPr(frames)[idx] = first + idx;
+    }
+    return frames;
+}
+
+static void check_written(const char* what, double expected, double actual) {
+    if (expected != actual) {
+        fprintf(stderr, "FAIL: %s: wrote %g frames, expected %g\n", what, actual, expected);
+        bench_failures++;
+    }
+}
+
+// CHECKS //////////////////////////////////////////////////////////////////////
+
+static void run_quick() {
+    mxArray *ch = make_channel(2, 3, "double", 5), *frames;
+    
+    if (ch == NULL) {
+        return;
+    }
+    bench_put("ch", mxDuplicateArray(ch));
+    bench_check_true("capacity rounds up", "ch.capacity == 8 and ch.shape == (2, 3) and ch.typecode == 'd'");
+    
+    // Five frames, numbered 0 to 29, read back in one piece.
+    frames = counting_frames(6, 5, 0);
+    check_written("first batch", 5, write_frames(ch, frames, true, false));
+    mxDestroyArray(frames);
+    bench_check_true("first batch", "ch.available() == 5");
+    bench_check_true("first batch", "array.array('d', str(ch.acquire())) == array.array('d', range(30))");
+    bench_check_true("release", "ch.release(5) is None and ch.available() == 0");
+    
+    // Six more wrap around the end of the ring, and come back in two pieces.
+    frames = counting_frames(6, 6, 30);
+    check_written("wrapping batch", 6, write_frames(ch, frames, true, false));
+    mxDestroyArray(frames);
+    bench_check_true("wrapping batch", "array.array('d', str(ch.acquire())) == array.array('d', range(30, 48))");
+    bench_check_true("wrapping batch", "ch.release(3) is None");
+    bench_check_true("wrapping batch", "array.array('d', str(ch.acquire(2))) == array.array('d', range(48, 60))");
+    bench_check_true("wrapping batch", "ch.release(3) is None and ch.available() == 0");
+    
+    // Without blocking, a full ring takes what fits.
+    frames = counting_frames(6, 10, 0);
+    check_written("nonblocking", 8, write_frames(ch, frames, false, false));
+    check_written("nonblocking", 0, write_frames(ch, frames, false, false));
+    mxDestroyArray(frames);
+    bench_check_true("nonblocking", "ch.release(8) is None");
+    
+    // Frames of the wrong class or size are refused.
+    frames = mxCreateNumericMatrix(6, 1, mxINT32_CLASS, mxREAL);
+    write_frames(ch, frames, true, true);
+    mxDestroyArray(frames);
+    frames = counting_frames(5, 1, 0);
+    write_frames(ch, frames, true, true);
+    mxDestroyArray(frames);
+    
+    // A closed channel refuses writes, and reads from it don't block.
+    bench_check_true("close", "ch.close() is None and ch.closed");
+    bench_check_true("close", "len(ch.acquire()) == 0");
+    frames = counting_frames(6, 1, 0);
+    write_frames(ch, frames, true, true);
+    mxDestroyArray(frames);
+    mxDestroyArray(ch);
+    
+    bench_check_true("write from Python",
+        "pymex.Channel((2,), 'i', 4).write(array.array('i', [1, 2, 3, 4])) == 2");
+    
+    // A reader thread keeps up with blocking writes through a small ring.
+    ch = make_channel(FRAME_ELEMENTS, 1, "double", 16);
+    bench_put("ch", mxDuplicateArray(ch));
+    bench_check_true("threaded reader", "start(ch) is None");
+    frames = counting_frames(FRAME_ELEMENTS, 100, 0);
+    check_written("threaded reader", 100, write_frames(ch, frames, true, false));
+    mxDestroyArray(frames);
+    bench_check_true("threaded reader", "ch.close() is None and reader.join() is None");
+    bench_check_true("threaded reader", "total == [100, sum(range(6400))]");
+    mxDestroyArray(ch);
+}
+
+// BENCHMARKS //////////////////////////////////////////////////////////////////
+
+static double bench_calls() {
+    mxArray *args[2], *consumer = bench_eval_expr("consume_one"), *result;
+    double start;
+    int idx;
+    
+    args[0] = consumer;
+    args[1] = mxCreateCellMatrix(1, 1);
+    start = bench_now();
+    for (idx = 0; idx < N_CALL_FRAMES; ++idx) {
+        mxSetCell(args[1], 0, counting_frames(FRAME_ELEMENTS, 1, idx));
+        result = bench_run_opcode(CALL_OPCODE, 2, args, NULL);
+        if (result != NULL) {
+            mxDestroyArray(result);
+        }
+    }
+    start = N_CALL_FRAMES / (bench_now() - start);
+    
+    mxDestroyArray(args[1]);
+    mxDestroyArray(consumer);
+    return start;
+}
+
+static double bench_channel() {
+    mxArray *ch = make_channel(FRAME_ELEMENTS, 1, "double", CHANNEL_CAPACITY), *frames;
+    double start, rate;
+    int idx;
+    
+    bench_put("ch", mxDuplicateArray(ch));
+    bench_check_true("start reader", "start(ch) is None");
+    frames = counting_frames(FRAME_ELEMENTS, BATCH_FRAMES, 0);
+    
+    start = bench_now();
+    for (idx = 0; idx < N_CHANNEL_FRAMES / BATCH_FRAMES; ++idx) {
+        write_frames(ch, frames, true, false);
+    }
+    bench_check_true("stop reader", "ch.close() is None and reader.join() is None");
+    rate = (N_CHANNEL_FRAMES / BATCH_FRAMES) * BATCH_FRAMES / (bench_now() - start);
+    
+    mxDestroyArray(frames);
+    mxDestroyArray(ch);
+    return rate;
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    double call_rate, channel_rate;
+    
+    if (!bench_init_pymex() || !bench_exec_python(SETUP)) {
+        return 1;
+    }
+    
+    if (quick) {
+        run_quick();
+    } else {
+        call_rate = bench_calls();
+        channel_rate = bench_channel();
+        printf("%d doubles per frame\n", FRAME_ELEMENTS);
+        printf("%-36s %14s\n", "path", "frames/s");
+        printf("%-36s %14.0f\n", "CALL per frame", call_rate);
+        printf("%-36s %14.0f\n", "channel, batches of 256, reader thread", channel_rate);
+    }
+    
+    mexstub_shutdown();
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All channel checks passed.\n");
+    }
+    return 0;
+}
@@ -0,0 +1,233 @@
+/**
+ * bench_common.c: Helpers shared by the standalone benchmarks.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Must agree with function_t in pymex_fns.c.
+#define EVAL_OPCODE 0
+#define PUT_OPCODE 4
+#define GET_OPCODE 5
+#define FLUSH_OPCODE 13
+#define EVALEXPR_OPCODE 16
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+int bench_failures = 0;
+
+// FUNCTIONS ///////////////////////////////////////////////////////////////////
+
+double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+bool bench_arrays_equal(const mxArray* a, const mxArray* b) {
+    size_t idx;
+    int field;
+    mxArray *field_a, *field_b;
+    
+    if (a == NULL || b == NULL) {
+        return a == b;
+    }
+    if (mxGetClassID(a) != mxGetClassID(b) ||
+        mxGetNumberOfDimensions(a) != mxGetNumberOfDimensions(b) ||
+        memcmp(mxGetDimensions(a), mxGetDimensions(b),
+            mxGetNumberOfDimensions(a) * sizeof(mwSize)) != 0
+    ) {
+        return false;
+    }
+    
+    if (mxIsCell(a)) {
+        for (idx = 0; idx < mxGetNumberOfElements(a); ++idx) {
+            if (!bench_arrays_equal(mxGetCell(a, idx), mxGetCell(b, idx))) {
+                return false;
+            }
+        }
+        return true;
+    } else if (mxIsStruct(a)) {
+        if (mxGetNumberOfFields(a) != mxGetNumberOfFields(b)) {
+            return false;
+        }
+        // Field order needn't match.
+        for (field = 0; field < mxGetNumberOfFields(a); ++field) {
+            for (idx = 0; idx < mxGetNumberOfElements(a); ++idx) {
+                field_a = mxGetFieldByNumber(a, idx, field);
+                field_b = mxGetField(b, idx, mxGetFieldNameByNumber(a, field));
+                if (!bench_arrays_equal(field_a, field_b)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    if (mxIsComplex(a) != mxIsComplex(b)) {
+        return false;
+    }
+    if (mxIsComplex(a) && memcmp(mxGetImagData(a), mxGetImagData(b),
+        mxGetNumberOfElements(a) * mxGetElementSize(a)) != 0
+    ) {
+        return false;
+    }
+    return memcmp(mxGetData(a), mxGetData(b),
+        mxGetNumberOfElements(a) * mxGetElementSize(a)) == 0;
+}
+
+mxArray* bench_opcode(int opcode) {
+    mxArray* array = mxCreateNumericMatrix(1, 1, mxINT8_CLASS, mxREAL);
+    *(signed char*) mxGetData(array) = (signed char) opcode;
+    return array;
+}
+
+static void setup_environment(void) {
+    char* old_path = getenv("PYTHONPATH");
+    char* new_path;
+    
+    // pymex imports _pymex from its source directory.
+    if (old_path == NULL || old_path[0] == '\0') {
+        setenv("PYTHONPATH", PYMEX_SOURCE_DIR, 1);
+    } else {
+        new_path = malloc(strlen(PYMEX_SOURCE_DIR) + strlen(old_path) + 2);
+        sprintf(new_path, "%s:%s", PYMEX_SOURCE_DIR, old_path);
+        setenv("PYTHONPATH", new_path, 1);
+        free(new_path);
+    }
+    
+    // Picked up by the stand-in getpref, as getpref('pymex', 'pythonhome').
+    #ifdef PYMEX_PYTHON_HOME
+        setenv("PYMEX_PYTHONHOME", PYMEX_PYTHON_HOME, 0);
+    #endif
+}
+
+bool bench_init_pymex(void) {
+    mxArray *prhs[1], *plhs[1];
+    
+    setup_environment();
+    
+    // FLUSH is the cheapest opcode to initialize with.
+    prhs[0] = bench_opcode(FLUSH_OPCODE);
+    if (mexstub_call(mexFunction, 1, plhs, 1, (const mxArray**) prhs) != 0) {
+        fprintf(stderr, "Could not initialize pymex: %s\n", mexstub_last_error());
+        mxDestroyArray(prhs[0]);
+        return false;
+    }
+    mxDestroyArray(plhs[0]);
+    mxDestroyArray(prhs[0]);
+    return true;
+}
+
+bool bench_exec_python(const char* code) {
+    if (PyRun_SimpleString(code) != 0) {
+        fprintf(stderr, "Python setup code raised an exception.\n");
+        return false;
+    }
+    return true;
+}
+
+mxArray* bench_run_opcode(int opcode, int nrhs, mxArray* args[], bool* failed) {
+    const mxArray* prhs[BENCH_MAX_ARGS + 1];
+    mxArray *plhs[1] = {NULL}, *m_opcode = bench_opcode(opcode);
+    int idx, status;
+    
+    prhs[0] = m_opcode;
+    for (idx = 0; idx < nrhs; ++idx) {
+        prhs[idx + 1] = args[idx];
+    }
+    status = mexstub_call(mexFunction, 1, plhs, nrhs + 1, prhs);
+    if (failed != NULL) {
+        *failed = status != 0;
+    } else if (status != 0) {
+        fprintf(stderr, "FAIL: %s\n", mexstub_last_error());
+        bench_failures++;
+    }
+    mxDestroyArray(m_opcode);
+    return status == 0 ? plhs[0] : NULL;
+}
+
+void bench_run_eval(const char* code) {
+    mxArray *arg = mxCreateString(code), *result;
+    bool failed;
+    
+    result = bench_run_opcode(EVAL_OPCODE, 1, &arg, &failed);
+    if (failed) {
+        fprintf(stderr, "FAIL: %s: %s\n", code, mexstub_last_error());
+        bench_failures++;
+    }
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    mxDestroyArray(arg);
+}
+
+mxArray* bench_eval_expr(const char* expr) {
+    mxArray *arg = mxCreateString(expr), *result = bench_run_opcode(EVALEXPR_OPCODE, 1, &arg, NULL);
+    
+    mxDestroyArray(arg);
+    return result;
+}
+
+void bench_put(const char* name, mxArray* value) {
+    mxArray *args[2], *result;
+    
+    args[0] = mxCreateString(name);
+    args[1] = value;
+    result = bench_run_opcode(PUT_OPCODE, 2, args, NULL);
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    mxDestroyArray(args[0]);
+}
+
+mxArray* bench_get(const char* name) {
+    mxArray *arg = mxCreateString(name), *result = bench_run_opcode(GET_OPCODE, 1, &arg, NULL);
+    
+    mxDestroyArray(arg);
+    return result;
+}
+
+bool bench_eval_true(const char* expr) {
+    mxArray* result = bench_eval_expr(expr);
+    bool value = result != NULL && mxIsLogicalScalarTrue(result);
+    
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    return value;
+}
+
+void bench_check_true(const char* what, const char* expr) {
+    if (!bench_eval_true(expr)) {
+        fprintf(stderr, "FAIL: %s: %s\n", what, expr);
+        bench_failures++;
+    }
+}
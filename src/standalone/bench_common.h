@@ -0,0 +1,106 @@
+/**
+ * bench_common.h: Helpers shared by the standalone benchmarks.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_STUB_BENCH_COMMON_H
+#define PYMEX_STUB_BENCH_COMMON_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "mexstub.h"
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Most arguments bench_run_opcode passes, not counting the opcode.
+#define BENCH_MAX_ARGS 16
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+// Checks that have failed so far; drivers exit nonzero if any did.
+extern int bench_failures;
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+/**
+ * Seconds on a monotonic clock.
+ */
+double bench_now(void);
+
+/**
+ * Compares two MATLAB arrays by class, dimensions and contents, recursing
+ * into cells and structs (whose fields may be in any order).
+ */
+bool bench_arrays_equal(const mxArray* a, const mxArray* b);
+
+/**
+ * Makes an int8 scalar holding a pymex opcode, as py_function_t does.
+ */
+mxArray* bench_opcode(int opcode);
+
+/**
+ * Points Python at pymex's sources and runs pymex's initialization, as the
+ * first call from MATLAB would. Returns false (after printing why) on
+ * failure.
+ */
+bool bench_init_pymex(void);
+
+/**
+ * Runs Python statements (which may span several lines, unlike with the
+ * EVAL opcode) in __main__. Returns false, after printing the traceback,
+ * if they raise.
+ */
+bool bench_exec_python(const char* code);
+
+/**
+ * Runs one opcode through mexFunction with the given arguments, which stay
+ * the caller's, and returns its output (owned by the caller), or NULL if it
+ * had none or raised an error. If failed isn't NULL, it is set to whether
+ * the opcode raised; otherwise an error is printed and counted as a failed
+ * check.
+ */
+mxArray* bench_run_opcode(int opcode, int nrhs, mxArray* args[], bool* failed);
+
+/**
+ * Runs Python code with the EVAL opcode, and evaluates an expression with
+ * EVALEXPR, returning its value (owned by the caller) or NULL. Errors count
+ * as failed checks.
+ */
+void bench_run_eval(const char* code);
+mxArray* bench_eval_expr(const char* expr);
+
+/**
+ * Binds value (which stays the caller's) to name in __main__ with PUT, and
+ * reads a name back with GET.
+ */
+void bench_put(const char* name, mxArray* value);
+mxArray* bench_get(const char* name);
+
+/**
+ * Returns whether a Python expression evaluates to True, and checks that
+ * it does, printing what was being checked if not.
+ */
+bool bench_eval_true(const char* expr);
+void bench_check_true(const char* what, const char* expr);
+
+#endif
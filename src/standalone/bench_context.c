@@ -0,0 +1,281 @@
+/**
+ * bench_context.c: Measures running Python code in contexts.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Times the PUT, GET, EVAL and EVALEXPR opcodes in __main__ against the
+// same opcodes in a context from py_context, which costs unboxing the
+// context on every call, and reports calls per second for each.
+//
+// Usage: bench_context [--quick]
+//
+// With --quick, globals set in one context are instead checked not to be
+// seen in __main__ or other contexts, builtins to be seen in all of them,
+// and anything but a context to be refused; the exit status is nonzero if
+// anything is off.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Must agree with function_t in pymex_fns.c.
+#define EVAL_OPCODE 0
+#define PUT_OPCODE 4
+#define GET_OPCODE 5
+#define EVALEXPR_OPCODE 16
+
+#define MAX_ARGS 3
+#define MIN_SECONDS 0.2
+
+static const char* NEW_CONTEXT = "__import__('_pymex.contexts', fromlist=['new_context']).new_context";
+
+// CALLS ///////////////////////////////////////////////////////////////////////
+
+/**
+ * Runs one opcode, returning its output (owned by the caller, and an empty
+ * array if it had none) or NULL on error. If context isn't NULL, it is
+ * passed as the last argument.
+ */
+static mxArray* run_in_context(int opcode, int nrhs, mxArray* args[], mxArray* context) {
+    mxArray *all_args[MAX_ARGS + 1], *result;
+    bool failed;
+    int idx;
+    
+    for (idx = 0; idx < nrhs; ++idx) {
+        all_args[idx] = args[idx];
+    }
+    if (context != NULL) {
+        all_args[nrhs++] = context;
+    }
+    result = bench_run_opcode(opcode, nrhs, all_args, &failed);
+    if (!failed && result == NULL) {
+        result = mxCreateDoubleMatrix(0, 0, mxREAL);
+    }
+    return result;
+}
+/**
+ * Runs an opcode with string arguments, and optionally a double as the
+ * last of them.
+ */
+static mxArray* run_strings(int opcode, const char* first, const char* second, mxArray* context) {
+    mxArray *args[2], *result;
+    int n_args = 1;
+    
+    args[0] = mxCreateString(first);
+    if (second != NULL) {
+        args[n_args++] = mxCreateString(second);
+    }
+    result = run_in_context(opcode, n_args, args, context);
+    while (n_args > 0) {
+        mxDestroyArray(args[--n_args]);
+    }
+    return result;
+}
+
+static mxArray* eval_expr(const char* expr, mxArray* context) {
+    mxArray *args[2], *result;
+    
+    args[0] = mxCreateString(expr);
+    args[1] = mxCreateStructMatrix(1, 1, 0, NULL);
+    result = run_in_context(EVALEXPR_OPCODE, context != NULL ? 2 : 1, args, context);
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+    return result;
+}
+
+static void put_double(const char* name, double value, mxArray* context) {
+    mxArray *args[2], *result;
+    
+    args[0] = mxCreateString(name);
+    args[1] = mxCreateDoubleScalar(value);
+    result = run_in_context(PUT_OPCODE, 2, args, context);
+    if (result == NULL) {
+        fprintf(stderr, "FAIL: put %s: %s\n", name, mexstub_last_error());
+        bench_failures++;
+    } else {
+        mxDestroyArray(result);
+    }
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+}
+
+/**
+ * Checks that an opcode returned a double scalar equal to expected, or
+ * failed if expected is NaN, and frees what it returned.
+ */
+static void check_value(const char* what, mxArray* result, double expected) {
+    bool ok;
+    
+    if (expected != expected) {
+        ok = result == NULL;
+    } else {
+        ok = result != NULL && mxIsDouble(result) && mxGetNumberOfElements(result) == 1
+            && mxGetScalar(result) == expected;
+    }
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        bench_failures++;
+    }
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+}
+
+static mxArray* get(const char* name, mxArray* context) {
+    return run_strings(GET_OPCODE, name, NULL, context);
+}
+
+// CHECKS //////////////////////////////////////////////////////////////////////
+
+static void check_isolation() {
+    char expr[256];
+    mxArray *a, *b, *result, *not_context;
+    
+    snprintf(expr, sizeof(expr), "%s('a')", NEW_CONTEXT);
+    a = eval_expr(expr, NULL);
+    snprintf(expr, sizeof(expr), "%s('b')", NEW_CONTEXT);
+    b = eval_expr(expr, NULL);
+    if (a == NULL || b == NULL) {
+        fprintf(stderr, "FAIL: could not make contexts: %s\n", mexstub_last_error());
+        bench_failures++;
+        return;
+    }
+    
+    put_double("x", 1, NULL);
+    put_double("x", 2, a);
+    put_double("x", 3, b);
+    result = run_strings(EVAL_OPCODE, "y = x * 10", NULL, a);
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    check_value("get from __main__", get("x", NULL), 1);
+    check_value("get from a", get("x", a), 2);
+    check_value("get from b", get("x", b), 3);
+    check_value("eval in a", get("y", a), 20);
+    check_value("not in __main__", get("y", NULL), 0.0 / 0.0);
+    check_value("not in b", get("y", b), 0.0 / 0.0);
+    check_value("eval_expr in b", eval_expr("x + len('ab')", b), 5);
+    check_value("builtins from b", eval_expr("float(len('abc'))", b), 3);
+    
+    // Only contexts will do.
+    not_context = eval_expr("{}", NULL);
+    check_value("dict as context", get("x", not_context), 0.0 / 0.0);
+    mxDestroyArray(not_context);
+    not_context = mxCreateDoubleScalar(1);
+    check_value("double as context", get("x", not_context), 0.0 / 0.0);
+    mxDestroyArray(not_context);
+    
+    mxDestroyArray(a);
+    mxDestroyArray(b);
+}
+
+// BENCHMARKS //////////////////////////////////////////////////////////////////
+
+/**
+ * Returns calls per second of the opcode with the given arguments.
+ */
+static double time_calls(int opcode, int nrhs, mxArray* args[], mxArray* context) {
+    double start = bench_now(), elapsed;
+    long n_calls = 0;
+    mxArray* result;
+    
+    do {
+        result = run_in_context(opcode, nrhs, args, context);
+        if (result == NULL) {
+            return 0.0;
+        }
+        mxDestroyArray(result);
+        ++n_calls;
+        elapsed = bench_now() - start;
+    } while (elapsed < MIN_SECONDS);
+    
+    return n_calls / elapsed;
+}
+
+static void run_benchmarks() {
+    char expr[256];
+    mxArray *context, *args[3];
+    
+    snprintf(expr, sizeof(expr), "%s()", NEW_CONTEXT);
+    context = eval_expr(expr, NULL);
+    if (context == NULL) {
+        return;
+    }
+    put_double("x", 1, NULL);
+    put_double("x", 1, context);
+    
+    printf("%-12s %14s %14s\n", "opcode", "__main__/s", "context/s");
+    args[0] = mxCreateString("x");
+    args[1] = mxCreateDoubleScalar(2);
+    printf("%-12s %14.0f %14.0f\n", "PUT",
+        time_calls(PUT_OPCODE, 2, args, NULL), time_calls(PUT_OPCODE, 2, args, context));
+    printf("%-12s %14.0f %14.0f\n", "GET",
+        time_calls(GET_OPCODE, 1, args, NULL), time_calls(GET_OPCODE, 1, args, context));
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+    
+    args[0] = mxCreateString("y = x + 1");
+    printf("%-12s %14.0f %14.0f\n", "EVAL",
+        time_calls(EVAL_OPCODE, 1, args, NULL), time_calls(EVAL_OPCODE, 1, args, context));
+    mxDestroyArray(args[0]);
+    
+    args[0] = mxCreateString("x + 1");
+    args[1] = mxCreateStructMatrix(1, 1, 0, NULL);
+    printf("%-12s %14.0f %14.0f\n", "EVALEXPR",
+        time_calls(EVALEXPR_OPCODE, 2, args, NULL), time_calls(EVALEXPR_OPCODE, 2, args, context));
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+    
+    mxDestroyArray(context);
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    
+    if (!bench_init_pymex()) {
+        return 1;
+    }
+    
+    if (quick) {
+        check_isolation();
+    } else {
+        run_benchmarks();
+    }
+    
+    mexstub_shutdown();
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All context checks passed.\n");
+    }
+    return 0;
+}
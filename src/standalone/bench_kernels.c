@@ -0,0 +1,472 @@
+/**
+ * bench_kernels.c: Compares the marshalling kernels against scalar reference loops.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Times each kernel in pymex_kernels.c at every instruction set level the
+// CPU supports, against a plain reference loop written without any of the
+// kernels' tricks, and reports throughput and speedup.
+//
+// Usage: bench_kernels [--quick]
+//
+// With --quick, every kernel is instead run at every level on a range of
+// awkward sizes and shapes, and its output compared byte for byte with the
+// reference loop's; the exit status is nonzero if any differ.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "bench_common.h"
+#include "../pymex_kernels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Not a power of two, so that the real and imaginary halves of a buffer
+// don't alias in the cache, but a multiple of 64 so that both are aligned.
+#define BENCH_ELEMENTS 1000000
+#define BENCH_SIDE 2000
+#define MIN_SECONDS 0.1
+#define MAX_DIMS 4
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef enum {
+    FILL_BYTES,
+    FILL_FLOATS,
+    FILL_DOUBLES,
+    FILL_LOGICALS,
+    FILL_ASCII_BYTES,
+    FILL_ASCII_CHARS
+} fill_t;
+
+typedef void (*kernel_fn_t)(void* out, const void* in, size_t n);
+
+typedef struct {
+    const char* name;
+    // Sizes per element, in bits so that packed logicals fit.
+    size_t in_bits;
+    size_t out_bits;
+    fill_t fill;
+    bool is_transpose;
+    kernel_fn_t reference;
+    kernel_fn_t kernel;
+} kernel_case_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+// Shape used by the transpose cases; kernel_fn_t has no room for it.
+static size_t shape_ndim;
+static size_t shape[MAX_DIMS];
+
+// REFERENCE LOOPS /////////////////////////////////////////////////////////////
+
+static void ref_transpose(void* out, const void* in, size_t el_size) {
+    size_t n = 1, idx, rest, axis, c_index, stride;
+    
+    for (axis = 0; axis < shape_ndim; ++axis) {
+        n *= shape[axis];
+    }
+    // Work out each element's C-order index from its column-major one.
+    for (idx = 0; idx < n; ++idx) {
+        rest = idx;
+        c_index = 0;
+        stride = n;
+        for (axis = 0; axis < shape_ndim; ++axis) {
+            stride /= shape[axis];
+            c_index += (rest % shape[axis]) * stride;
+            rest /= shape[axis];
+        }
+        memcpy((char*) out + c_index * el_size, (const char*) in + idx * el_size, el_size);
+    }
+}
+
+static void ref_transpose_1(void* out, const void* in, size_t n) { ref_transpose(out, in, 1); }
+static void ref_transpose_2(void* out, const void* in, size_t n) { ref_transpose(out, in, 2); }
+static void ref_transpose_4(void* out, const void* in, size_t n) { ref_transpose(out, in, 4); }
+static void ref_transpose_8(void* out, const void* in, size_t n) { ref_transpose(out, in, 8); }
+
+static void ref_interleave_f64(void* out, const void* in, size_t n) {
+    const double *re = in, *im = re + n;
+    double* dst = out;
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[2 * idx] = re[idx];
+        dst[2 * idx + 1] = im[idx];
+    }
+}
+
+static void ref_interleave_f32(void* out, const void* in, size_t n) {
+    const float *re = in, *im = re + n;
+    float* dst = out;
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[2 * idx] = re[idx];
+        dst[2 * idx + 1] = im[idx];
+    }
+}
+
+static void ref_split_f64(void* out, const void* in, size_t n) {
+    const double* src = in;
+    double *re = out, *im = re + n;
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        re[idx] = src[2 * idx];
+        im[idx] = src[2 * idx + 1];
+    }
+}
+
+static void ref_split_f32(void* out, const void* in, size_t n) {
+    const float* src = in;
+    float *re = out, *im = re + n;
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        re[idx] = src[2 * idx];
+        im[idx] = src[2 * idx + 1];
+    }
+}
+
+static void ref_pack(void* out, const void* in, size_t n) {
+    const unsigned char* src = in;
+    unsigned char* bits = out;
+    size_t idx;
+    memset(bits, 0, (n + 7) / 8);
+    for (idx = 0; idx < n; ++idx) {
+        bits[idx / 8] |= (src[idx] != 0) << (idx % 8);
+    }
+}
+
+static void ref_unpack(void* out, const void* in, size_t n) {
+    const unsigned char* bits = in;
+    unsigned char* dst = out;
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[idx] = (bits[idx / 8] >> (idx % 8)) & 1;
+    }
+}
+
+static void ref_widen_chars(void* out, const void* in, size_t n) {
+    const unsigned char* src = in;
+    mxChar* dst = out;
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[idx] = src[idx];
+    }
+}
+
+static void ref_narrow_chars(void* out, const void* in, size_t n) {
+    const mxChar* src = in;
+    char* dst = out;
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[idx] = (char) src[idx];
+    }
+}
+
+static void ref_widen_floats(void* out, const void* in, size_t n) {
+    const float* src = in;
+    double* dst = out;
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[idx] = src[idx];
+    }
+}
+
+static void ref_narrow_doubles(void* out, const void* in, size_t n) {
+    const double* src = in;
+    float* dst = out;
+    size_t idx;
+    for (idx = 0; idx < n; ++idx) {
+        dst[idx] = (float) src[idx];
+    }
+}
+
+// KERNEL WRAPPERS /////////////////////////////////////////////////////////////
+
+static void run_transpose_1(void* out, const void* in, size_t n) { transpose_nd(out, in, shape_ndim, shape, 1); }
+static void run_transpose_2(void* out, const void* in, size_t n) { transpose_nd(out, in, shape_ndim, shape, 2); }
+static void run_transpose_4(void* out, const void* in, size_t n) { transpose_nd(out, in, shape_ndim, shape, 4); }
+static void run_transpose_8(void* out, const void* in, size_t n) { transpose_nd(out, in, shape_ndim, shape, 8); }
+
+static void run_interleave_f64(void* out, const void* in, size_t n) {
+    interleave_complex(out, in, (const double*) in + n, n, 8);
+}
+
+static void run_interleave_f32(void* out, const void* in, size_t n) {
+    interleave_complex(out, in, (const float*) in + n, n, 4);
+}
+
+static void run_split_f64(void* out, const void* in, size_t n) {
+    split_complex(out, (double*) out + n, in, n, 8);
+}
+
+static void run_split_f32(void* out, const void* in, size_t n) {
+    split_complex(out, (float*) out + n, in, n, 4);
+}
+
+static void run_pack(void* out, const void* in, size_t n) { pack_logicals(out, in, n); }
+static void run_unpack(void* out, const void* in, size_t n) { unpack_logicals(out, in, n); }
+static void run_widen_chars(void* out, const void* in, size_t n) { widen_chars(out, in, n); }
+static void run_narrow_chars(void* out, const void* in, size_t n) { narrow_chars(out, in, n); }
+static void run_widen_floats(void* out, const void* in, size_t n) { widen_floats(out, in, n); }
+static void run_narrow_doubles(void* out, const void* in, size_t n) { narrow_doubles(out, in, n); }
+
+static const kernel_case_t CASES[] = {
+    {"transpose 8-byte", 64, 64, FILL_BYTES, true, ref_transpose_8, run_transpose_8},
+    {"transpose 4-byte", 32, 32, FILL_BYTES, true, ref_transpose_4, run_transpose_4},
+    {"transpose 2-byte", 16, 16, FILL_BYTES, true, ref_transpose_2, run_transpose_2},
+    {"transpose 1-byte", 8, 8, FILL_BYTES, true, ref_transpose_1, run_transpose_1},
+    {"interleave complex double", 128, 128, FILL_DOUBLES, false, ref_interleave_f64, run_interleave_f64},
+    {"interleave complex single", 64, 64, FILL_FLOATS, false, ref_interleave_f32, run_interleave_f32},
+    {"split complex double", 128, 128, FILL_DOUBLES, false, ref_split_f64, run_split_f64},
+    {"split complex single", 64, 64, FILL_FLOATS, false, ref_split_f32, run_split_f32},
+    {"pack logicals", 8, 1, FILL_LOGICALS, false, ref_pack, run_pack},
+    {"unpack logicals", 1, 8, FILL_BYTES, false, ref_unpack, run_unpack},
+    {"widen chars", 8, 16, FILL_ASCII_BYTES, false, ref_widen_chars, run_widen_chars},
+    {"narrow chars", 16, 8, FILL_ASCII_CHARS, false, ref_narrow_chars, run_narrow_chars},
+    {"widen single to double", 32, 64, FILL_FLOATS, false, ref_widen_floats, run_widen_floats},
+    {"narrow double to single", 64, 32, FILL_DOUBLES, false, ref_narrow_doubles, run_narrow_doubles},
+};
+
+#define N_CASES (sizeof(CASES) / sizeof(CASES[0]))
+
+// HELPERS /////////////////////////////////////////////////////////////////////
+
+static size_t n_bytes(size_t n, size_t bits) {
+    return (n * bits + 7) / 8;
+}
+
+/**
+ * Fills buf with n_bytes of pseudo-random input of the given kind.
+ */
+static void fill_input(void* buf, size_t size, fill_t fill) {
+    unsigned char* bytes = buf;
+    size_t idx;
+    unsigned seed = 12345;
+    
+    for (idx = 0; idx < size; ++idx) {
+        seed = seed * 1103515245 + 12345;
+        bytes[idx] = (unsigned char) (seed >> 16);
+    }
+    
+    switch (fill) {
+        case FILL_FLOATS:
+            for (idx = 0; idx < size / sizeof(float); ++idx) {
+                ((float*) buf)[idx] = (float) (bytes[idx * sizeof(float)] - 128) / 3.0f;
+            }
+            break;
+        case FILL_DOUBLES:
+            for (idx = 0; idx < size / sizeof(double); ++idx) {
+                ((double*) buf)[idx] = (bytes[idx * sizeof(double)] - 128) / 3.0;
+            }
+            break;
+        case FILL_LOGICALS:
+            for (idx = 0; idx < size; ++idx) {
+                bytes[idx] = bytes[idx] & 1;
+            }
+            break;
+        case FILL_ASCII_BYTES:
+            for (idx = 0; idx < size; ++idx) {
+                bytes[idx] = 1 + bytes[idx] % 127;
+            }
+            break;
+        case FILL_ASCII_CHARS:
+            for (idx = 0; idx < size / sizeof(mxChar); ++idx) {
+                ((mxChar*) buf)[idx] = 1 + bytes[idx * sizeof(mxChar)] % 127;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static size_t set_shape(size_t ndim, const size_t* dims) {
+    size_t n = 1, axis;
+    
+    shape_ndim = ndim;
+    for (axis = 0; axis < ndim; ++axis) {
+        shape[axis] = dims[axis];
+        n *= dims[axis];
+    }
+    return n;
+}
+
+// CHECKS //////////////////////////////////////////////////////////////////////
+
+static void check_case(const kernel_case_t* c, size_t n) {
+    size_t in_size = n_bytes(n, c->in_bits), out_size = n_bytes(n, c->out_bits);
+    // One spare byte, so that zero-sized cases still get real buffers.
+    unsigned char* in = malloc(in_size + 1);
+    unsigned char* expected = malloc(out_size + 1);
+    unsigned char* actual = malloc(out_size + 1);
+    int level, best = detect_simd_level();
+    
+    fill_input(in, in_size, c->fill);
+    c->reference(expected, in, n);
+    for (level = SIMD_SCALAR; level <= best; ++level) {
+        set_simd_level((simd_level_t) level);
+        memset(actual, 0xa5, out_size + 1);
+        c->kernel(actual, in, n);
+        if (memcmp(expected, actual, out_size) != 0 || actual[out_size] != 0xa5) {
+            fprintf(stderr, "FAIL: %s at %s, n = %lu\n", c->name,
+                simd_level_name((simd_level_t) level), (unsigned long) n);
+            bench_failures++;
+        }
+    }
+    
+    free(in);
+    free(expected);
+    free(actual);
+}
+
+/**
+ * Checks that the char kernels notice a single non-ASCII character
+ * wherever it falls.
+ */
+static void check_non_ascii(size_t n) {
+    char* bytes = malloc(n);
+    mxChar* chars = malloc(n * sizeof(mxChar));
+    int level, best = detect_simd_level();
+    size_t pos;
+    
+    for (level = SIMD_SCALAR; level <= best; ++level) {
+        set_simd_level((simd_level_t) level);
+        for (pos = 0; pos < n; ++pos) {
+            fill_input(bytes, n, FILL_ASCII_BYTES);
+            fill_input(chars, n * sizeof(mxChar), FILL_ASCII_CHARS);
+            bytes[pos] = (char) 0xc3;
+            chars[pos] = 0x100;
+            if (widen_chars(chars, bytes, n) || narrow_chars(bytes, chars, n)) {
+                fprintf(stderr, "FAIL: missed non-ASCII character at %lu of %lu with %s\n",
+                    (unsigned long) pos, (unsigned long) n, simd_level_name((simd_level_t) level));
+                bench_failures++;
+                break;
+            }
+        }
+    }
+    
+    free(bytes);
+    free(chars);
+}
+
+static void run_checks() {
+    static const size_t SIZES[] = {0, 1, 3, 7, 8, 15, 17, 31, 33, 63, 64, 65, 100, 1000, 4099};
+    static const size_t SHAPES[][MAX_DIMS + 1] = {
+        // ndim, then dims.
+        {2, 1, 1}, {2, 3, 5}, {2, 5, 3}, {2, 4, 4}, {2, 33, 67}, {2, 64, 64},
+        {2, 100, 1}, {2, 1, 100}, {2, 0, 5}, {3, 2, 3, 4}, {3, 5, 1, 7},
+        {3, 17, 9, 33}, {4, 3, 4, 5, 6}, {1, 10}
+    };
+    size_t idx_case, idx;
+    const kernel_case_t* c;
+    
+    for (idx_case = 0; idx_case < N_CASES; ++idx_case) {
+        c = &CASES[idx_case];
+        if (c->is_transpose) {
+            for (idx = 0; idx < sizeof(SHAPES) / sizeof(SHAPES[0]); ++idx) {
+                check_case(c, set_shape(SHAPES[idx][0], &SHAPES[idx][1]));
+            }
+        } else {
+            for (idx = 0; idx < sizeof(SIZES) / sizeof(SIZES[0]); ++idx) {
+                check_case(c, SIZES[idx]);
+            }
+        }
+    }
+    
+    check_non_ascii(100);
+}
+
+// BENCHMARKS //////////////////////////////////////////////////////////////////
+
+/**
+ * Returns the best time of fn over repeated runs.
+ */
+static double time_kernel(kernel_fn_t fn, void* out, const void* in, size_t n) {
+    double best = 0.0, start = bench_now(), t0, elapsed;
+    
+    do {
+        t0 = bench_now();
+        fn(out, in, n);
+        elapsed = bench_now() - t0;
+        if (best == 0.0 || elapsed < best) {
+            best = elapsed;
+        }
+    } while (bench_now() - start < MIN_SECONDS);
+    return best;
+}
+
+static void run_benchmarks() {
+    static const size_t SQUARE[] = {BENCH_SIDE, BENCH_SIDE};
+    size_t idx_case, n, in_size, out_size;
+    const kernel_case_t* c;
+    void *in, *out;
+    double reference, t;
+    int level, best = detect_simd_level();
+    
+    printf("%-28s %-8s %10s %10s %8s\n", "kernel", "level", "ms", "GB/s", "speedup");
+    for (idx_case = 0; idx_case < N_CASES; ++idx_case) {
+        c = &CASES[idx_case];
+        n = c->is_transpose ? set_shape(2, SQUARE) : BENCH_ELEMENTS;
+        in_size = n_bytes(n, c->in_bits);
+        out_size = n_bytes(n, c->out_bits);
+        // MATLAB's allocator aligns at least this well.
+        if (posix_memalign(&in, 64, in_size) != 0 || posix_memalign(&out, 64, out_size) != 0) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+        }
+        fill_input(in, in_size, c->fill);
+        
+        reference = time_kernel(c->reference, out, in, n);
+        printf("%-28s %-8s %10.2f %10.2f %7.2fx\n", c->name, "ref",
+            1e3 * reference, (in_size + out_size) / reference / 1e9, 1.0);
+        for (level = SIMD_SCALAR; level <= best; ++level) {
+            set_simd_level((simd_level_t) level);
+            t = time_kernel(c->kernel, out, in, n);
+            printf("%-28s %-8s %10.2f %10.2f %7.2fx\n", "", simd_level_name((simd_level_t) level),
+                1e3 * t, (in_size + out_size) / t / 1e9, reference / t);
+        }
+        
+        free(in);
+        free(out);
+    }
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    
+    if (quick) {
+        run_checks();
+    } else {
+        printf("Best supported level: %s\n", simd_level_name(detect_simd_level()));
+        run_benchmarks();
+    }
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All kernel checks passed up to %s.\n", simd_level_name(detect_simd_level()));
+    }
+    return 0;
+}
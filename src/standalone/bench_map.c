@@ -0,0 +1,348 @@
+/**
+ * bench_map.c: Measures mapping a Python callable over array slices.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Times applying a Python callable to each element of a vector, and to
+// each column of a matrix, with one CALL per slice (as a MATLAB loop or
+// cellfun would) against one MAP for all of them, and reports slices per
+// second for each.
+//
+// Usage: bench_map [--quick]
+//
+// With --quick, MAP is instead checked for each kind of input (columns,
+// rows, scalars, cells) and output (numbers, sequences, other classes,
+// cells), for views that outlive the call, for results that don't fit and
+// for leaks; the exit status is nonzero if anything is off.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Must agree with function_t in pymex_fns.c.
+#define CALL_OPCODE 7
+#define MAP_OPCODE 25
+
+#define MIN_SECONDS 0.2
+
+// Slices in the timed arrays, and rows in the timed matrix.
+#define N_SLICES 10000
+#define N_ROWS 64
+
+// Pure Python, so that this runs without NumPy; struct reads the views.
+static const char* SETUP =
+    "import struct\n"
+    "def values(v):\n"
+    "    return struct.unpack(v.format * len(v), v.tobytes())\n"
+    "def total(v):\n"
+    "    return sum(values(v))\n"
+    "def extremes(v):\n"
+    "    return [min(values(v)), max(values(v))]\n"
+    "def square(x):\n"
+    "    return x * x if type(x) is int else -1\n"
+    "def hundredfold(x):\n"
+    "    return x * 100\n"
+    "def upper(s):\n"
+    "    return s.upper()\n"
+    "def ragged(v):\n"
+    "    return range(int(v))\n"
+    "def fail(x):\n"
+    "    raise ValueError('no')\n"
+    "kept = []\n"
+    "def keep(v):\n"
+    "    kept.append(v)\n"
+    "    return len(v)\n"
+    "def increment(x):\n"
+    "    return x + 1\n"
+    "def ignore(x):\n"
+    "    return 0.0\n"
+    "def identity(v):\n"
+    "    return v\n";
+
+// CALLS ///////////////////////////////////////////////////////////////////////
+
+/**
+ * Maps the named function in __main__ over data, returning the result or
+ * NULL on error.
+ */
+static mxArray* map(const char* fn_name, const mxArray* data, int dim, const char* output) {
+    mxArray *args[4], *result;
+    bool failed;
+    
+    args[0] = bench_eval_expr(fn_name);
+    args[1] = (mxArray*) data;
+    args[2] = mxCreateDoubleScalar(dim);
+    args[3] = mxCreateString(output);
+    result = args[0] == NULL ? NULL : bench_run_opcode(MAP_OPCODE, 4, args, &failed);
+    if (args[0] != NULL) {
+        mxDestroyArray(args[0]);
+    }
+    mxDestroyArray(args[2]);
+    mxDestroyArray(args[3]);
+    return result;
+}
+
+/**
+ * Checks that result has the given class, size and (as doubles) values,
+ * freeing it.
+ */
+static void check_result(const char* what, mxArray* result, mxClassID class,
+                         size_t rows, size_t cols, const double* expected) {
+    size_t idx;
+    bool ok = result != NULL && mxGetClassID(result) == class
+        && mxGetM(result) == rows && mxGetN(result) == cols;
+    
+    for (idx = 0; ok && idx < rows * cols; ++idx) {
+        switch (class) {
+            case mxDOUBLE_CLASS: ok = ((double*) mxGetData(result))[idx] == expected[idx]; break;
+            case mxSINGLE_CLASS: ok = ((float*) mxGetData(result))[idx] == expected[idx]; break;
+            case mxINT32_CLASS: ok = ((int*) mxGetData(result))[idx] == expected[idx]; break;
+            case mxUINT8_CLASS: ok = ((unsigned char*) mxGetData(result))[idx] == expected[idx]; break;
+            case mxLOGICAL_CLASS: ok = ((mxLogical*) mxGetData(result))[idx] == expected[idx]; break;
+            default: ok = false;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        bench_failures++;
+    }
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+}
+
+static void check_fails(const char* what, mxArray* result) {
+    if (result != NULL) {
+        fprintf(stderr, "FAIL: %s: no error\n", what);
+        bench_failures++;
+        mxDestroyArray(result);
+    }
+}
+
+/**
+ * A rows x cols double matrix holding 1, 2, 3... in column-major order.
+ */
+static mxArray* counting_matrix(size_t rows, size_t cols) {
+    mxArray* matrix = mxCreateDoubleMatrix(rows, cols, mxREAL);
+    size_t idx;
+    
+    for (idx = 0; idx < rows * cols; ++idx) {
+        mxGetPr(matrix)[idx] = idx + 1;
+    }
+    return matrix;
+}
+
+// CHECKS //////////////////////////////////////////////////////////////////////
+
+static void check_numeric_inputs() {
+    static const double COLUMN_SUMS[] = {6, 15, 24, 33};
+    static const double ROW_SUMS[] = {22, 26, 30};
+    static const double COLUMN_EXTREMES[] = {1, 3, 4, 6, 7, 9, 10, 12};
+    static const double ROW_EXTREMES[] = {1, 2, 3, 10, 11, 12};
+    static const double SQUARES[] = {1, 4, 9, 16, 25};
+    static const double COUNTING[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12};
+    mxArray *matrix = counting_matrix(3, 4), *ints = mxCreateNumericMatrix(1, 5, mxINT32_CLASS, mxREAL);
+    mxArray* singles = mxCreateNumericMatrix(3, 4, mxSINGLE_CLASS, mxREAL);
+    int idx;
+    
+    check_result("columns", map("total", matrix, 2, "double"), mxDOUBLE_CLASS, 1, 4, COLUMN_SUMS);
+    check_result("rows", map("total", matrix, 1, "double"), mxDOUBLE_CLASS, 3, 1, ROW_SUMS);
+    check_result("column sequences", map("extremes", matrix, 2, "double"), mxDOUBLE_CLASS, 2, 4, COLUMN_EXTREMES);
+    check_result("row sequences", map("extremes", matrix, 1, "double"), mxDOUBLE_CLASS, 3, 2, ROW_EXTREMES);
+    
+    // Single elements arrive as Python scalars of the matching type.
+    for (idx = 0; idx < 5; ++idx) {
+        ((int*) mxGetData(ints))[idx] = idx + 1;
+    }
+    check_result("scalars", map("square", ints, 2, "int32"), mxINT32_CLASS, 1, 5, SQUARES);
+    check_result("scalars as doubles", map("square", ints, 2, "double"), mxDOUBLE_CLASS, 1, 5, SQUARES);
+    
+    // Views of singles, returned as they are, are widened in bulk, and
+    // narrowed in bulk into single columns.
+    for (idx = 0; idx < 12; ++idx) {
+        ((float*) mxGetData(singles))[idx] = idx + 1;
+    }
+    check_result("single columns", map("identity", singles, 2, "single"), mxSINGLE_CLASS, 3, 4, COUNTING);
+    check_result("single rows", map("identity", singles, 1, "double"), mxDOUBLE_CLASS, 3, 4, COUNTING);
+    
+    mxDestroyArray(matrix);
+    mxDestroyArray(ints);
+    mxDestroyArray(singles);
+}
+
+static void check_outputs() {
+    static const double SATURATED[] = {100, 200, 255, 0};
+    static const double NONZERO[] = {1, 1, 1, 0};
+    mxArray *row = counting_matrix(1, 4), *cell = mxCreateCellMatrix(1, 2), *result;
+    
+    mxGetPr(row)[3] = 0;
+    check_result("saturation", map("hundredfold", row, 2, "uint8"), mxUINT8_CLASS, 1, 4, SATURATED);
+    check_result("logical", map("hundredfold", row, 2, "logical"), mxLOGICAL_CLASS, 1, 4, NONZERO);
+    
+    // Cells are mapped element by element, whatever the dimension.
+    mxSetCell(cell, 0, mxCreateString("ab"));
+    mxSetCell(cell, 1, mxCreateString("cde"));
+    result = map("upper", cell, 1, "cell");
+    if (result == NULL || !mxIsCell(result) || mxGetN(result) != 2
+            || mxGetNumberOfElements(mxGetCell(result, 1)) != 3 || mxGetChars(mxGetCell(result, 1))[0] != 'C') {
+        fprintf(stderr, "FAIL: cell to cell\n");
+        bench_failures++;
+    }
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    
+    check_fails("unknown class", map("total", row, 2, "char"));
+    check_fails("ragged results", map("ragged", row, 2, "double"));
+    check_fails("strings as numbers", map("upper", cell, 2, "double"));
+    check_fails("exception", map("fail", row, 2, "double"));
+    mxDestroyArray(row);
+    mxDestroyArray(cell);
+}
+
+static void check_views() {
+    size_t baseline = mexstub_live_arrays();
+    mxArray *matrix = counting_matrix(3, 4), *result;
+    
+    // Views kept past the call see a copy, so changes to the input (or
+    // freeing it) don't reach them.
+    result = map("keep", matrix, 1, "double");
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    mxGetPr(matrix)[1] = -1;
+    mxDestroyArray(matrix);
+    bench_check_true("kept views", "len(kept) == 3 and all(v.readonly for v in kept)");
+    bench_check_true("kept views", "values(kept[1]) == (2.0, 5.0, 8.0, 11.0)");
+    bench_check_true("contiguous rows", "kept[1].strides == (8,)");
+    
+    bench_check_true("release", "kept.__delslice__(0, len(kept)) is None");
+    if (mexstub_live_arrays() != baseline) {
+        fprintf(stderr, "FAIL: release: %d arrays leaked\n", (int) (mexstub_live_arrays() - baseline));
+        bench_failures++;
+    }
+}
+
+// BENCHMARKS //////////////////////////////////////////////////////////////////
+
+/**
+ * Returns slices per second, calling fn on each column of data with CALL.
+ */
+static double time_calls(const char* fn_name, const mxArray* data) {
+    mxArray *rhs[2], *column, *result;
+    size_t rows = mxGetM(data), cols = mxGetN(data), idx;
+    double start = bench_now(), elapsed;
+    long n_slices = 0;
+    
+    rhs[0] = bench_eval_expr(fn_name);
+    rhs[1] = mxCreateCellMatrix(1, 1);
+    do {
+        for (idx = 0; idx < cols; ++idx) {
+            // As x(:, k) would, copy the column out first.
+            column = mxCreateDoubleMatrix(rows, 1, mxREAL);
+            memcpy(mxGetPr(column), mxGetPr(data) + idx * rows, rows * sizeof(double));
+            mxSetCell(rhs[1], 0, column);
+            result = bench_run_opcode(CALL_OPCODE, 2, rhs, NULL);
+            if (result == NULL) {
+                return 0.0;
+            }
+            mxDestroyArray(result);
+        }
+        n_slices += cols;
+        elapsed = bench_now() - start;
+    } while (elapsed < MIN_SECONDS);
+    
+    mxDestroyArray(rhs[0]);
+    mxDestroyArray(rhs[1]);
+    return n_slices / elapsed;
+}
+
+/**
+ * Returns slices per second, mapping fn over the columns of data.
+ */
+static double time_map(const char* fn_name, const mxArray* data) {
+    mxArray* result;
+    double start = bench_now(), elapsed;
+    long n_slices = 0;
+    
+    do {
+        result = map(fn_name, data, 2, "double");
+        if (result == NULL) {
+            return 0.0;
+        }
+        mxDestroyArray(result);
+        n_slices += mxGetN(data);
+        elapsed = bench_now() - start;
+    } while (elapsed < MIN_SECONDS);
+    
+    return n_slices / elapsed;
+}
+
+static void run_benchmarks() {
+    mxArray *row = counting_matrix(1, N_SLICES), *matrix = counting_matrix(N_ROWS, N_SLICES);
+    
+    printf("%-32s %14s %14s\n", "slices", "CALL/s", "MAP/s");
+    printf("%-32s %14.0f %14.0f\n", "increment, 1 x 10000 elements",
+        time_calls("increment", row), time_map("increment", row));
+    // CALL boxes each column as an mxArray, so only MAP's views could be
+    // read here without NumPy; ignore them either way.
+    printf("%-32s %14.0f %14.0f\n", "ignore, 64 x 10000 columns",
+        time_calls("ignore", matrix), time_map("ignore", matrix));
+    
+    mxDestroyArray(row);
+    mxDestroyArray(matrix);
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    
+    if (!bench_init_pymex() || !bench_exec_python(SETUP)) {
+        return 1;
+    }
+    
+    if (quick) {
+        check_numeric_inputs();
+        check_outputs();
+        check_views();
+    } else {
+        run_benchmarks();
+    }
+    
+    mexstub_shutdown();
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All map checks passed.\n");
+    }
+    return 0;
+}
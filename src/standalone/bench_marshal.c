@@ -0,0 +1,542 @@
+/**
+ * bench_marshal.c: Micro-benchmark for mat2py and py2mat.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Runs pymex's marshalling functions against the stand-in MEX library, so
+// that changes to them can be timed (and sanity-checked) without MATLAB.
+//
+// Usage: bench_marshal [--quick]
+//
+// With --quick, each case is converted once in each direction and checked
+// for round-trip fidelity and leaked arrays; the exit status is nonzero if
+// anything is off.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+#include "../pymex_marshal.h"
+#include "../pymex_struct.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Iterations per simulated MEX call. Memory from mxCalloc (e.g. in
+// get_matlab_str) is only reclaimed when a call returns, as in MATLAB, so
+// this bounds how much can pile up.
+#define BATCH_SIZE 64
+#define MIN_SECONDS 0.2
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    const char* name;
+    mxArray* (*make)(size_t n);
+    size_t n;
+    // Python expression that py2mat should turn into the same array as
+    // make(n), or NULL if py2mat should not be run for this case.
+    const char* py_expr;
+    // Whether mat2py followed by py2mat should reproduce the input.
+    bool round_trip;
+    // Whether mat2py runs with lazy_structs set.
+    bool lazy;
+} bench_case_t;
+
+typedef enum {
+    DIR_MAT2PY,
+    DIR_PY2MAT
+} direction_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+// Entry points take no user data, so the case being run is passed here.
+static const bench_case_t* current_case;
+static direction_t current_direction;
+static PyObject* current_source;
+static double batch_seconds;
+
+// CASE CONSTRUCTORS ///////////////////////////////////////////////////////////
+
+static mxArray* make_double(size_t n) {
+    return mxCreateDoubleScalar(1.5);
+}
+
+static mxArray* make_logical(size_t n) {
+    return mxCreateLogicalScalar(true);
+}
+
+static mxArray* make_int32(size_t n) {
+    mxArray* array = mxCreateNumericMatrix(1, 1, mxINT32_CLASS, mxREAL);
+    *(int*) mxGetData(array) = 7;
+    return array;
+}
+
+static mxArray* make_int64(size_t n) {
+    mxArray* array = mxCreateNumericMatrix(1, 1, mxINT64_CLASS, mxREAL);
+    *(long long int*) mxGetData(array) = 7;
+    return array;
+}
+
+static mxArray* make_char(size_t n) {
+    char* buf = malloc(n + 1);
+    mxArray* array;
+    
+    memset(buf, 'x', n);
+    buf[n] = '\0';
+    array = mxCreateString(buf);
+    free(buf);
+    return array;
+}
+
+static mxArray* make_cell(size_t n) {
+    mxArray* array = mxCreateCellMatrix(1, n);
+    size_t idx;
+    
+    for (idx = 0; idx < n; ++idx) {
+        mxSetCell(array, idx, mxCreateDoubleScalar(1.5));
+    }
+    return array;
+}
+
+static mxArray* make_struct(size_t n) {
+    char names[64][8];
+    const char* field_names[64];
+    mxArray* array;
+    size_t idx;
+    
+    for (idx = 0; idx < n && idx < 64; ++idx) {
+        sprintf(names[idx], "f%d", (int) idx);
+        field_names[idx] = names[idx];
+    }
+    array = mxCreateStructMatrix(1, 1, (int) idx, field_names);
+    for (idx = 0; idx < n && idx < 64; ++idx) {
+        mxSetFieldByNumber(array, 0, (int) idx, mxCreateDoubleScalar((double) idx));
+    }
+    return array;
+}
+
+static mxArray* make_matrix(size_t n) {
+    mxArray* array = mxCreateDoubleMatrix(n, n, mxREAL);
+    double* data = mxGetPr(array);
+    size_t idx;
+    
+    for (idx = 0; idx < n * n; ++idx) {
+        data[idx] = (double) idx;
+    }
+    return array;
+}
+
+/**
+ * A configuration-like struct: a name, an n by n matrix and a nested
+ * struct of settings.
+ */
+static mxArray* make_config(size_t n) {
+    const char* field_names[] = {"name", "matrix", "nested"};
+    mxArray* array = mxCreateStructMatrix(1, 1, 3, field_names);
+    
+    mxSetField(array, 0, "name", make_char(16));
+    mxSetField(array, 0, "matrix", make_matrix(n));
+    mxSetField(array, 0, "nested", make_struct(8));
+    return array;
+}
+
+/**
+ * n bytes of binary data, marked as such with PyBytes.
+ */
+static mxArray* make_bytes(size_t n) {
+    static const char* props[] = {"data"};
+    mxArray *array = mexstub_create_object("PyBytes", 1, props);
+    mxArray* data = mxCreateNumericMatrix(n, 1, mxUINT8_CLASS, mxREAL);
+    
+    memset(mxGetData(data), 'x', n);
+    mxSetProperty(array, 0, "data", data);
+    mxDestroyArray(data);
+    return array;
+}
+
+static const bench_case_t CASES[] = {
+    {"double scalar", make_double, 1, "1.5", true, false},
+    {"logical scalar", make_logical, 1, "True", true, false},
+    {"int32 scalar", make_int32, 1, "7", true, false},
+    {"int64 scalar", make_int64, 1, "7L", true, false},
+    {"char 1x16", make_char, 16, "'x' * 16", true, false},
+    {"char 1x4096", make_char, 4096, "'x' * 4096", true, false},
+    {"char 1x1048576", make_char, 1048576, "'x' * 1048576", true, false},
+    // mat2py keeps both dimensions of a cell array ([[...]] for 1xN), and
+    // turns structs into dicts, which come back boxed; so these cases only
+    // round-trip starting from Python.
+    {"cell 1x16", make_cell, 16, "[1.5] * 16", false, false},
+    {"cell 1x1024", make_cell, 1024, "[1.5] * 1024", false, false},
+    {"struct 8 fields", make_struct, 8,
+        "pymex.mtypes.struct(('f%d' % i, float(i)) for i in range(8))", false, false},
+    // With lazy_structs, structs become StructProxy objects, which do
+    // round-trip, and free their copies.
+    {"struct 8 fields lazy", make_struct, 8,
+        "pymex.mtypes.struct(('f%d' % i, float(i)) for i in range(8))", true, true},
+    {"config 100x100 lazy", make_config, 100, NULL, true, true},
+    // PyBytes arrive as memoryviews, and binary data comes back as a uint8
+    // column vector, which is what these cases compare against.
+    {"bytes 4096", make_bytes, 4096, "bytearray('x' * 4096)", true, false},
+    {"bytes 1048576", make_bytes, 1048576, "bytearray('x' * 1048576)", true, false},
+    {"buffer 1048576", make_bytes, 1048576, "buffer('x' * 1048576)", true, false},
+    // Boxed as pymex.mxArray; the persistent copy this makes is never
+    // freed (see README), so these cases are only timed, not checked.
+    {"double 100x100", make_matrix, 100, NULL, false, false},
+    {"config 100x100", make_config, 100, NULL, false, false},
+};
+
+#define N_CASES (sizeof(CASES) / sizeof(CASES[0]))
+
+// UTILITY FUNCTIONS ///////////////////////////////////////////////////////////
+
+/**
+ * Size in bytes of the data held by a MATLAB array, used to report
+ * throughput.
+ */
+static size_t payload_bytes(const mxArray* array) {
+    size_t total = 0, idx;
+    int field;
+    mxArray* data;
+    
+    if (mxIsCell(array)) {
+        for (idx = 0; idx < mxGetNumberOfElements(array); ++idx) {
+            total += payload_bytes(mxGetCell(array, idx));
+        }
+    } else if (mxIsStruct(array)) {
+        for (idx = 0; idx < mxGetNumberOfElements(array); ++idx) {
+            for (field = 0; field < mxGetNumberOfFields(array); ++field) {
+                total += payload_bytes(mxGetFieldByNumber(array, idx, field));
+            }
+        }
+    } else if (mxIsClass(array, "PyBytes")) {
+        data = mxGetProperty(array, 0, "data");
+        total = mxGetNumberOfElements(data);
+        mxDestroyArray(data);
+    } else {
+        total = mxGetNumberOfElements(array) * mxGetElementSize(array);
+    }
+    return total;
+}
+
+
+static void fail(const char* case_name, const char* what) {
+    fprintf(stderr, "FAIL: %s: %s\n", case_name, what);
+    bench_failures++;
+}
+
+static PyObject* eval_python(const char* expr) {
+    PyObject* globals = PyModule_GetDict(PyImport_AddModule("__main__"));
+    PyObject* result = PyRun_String(expr, Py_eval_input, globals, globals);
+    
+    if (result == NULL) {
+        PyErr_Print();
+        mexErrMsgTxt("Could not evaluate benchmark expression.");
+    }
+    return result;
+}
+
+// ENTRY POINTS ////////////////////////////////////////////////////////////////
+// Each of these is run via mexstub_call, as MATLAB would run mexFunction.
+
+static void init_entry(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    PyRun_SimpleString("import pymex");
+}
+
+/**
+ * Times one batch of conversions in the current direction, leaving the
+ * elapsed time in batch_seconds.
+ */
+static void batch_entry(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    mxArray *m_value, *m_result;
+    PyObject* py_result;
+    double start;
+    int idx;
+    
+    lazy_structs = current_case->lazy;
+    if (current_direction == DIR_MAT2PY) {
+        m_value = current_case->make(current_case->n);
+        start = bench_now();
+        for (idx = 0; idx < BATCH_SIZE; ++idx) {
+            py_result = mat2py(m_value, false);
+            Py_DECREF(py_result);
+        }
+        batch_seconds = bench_now() - start;
+    } else {
+        start = bench_now();
+        for (idx = 0; idx < BATCH_SIZE; ++idx) {
+            // py2mat consumes the reference it's given.
+            Py_INCREF(current_source);
+            m_result = py2mat(current_source);
+            mxDestroyArray(m_result);
+        }
+        batch_seconds = bench_now() - start;
+    }
+}
+
+/**
+ * Converts the current case once in each direction and checks the results.
+ */
+static void check_entry(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    mxArray *m_value, *m_expected, *m_back;
+    PyObject *py_value, *py_field;
+    
+    lazy_structs = current_case->lazy;
+    m_value = current_case->make(current_case->n);
+    m_expected = m_value;
+    py_value = mat2py(m_value, false);
+    if (py_value == NULL) {
+        fail(current_case->name, "mat2py returned NULL");
+        return;
+    }
+    if (mxIsClass(m_value, "PyBytes")) {
+        if (!PyMemoryView_Check(py_value) || !PyMemoryView_GET_BUFFER(py_value)->readonly) {
+            fail(current_case->name, "PyBytes is not a read-only memoryview");
+        }
+        // Only the data comes back.
+        m_expected = mxGetProperty(m_value, 0, "data");
+    }
+    if (current_case->round_trip) {
+        Py_INCREF(py_value);
+        m_back = py2mat(py_value);
+        if (!bench_arrays_equal(m_expected, m_back)) {
+            fail(current_case->name, "mat2py -> py2mat did not round-trip");
+        }
+    }
+    if (current_case->lazy) {
+        // Reading a field converts just that one; nested structs are
+        // proxies too.
+        py_field = PyMapping_GetItemString(py_value, (char*) mxGetFieldNameByNumber(m_value, 0));
+        if (py_field == NULL || !bench_arrays_equal(mxGetFieldByNumber(m_value, 0, 0), py2mat(py_field))) {
+            fail(current_case->name, "first field read back wrong");
+        }
+        if (mxGetField(m_value, 0, "nested") != NULL) {
+            py_field = PyMapping_GetItemString(py_value, "nested");
+            if (py_field == NULL || Py_TYPE(py_field) != &struct_proxy_type) {
+                fail(current_case->name, "nested struct is not a proxy");
+            }
+            Py_XDECREF(py_field);
+        }
+        // The last reference hands its array straight over.
+        Py_DECREF(py_value);
+        py_value = mat2py(m_value, false);
+        m_back = py2mat(py_value);
+        if (!bench_arrays_equal(m_value, m_back)) {
+            fail(current_case->name, "proxy did not hand back its struct");
+        }
+        // It was persistent, so it isn't freed with the other temporaries.
+        mxDestroyArray(m_back);
+    } else {
+        Py_DECREF(py_value);
+    }
+    
+    if (current_source != NULL) {
+        Py_INCREF(current_source);
+        m_back = py2mat(current_source);
+        if (!bench_arrays_equal(m_expected, m_back)) {
+            fail(current_case->name, "py2mat disagrees with MATLAB value");
+        }
+    }
+}
+
+static void source_entry(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    current_source = eval_python(current_case->py_expr);
+}
+
+/**
+ * Converts a buffer to a MATLAB array with mat_from_buffer, checks the
+ * result against expected (column-major, with imag holding the imaginary
+ * parts for complex type codes), and checks that buffer_from_mat gives the
+ * buffer back.
+ */
+static void check_typed_buffer(const char* what, const void* data, size_t n_bytes, const char* typecode,
+                               mwSize ndim, const mwSize* dims, bool c_order,
+                               mxClassID class_id, const void* expected, const void* imag) {
+    mxArray* m_value = mat_from_buffer(data, n_bytes, typecode, ndim, dims, c_order);
+    PyObject* py_back;
+    size_t part_bytes;
+    
+    if (m_value == NULL) {
+        PyErr_Print();
+        fail(what, "mat_from_buffer failed");
+        return;
+    }
+    part_bytes = mxGetNumberOfElements(m_value) * mxGetElementSize(m_value);
+    if (mxGetClassID(m_value) != class_id || part_bytes != (imag == NULL ? n_bytes : n_bytes / 2)
+            || memcmp(mxGetData(m_value), expected, part_bytes) != 0
+            || (imag != NULL && (!mxIsComplex(m_value) || memcmp(mxGetImagData(m_value), imag, part_bytes) != 0))) {
+        fail(what, "wrong MATLAB array");
+    }
+    
+    py_back = buffer_from_mat(m_value, c_order);
+    if (py_back == NULL || (size_t) PyByteArray_GET_SIZE(py_back) != n_bytes
+            || memcmp(PyByteArray_AS_STRING(py_back), data, n_bytes) != 0) {
+        fail(what, "buffer_from_mat did not round-trip");
+    }
+    Py_XDECREF(py_back);
+    mxDestroyArray(m_value);
+}
+
+static void typed_buffers_entry(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    static const double ROWS[] = {1, 2, 3, 4, 5, 6}, COLUMNS[] = {1, 4, 2, 5, 3, 6};
+    static const double PAIRS[] = {1, 10, 2, 20, 3, 30, 4, 40};
+    static const double REAL[] = {1, 3, 2, 4}, IMAG[] = {10, 30, 20, 40};
+    static const mxLogical BOOLS[] = {1, 0, 0, 1, 1, 0};
+    static const mwSize MATRIX[] = {2, 3}, SQUARE[] = {2, 2}, CUBE[] = {2, 3, 4}, VECTOR[] = {6};
+    short c_cube[24], f_cube[24];
+    long longs[6];
+    size_t i, j, k;
+    
+    check_typed_buffer("C order", ROWS, sizeof(ROWS), "d", 2, MATRIX, true, mxDOUBLE_CLASS, COLUMNS, NULL);
+    check_typed_buffer("Fortran order", COLUMNS, sizeof(COLUMNS), "d", 2, MATRIX, false, mxDOUBLE_CLASS, COLUMNS, NULL);
+    check_typed_buffer("vector", ROWS, sizeof(ROWS), "d", 1, VECTOR, true, mxDOUBLE_CLASS, ROWS, NULL);
+    check_typed_buffer("complex", PAIRS, sizeof(PAIRS), "D", 2, SQUARE, true, mxDOUBLE_CLASS, REAL, IMAG);
+    check_typed_buffer("logical", BOOLS, sizeof(BOOLS), "?", 2, MATRIX, false, mxLOGICAL_CLASS, BOOLS, NULL);
+    
+    // Element (i, j, k) is at i * 12 + j * 4 + k in C order, and at
+    // i + j * 2 + k * 6 in column-major order.
+    for (i = 0; i < 2; ++i) {
+        for (j = 0; j < 3; ++j) {
+            for (k = 0; k < 4; ++k) {
+                c_cube[i * 12 + j * 4 + k] = f_cube[i + j * 2 + k * 6] = (short) (100 * i + 10 * j + k);
+            }
+        }
+    }
+    check_typed_buffer("3-D", c_cube, sizeof(c_cube), "h", 3, CUBE, true, mxINT16_CLASS, f_cube, NULL);
+    
+    for (i = 0; i < 6; ++i) {
+        longs[i] = (long) i - 3;
+    }
+    check_typed_buffer("long", longs, sizeof(longs), "l", 1, VECTOR, true,
+        sizeof(long) == 8 ? mxINT64_CLASS : mxINT32_CLASS, longs, NULL);
+    
+    if (mat_from_buffer(ROWS, sizeof(ROWS), "x", 2, MATRIX, true) != NULL || !PyErr_ExceptionMatches(PyExc_ValueError)) {
+        fail("unknown type code", "no ValueError");
+    }
+    PyErr_Clear();
+    if (mat_from_buffer(ROWS, sizeof(ROWS) - 1, "d", 2, MATRIX, true) != NULL || !PyErr_ExceptionMatches(PyExc_ValueError)) {
+        fail("short buffer", "no ValueError");
+    }
+    PyErr_Clear();
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+static void run_checked(mexstub_entry_t entry) {
+    mxArray* plhs[1];
+    
+    if (mexstub_call(entry, 0, plhs, 0, NULL) != 0) {
+        fprintf(stderr, "FAIL: %s: %s\n",
+            current_case == NULL ? "init" : current_case->name,
+            mexstub_last_error());
+        bench_failures++;
+    }
+}
+
+static void bench_direction(direction_t direction, size_t n_bytes) {
+    double total = 0.0, per_op;
+    long n_ops = 0;
+    
+    current_direction = direction;
+    while (total < MIN_SECONDS) {
+        run_checked(batch_entry);
+        if (bench_failures > 0) {
+            return;
+        }
+        total += batch_seconds;
+        n_ops += BATCH_SIZE;
+        // The boxed cases leak a copy per conversion; don't let them run
+        // long.
+        if (current_case->py_expr == NULL && !current_case->lazy && n_ops >= 4 * BATCH_SIZE) {
+            break;
+        }
+    }
+    
+    per_op = total / n_ops;
+    printf("%-20s %-8s %12.1f %12.1f\n", current_case->name,
+        direction == DIR_MAT2PY ? "mat2py" : "py2mat",
+        per_op * 1e9, n_bytes / per_op / 1e6);
+}
+
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    mxArray* m_sample;
+    size_t idx, baseline, n_bytes;
+    
+    if (!bench_init_pymex()) {
+        return 1;
+    }
+    run_checked(init_entry);
+    
+    if (quick) {
+        baseline = mexstub_live_arrays();
+        run_checked(typed_buffers_entry);
+        if (mexstub_live_arrays() != baseline) {
+            fail("typed buffers", "arrays leaked");
+        }
+    } else {
+        printf("%-20s %-8s %12s %12s\n", "case", "dir", "ns/op", "MB/s");
+    }
+    
+    for (idx = 0; idx < N_CASES && bench_failures == 0; ++idx) {
+        current_case = &CASES[idx];
+        current_source = NULL;
+        if (current_case->py_expr != NULL) {
+            run_checked(source_entry);
+        }
+        
+        if (quick) {
+            if (current_case->py_expr == NULL && !current_case->lazy) {
+                continue;
+            }
+            baseline = mexstub_live_arrays();
+            run_checked(check_entry);
+            if (mexstub_live_arrays() != baseline) {
+                fail(current_case->name, "arrays leaked");
+            }
+        } else {
+            m_sample = current_case->make(current_case->n);
+            n_bytes = payload_bytes(m_sample);
+            mxDestroyArray(m_sample);
+            
+            bench_direction(DIR_MAT2PY, n_bytes);
+            if (current_case->py_expr != NULL) {
+                bench_direction(DIR_PY2MAT, n_bytes);
+            }
+        }
+        
+        Py_XDECREF(current_source);
+    }
+    
+    mexstub_shutdown();
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All marshalling checks passed.\n");
+    }
+    return 0;
+}
@@ -0,0 +1,391 @@
+/**
+ * bench_memo.c: Measures memoized calls into Python.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Times calls into Python through a memo (from MEMOIZE), on a miss and on a
+// hit, against the generic CALL opcode, and reports calls per second for
+// each; then times hashing alone, with a large argument that always hits.
+//
+// Usage: bench_memo [--quick]
+//
+// With --quick, a memo is instead checked for hits and misses on equal and
+// unequal arguments, least-recently-used eviction, calls that bypass it and
+// freeing its results; the exit status is nonzero if anything is off.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Must agree with function_t in pymex_fns.c.
+#define CALL_OPCODE 7
+#define MEMOIZE_OPCODE 23
+#define MEMOCALL_OPCODE 24
+
+#define MAX_ARGS 4
+#define MIN_SECONDS 0.2
+
+// Characters in the string passed to the timed function.
+#define N_TEXT 10000
+// Characters in the string used to time hashing.
+#define N_CHARS 1048576
+
+// Python functions that count how often they are called.
+static const char* SETUP =
+    "calls = [0]\n"
+    "def describe(*args):\n"
+    "    calls[0] += 1\n"
+    "    return repr(args)\n"
+    "def padded(key):\n"
+    "    calls[0] += 1\n"
+    "    return key * 100\n"
+    "def fresh(*args):\n"
+    "    calls[0] += 1\n"
+    "    return object()\n"
+    "class Block(object):\n"
+    "    def __init__(self, n):\n"
+    "        self.nbytes = int(n)\n"
+    "def block(n):\n"
+    "    return Block(n)\n"
+    "def doubles(n):\n"
+    "    import array\n"
+    "    return array.array('d', [0.0]) * int(n)\n"
+    "def checksum(text):\n"
+    "    return float(sum(ord(c) for c in text) % 65521)\n"
+    "def length(text):\n"
+    "    return len(text)\n";
+
+// CALLS ///////////////////////////////////////////////////////////////////////
+
+/**
+ * Returns a memo for the named function in __main__, also bound to "memo"
+ * there.
+ */
+static mxArray* make_memo(const char* fn_name, double budget) {
+    mxArray *args[2], *memo;
+    
+    args[0] = bench_eval_expr(fn_name);
+    args[1] = mxCreateDoubleScalar(budget);
+    memo = bench_run_opcode(MEMOIZE_OPCODE, 2, args, NULL);
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+    if (memo != NULL) {
+        bench_put("memo", memo);
+    }
+    return memo;
+}
+
+static mxArray* memo_call(mxArray* memo, int n_args, mxArray* args[]) {
+    mxArray* rhs[MAX_ARGS + 1];
+    int idx;
+    
+    rhs[0] = memo;
+    for (idx = 0; idx < n_args; ++idx) {
+        rhs[idx + 1] = args[idx];
+    }
+    return bench_run_opcode(MEMOCALL_OPCODE, n_args + 1, rhs, NULL);
+}
+
+/**
+ * Calls through a memo and compares the result with expected (if not
+ * NULL), freeing both the result and the arguments.
+ */
+static void check_call(const char* what, mxArray* memo, int n_args, mxArray* args[], mxArray* expected) {
+    mxArray* result = memo_call(memo, n_args, args);
+    int idx;
+    
+    if (result == NULL || (expected != NULL && !bench_arrays_equal(expected, result))) {
+        fprintf(stderr, "FAIL: %s: wrong result\n", what);
+        bench_failures++;
+    }
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    if (expected != NULL) {
+        mxDestroyArray(expected);
+    }
+    for (idx = 0; idx < n_args; ++idx) {
+        mxDestroyArray(args[idx]);
+    }
+}
+
+static mxArray* int32_scalar(int value) {
+    mxArray* array = mxCreateNumericMatrix(1, 1, mxINT32_CLASS, mxREAL);
+    *(int*) mxGetData(array) = value;
+    return array;
+}
+
+static mxArray* make_text(size_t n, char fill) {
+    char* buf = malloc(n + 1);
+    mxArray* text;
+    
+    memset(buf, fill, n);
+    buf[n] = '\0';
+    text = mxCreateString(buf);
+    free(buf);
+    return text;
+}
+
+static mxArray* double_cell(size_t n) {
+    mxArray* cell = mxCreateCellMatrix(1, n);
+    size_t idx;
+    
+    for (idx = 0; idx < n; ++idx) {
+        mxSetCell(cell, idx, mxCreateDoubleScalar(idx * 0.5));
+    }
+    return cell;
+}
+
+// CHECKS //////////////////////////////////////////////////////////////////////
+
+static void check_hits() {
+    mxArray *memo = make_memo("describe", 1 << 20), *args[2];
+    
+    args[0] = mxCreateString("abc");
+    args[1] = mxCreateDoubleScalar(2);
+    check_call("first call", memo, 2, args, mxCreateString("('abc', 2.0)"));
+    args[0] = mxCreateString("abc");
+    args[1] = mxCreateDoubleScalar(2);
+    check_call("equal arguments", memo, 2, args, mxCreateString("('abc', 2.0)"));
+    bench_check_true("equal arguments", "calls[0] == 1 and memo.hits == 1 and memo.misses == 1");
+    
+    // Same bytes, different class or shape; and different contents.
+    args[0] = mxCreateString("abc");
+    args[1] = int32_scalar(2);
+    check_call("int32 argument", memo, 2, args, mxCreateString("('abc', 2)"));
+    args[0] = mxCreateString("abd");
+    args[1] = mxCreateDoubleScalar(2);
+    check_call("other string", memo, 2, args, mxCreateString("('abd', 2.0)"));
+    args[0] = double_cell(3);
+    check_call("cell argument", memo, 1, args, NULL);
+    args[0] = double_cell(3);
+    check_call("equal cell argument", memo, 1, args, NULL);
+    args[0] = double_cell(3);
+    mxSetN(args[0], 1);
+    mxSetM(args[0], 3);
+    check_call("column cell argument", memo, 1, args, NULL);
+    bench_check_true("unequal arguments", "calls[0] == 5 and memo.hits == 2 and memo.misses == 5");
+    
+    // PyObjects can't be hashed by content, so calls with them go
+    // straight through.
+    args[0] = bench_eval_expr("describe");
+    check_call("PyObject argument", memo, 1, args, NULL);
+    args[0] = bench_eval_expr("describe");
+    check_call("PyObject argument", memo, 1, args, NULL);
+    bench_check_true("PyObject arguments", "calls[0] == 7 and memo.bypassed == 2 and memo.entries == 5");
+    
+    bench_check_true("hit rate", "abs(memo.hit_rate - 2.0 / 7) < 1e-12");
+    mxDestroyArray(memo);
+}
+
+static void check_eviction() {
+    bench_exec_python("calls[0] = 0");
+    // Each result (100 chars) costs a little under 350 bytes, so this
+    // holds two.
+    mxArray *memo = make_memo("padded", 800), *args[1];
+    const char* keys = "abacab";
+    char key[2] = {0, 0}, expected[101];
+    int idx;
+    
+    // a, b, a (a is now newest), c (evicting b), a (a hit), b (a miss).
+    for (idx = 0; keys[idx] != '\0'; ++idx) {
+        key[0] = keys[idx];
+        memset(expected, keys[idx], 100);
+        expected[100] = '\0';
+        args[0] = mxCreateString(key);
+        check_call("eviction", memo, 1, args, mxCreateString(expected));
+    }
+    bench_check_true("eviction", "memo.hits == 2 and memo.misses == 4 and memo.entries == 2 and memo.evictions == 2");
+    bench_check_true("eviction", "memo.bytes <= memo.budget");
+    mxDestroyArray(memo);
+    
+    // A result bigger than the whole budget isn't cached at all.
+    memo = make_memo("padded", 100);
+    args[0] = mxCreateString("a");
+    check_call("over budget", memo, 1, args, NULL);
+    bench_check_true("over budget", "memo.entries == 0 and memo.bypassed == 1");
+    mxDestroyArray(memo);
+}
+
+static void check_boxed_results() {
+    mxArray *memo = make_memo("fresh", 1 << 20), *args[1], *first, *second;
+    
+    // Boxed results are kept as Python objects, so a hit is the same one.
+    args[0] = mxCreateDoubleScalar(1);
+    first = memo_call(memo, 1, args);
+    second = memo_call(memo, 1, args);
+    if (first != NULL && second != NULL) {
+        bench_put("first", first);
+        bench_put("second", second);
+        bench_check_true("boxed result", "first is second and memo.hits == 1");
+        mxDestroyArray(first);
+        mxDestroyArray(second);
+    }
+    mxDestroyArray(args[0]);
+    mxDestroyArray(memo);
+    
+    // They count what they hold against the budget, by nbytes where they
+    // have it and sys.getsizeof otherwise.
+    memo = make_memo("block", 1 << 20);
+    args[0] = mxCreateDoubleScalar(1 << 16);
+    check_call("boxed result size", memo, 1, args, NULL);
+    bench_check_true("boxed result size", "memo.entries == 1 and memo.bytes > 1 << 16");
+    args[0] = mxCreateDoubleScalar(1 << 21);
+    check_call("boxed result over budget", memo, 1, args, NULL);
+    bench_check_true("boxed result over budget", "memo.entries == 1 and memo.bypassed == 1");
+    mxDestroyArray(memo);
+    
+    memo = make_memo("doubles", 1 << 20);
+    args[0] = mxCreateDoubleScalar(1 << 18);
+    check_call("boxed result without nbytes", memo, 1, args, NULL);
+    bench_check_true("boxed result without nbytes", "memo.entries == 0 and memo.bypassed == 1");
+    mxDestroyArray(memo);
+}
+
+static void check_release() {
+    size_t baseline = mexstub_live_arrays();
+    mxArray *memo = make_memo("describe", 1 << 20), *args[1], *result;
+    int idx;
+    
+    for (idx = 0; idx < 10; ++idx) {
+        args[0] = mxCreateDoubleScalar(idx);
+        result = memo_call(memo, 1, args);
+        if (result != NULL) {
+            mxDestroyArray(result);
+        }
+        mxDestroyArray(args[0]);
+    }
+    mxDestroyArray(memo);
+    bench_check_true("release", "memo.entries == 10");
+    if (mexstub_live_arrays() == baseline) {
+        fprintf(stderr, "FAIL: release: results were not kept\n");
+        bench_failures++;
+    }
+    bench_check_true("release", "memo.clear() is None and memo.entries == 0 and memo.bytes == 0");
+    if (mexstub_live_arrays() != baseline) {
+        fprintf(stderr, "FAIL: release: %d arrays leaked\n", (int) (mexstub_live_arrays() - baseline));
+        bench_failures++;
+    }
+}
+
+// BENCHMARKS //////////////////////////////////////////////////////////////////
+
+/**
+ * Returns calls per second, through the memo if non-NULL, or with CALL.
+ * With a memo and fresh set, each call has different arguments, so all
+ * of them miss.
+ */
+static double time_calls(mxArray* callee, mxArray* memo, bool fresh, mxArray* arg) {
+    mxArray *rhs[2], *result;
+    double start = bench_now(), elapsed;
+    long n_calls = 0;
+    int idx;
+    
+    if (memo == NULL) {
+        rhs[0] = callee;
+        rhs[1] = mxCreateCellMatrix(1, 1);
+        mxSetCell(rhs[1], 0, mxDuplicateArray(arg));
+    }
+    do {
+        if (memo == NULL) {
+            result = bench_run_opcode(CALL_OPCODE, 2, rhs, NULL);
+        } else {
+            if (fresh) {
+                // Each call gets a string it hasn't seen before.
+                for (idx = 0; idx < 8; ++idx) {
+                    mxGetChars(arg)[idx] = 'a' + ((n_calls >> (4 * idx)) & 15);
+                }
+            }
+            result = memo_call(memo, 1, &arg);
+        }
+        if (result == NULL) {
+            return 0.0;
+        }
+        mxDestroyArray(result);
+        ++n_calls;
+        elapsed = bench_now() - start;
+    } while (elapsed < MIN_SECONDS);
+    
+    if (memo == NULL) {
+        mxDestroyArray(rhs[1]);
+    }
+    return n_calls / elapsed;
+}
+
+static void run_benchmarks() {
+    mxArray *callee = bench_eval_expr("checksum"), *memo = make_memo("checksum", 64 << 20);
+    mxArray *arg = make_text(N_TEXT, 'a'), *text;
+    double rate;
+    
+    printf("checksum(text) with %d chars:\n", N_TEXT);
+    printf("%-24s %14s\n", "path", "calls/s");
+    printf("%-24s %14.0f\n", "CALL", time_calls(callee, NULL, false, arg));
+    printf("%-24s %14.0f\n", "memo, missing", time_calls(callee, memo, true, arg));
+    printf("%-24s %14.0f\n", "memo, hitting", time_calls(callee, memo, false, arg));
+    mxDestroyArray(memo);
+    mxDestroyArray(callee);
+    mxDestroyArray(arg);
+    
+    // Hits on a long string cost little more than hashing it.
+    text = make_text(N_CHARS, 'x');
+    memo = make_memo("length", 64 << 20);
+    rate = time_calls(NULL, memo, false, text);
+    printf("\nlength(text) with %d chars, hitting:\n", N_CHARS);
+    printf("%.0f calls/s, %.2f GB/s hashed\n", rate, rate * N_CHARS * sizeof(mxChar) / 1e9);
+    mxDestroyArray(memo);
+    mxDestroyArray(text);
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    
+    if (!bench_init_pymex() || !bench_exec_python(SETUP)) {
+        return 1;
+    }
+    
+    if (quick) {
+        check_hits();
+        check_eviction();
+        check_boxed_results();
+        check_release();
+    } else {
+        run_benchmarks();
+    }
+    
+    mexstub_shutdown();
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All memo checks passed.\n");
+    }
+    return 0;
+}
@@ -0,0 +1,283 @@
+/**
+ * bench_parallel.c: Measures how cell marshalling scales with the copy pool.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Converts a large cell array of numeric matrices with mat2py at several
+// marshalling pool sizes, and reports the time and throughput of each.
+//
+// Usage: bench_parallel [--quick] [total MB [max threads]]
+//
+// The maximum thread count defaults to one per CPU.
+//
+// With --quick, a smaller cell with a mix of element classes (including
+// complex and logical arrays, and elements that aren't copied at all) is
+// converted serially and in parallel instead, and every boxed copy is
+// compared against its source; the exit status is nonzero on a mismatch.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+#include "../pymex_marshal.h"
+#include "../pymex_parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define DEFAULT_TOTAL_MB 512
+#define MATRIX_ROWS 1024
+#define MATRIX_COLS 512
+#define MIN_REPEATS 3
+#define MIN_SECONDS 1.0
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+// Entry points take no user data, so their inputs and outputs go here.
+static mxArray* current_cell;
+static double convert_seconds;
+
+// CELL CONSTRUCTORS ///////////////////////////////////////////////////////////
+
+static mxArray* make_matrix(mxClassID class_id, mxComplexity complexity, unsigned seed) {
+    mxArray* matrix = mxCreateNumericMatrix(MATRIX_ROWS, MATRIX_COLS, class_id, complexity);
+    unsigned char* bytes = mxGetData(matrix);
+    size_t idx, n_bytes = mxGetNumberOfElements(matrix) * mxGetElementSize(matrix);
+    
+    // Any byte pattern will do, so long as copies can be told apart.
+    for (idx = 0; idx < n_bytes; ++idx) {
+        bytes[idx] = (unsigned char) (idx * 31 + seed);
+    }
+    if (complexity == mxCOMPLEX) {
+        bytes = mxGetImagData(matrix);
+        for (idx = 0; idx < n_bytes; ++idx) {
+            bytes[idx] = (unsigned char) (idx * 17 + seed);
+        }
+    }
+    return matrix;
+}
+
+static mxArray* make_double_cell(size_t total_mb) {
+    size_t matrix_bytes = MATRIX_ROWS * MATRIX_COLS * sizeof(double);
+    size_t idx, n = (total_mb << 20) / matrix_bytes;
+    mxArray* cell = mxCreateCellMatrix(1, n < 1 ? 1 : n);
+    
+    for (idx = 0; idx < mxGetNumberOfElements(cell); ++idx) {
+        mxSetCell(cell, idx, make_matrix(mxDOUBLE_CLASS, mxREAL, (unsigned) idx));
+    }
+    return cell;
+}
+
+static mxArray* make_mixed_cell() {
+    mxArray* cell = mxCreateCellMatrix(2, 4);
+    mxArray* logicals = mxCreateLogicalMatrix(MATRIX_ROWS, MATRIX_COLS);
+    size_t idx;
+    
+    for (idx = 0; idx < mxGetNumberOfElements(logicals); ++idx) {
+        mxGetLogicals(logicals)[idx] = idx % 3 == 0;
+    }
+    
+    mxSetCell(cell, 0, make_matrix(mxDOUBLE_CLASS, mxREAL, 1));
+    mxSetCell(cell, 1, make_matrix(mxDOUBLE_CLASS, mxREAL, 2));
+    mxSetCell(cell, 2, make_matrix(mxDOUBLE_CLASS, mxCOMPLEX, 3));
+    mxSetCell(cell, 3, make_matrix(mxINT16_CLASS, mxREAL, 4));
+    mxSetCell(cell, 4, make_matrix(mxSINGLE_CLASS, mxREAL, 5));
+    mxSetCell(cell, 5, logicals);
+    mxSetCell(cell, 6, mxCreateDoubleScalar(42.0));
+    mxSetCell(cell, 7, mxCreateString("not copied"));
+    return cell;
+}
+
+// BOXED COPIES ////////////////////////////////////////////////////////////////
+
+/**
+ * Calls visit on every boxed mxArray in a (possibly nested) list made by
+ * mat2py, along with the cell element it was copied from.
+ */
+static void visit_boxed(PyObject* py_value, const mxArray* cell, size_t* idx_el,
+    void (*visit)(mxArray* copy, const mxArray* source)
+) {
+    Py_ssize_t idx;
+    
+    if (PyList_Check(py_value)) {
+        for (idx = 0; idx < PyList_GET_SIZE(py_value); ++idx) {
+            visit_boxed(PyList_GET_ITEM(py_value, idx), cell, idx_el, visit);
+        }
+        return;
+    }
+    
+    // Lists come out in row-major order, while cells are column-major.
+    if (is_boxed_mxarray(py_value)) {
+        visit(unbox_mxarray(py_value), mxGetCell(cell,
+            (*idx_el % mxGetN(cell)) * mxGetM(cell) + *idx_el / mxGetN(cell)));
+    }
+    (*idx_el)++;
+}
+
+static void check_copy(mxArray* copy, const mxArray* source) {
+    if (copy == source || !bench_arrays_equal(copy, source)) {
+        fprintf(stderr, "FAIL: boxed copy of a %s array differs from its source\n",
+            mxGetClassName(source));
+        bench_failures++;
+    }
+}
+
+static void release_copy(mxArray* copy, const mxArray* source) {
+    // mxArray.__del__ doesn't free its array (see README), so the benchmark
+    // does, to keep repeated conversions from exhausting memory.
+    mxDestroyArray(copy);
+}
+
+// ENTRY POINTS ////////////////////////////////////////////////////////////////
+// Each of these is run via mexstub_call, as MATLAB would run mexFunction.
+
+static void convert_entry(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    PyObject* py_value;
+    size_t idx_el = 0;
+    double start = bench_now();
+    
+    py_value = mat2py(current_cell, false);
+    convert_seconds = bench_now() - start;
+    
+    visit_boxed(py_value, current_cell, &idx_el, release_copy);
+    Py_DECREF(py_value);
+}
+
+static void check_entry(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    PyObject* py_value;
+    size_t idx_el = 0;
+    
+    py_value = mat2py(current_cell, false);
+    visit_boxed(py_value, current_cell, &idx_el, check_copy);
+    if (idx_el != mxGetNumberOfElements(current_cell)) {
+        fprintf(stderr, "FAIL: converted list has %lu elements, expected %lu\n",
+            (unsigned long) idx_el, (unsigned long) mxGetNumberOfElements(current_cell));
+        bench_failures++;
+    }
+    idx_el = 0;
+    visit_boxed(py_value, current_cell, &idx_el, release_copy);
+    Py_DECREF(py_value);
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+static void run_checked(mexstub_entry_t entry) {
+    mxArray* plhs[1];
+    
+    if (mexstub_call(entry, 0, plhs, 0, NULL) != 0) {
+        fprintf(stderr, "FAIL: %s\n", mexstub_last_error());
+        bench_failures++;
+    }
+}
+
+static void run_quick() {
+    int threads[] = {1, 4};
+    size_t idx;
+    
+    current_cell = make_mixed_cell();
+    for (idx = 0; idx < sizeof(threads) / sizeof(threads[0]); ++idx) {
+        set_marshal_threads(threads[idx]);
+        run_checked(check_entry);
+    }
+    mxDestroyArray(current_cell);
+}
+
+/**
+ * Doubles the thread count, but always finishes on max_threads itself.
+ */
+static int next_thread_count(int n_threads, int max_threads) {
+    if (n_threads < max_threads && 2 * n_threads > max_threads) {
+        return max_threads;
+    }
+    return 2 * n_threads;
+}
+
+static void run_bench(size_t total_mb, int max_threads) {
+    int n_threads, n_repeats;
+    double best, serial = 0.0, start, total_bytes;
+    
+    if (max_threads <= 0) {
+        set_marshal_threads(0);
+        max_threads = get_marshal_threads();
+    }
+    
+    current_cell = make_double_cell(total_mb);
+    total_bytes = (double) mxGetNumberOfElements(current_cell) * MATRIX_ROWS * MATRIX_COLS * sizeof(double);
+    printf("%lu matrices, %.0f MB total, up to %d threads\n",
+        (unsigned long) mxGetNumberOfElements(current_cell), total_bytes / (1 << 20), max_threads);
+    printf("%8s %12s %12s %8s\n", "threads", "ms", "GB/s", "speedup");
+    
+    for (n_threads = 1; n_threads <= max_threads && bench_failures == 0;
+        n_threads = next_thread_count(n_threads, max_threads)
+    ) {
+        set_marshal_threads(n_threads);
+        best = 0.0;
+        start = bench_now();
+        for (n_repeats = 0; n_repeats < MIN_REPEATS || bench_now() - start < MIN_SECONDS; ++n_repeats) {
+            run_checked(convert_entry);
+            if (best == 0.0 || convert_seconds < best) {
+                best = convert_seconds;
+            }
+        }
+        if (n_threads == 1) {
+            serial = best;
+        }
+        printf("%8d %12.1f %12.2f %7.2fx\n", n_threads, 1e3 * best,
+            total_bytes / best / 1e9, serial / best);
+    }
+    mxDestroyArray(current_cell);
+}
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    size_t total_mb = DEFAULT_TOTAL_MB;
+    int max_threads = 0;
+    
+    if (!quick && argc > 1) {
+        total_mb = strtoul(argv[1], NULL, 10);
+    }
+    if (!quick && argc > 2) {
+        max_threads = atoi(argv[2]);
+    }
+    
+    if (!bench_init_pymex()) {
+        return 1;
+    }
+    
+    if (quick) {
+        run_quick();
+    } else {
+        run_bench(total_mb, max_threads);
+    }
+    
+    mexstub_shutdown();
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All parallel marshalling checks passed.\n");
+    }
+    return 0;
+}
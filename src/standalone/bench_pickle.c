@@ -0,0 +1,314 @@
+/**
+ * bench_pickle.c: Measures saving and loading PyObjects by pickling.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Times moving Python objects through the pickled state that PyObject's
+// saveobj and loadobj use (from _pymex.pickling), with large buffers kept
+// out of the pickle, against pickling them whole; either way, the state
+// goes to MATLAB and back as it would through a MAT-file.
+//
+// Usage: bench_pickle [--quick]
+//
+// With --quick, objects holding strings, bytearrays, arrays and boxed
+// MATLAB arrays are instead checked to come back equal, with their large
+// buffers out of band, numeric arrays to be saved as typed MATLAB arrays,
+// temporary NumPy arrays to get a buffer each, and
+// unpicklable objects to fail clearly; the exit status is nonzero if
+// anything is off.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define MIN_SECONDS 0.2
+
+// Doubles in the array used for timing.
+#define N_DOUBLES 1048576
+
+static const char* SETUP =
+    "import array, cPickle, pymex\n"
+    "from _pymex.pickling import dump_state, load_state\n"
+    "def whole_state(obj):\n"
+    "    return bytearray(cPickle.dumps(obj, 2))\n"
+    "def load_whole(data):\n"
+    "    return cPickle.loads(data.tobytes())\n"
+    "class Opaque(object):\n"
+    "    def __reduce__(self):\n"
+    "        raise TypeError('no pickles here')\n";
+
+// CALLS ///////////////////////////////////////////////////////////////////////
+
+/**
+ * Wraps a uint8 array in a PyBytes, as loadobj does, taking ownership.
+ */
+static mxArray* wrap_bytes(mxArray* data) {
+    static const char* props[] = {"data"};
+    mxArray* bytes = mexstub_create_object("PyBytes", 1, props);
+    
+    mxSetProperty(bytes, 0, "data", data);
+    mxDestroyArray(data);
+    return bytes;
+}
+
+// SAVING AND LOADING //////////////////////////////////////////////////////////
+
+/**
+ * Saves the Python expression expr as saveobj would, and loads the state
+ * back as loadobj would, binding the result to "restored" in __main__.
+ * Returns the number of out-of-band buffers, or -1 on failure.
+ */
+static int save_and_load(const char* expr) {
+    char call[256];
+    mxArray *state, *pickle, *buffers, *binary;
+    size_t idx, n_buffers;
+    
+    snprintf(call, sizeof(call), "dump_state(%s)", expr);
+    state = bench_eval_expr(call);
+    if (state == NULL || !mxIsCell(state) || mxGetNumberOfElements(state) != 3) {
+        if (state != NULL) {
+            mxDestroyArray(state);
+        }
+        return -1;
+    }
+    
+    // As loadobj, wrap the pickle and the binary buffers in PyBytes, and
+    // leave MATLAB arrays as they are.
+    pickle = wrap_bytes(mxDuplicateArray(mxGetCell(state, 0)));
+    buffers = mxDuplicateArray(mxGetCell(state, 1));
+    binary = mxGetCell(state, 2);
+    n_buffers = mxGetNumberOfElements(buffers);
+    for (idx = 0; idx < n_buffers; ++idx) {
+        if (((unsigned char*) mxGetData(binary))[idx]) {
+            mxSetCell(buffers, idx, wrap_bytes(mxGetCell(buffers, idx)));
+        }
+    }
+    bench_put("pickle", pickle);
+    bench_put("buffers", buffers);
+    mxDestroyArray(pickle);
+    mxDestroyArray(buffers);
+    mxDestroyArray(state);
+    
+    return bench_exec_python("restored = load_state(pickle, buffers)") ? (int) n_buffers : -1;
+}
+
+static void check_round_trip(const char* what, const char* expr, int n_out_of_band, const char* check) {
+    int n_buffers;
+    
+    if (!bench_exec_python(expr)) {
+        bench_failures++;
+        return;
+    }
+    n_buffers = save_and_load("original");
+    if (n_buffers < 0) {
+        fprintf(stderr, "FAIL: %s: could not save and load\n", what);
+        bench_failures++;
+        return;
+    }
+    if (n_buffers != n_out_of_band) {
+        fprintf(stderr, "FAIL: %s: %d buffers out of band, not %d\n", what, n_buffers, n_out_of_band);
+        bench_failures++;
+    }
+    bench_check_true(what, check);
+}
+
+// CHECKS //////////////////////////////////////////////////////////////////////
+
+static void check_round_trips() {
+    check_round_trip("small objects",
+        "original = {'a': [1, 2.5, u'x'], 'b': ('y' * 10, None)}", 0,
+        "restored == original");
+    check_round_trip("large str",
+        "original = ['x' * 4096, 'y' * 4096, 'z']", 2,
+        "restored == original and type(restored[0]) is str");
+    check_round_trip("shared str",
+        "s = 'x' * 4096; original = [s, s]", 1,
+        "restored == original and restored[0] is restored[1]");
+    check_round_trip("large bytearray",
+        "original = {'data': bytearray(range(256)) * 16}", 1,
+        "restored == original and type(restored['data']) is bytearray");
+    check_round_trip("array",
+        "original = array.array('d', range(1000))", 1,
+        "restored == original and restored.typecode == 'd'");
+    check_round_trip("int16 array",
+        "original = array.array('h', range(-1000, 1000))", 1,
+        "restored == original and restored.typecode == 'h'");
+    check_round_trip("char array",
+        "original = array.array('c', 'xyz' * 1000)", 1,
+        "restored == original and restored.typecode == 'c'");
+    
+    // Boxed MATLAB arrays can't be pickled, but travel as themselves.
+    bench_put("matrix", mxCreateDoubleMatrix(3, 3, mxREAL));
+    check_round_trip("boxed mxArray",
+        "original = {'m': matrix, 'n': 3}", 1,
+        "isinstance(restored['m'], __import__('pymex').mxArray) and restored['n'] == 3");
+}
+
+/**
+ * Checks that numeric arrays are saved as MATLAB arrays of their own class
+ * and shape, rather than as their bytes.
+ */
+static void check_typed_arrays() {
+    mxArray* saved;
+    
+    bench_check_true("typed array out of band",
+        "dump_state(array.array('i', range(1000)))[2] == bytearray([0])");
+    saved = bench_eval_expr("dump_state(array.array('i', range(1000)))[1][0]");
+    if (saved == NULL || !mxIsInt32(saved) || mxGetM(saved) != 1 || mxGetN(saved) != 1000
+            || ((int*) mxGetData(saved))[999] != 999) {
+        fprintf(stderr, "FAIL: typed array: not saved as a 1x1000 int32 array\n");
+        bench_failures++;
+    }
+    if (saved != NULL) {
+        mxDestroyArray(saved);
+    }
+}
+
+/**
+ * Checks that NumPy arrays pickled as temporaries (as by __reduce__) each
+ * get their own buffer. Their data is copied out of band, so nothing else
+ * keeps them alive, and a later one may reuse a freed one's id. NumPy may
+ * not be installed, so this saves stand-ins that look like ndarrays to
+ * dump_state, and doesn't load them.
+ */
+static void check_temporary_arrays() {
+    bench_exec_python(
+        "import sys, types\n"
+        "class ndarray(object):\n"
+        "    dtype = types.ModuleType('dtype')\n"
+        "    dtype.hasobject, dtype.isnative = False, True\n"
+        "    dtype.str, dtype.char = '|u1', 'B'\n"
+        "    flags = types.ModuleType('flags')\n"
+        "    flags.f_contiguous = flags.c_contiguous = True\n"
+        "    def __init__(self, data):\n"
+        "        self.data, self.nbytes, self.shape = data, len(data), (len(data),)\n"
+        "    def tobytes(self, order):\n"
+        "        return self.data\n"
+        "class Fresh(object):\n"
+        "    def __init__(self, data):\n"
+        "        self.data = data\n"
+        "    def __reduce__(self):\n"
+        "        return (Fresh, (ndarray(self.data),))\n"
+        "sys.modules['numpy'] = types.ModuleType('numpy')\n"
+        "sys.modules['numpy'].ndarray = ndarray\n"
+        "try:\n"
+        "    state = dump_state([Fresh(c * 4096) for c in 'abcd'])\n"
+        "finally:\n"
+        "    del sys.modules['numpy']\n"
+    );
+    bench_check_true("temporary arrays",
+        "[str(pymex.from_matlab_array(b)[:1]) for b in state[1]] == list('abcd')");
+}
+
+static void check_unpicklable() {
+    bench_exec_python(
+        "try:\n"
+        "    dump_state([Opaque()])\n"
+        "    message = ''\n"
+        "except cPickle.PicklingError as ex:\n"
+        "    message = str(ex)\n"
+    );
+    bench_check_true("unpicklable", "\"it can't be pickled (no pickles here)\" in message");
+}
+
+// BENCHMARKS //////////////////////////////////////////////////////////////////
+
+/**
+ * Returns round trips per second of big, out of band through dump_state or
+ * whole through cPickle.
+ */
+static double time_round_trips(bool out_of_band) {
+    mxArray* state;
+    double start = bench_now(), elapsed;
+    long n_trips = 0;
+    
+    do {
+        if (out_of_band) {
+            if (save_and_load("big") < 0) {
+                return 0.0;
+            }
+        } else {
+            state = bench_eval_expr("whole_state(big)");
+            if (state == NULL) {
+                return 0.0;
+            }
+            bench_put("pickle", wrap_bytes(state));
+            if (!bench_exec_python("restored = load_whole(pickle)")) {
+                return 0.0;
+            }
+        }
+        ++n_trips;
+        elapsed = bench_now() - start;
+    } while (elapsed < MIN_SECONDS);
+    
+    return n_trips / elapsed;
+}
+
+static void run_benchmarks() {
+    char setup[64];
+    double rate;
+    
+    snprintf(setup, sizeof(setup), "big = array.array('d', range(%d))", N_DOUBLES);
+    bench_exec_python(setup);
+    
+    printf("array.array of %d doubles:\n", N_DOUBLES);
+    printf("%-24s %14s %14s\n", "path", "trips/s", "MB/s");
+    rate = time_round_trips(false);
+    printf("%-24s %14.1f %14.0f\n", "whole pickle", rate, rate * N_DOUBLES * 8 / 1e6);
+    rate = time_round_trips(true);
+    printf("%-24s %14.1f %14.0f\n", "out of band", rate, rate * N_DOUBLES * 8 / 1e6);
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    
+    if (!bench_init_pymex() || !bench_exec_python(SETUP)) {
+        return 1;
+    }
+    
+    if (quick) {
+        check_round_trips();
+        check_typed_arrays();
+        check_temporary_arrays();
+        check_unpicklable();
+    } else {
+        run_benchmarks();
+    }
+    
+    mexstub_shutdown();
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All pickling checks passed.\n");
+    }
+    return 0;
+}
@@ -0,0 +1,265 @@
+/**
+ * bench_startup.c: Measures starting Python and importing modules.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Times importing many modules from the end of a long sys.path, as a new
+// worker does, with the usual import machinery, with an import index
+// listing each directory (see _pymex/import_cache.py), and with an index
+// read back from the file the first one saved; also reports how long
+// pymex takes to start, preloading the modules named by PYMEX_PRELOAD.
+//
+// Usage: bench_startup [--quick]
+//
+// With --quick, pymex is instead started with an import index and modules
+// to preload, and the index is checked to find the same modules as the
+// usual machinery would, to fall back for those it can't, to notice changed
+// directories, and to reuse and refresh saved listings; the exit status is
+// nonzero if anything is off.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define MIN_SECONDS 0.2
+
+// Directories put on sys.path, and modules in the last of them.
+#define N_DIRS 40
+#define N_MODULES 300
+
+// Makes a tree of module directories under a temporary root, and a way to
+// import all of its modules afresh.
+static const char* SETUP =
+    "import os, sys, tempfile\n"
+    "from _pymex.import_cache import ImportIndex\n"
+    "root = tempfile.mkdtemp(prefix='pymex_startup_')\n"
+    "def write(path, text=''):\n"
+    "    with open(os.path.join(root, path), 'w') as f:\n"
+    "        f.write(text)\n"
+    "def make_tree(n_dirs, n_modules):\n"
+    "    dirs = [os.path.join(root, 'd{}'.format(idx)) for idx in range(n_dirs)]\n"
+    "    for dirname in dirs:\n"
+    "        os.mkdir(dirname)\n"
+    "    for idx in range(n_modules):\n"
+    "        write('d{}/mod{}.py'.format(n_dirs - 1, idx), 'value = {}\\n'.format(idx))\n"
+    "    sys.path[0:0] = dirs\n"
+    "    return dirs\n"
+    "def import_all(n_modules, index=None):\n"
+    "    if index is not None:\n"
+    "        sys.meta_path.insert(0, index)\n"
+    "    try:\n"
+    "        for idx in range(n_modules):\n"
+    "            __import__('mod{}'.format(idx))\n"
+    "    finally:\n"
+    "        if index is not None:\n"
+    "            sys.meta_path.remove(index)\n"
+    "        for idx in range(n_modules):\n"
+    "            sys.modules.pop('mod{}'.format(idx), None)\n";
+
+// CALLS ///////////////////////////////////////////////////////////////////////
+
+static void check_exec(const char* what, const char* code) {
+    if (!bench_exec_python(code)) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        bench_failures++;
+    }
+}
+
+// CHECKS //////////////////////////////////////////////////////////////////////
+
+static void check_preload(const char* index_file) {
+    char expr[512];
+    
+    bench_check_true("preload", "'colorsys' in sys.modules and 'json' in sys.modules");
+    bench_check_true("preload", "isinstance(sys.meta_path[0], ImportIndex) and sys.meta_path[0].hits > 0");
+    snprintf(expr, sizeof(expr), "os.path.exists('%s')", index_file);
+    bench_check_true("preload", expr);
+}
+
+static void check_lookups() {
+    check_exec("make tree",
+        "dirs = make_tree(5, 2)\n"
+        // Earlier directories shadow later ones; packages shadow modules,
+        // but directories that aren't packages don't.
+        "write('d1/twin.py'); write('d3/twin.py')\n"
+        "os.mkdir(os.path.join(root, 'd2/pkg')); write('d2/pkg/__init__.py'); write('d2/pkg/sub.py')\n"
+        "write('d3/pkg.py')\n"
+        "os.mkdir(os.path.join(root, 'd0/loose')); write('d4/loose.py')\n"
+        "index = ImportIndex(os.path.join(root, 'index'))\n"
+        "sys.meta_path.insert(0, index)\n"
+        "import twin, pkg.sub, loose, mod1\n"
+    );
+    bench_check_true("shadowing", "twin.__file__.startswith(dirs[1])");
+    bench_check_true("packages", "pkg.__path__ == [os.path.join(dirs[2], 'pkg')] and pkg.sub.__file__.startswith(dirs[2])");
+    bench_check_true("non-packages", "loose.__file__.startswith(dirs[4])");
+    bench_check_true("modules", "mod1.value == 1 and index.hits == 5 and index.fallbacks == 0");
+    
+    // Modules the listings don't have are left to the usual machinery.
+    // Directories modified since they were listed are listed again, so
+    // modules written since are found, and shadow those further on.
+    check_exec("fallback",
+        "try:\n"
+        "    import not_a_module\n"
+        "    missing = False\n"
+        "except ImportError:\n"
+        "    missing = True\n"
+        "t = os.stat(dirs[0]).st_mtime\n"
+        "write('d0/latecomer.py', 'value = 42\\n'); write('d0/mod1.py', 'value = -1\\n')\n"
+        "os.utime(dirs[0], (t + 5, t + 5))\n"
+        "del sys.modules['mod1']\n"
+        "import latecomer, mod1\n"
+    );
+    bench_check_true("fallback", "missing and index.fallbacks == 1");
+    bench_check_true("changed directories", "latecomer.value == 42 and mod1.value == -1 and index.hits == 7");
+    bench_check_true("builtins", "__import__('imp') is not None");
+    
+    // The working directory is looked at as it is now.
+    check_exec("working directory",
+        "os.mkdir(os.path.join(root, 'here')); write('here/resident.py')\n"
+        "cwd = os.getcwd()\n"
+        "os.chdir(root)\n"
+        "try:\n"
+        "    away = index.find_module('resident', [''])\n"
+        "    os.chdir(os.path.join(root, 'here'))\n"
+        "    home = index.find_module('resident', [''])\n"
+        "finally:\n"
+        "    os.chdir(cwd)\n"
+    );
+    bench_check_true("working directory", "away is None and home is not None");
+    
+    // Saved listings are reused while their directories are unchanged.
+    check_exec("reuse",
+        "index.save()\n"
+        "sys.meta_path.remove(index)\n"
+        "t = os.stat(dirs[3]).st_mtime\n"
+        "write('d3/extra.py'); os.utime(dirs[3], (t + 10, t + 10))\n"
+        "reloaded = ImportIndex(os.path.join(root, 'index'))\n"
+        "for dirname in dirs:\n"
+        "    reloaded.find_module('extra', [dirname])\n"
+    );
+    // d0 was listed again after it changed, and saved as it is now.
+    bench_check_true("reuse", "reloaded.reused == 4 and reloaded.listed == 1 and reloaded.hits == 1");
+    bench_check_true("reuse", "reloaded.find_module('extra') is not None and reloaded.find_module('mod0') is not None");
+}
+
+// BENCHMARKS //////////////////////////////////////////////////////////////////
+
+/**
+ * Returns how long importing all the modules takes, given Python for the
+ * index to use (or None).
+ */
+static double time_imports(const char* index_expr) {
+    char code[256];
+    double start = bench_now(), elapsed;
+    long n_runs = 0;
+    
+    snprintf(code, sizeof(code), "import_all(%d, %s)", N_MODULES, index_expr);
+    do {
+        if (!bench_exec_python(code)) {
+            return 0.0;
+        }
+        ++n_runs;
+        elapsed = bench_now() - start;
+    } while (elapsed < MIN_SECONDS);
+    
+    return elapsed / n_runs;
+}
+
+static void run_benchmarks(double startup) {
+    char setup[64];
+    
+    snprintf(setup, sizeof(setup), "make_tree(%d, %d)", N_DIRS, N_MODULES);
+    if (!bench_exec_python(setup) || !bench_exec_python("import_all(1)")) {
+        return;
+    }
+    // Leave .pyc files behind, so that every path below loads them.
+    time_imports("None");
+    
+    printf("pymex startup: %.1f ms\n\n", startup * 1e3);
+    printf("%d modules from the last of %d directories:\n", N_MODULES, N_DIRS);
+    printf("%-24s %14s\n", "path", "ms");
+    printf("%-24s %14.2f\n", "usual machinery", time_imports("None") * 1e3);
+    printf("%-24s %14.2f\n", "listing directories", time_imports("ImportIndex()") * 1e3);
+    bench_exec_python("shared = os.path.join(root, 'index'); first = ImportIndex(shared); "
+                      "import_all(1, first); first.save()");
+    printf("%-24s %14.2f\n", "saved listings", time_imports("ImportIndex(shared)") * 1e3);
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    char index_file[] = "/tmp/pymex_index_XXXXXX";
+    double start;
+    int fd;
+    
+    if (quick) {
+        // The index goes where no one else will look; mkstemp makes an
+        // empty file, which is taken as an empty index.
+        fd = mkstemp(index_file);
+        if (fd < 0) {
+            perror("mkstemp");
+            return 1;
+        }
+        close(fd);
+        setenv("PYMEX_IMPORT_INDEX", index_file, 1);
+        setenv("PYMEX_PRELOAD", "colorsys, json", 1);
+    }
+    
+    start = bench_now();
+    if (!bench_init_pymex()) {
+        return 1;
+    }
+    start = bench_now() - start;
+    if (!bench_exec_python(SETUP)) {
+        return 1;
+    }
+    
+    if (quick) {
+        check_preload(index_file);
+        check_lookups();
+    } else {
+        run_benchmarks(start);
+    }
+    
+    bench_exec_python("import shutil; shutil.rmtree(root)");
+    mexstub_shutdown();
+    if (quick) {
+        // Only now, as the index is saved again as Python exits.
+        unlink(index_file);
+    }
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All startup checks passed.\n");
+    }
+    return 0;
+}
@@ -0,0 +1,414 @@
+/**
+ * bench_table.c: Measures table and DataFrame conversion.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Converts a MATLAB table of numeric columns to a pandas DataFrame and back
+// through pymex's marshalling, and reports rows per second each way. The
+// table class and the functions pymex calls on it (table2struct, height,
+// table, ...) are stand-ins registered with mexstub, which keep a table's
+// variables in a struct.
+//
+// Usage: bench_table [--quick]
+//
+// With --quick, a small table of every kind of column is instead converted
+// once each way and checked; the exit status is nonzero on a mismatch. If
+// pandas isn't installed, the checks run against a stand-in for it, which
+// keeps columns as lists (so only pymex's side is checked), and there is
+// nothing to time.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define N_ROWS 1000000
+#define N_COLUMNS 8
+#define N_REPEATS 5
+
+// Stands in for pandas, if it isn't installed, by replacing the pandas half
+// of _pymex/tables.py with functions that keep columns as lists.
+static const char* FAKE_PANDAS =
+    "import array, sys, types\n"
+    "import _pymex.tables as tables\n"
+    "TYPECODES = {'f8': 'd', 'f4': 'f', 'b1': 'B', 'i4': 'i', 'u1': 'B'}\n"
+    "class DataFrame(object):\n"
+    "    def __init__(self, names, columns, row_names):\n"
+    "        self.names, self.columns, self.row_names = names, columns, row_names\n"
+    "    def __len__(self):\n"
+    "        return len(self.columns[0][1]) if self.columns else 0\n"
+    "def dataframe_from_columns(names, columns, row_names):\n"
+    "    stored = []\n"
+    "    for column in columns:\n"
+    "        if column[0] == 'numeric':\n"
+    "            values = array.array(TYPECODES[column[2]], str(column[1]))\n"
+    "            stored.append(('numeric', values, column[2]))\n"
+    "        elif column[0] == 'categorical':\n"
+    "            codes = array.array('d', str(column[1]))\n"
+    "            stored.append(('categorical', [column[2][int(c) - 1] if c == c else None for c in codes], column[2]))\n"
+    "        else:\n"
+    "            stored.append(column)\n"
+    "    return DataFrame(names, stored, row_names)\n"
+    "def columns_from_dataframe(frame):\n"
+    "    columns = []\n"
+    "    for column in frame.columns:\n"
+    "        if column[0] == 'categorical':\n"
+    "            codes = array.array('d', [column[2].index(v) + 1 if v is not None else 0 for v in column[1]])\n"
+    "            columns.append(('categorical', codes, column[2]))\n"
+    "        else:\n"
+    "            columns.append(column)\n"
+    "    return frame.names, columns, frame.row_names\n"
+    "pandas = types.ModuleType('pandas')\n"
+    "pandas.DataFrame = DataFrame\n"
+    "sys.modules['pandas'] = pandas\n"
+    "tables.dataframe_from_columns = dataframe_from_columns\n"
+    "tables.columns_from_dataframe = columns_from_dataframe\n";
+
+// What the checked table should look like in Python, for either pandas.
+static const char* CHECK_REAL =
+    "list(df.columns) == ['x', 'flag', 'label', 'kind'] and list(df.index) == ['a', 'b', 'c'] and "
+    "list(df['x']) == [1.5, 2.5, 3.5] and list(df['flag']) == [True, False, True] and "
+    "list(df['label']) == ['one', 'two', 'three'] and "
+    "list(df['kind'].astype(object).where(df['kind'].notnull(), None)) == ['low', None, 'high']";
+static const char* CHECK_FAKE =
+    "df.names == ['x', 'flag', 'label', 'kind'] and df.row_names == ['a', 'b', 'c'] and "
+    "list(df.columns[0][1]) == [1.5, 2.5, 3.5] and df.columns[0][2] == 'f8' and "
+    "list(df.columns[1][1]) == [1, 0, 1] and df.columns[1][2] == 'b1' and "
+    "df.columns[2] == ('objects', ['one', 'two', 'three']) and "
+    "df.columns[3][1] == ['low', None, 'high']";
+
+// STUB MATLAB FUNCTIONS ///////////////////////////////////////////////////////
+// Tables are objects with a struct of variables, "vars", and a cellstr of
+// row names, "RowNames"; categoricals have double "codes" (NaN where
+// undefined) and a cellstr of "names".
+
+static const char* TABLE_PROPS[] = {"vars", "RowNames"};
+static const char* CATEGORICAL_PROPS[] = {"codes", "names"};
+
+static char* get_string(const mxArray* m_str) {
+    static char buf[64];
+    mxGetString(m_str, buf, sizeof(buf));
+    return buf;
+}
+
+static void fn_height(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    mxArray* vars = mxGetProperty(prhs[0], 0, "vars");
+    
+    plhs[0] = mxCreateDoubleScalar(mxGetNumberOfFields(vars) == 0 ? 0 :
+        mxGetM(mxGetFieldByNumber(vars, 0, 0)));
+}
+
+static void fn_table2struct(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    plhs[0] = mxDuplicateArray(mxGetProperty(prhs[0], 0, "vars"));
+}
+
+static void fn_getfield(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    const char* field_names[] = {"RowNames"};
+    char* name = get_string(prhs[1]);
+    
+    if (mxIsClass(prhs[0], "table") && strcmp(name, "Properties") == 0) {
+        plhs[0] = mxCreateStructMatrix(1, 1, 1, field_names);
+        mxSetField(plhs[0], 0, "RowNames", mxDuplicateArray(mxGetProperty(prhs[0], 0, "RowNames")));
+    } else {
+        plhs[0] = mxDuplicateArray(mxGetField(prhs[0], 0, name));
+    }
+}
+
+static void fn_double(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    plhs[0] = mxDuplicateArray(mxGetProperty(prhs[0], 0, "codes"));
+}
+
+static void fn_categories(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    plhs[0] = mxDuplicateArray(mxGetProperty(prhs[0], 0, "names"));
+}
+
+/**
+ * categorical(codes, 1:n, names), with codes outside 1:n undefined.
+ */
+static void fn_categorical(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    mxArray* codes = mxDuplicateArray(prhs[0]);
+    size_t n = mxGetNumberOfElements(prhs[1]), idx;
+    double* data = mxGetPr(codes);
+    
+    for (idx = 0; idx < mxGetNumberOfElements(codes); ++idx) {
+        if (data[idx] < 1 || data[idx] > n) {
+            data[idx] = NAN;
+        }
+    }
+    plhs[0] = mexstub_create_object("categorical", 2, CATEGORICAL_PROPS);
+    mxSetProperty(plhs[0], 0, "codes", codes);
+    mxSetProperty(plhs[0], 0, "names", prhs[2]);
+    mxDestroyArray(codes);
+}
+
+/**
+ * table(var1, ..., 'VariableNames', names[, 'RowNames', rows]).
+ */
+static void fn_table(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    const char* field_names[64];
+    mxArray *names = NULL, *rows = NULL, *vars;
+    int n_vars = 0, idx;
+    
+    while (n_vars < nrhs && !mxIsChar(prhs[n_vars])) {
+        ++n_vars;
+    }
+    for (idx = n_vars; idx + 1 < nrhs; idx += 2) {
+        if (strcmp(get_string(prhs[idx]), "VariableNames") == 0) {
+            names = prhs[idx + 1];
+        } else {
+            rows = prhs[idx + 1];
+        }
+    }
+    for (idx = 0; idx < n_vars; ++idx) {
+        field_names[idx] = mxArrayToString(mxGetCell(names, idx));
+    }
+    vars = mxCreateStructMatrix(1, 1, n_vars, field_names);
+    for (idx = 0; idx < n_vars; ++idx) {
+        mxSetFieldByNumber(vars, 0, idx, mxDuplicateArray(prhs[idx]));
+        mxFree((char*) field_names[idx]);
+    }
+    
+    plhs[0] = mexstub_create_object("table", 2, TABLE_PROPS);
+    mxSetProperty(plhs[0], 0, "vars", vars);
+    mxDestroyArray(vars);
+    if (rows != NULL) {
+        mxSetProperty(plhs[0], 0, "RowNames", rows);
+    } else {
+        vars = mxCreateCellMatrix(0, 0);
+        mxSetProperty(plhs[0], 0, "RowNames", vars);
+        mxDestroyArray(vars);
+    }
+}
+
+// TABLES //////////////////////////////////////////////////////////////////////
+
+static mxArray* make_cellstr(size_t n, const char** strings) {
+    mxArray* cell = mxCreateCellMatrix(n, 1);
+    size_t idx;
+    
+    for (idx = 0; idx < n; ++idx) {
+        mxSetCell(cell, idx, mxCreateString(strings[idx]));
+    }
+    return cell;
+}
+
+/**
+ * Makes a table with one column of each kind, and named rows.
+ */
+static mxArray* make_checked_table() {
+    const char* var_names[] = {"x", "flag", "label", "kind"};
+    const char* labels[] = {"one", "two", "three"};
+    const char* kinds[] = {"low", "high"};
+    const char* row_names[] = {"a", "b", "c"};
+    mxArray *vars = mxCreateStructMatrix(1, 1, 4, var_names), *table, *kind, *value;
+    size_t idx;
+    
+    value = mxCreateLogicalMatrix(3, 1);
+    for (idx = 0; idx < 3; ++idx) {
+        ((mxLogical*) mxGetData(value))[idx] = idx != 1;
+    }
+    mxSetField(vars, 0, "flag", value);
+    value = mxCreateDoubleMatrix(3, 1, mxREAL);
+    for (idx = 0; idx < 3; ++idx) {
+        mxGetPr(value)[idx] = idx + 1.5;
+    }
+    mxSetField(vars, 0, "x", value);
+    mxSetField(vars, 0, "label", make_cellstr(3, labels));
+    
+    kind = mexstub_create_object("categorical", 2, CATEGORICAL_PROPS);
+    value = mxCreateDoubleMatrix(3, 1, mxREAL);
+    mxGetPr(value)[0] = 1;
+    mxGetPr(value)[1] = NAN;
+    mxGetPr(value)[2] = 2;
+    mxSetProperty(kind, 0, "codes", value);
+    mxDestroyArray(value);
+    value = make_cellstr(2, kinds);
+    mxSetProperty(kind, 0, "names", value);
+    mxDestroyArray(value);
+    mxSetField(vars, 0, "kind", kind);
+    
+    table = mexstub_create_object("table", 2, TABLE_PROPS);
+    mxSetProperty(table, 0, "vars", vars);
+    mxDestroyArray(vars);
+    value = make_cellstr(3, row_names);
+    mxSetProperty(table, 0, "RowNames", value);
+    mxDestroyArray(value);
+    return table;
+}
+
+static mxArray* make_numeric_table(size_t n_rows, size_t n_columns) {
+    char names[N_COLUMNS][8];
+    const char* field_names[N_COLUMNS];
+    mxArray *vars, *table, *value;
+    size_t idx, idx_row;
+    
+    for (idx = 0; idx < n_columns; ++idx) {
+        sprintf(names[idx], "c%d", (int) idx);
+        field_names[idx] = names[idx];
+    }
+    vars = mxCreateStructMatrix(1, 1, (int) n_columns, field_names);
+    for (idx = 0; idx < n_columns; ++idx) {
+        value = mxCreateDoubleMatrix(n_rows, 1, mxREAL);
+        for (idx_row = 0; idx_row < n_rows; ++idx_row) {
+            mxGetPr(value)[idx_row] = (double) (idx_row + idx);
+        }
+        mxSetFieldByNumber(vars, 0, (int) idx, value);
+    }
+    
+    table = mexstub_create_object("table", 2, TABLE_PROPS);
+    mxSetProperty(table, 0, "vars", vars);
+    mxDestroyArray(vars);
+    value = mxCreateCellMatrix(0, 0);
+    mxSetProperty(table, 0, "RowNames", value);
+    mxDestroyArray(value);
+    return table;
+}
+
+// CALLS ///////////////////////////////////////////////////////////////////////
+
+static void check_equal(const char* what, const mxArray* expected, const mxArray* actual) {
+    if (!bench_arrays_equal(expected, actual)) {
+        fprintf(stderr, "FAIL: %s differs after a round trip\n", what);
+        bench_failures++;
+    }
+}
+
+// CHECKS //////////////////////////////////////////////////////////////////////
+
+static void run_quick(bool real_pandas) {
+    mxArray *table = make_checked_table(), *back, *vars, *kind, *kind_back;
+    const char* var_names[] = {"x", "flag", "label"};
+    int idx;
+    
+    bench_put("df", table);
+    bench_check_true("table to DataFrame", real_pandas ? CHECK_REAL : CHECK_FAKE);
+    
+    back = bench_get("df");
+    if (back == NULL || !mxIsClass(back, "table")) {
+        fprintf(stderr, "FAIL: DataFrame did not come back as a table\n");
+        bench_failures++;
+    } else {
+        vars = mxGetProperty(table, 0, "vars");
+        for (idx = 0; idx < 3; ++idx) {
+            check_equal(var_names[idx], mxGetField(vars, 0, var_names[idx]),
+                mxGetField(mxGetProperty(back, 0, "vars"), 0, var_names[idx]));
+        }
+        kind = mxGetField(vars, 0, "kind");
+        kind_back = mxGetField(mxGetProperty(back, 0, "vars"), 0, "kind");
+        check_equal("categorical codes", mxGetProperty(kind, 0, "codes"), mxGetProperty(kind_back, 0, "codes"));
+        check_equal("categories", mxGetProperty(kind, 0, "names"), mxGetProperty(kind_back, 0, "names"));
+        check_equal("row names", mxGetProperty(table, 0, "RowNames"), mxGetProperty(back, 0, "RowNames"));
+        mxDestroyArray(back);
+    }
+    mxDestroyArray(table);
+    
+    // A variable with two columns can't be converted, so the table is boxed.
+    table = make_numeric_table(3, 1);
+    vars = mxGetProperty(table, 0, "vars");
+    mxSetFieldByNumber(vars, 0, 0, mxCreateDoubleMatrix(3, 2, mxREAL));
+    mxSetProperty(table, 0, "vars", vars);
+    bench_put("boxed", table);
+    bench_check_true("unconvertible table", "isinstance(boxed, __import__('pymex').mxArray)");
+    mxDestroyArray(table);
+}
+
+// BENCHMARKS //////////////////////////////////////////////////////////////////
+
+static void run_timing() {
+    mxArray *table = make_numeric_table(N_ROWS, N_COLUMNS), *back;
+    double start, to_python = INFINITY, to_matlab = INFINITY;
+    int idx;
+    
+    for (idx = 0; idx < N_REPEATS; ++idx) {
+        start = bench_now();
+        bench_put("df", table);
+        to_python = fmin(to_python, bench_now() - start);
+        start = bench_now();
+        back = bench_get("df");
+        to_matlab = fmin(to_matlab, bench_now() - start);
+        if (back != NULL) {
+            mxDestroyArray(back);
+        }
+    }
+    mxDestroyArray(table);
+    
+    printf("%d rows, %d double columns (%.0f MB)\n", N_ROWS, N_COLUMNS, N_ROWS * N_COLUMNS * 8 / 1e6);
+    printf("%-24s %14s %10s\n", "direction", "rows/s", "MB/s");
+    printf("%-24s %14.0f %10.0f\n", "table to DataFrame", N_ROWS / to_python, N_ROWS * N_COLUMNS * 8 / to_python / 1e6);
+    printf("%-24s %14.0f %10.0f\n", "DataFrame to table", N_ROWS / to_matlab, N_ROWS * N_COLUMNS * 8 / to_matlab / 1e6);
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0, real_pandas;
+    PyObject* pandas;
+    
+    if (!bench_init_pymex()) {
+        return 1;
+    }
+    mexstub_register("height", fn_height);
+    mexstub_register("table2struct", fn_table2struct);
+    mexstub_register("getfield", fn_getfield);
+    mexstub_register("double", fn_double);
+    mexstub_register("categories", fn_categories);
+    mexstub_register("categorical", fn_categorical);
+    mexstub_register("table", fn_table);
+    
+    pandas = PyImport_ImportModule("pandas");
+    real_pandas = pandas != NULL;
+    Py_XDECREF(pandas);
+    PyErr_Clear();
+    
+    if (!real_pandas) {
+        if (!quick) {
+            printf("pandas is not installed; nothing to time.\n");
+            mexstub_shutdown();
+            return 0;
+        }
+        if (!bench_exec_python(FAKE_PANDAS)) {
+            return 1;
+        }
+    }
+    
+    if (quick) {
+        run_quick(real_pandas);
+    } else {
+        run_timing();
+    }
+    
+    mexstub_shutdown();
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All table checks passed%s.\n", real_pandas ? "" : " (with a stand-in for pandas)");
+    }
+    return 0;
+}
@@ -0,0 +1,334 @@
+/**
+ * bench_trace.c: Checks and measures tracing of boundary crossings.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// Times a cheap EVALEXPR with tracing off, on, and with Python frames, and
+// reports calls per second for each.
+//
+// Usage: bench_trace [--quick]
+//
+// With --quick, a trace is instead recorded across opcodes, marshalling,
+// calls back into MATLAB that re-enter the MEX file, errors and Python
+// frames, saved, and read back with Python's json module to check that
+// spans nest as they should; the exit status is nonzero if anything is off.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <Python.h>
+
+#include "bench_common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+// Must agree with function_t in pymex_fns.c.
+#define EVAL_OPCODE 0
+#define EVALEXPR_OPCODE 16
+#define TRACE_OPCODE 26
+
+#define MIN_SECONDS 0.2
+
+static const char* SETUP =
+    "import json, os, tempfile\n"
+    "import pymex\n"
+    "trace_file = tempfile.mktemp('.json')\n"
+    "def fib(n):\n"
+    "    return n if n < 2 else fib(n - 1) + fib(n - 2)\n"
+    "def deep(n):\n"
+    "    return 0 if n == 0 else deep(n - 1) + 1\n"
+    "def outer():\n"
+    "    deep(300)\n"
+    "    return len('after')\n"
+    "def read_trace(filename):\n"
+    "    with open(filename) as f:\n"
+    "        trace = json.load(f)\n"
+    "    os.remove(filename)\n"
+    "    return [e for e in trace['traceEvents'] if e['ph'] == 'X']\n"
+    "def named(name):\n"
+    "    return [e for e in events if e['name'] == name]\n"
+    "def starting(prefix):\n"
+    "    return [e for e in events if e['name'].startswith(prefix)]\n"
+    "def inside(inner, outer):\n"
+    "    return (outer['ts'] <= inner['ts'] and\n"
+    "        inner['ts'] + inner['dur'] <= outer['ts'] + outer['dur'] + 1e-3 and\n"
+    "        inner['args']['depth'] > outer['args']['depth'])\n"
+    "def nested():\n"
+    "    # Spans at the same depth never overlap, and each span is inside\n"
+    "    # one a level up.\n"
+    "    by_depth = {}\n"
+    "    for e in events:\n"
+    "        by_depth.setdefault(e['args']['depth'], []).append(e)\n"
+    "    for d, spans in by_depth.items():\n"
+    "        spans.sort(key=lambda e: e['ts'])\n"
+    "        for a, b in zip(spans, spans[1:]):\n"
+    "            if a['ts'] + a['dur'] > b['ts'] + 1e-3:\n"
+    "                return False\n"
+    "        for e in spans:\n"
+    "            if d > 0 and not any(inside(e, p) for p in by_depth[d - 1]):\n"
+    "                return False\n"
+    "    return True\n";
+
+// CALLS ///////////////////////////////////////////////////////////////////////
+
+static bool run_string(int opcode, const char* str) {
+    mxArray *arg = mxCreateString(str), *result;
+    bool failed;
+    
+    result = bench_run_opcode(opcode, 1, &arg, &failed);
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    mxDestroyArray(arg);
+    return !failed;
+}
+
+static void run_trace(const char* command) {
+    if (!run_string(TRACE_OPCODE, command)) {
+        fprintf(stderr, "FAIL: trace %s: %s\n", command, mexstub_last_error());
+        bench_failures++;
+    }
+}
+
+/**
+ * Saves the trace to trace_file, and reads its complete events back into
+ * events in __main__. Returns how many events TRACE said it wrote.
+ */
+static double save_trace() {
+    mxArray *args[2], *result = NULL;
+    double n_events = -1;
+    
+    args[0] = mxCreateString("save");
+    args[1] = bench_eval_expr("trace_file");
+    if (args[1] != NULL) {
+        result = bench_run_opcode(TRACE_OPCODE, 2, args, NULL);
+        mxDestroyArray(args[1]);
+    }
+    if (result != NULL) {
+        n_events = mxGetScalar(result);
+        mxDestroyArray(result);
+    }
+    mxDestroyArray(args[0]);
+    
+    bench_run_eval("events = read_trace(trace_file)");
+    return n_events;
+}
+
+// MATLAB FUNCTIONS ////////////////////////////////////////////////////////////
+
+/**
+ * Calls back into the MEX file, as a MATLAB function using PyObjects
+ * would, and returns twice its argument.
+ */
+static void fn_reenter(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    const mxArray* args[2];
+    mxArray *m_opcode = bench_opcode(EVAL_OPCODE), *code = mxCreateString("reentered = True");
+    
+    args[0] = m_opcode;
+    args[1] = code;
+    mexFunction(0, NULL, 2, args);
+    mxDestroyArray(m_opcode);
+    mxDestroyArray(code);
+    plhs[0] = mxCreateDoubleScalar(2 * mxGetScalar(prhs[0]));
+}
+
+static void fn_eval(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+}
+
+// CHECKS //////////////////////////////////////////////////////////////////////
+
+static void check_spans() {
+    mxArray* cell;
+    char expr[64];
+    double n_events;
+    
+    run_trace("reset");
+    run_trace("on");
+    bench_run_eval("x = 1");
+    cell = mxCreateCellMatrix(1, 2);
+    mxSetCell(cell, 0, mxCreateDoubleScalar(1));
+    mxSetCell(cell, 1, mxCreateString("ab"));
+    bench_put("c", cell);
+    mxDestroyArray(cell);
+    bench_run_eval("r = pymex.feval('reenter', 2.0)");
+    bench_run_eval("pymex.mateval('disp(1)')");
+    if (run_string(EVAL_OPCODE, "1 / 0")) {
+        fprintf(stderr, "FAIL: error: no error\n");
+        bench_failures++;
+    }
+    bench_run_eval("y = 2");
+    n_events = save_trace();
+    run_trace("off");
+    
+    sprintf(expr, "len(events) == %d", (int) n_events);
+    bench_check_true("event count", expr);
+    bench_check_true("nesting", "nested()");
+    bench_check_true("categories", "set(e['cat'] for e in events) == set(['opcode', 'marshal', 'matlab'])");
+    bench_check_true("opcodes", "len(named('eval')) == 6 and len(named('put')) == 1");
+    bench_check_true("opcodes", "all(e['cat'] == 'opcode' for e in named('eval'))");
+    
+    // One span per top-level conversion, named for what was converted.
+    bench_check_true("marshalling", "[e['args']['depth'] for e in named('mat2py cell')] == [1]");
+    bench_check_true("marshalling", "not any(inside(a, b) for a in starting('mat2py') for b in starting('mat2py'))");
+    bench_check_true("marshalling", "named('py2mat float')[0]['args']['depth'] == 1");
+    bench_check_true("marshalling", "named('py2mat float')[0]['ts'] < named('feval reenter')[0]['ts']");
+    
+    // Calls back into MATLAB, and opcodes run from inside them.
+    bench_check_true("feval", "[(e['cat'], e['args']['depth']) for e in named('feval reenter')] == [('matlab', 1)]");
+    bench_check_true("re-entry", "any(e['args']['depth'] == 2 and inside(e, named('feval reenter')[0]) for e in named('eval'))");
+    bench_check_true("mateval", "[e['cat'] for e in named('mateval')] == ['matlab']");
+    
+    // The call that raised leaves its span open; the next call closes it.
+    bench_check_true("error", "sorted(e['args']['depth'] for e in named('eval')) == [0, 0, 0, 0, 0, 2]");
+}
+
+static void check_frames() {
+    run_trace("reset");
+    run_trace("frames");
+    bench_run_eval("f = fib(5)");
+    bench_run_eval("n = len('abc')");
+    save_trace();
+    run_trace("off");
+    
+    bench_check_true("frames", "len(starting('fib (<string>:')) == 15");
+    bench_check_true("frames", "set(e['cat'] for e in starting('fib')) == set(['python'])");
+    bench_check_true("builtins", "len(named('len')) == 1");
+    bench_check_true("frames nesting", "nested()");
+    bench_check_true("frames nesting", "max(e['args']['depth'] for e in starting('fib')) >= 5");
+    
+    // Frames deeper than the trace can hold aren't recorded, and nor are
+    // their returns, so the frames around them still end in the right place.
+    run_trace("reset");
+    run_trace("frames");
+    bench_run_eval("d = outer()");
+    save_trace();
+    run_trace("off");
+    bench_check_true("deep frames", "len(starting('deep')) < 300 and nested()");
+    bench_check_true("deep frames", "[inside(e, starting('outer')[0]) for e in named('len')] == [True]");
+    bench_check_true("deep frames", "all(inside(e, starting('outer')[0]) for e in starting('deep'))");
+    
+    // Nothing is recorded once tracing is off.
+    run_trace("reset");
+    bench_run_eval("f = fib(3)");
+    if (save_trace() != 0) {
+        fprintf(stderr, "FAIL: off: events recorded\n");
+        bench_failures++;
+    }
+    bench_check_true("off", "events == []");
+}
+
+static void check_commands() {
+    mxArray *args[2], *result;
+    bool failed;
+    
+    args[0] = mxCreateString("save");
+    args[1] = mxCreateString("/nonexistent/trace.json");
+    result = bench_run_opcode(TRACE_OPCODE, 2, args, &failed);
+    if (!failed) {
+        fprintf(stderr, "FAIL: unwritable file: no error\n");
+        bench_failures++;
+    }
+    if (run_string(TRACE_OPCODE, "sideways")) {
+        fprintf(stderr, "FAIL: unknown command: no error\n");
+        bench_failures++;
+    }
+    if (result != NULL) {
+        mxDestroyArray(result);
+    }
+    mxDestroyArray(args[0]);
+    mxDestroyArray(args[1]);
+}
+
+// BENCHMARKS //////////////////////////////////////////////////////////////////
+
+/**
+ * Returns calls per second of EVALEXPR on expr, with tracing set by command.
+ * The trace is reset as it goes, so that it never fills up.
+ */
+static double time_calls(const char* command, const char* expr) {
+    mxArray *arg = mxCreateString(expr), *result;
+    double start, elapsed;
+    long n_calls = 0;
+    int idx;
+    
+    run_trace("reset");
+    run_trace(command);
+    start = bench_now();
+    do {
+        for (idx = 0; idx < 1000; ++idx) {
+            result = bench_run_opcode(EVALEXPR_OPCODE, 1, &arg, NULL);
+            if (result == NULL) {
+                return 0.0;
+            }
+            mxDestroyArray(result);
+        }
+        n_calls += idx;
+        run_trace("reset");
+        elapsed = bench_now() - start;
+    } while (elapsed < MIN_SECONDS);
+    run_trace("off");
+    
+    mxDestroyArray(arg);
+    return n_calls / elapsed;
+}
+
+static void run_benchmarks() {
+    static const char* EXPRS[] = {"abs(-1.5)", "fib(4)"};
+    size_t idx;
+    
+    printf("%-12s %14s %14s %14s\n", "expression", "off/s", "on/s", "frames/s");
+    for (idx = 0; idx < sizeof(EXPRS) / sizeof(EXPRS[0]); ++idx) {
+        printf("%-12s %14.0f %14.0f %14.0f\n", EXPRS[idx], time_calls("off", EXPRS[idx]),
+            time_calls("on", EXPRS[idx]), time_calls("frames", EXPRS[idx]));
+    }
+}
+
+// MAIN ////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv) {
+    bool quick = argc > 1 && strcmp(argv[1], "--quick") == 0;
+    
+    if (!bench_init_pymex() || !bench_exec_python(SETUP)) {
+        return 1;
+    }
+    mexstub_register("reenter", fn_reenter);
+    mexstub_register("eval", fn_eval);
+    
+    if (quick) {
+        check_spans();
+        check_frames();
+        check_commands();
+    } else {
+        run_benchmarks();
+    }
+    
+    mexstub_shutdown();
+    
+    if (bench_failures > 0) {
+        fprintf(stderr, "%d check(s) failed.\n", bench_failures);
+        return 1;
+    }
+    if (quick) {
+        printf("All trace checks passed.\n");
+    }
+    return 0;
+}
@@ -0,0 +1,172 @@
+/**
+ * matrix.h: Stand-in for the subset of MATLAB's matrix.h used by pymex.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// This header, along with mex.h and mexstub.c, lets the pymex sources be
+// built and exercised without MATLAB. It mirrors the names, types and
+// enumeration values of MATLAB's own header (with -largeArrayDims), but
+// only as much of the API as pymex actually uses.
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_STUB_MATRIX_H
+#define PYMEX_STUB_MATRIX_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef struct mxArray_tag mxArray;
+
+typedef size_t mwSize;
+typedef size_t mwIndex;
+typedef ptrdiff_t mwSignedIndex;
+
+typedef bool mxLogical;
+typedef unsigned short mxChar;
+
+typedef enum {
+    mxUNKNOWN_CLASS = 0,
+    mxCELL_CLASS,
+    mxSTRUCT_CLASS,
+    mxLOGICAL_CLASS,
+    mxCHAR_CLASS,
+    mxVOID_CLASS,
+    mxDOUBLE_CLASS,
+    mxSINGLE_CLASS,
+    mxINT8_CLASS,
+    mxUINT8_CLASS,
+    mxINT16_CLASS,
+    mxUINT16_CLASS,
+    mxINT32_CLASS,
+    mxUINT32_CLASS,
+    mxINT64_CLASS,
+    mxUINT64_CLASS,
+    mxFUNCTION_CLASS,
+    mxOPAQUE_CLASS,
+    mxOBJECT_CLASS
+} mxClassID;
+
+typedef enum {
+    mxREAL,
+    mxCOMPLEX
+} mxComplexity;
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+// Memory.
+void* mxMalloc(size_t n);
+void* mxCalloc(size_t n, size_t size);
+void* mxRealloc(void* ptr, size_t size);
+void mxFree(void* ptr);
+
+// Creation and destruction.
+mxArray* mxCreateDoubleScalar(double value);
+mxArray* mxCreateLogicalScalar(mxLogical value);
+mxArray* mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity complexity);
+mxArray* mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID class_id, mxComplexity complexity);
+mxArray* mxCreateNumericArray(mwSize ndim, const mwSize* dims, mxClassID class_id, mxComplexity complexity);
+mxArray* mxCreateUninitNumericMatrix(mwSize m, mwSize n, mxClassID class_id, mxComplexity complexity);
+mxArray* mxCreateUninitNumericArray(mwSize ndim, const mwSize* dims, mxClassID class_id, mxComplexity complexity);
+mxArray* mxCreateLogicalMatrix(mwSize m, mwSize n);
+mxArray* mxCreateLogicalArray(mwSize ndim, const mwSize* dims);
+mxArray* mxCreateString(const char* str);
+mxArray* mxCreateCharMatrixFromStrings(mwSize m, const char** str);
+mxArray* mxCreateCharArray(mwSize ndim, const mwSize* dims);
+mxArray* mxCreateCellMatrix(mwSize m, mwSize n);
+mxArray* mxCreateCellArray(mwSize ndim, const mwSize* dims);
+mxArray* mxCreateStructMatrix(mwSize m, mwSize n, int nfields, const char** field_names);
+mxArray* mxCreateStructArray(mwSize ndim, const mwSize* dims, int nfields, const char** field_names);
+mxArray* mxDuplicateArray(const mxArray* array);
+void mxDestroyArray(mxArray* array);
+
+// Shape.
+mwSize mxGetM(const mxArray* array);
+mwSize mxGetN(const mxArray* array);
+void mxSetM(mxArray* array, mwSize m);
+void mxSetN(mxArray* array, mwSize n);
+mwSize mxGetNumberOfDimensions(const mxArray* array);
+const mwSize* mxGetDimensions(const mxArray* array);
+int mxSetDimensions(mxArray* array, const mwSize* dims, mwSize ndim);
+mwSize mxGetNumberOfElements(const mxArray* array);
+size_t mxGetElementSize(const mxArray* array);
+mwIndex mxCalcSingleSubscript(const mxArray* array, mwSize nsubs, const mwIndex* subs);
+
+// Classes.
+mxClassID mxGetClassID(const mxArray* array);
+const char* mxGetClassName(const mxArray* array);
+bool mxIsClass(const mxArray* array, const char* name);
+bool mxIsCell(const mxArray* array);
+bool mxIsStruct(const mxArray* array);
+bool mxIsChar(const mxArray* array);
+bool mxIsLogical(const mxArray* array);
+bool mxIsNumeric(const mxArray* array);
+bool mxIsDouble(const mxArray* array);
+bool mxIsSingle(const mxArray* array);
+bool mxIsInt32(const mxArray* array);
+bool mxIsInt64(const mxArray* array);
+bool mxIsUint8(const mxArray* array);
+bool mxIsComplex(const mxArray* array);
+bool mxIsSparse(const mxArray* array);
+bool mxIsEmpty(const mxArray* array);
+bool mxIsFunctionHandle(const mxArray* array);
+bool mxIsLogicalScalar(const mxArray* array);
+bool mxIsLogicalScalarTrue(const mxArray* array);
+
+// Data.
+void* mxGetData(const mxArray* array);
+void mxSetData(mxArray* array, void* data);
+void* mxGetImagData(const mxArray* array);
+void mxSetImagData(mxArray* array, void* data);
+double* mxGetPr(const mxArray* array);
+double* mxGetPi(const mxArray* array);
+double mxGetScalar(const mxArray* array);
+mxLogical* mxGetLogicals(const mxArray* array);
+mxChar* mxGetChars(const mxArray* array);
+// Sparse arrays are never made here, so these only exist to link.
+mwIndex* mxGetIr(const mxArray* array);
+mwIndex* mxGetJc(const mxArray* array);
+mwSize mxGetNzmax(const mxArray* array);
+int mxGetString(const mxArray* array, char* buf, mwSize buflen);
+char* mxArrayToString(const mxArray* array);
+
+// Cells.
+mxArray* mxGetCell(const mxArray* array, mwIndex idx);
+void mxSetCell(mxArray* array, mwIndex idx, mxArray* value);
+
+// Structs.
+int mxGetNumberOfFields(const mxArray* array);
+const char* mxGetFieldNameByNumber(const mxArray* array, int field);
+int mxGetFieldNumber(const mxArray* array, const char* name);
+mxArray* mxGetField(const mxArray* array, mwIndex idx, const char* name);
+mxArray* mxGetFieldByNumber(const mxArray* array, mwIndex idx, int field);
+void mxSetField(mxArray* array, mwIndex idx, const char* name, mxArray* value);
+void mxSetFieldByNumber(mxArray* array, mwIndex idx, int field, mxArray* value);
+int mxAddField(mxArray* array, const char* name);
+
+// Objects.
+mxArray* mxGetProperty(const mxArray* array, mwIndex idx, const char* name);
+void mxSetProperty(mxArray* array, mwIndex idx, const char* name, const mxArray* value);
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * mex.h: Stand-in for the subset of MATLAB's mex.h used by pymex.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_STUB_MEX_H
+#define PYMEX_STUB_MEX_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "matrix.h"
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]);
+
+void mexErrMsgTxt(const char* msg);
+void mexErrMsgIdAndTxt(const char* id, const char* fmt, ...);
+void mexWarnMsgTxt(const char* msg);
+void mexWarnMsgIdAndTxt(const char* id, const char* fmt, ...);
+int mexPrintf(const char* fmt, ...);
+
+int mexCallMATLAB(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[], const char* name);
+mxArray* mexCallMATLABWithTrap(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[], const char* name);
+int mexEvalString(const char* cmd);
+mxArray* mexEvalStringWithTrap(const char* cmd);
+
+mxArray* mexGetVariable(const char* workspace, const char* name);
+int mexPutVariable(const char* workspace, const char* name, const mxArray* value);
+
+void mexMakeArrayPersistent(mxArray* array);
+void mexMakeMemoryPersistent(void* ptr);
+int mexAtExit(void (*fn)(void));
+void mexLock(void);
+void mexUnlock(void);
+const char* mexFunctionName(void);
+
+#endif
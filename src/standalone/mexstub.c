@@ -0,0 +1,1284 @@
+/**
+ * mexstub.c: Stand-in implementation of the MEX and matrix APIs.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// This is not MATLAB, and makes no attempt to be: there is no copy-on-write,
+// no sparse or complex interleaving, and "objects" are just structs with a
+// class name. What it does reproduce is the memory-ownership model that MEX
+// code must respect (temporaries are reclaimed when a MEX call returns,
+// persistent arrays are not, containers own their contents) and the
+// non-local error exit of mexErrMsgTxt, since those are what pymex's
+// correctness and performance hinge on.
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "mexstub.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// CONSTANTS ///////////////////////////////////////////////////////////////////
+
+#define MAX_FUNCTIONS 128
+#define MAX_EXIT_FNS 16
+#define ERROR_BUF_SIZE 2048
+
+static const char* CLASS_NAMES[] = {
+    "unknown", "cell", "struct", "logical", "char", "void", "double",
+    "single", "int8", "uint8", "int16", "uint16", "int32", "uint32",
+    "int64", "uint64", "function_handle", "opaque", "object"
+};
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+struct mxArray_tag {
+    mxClassID class_id;
+    // Only set for objects (including function handles).
+    char* class_name;
+    mwSize ndim;
+    mwSize* dims;
+    mwSize n_els;
+    size_t el_size;
+    // For cells, an array of mxArray*. For structs and objects, an array of
+    // mxArray* with n_fields entries per element.
+    void* data;
+    void* imag_data;
+    int n_fields;
+    char** field_names;
+    // Ownership: persistent arrays outlive MEX calls, and owned arrays are
+    // freed along with the container they were placed in.
+    bool persistent;
+    bool owned;
+    // Index into the temporaries list, or -1 if not a temporary.
+    long temp_slot;
+};
+
+typedef union {
+    long slot;
+    // Keep the user's block suitably aligned for any type.
+    long double align;
+} block_header_t;
+
+typedef struct call_frame {
+    jmp_buf jmp;
+    size_t temps_mark;
+    size_t blocks_mark;
+    // Trap frames (mexCallMATLABWithTrap) catch errors but leave cleanup to
+    // the enclosing MEX call.
+    bool trap_only;
+    struct call_frame* parent;
+} call_frame_t;
+
+typedef struct {
+    char* name;
+    mexstub_function_t fn;
+} function_entry_t;
+
+typedef struct variable {
+    char* workspace;
+    char* name;
+    mxArray* value;
+    struct variable* next;
+} variable_t;
+
+// GLOBALS /////////////////////////////////////////////////////////////////////
+
+static mxArray** temps = NULL;
+static size_t n_temps = 0, cap_temps = 0;
+
+static block_header_t** blocks = NULL;
+static size_t n_blocks = 0, cap_blocks = 0;
+
+static call_frame_t* current_frame = NULL;
+static int call_depth = 0;
+static char last_error[ERROR_BUF_SIZE] = "";
+
+static function_entry_t functions[MAX_FUNCTIONS];
+static int n_functions = 0;
+static bool defaults_registered = false;
+
+static void (*exit_fns[MAX_EXIT_FNS])(void);
+static int n_exit_fns = 0;
+
+static variable_t* variables = NULL;
+
+static size_t n_live = 0;
+
+// The thread that first called mexstub_call plays MATLAB's main thread.
+static pthread_t mex_thread;
+static bool have_mex_thread = false;
+static size_t n_off_thread = 0;
+
+// FORWARD DECLARATIONS ////////////////////////////////////////////////////////
+
+static void register_defaults(void);
+
+// UTILITY MACROS //////////////////////////////////////////////////////////////
+
+// Counts calls from threads other than MATLAB's, which MATLAB does not
+// allow. Only the accessors pymex might be tempted to call from Python
+// threads are checked.
+#define NOTE_THREAD() do { \
+        if (have_mex_thread && !pthread_equal(pthread_self(), mex_thread)) { \
+            __sync_fetch_and_add(&n_off_thread, 1); \
+        } \
+    } while (0)
+
+// UTILITY FUNCTIONS ///////////////////////////////////////////////////////////
+
+static char* copy_str(const char* str) {
+    size_t len = strlen(str);
+    char* copy = malloc(len + 1);
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+static void* grow(void* buf, size_t* capacity, size_t needed, size_t el_size) {
+    if (needed <= *capacity) {
+        return buf;
+    }
+    *capacity = *capacity == 0 ? 256 : *capacity;
+    while (*capacity < needed) {
+        *capacity *= 2;
+    }
+    return realloc(buf, *capacity * el_size);
+}
+
+static void register_temp(mxArray* array) {
+    if (call_depth == 0) {
+        array->temp_slot = -1;
+        return;
+    }
+    temps = grow(temps, &cap_temps, n_temps + 1, sizeof(mxArray*));
+    array->temp_slot = (long) n_temps;
+    temps[n_temps++] = array;
+}
+
+static void unregister_temp(mxArray* array) {
+    if (array->temp_slot >= 0) {
+        temps[array->temp_slot] = NULL;
+        array->temp_slot = -1;
+    }
+}
+
+static size_t class_element_size(mxClassID class_id) {
+    switch (class_id) {
+        case mxLOGICAL_CLASS:   return sizeof(mxLogical);
+        case mxCHAR_CLASS:      return sizeof(mxChar);
+        case mxDOUBLE_CLASS:    return sizeof(double);
+        case mxSINGLE_CLASS:    return sizeof(float);
+        case mxINT8_CLASS:
+        case mxUINT8_CLASS:     return 1;
+        case mxINT16_CLASS:
+        case mxUINT16_CLASS:    return 2;
+        case mxINT32_CLASS:
+        case mxUINT32_CLASS:    return 4;
+        case mxINT64_CLASS:
+        case mxUINT64_CLASS:    return 8;
+        default:                return sizeof(mxArray*);
+    }
+}
+
+static bool has_children(const mxArray* array) {
+    return array->class_id == mxCELL_CLASS || array->class_id == mxSTRUCT_CLASS ||
+        array->class_id == mxOBJECT_CLASS || array->class_id == mxFUNCTION_CLASS;
+}
+
+static size_t n_slots(const mxArray* array) {
+    if (array->class_id == mxCELL_CLASS) {
+        return array->n_els;
+    }
+    return array->n_els * array->n_fields;
+}
+
+/**
+ * Allocates a new array. Dimensions are normalized as MATLAB does: at least
+ * two, with trailing singletons beyond the second dropped.
+ */
+static mxArray* new_array(mxClassID class_id, mwSize ndim, const mwSize* dims, bool complex, bool zeroed, int n_fields) {
+    mxArray* array = calloc(1, sizeof(mxArray));
+    mwSize idx;
+    size_t n_bytes;
+    
+    array->class_id = class_id;
+    array->ndim = ndim < 2 ? 2 : ndim;
+    array->dims = malloc(array->ndim * sizeof(mwSize));
+    for (idx = 0; idx < array->ndim; ++idx) {
+        array->dims[idx] = idx < ndim ? dims[idx] : 1;
+    }
+    while (array->ndim > 2 && array->dims[array->ndim - 1] == 1) {
+        array->ndim--;
+    }
+    array->n_els = 1;
+    for (idx = 0; idx < array->ndim; ++idx) {
+        array->n_els *= array->dims[idx];
+    }
+    
+    array->el_size = class_element_size(class_id);
+    array->n_fields = n_fields;
+    n_bytes = (has_children(array) ? n_slots(array) : array->n_els) * array->el_size;
+    // Always allocate something, so that mxGetData is non-NULL as in MATLAB.
+    array->data = zeroed || has_children(array) ? calloc(n_bytes + 1, 1) : malloc(n_bytes + 1);
+    if (complex) {
+        array->imag_data = zeroed ? calloc(n_bytes + 1, 1) : malloc(n_bytes + 1);
+    }
+    
+    n_live++;
+    register_temp(array);
+    return array;
+}
+
+static mxArray* new_array_2d(mxClassID class_id, mwSize m, mwSize n, bool complex, bool zeroed) {
+    mwSize dims[2];
+    dims[0] = m;
+    dims[1] = n;
+    return new_array(class_id, 2, dims, complex, zeroed, 0);
+}
+
+static void set_child(mxArray* array, size_t slot, mxArray* value) {
+    ((mxArray**) array->data)[slot] = value;
+    if (value != NULL) {
+        value->owned = true;
+    }
+}
+
+static mxArray* get_child(const mxArray* array, size_t slot) {
+    return ((mxArray**) array->data)[slot];
+}
+
+// HOST API ////////////////////////////////////////////////////////////////////
+
+void mexstub_register(const char* name, mexstub_function_t fn) {
+    int idx;
+    
+    if (!defaults_registered) {
+        register_defaults();
+    }
+    
+    for (idx = 0; idx < n_functions; ++idx) {
+        if (strcmp(functions[idx].name, name) == 0) {
+            functions[idx].fn = fn;
+            return;
+        }
+    }
+    if (n_functions == MAX_FUNCTIONS) {
+        fprintf(stderr, "mexstub: too many registered functions.\n");
+        abort();
+    }
+    functions[n_functions].name = copy_str(name);
+    functions[n_functions].fn = fn;
+    n_functions++;
+}
+
+/**
+ * Reclaims the temporaries and mxCalloc'd memory of a frame, except for the
+ * outputs in plhs (which become temporaries of the enclosing frame, if any).
+ */
+static void release_frame(call_frame_t* frame, mxArray* plhs[], int n_out) {
+    size_t idx;
+    mxArray* array;
+    int idx_out;
+    
+    for (idx_out = 0; idx_out < n_out; ++idx_out) {
+        if (plhs[idx_out] != NULL) {
+            unregister_temp(plhs[idx_out]);
+        }
+    }
+    
+    // Destroying a container destroys its contents, which may clear slots
+    // further along, so re-read the list on every iteration.
+    for (idx = frame->temps_mark; idx < n_temps; ++idx) {
+        array = temps[idx];
+        if (array == NULL) {
+            continue;
+        }
+        if (array->owned || array->persistent) {
+            array->temp_slot = -1;
+        } else {
+            mxDestroyArray(array);
+        }
+    }
+    n_temps = frame->temps_mark;
+    
+    for (idx = frame->blocks_mark; idx < n_blocks; ++idx) {
+        if (blocks[idx] != NULL) {
+            free(blocks[idx]);
+        }
+    }
+    n_blocks = frame->blocks_mark;
+    
+    // Hand the outputs to the caller's frame.
+    call_depth--;
+    for (idx_out = 0; idx_out < n_out; ++idx_out) {
+        if (plhs[idx_out] != NULL) {
+            register_temp(plhs[idx_out]);
+        }
+    }
+    call_depth++;
+}
+
+int mexstub_call(mexstub_entry_t entry, int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
+    call_frame_t frame;
+    volatile int status = 0;
+    // MATLAB always provides room for one output, even when nlhs is 0, and
+    // MEX code may use it; the caller must do the same.
+    int n_out = nlhs > 0 ? nlhs : 1;
+    int idx;
+    
+    if (!defaults_registered) {
+        register_defaults();
+    }
+    if (!have_mex_thread) {
+        mex_thread = pthread_self();
+        have_mex_thread = true;
+    }
+    
+    for (idx = 0; idx < n_out; ++idx) {
+        plhs[idx] = NULL;
+    }
+    
+    frame.temps_mark = n_temps;
+    frame.blocks_mark = n_blocks;
+    frame.trap_only = false;
+    frame.parent = current_frame;
+    current_frame = &frame;
+    call_depth++;
+    
+    if (setjmp(frame.jmp) == 0) {
+        entry(nlhs, plhs, nrhs, prhs);
+    } else {
+        status = 1;
+        // As in MATLAB, outputs of a failed call are discarded.
+        for (idx = 0; idx < n_out; ++idx) {
+            plhs[idx] = NULL;
+        }
+    }
+    
+    release_frame(&frame, plhs, n_out);
+    call_depth--;
+    current_frame = frame.parent;
+    return status;
+}
+
+const char* mexstub_last_error(void) {
+    return last_error;
+}
+
+mxArray* mexstub_create_object(const char* class_name, int nprops, const char** prop_names) {
+    mwSize dims[2] = {1, 1};
+    mxArray* array;
+    int idx;
+    
+    array = new_array(
+        strcmp(class_name, "function_handle") == 0 ? mxFUNCTION_CLASS : mxOBJECT_CLASS,
+        2, dims, false, true, nprops
+    );
+    array->class_name = copy_str(class_name);
+    array->field_names = malloc((nprops + 1) * sizeof(char*));
+    for (idx = 0; idx < nprops; ++idx) {
+        array->field_names[idx] = copy_str(prop_names[idx]);
+    }
+    return array;
+}
+
+void mexstub_shutdown(void) {
+    while (n_exit_fns > 0) {
+        exit_fns[--n_exit_fns]();
+    }
+}
+
+size_t mexstub_live_arrays(void) {
+    return n_live;
+}
+
+size_t mexstub_off_thread_calls(void) {
+    return n_off_thread;
+}
+
+// MEMORY //////////////////////////////////////////////////////////////////////
+
+void* mxMalloc(size_t n) {
+    block_header_t* block = malloc(sizeof(block_header_t) + n);
+    
+    if (block == NULL) {
+        return NULL;
+    }
+    if (call_depth > 0) {
+        blocks = grow(blocks, &cap_blocks, n_blocks + 1, sizeof(block_header_t*));
+        block->slot = (long) n_blocks;
+        blocks[n_blocks++] = block;
+    } else {
+        block->slot = -1;
+    }
+    return block + 1;
+}
+
+void* mxCalloc(size_t n, size_t size) {
+    void* ptr = mxMalloc(n * size);
+    if (ptr != NULL) {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+void* mxRealloc(void* ptr, size_t size) {
+    block_header_t* block;
+    
+    if (ptr == NULL) {
+        return mxMalloc(size);
+    }
+    block = realloc((block_header_t*) ptr - 1, sizeof(block_header_t) + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    if (block->slot >= 0) {
+        blocks[block->slot] = block;
+    }
+    return block + 1;
+}
+
+void mxFree(void* ptr) {
+    block_header_t* block;
+    
+    if (ptr == NULL) {
+        return;
+    }
+    block = (block_header_t*) ptr - 1;
+    if (block->slot >= 0) {
+        blocks[block->slot] = NULL;
+    }
+    free(block);
+}
+
+void mexMakeMemoryPersistent(void* ptr) {
+    block_header_t* block = (block_header_t*) ptr - 1;
+    if (block->slot >= 0) {
+        blocks[block->slot] = NULL;
+        block->slot = -1;
+    }
+}
+
+void mexMakeArrayPersistent(mxArray* array) {
+    array->persistent = true;
+    unregister_temp(array);
+}
+
+// CREATION AND DESTRUCTION ////////////////////////////////////////////////////
+
+mxArray* mxCreateDoubleScalar(double value) {
+    mxArray* array = new_array_2d(mxDOUBLE_CLASS, 1, 1, false, false);
+    *(double*) array->data = value;
+    return array;
+}
+
+mxArray* mxCreateLogicalScalar(mxLogical value) {
+    mxArray* array = new_array_2d(mxLOGICAL_CLASS, 1, 1, false, false);
+    *(mxLogical*) array->data = value;
+    return array;
+}
+
+mxArray* mxCreateDoubleMatrix(mwSize m, mwSize n, mxComplexity complexity) {
+    return new_array_2d(mxDOUBLE_CLASS, m, n, complexity == mxCOMPLEX, true);
+}
+
+mxArray* mxCreateNumericMatrix(mwSize m, mwSize n, mxClassID class_id, mxComplexity complexity) {
+    return new_array_2d(class_id, m, n, complexity == mxCOMPLEX, true);
+}
+
+mxArray* mxCreateNumericArray(mwSize ndim, const mwSize* dims, mxClassID class_id, mxComplexity complexity) {
+    return new_array(class_id, ndim, dims, complexity == mxCOMPLEX, true, 0);
+}
+
+mxArray* mxCreateUninitNumericMatrix(mwSize m, mwSize n, mxClassID class_id, mxComplexity complexity) {
+    return new_array_2d(class_id, m, n, complexity == mxCOMPLEX, false);
+}
+
+mxArray* mxCreateUninitNumericArray(mwSize ndim, const mwSize* dims, mxClassID class_id, mxComplexity complexity) {
+    return new_array(class_id, ndim, dims, complexity == mxCOMPLEX, false, 0);
+}
+
+mxArray* mxCreateLogicalMatrix(mwSize m, mwSize n) {
+    return new_array_2d(mxLOGICAL_CLASS, m, n, false, true);
+}
+
+mxArray* mxCreateLogicalArray(mwSize ndim, const mwSize* dims) {
+    return new_array(mxLOGICAL_CLASS, ndim, dims, false, true, 0);
+}
+
+mxArray* mxCreateString(const char* str) {
+    size_t len = strlen(str), idx;
+    mxArray* array = new_array_2d(mxCHAR_CLASS, len == 0 ? 0 : 1, len, false, false);
+    mxChar* chars = array->data;
+    for (idx = 0; idx < len; ++idx) {
+        chars[idx] = (unsigned char) str[idx];
+    }
+    return array;
+}
+
+mxArray* mxCreateCharMatrixFromStrings(mwSize m, const char** str) {
+    size_t n = 0, len, idx_row, idx_col;
+    mxArray* array;
+    mxChar* chars;
+    
+    for (idx_row = 0; idx_row < m; ++idx_row) {
+        len = strlen(str[idx_row]);
+        n = len > n ? len : n;
+    }
+    array = new_array_2d(mxCHAR_CLASS, m, n, false, false);
+    chars = array->data;
+    // Column-major, with shorter rows padded with spaces.
+    for (idx_row = 0; idx_row < m; ++idx_row) {
+        len = strlen(str[idx_row]);
+        for (idx_col = 0; idx_col < n; ++idx_col) {
+            chars[idx_col * m + idx_row] =
+                idx_col < len ? (unsigned char) str[idx_row][idx_col] : ' ';
+        }
+    }
+    return array;
+}
+
+mxArray* mxCreateCharArray(mwSize ndim, const mwSize* dims) {
+    return new_array(mxCHAR_CLASS, ndim, dims, false, true, 0);
+}
+
+mxArray* mxCreateCellMatrix(mwSize m, mwSize n) {
+    return new_array_2d(mxCELL_CLASS, m, n, false, true);
+}
+
+mxArray* mxCreateCellArray(mwSize ndim, const mwSize* dims) {
+    return new_array(mxCELL_CLASS, ndim, dims, false, true, 0);
+}
+
+mxArray* mxCreateStructArray(mwSize ndim, const mwSize* dims, int nfields, const char** field_names) {
+    mxArray* array = new_array(mxSTRUCT_CLASS, ndim, dims, false, true, nfields);
+    int idx;
+    
+    array->field_names = malloc((nfields + 1) * sizeof(char*));
+    for (idx = 0; idx < nfields; ++idx) {
+        array->field_names[idx] = copy_str(field_names[idx]);
+    }
+    return array;
+}
+
+mxArray* mxCreateStructMatrix(mwSize m, mwSize n, int nfields, const char** field_names) {
+    mwSize dims[2];
+    dims[0] = m;
+    dims[1] = n;
+    return mxCreateStructArray(2, dims, nfields, field_names);
+}
+
+mxArray* mxDuplicateArray(const mxArray* array) {
+    mxArray* copy;
+    size_t slot, n_bytes;
+    int idx;
+    
+    if (array == NULL) {
+        return NULL;
+    }
+    
+    copy = new_array(array->class_id, array->ndim, array->dims,
+        array->imag_data != NULL, true, array->n_fields);
+    if (array->class_name != NULL) {
+        copy->class_name = copy_str(array->class_name);
+    }
+    if (array->field_names != NULL) {
+        copy->field_names = malloc((array->n_fields + 1) * sizeof(char*));
+        for (idx = 0; idx < array->n_fields; ++idx) {
+            copy->field_names[idx] = copy_str(array->field_names[idx]);
+        }
+    }
+    
+    if (has_children(array)) {
+        for (slot = 0; slot < n_slots(array); ++slot) {
+            set_child(copy, slot, mxDuplicateArray(get_child(array, slot)));
+        }
+    } else {
+        n_bytes = array->n_els * array->el_size;
+        memcpy(copy->data, array->data, n_bytes);
+        if (array->imag_data != NULL) {
+            memcpy(copy->imag_data, array->imag_data, n_bytes);
+        }
+    }
+    return copy;
+}
+
+void mxDestroyArray(mxArray* array) {
+    size_t slot;
+    int idx;
+    
+    if (array == NULL) {
+        return;
+    }
+    
+    if (has_children(array)) {
+        for (slot = 0; slot < n_slots(array); ++slot) {
+            mxDestroyArray(get_child(array, slot));
+        }
+    }
+    if (array->field_names != NULL) {
+        for (idx = 0; idx < array->n_fields; ++idx) {
+            free(array->field_names[idx]);
+        }
+        free(array->field_names);
+    }
+    
+    unregister_temp(array);
+    free(array->class_name);
+    free(array->dims);
+    free(array->data);
+    free(array->imag_data);
+    free(array);
+    n_live--;
+}
+
+// SHAPE ///////////////////////////////////////////////////////////////////////
+
+mwSize mxGetM(const mxArray* array) {
+    return array->dims[0];
+}
+
+mwSize mxGetN(const mxArray* array) {
+    mwSize n = 1, idx;
+    for (idx = 1; idx < array->ndim; ++idx) {
+        n *= array->dims[idx];
+    }
+    return n;
+}
+
+void mxSetM(mxArray* array, mwSize m) {
+    array->dims[0] = m;
+    array->n_els = m * mxGetN(array);
+}
+
+void mxSetN(mxArray* array, mwSize n) {
+    array->ndim = 2;
+    array->dims[1] = n;
+    array->n_els = array->dims[0] * n;
+}
+
+mwSize mxGetNumberOfDimensions(const mxArray* array) {
+    return array->ndim;
+}
+
+const mwSize* mxGetDimensions(const mxArray* array) {
+    return array->dims;
+}
+
+int mxSetDimensions(mxArray* array, const mwSize* dims, mwSize ndim) {
+    mwSize idx;
+    
+    free(array->dims);
+    array->ndim = ndim < 2 ? 2 : ndim;
+    array->dims = malloc(array->ndim * sizeof(mwSize));
+    array->n_els = 1;
+    for (idx = 0; idx < array->ndim; ++idx) {
+        array->dims[idx] = idx < ndim ? dims[idx] : 1;
+        array->n_els *= array->dims[idx];
+    }
+    return 0;
+}
+
+mwSize mxGetNumberOfElements(const mxArray* array) {
+    NOTE_THREAD();
+    return array->n_els;
+}
+
+size_t mxGetElementSize(const mxArray* array) {
+    NOTE_THREAD();
+    return array->el_size;
+}
+
+mwIndex mxCalcSingleSubscript(const mxArray* array, mwSize nsubs, const mwIndex* subs) {
+    mwIndex idx = 0, stride = 1;
+    mwSize dim;
+    
+    for (dim = 0; dim < nsubs && dim < array->ndim; ++dim) {
+        idx += subs[dim] * stride;
+        stride *= array->dims[dim];
+    }
+    return idx;
+}
+
+// CLASSES /////////////////////////////////////////////////////////////////////
+
+mxClassID mxGetClassID(const mxArray* array) {
+    return array->class_id;
+}
+
+const char* mxGetClassName(const mxArray* array) {
+    if (array->class_name != NULL) {
+        return array->class_name;
+    }
+    return CLASS_NAMES[array->class_id];
+}
+
+bool mxIsClass(const mxArray* array, const char* name) {
+    return strcmp(mxGetClassName(array), name) == 0;
+}
+
+bool mxIsCell(const mxArray* array) {
+    return array->class_id == mxCELL_CLASS;
+}
+
+bool mxIsStruct(const mxArray* array) {
+    return array->class_id == mxSTRUCT_CLASS;
+}
+
+bool mxIsChar(const mxArray* array) {
+    return array->class_id == mxCHAR_CLASS;
+}
+
+bool mxIsLogical(const mxArray* array) {
+    return array->class_id == mxLOGICAL_CLASS;
+}
+
+bool mxIsNumeric(const mxArray* array) {
+    return array->class_id >= mxDOUBLE_CLASS && array->class_id <= mxUINT64_CLASS;
+}
+
+bool mxIsDouble(const mxArray* array) {
+    return array->class_id == mxDOUBLE_CLASS;
+}
+
+bool mxIsSingle(const mxArray* array) {
+    return array->class_id == mxSINGLE_CLASS;
+}
+
+bool mxIsInt32(const mxArray* array) {
+    return array->class_id == mxINT32_CLASS;
+}
+
+bool mxIsInt64(const mxArray* array) {
+    return array->class_id == mxINT64_CLASS;
+}
+
+bool mxIsUint8(const mxArray* array) {
+    return array->class_id == mxUINT8_CLASS;
+}
+
+bool mxIsComplex(const mxArray* array) {
+    return array->imag_data != NULL;
+}
+
+bool mxIsSparse(const mxArray* array) {
+    return false;
+}
+
+bool mxIsEmpty(const mxArray* array) {
+    return array->n_els == 0;
+}
+
+bool mxIsFunctionHandle(const mxArray* array) {
+    return array->class_id == mxFUNCTION_CLASS;
+}
+
+bool mxIsLogicalScalar(const mxArray* array) {
+    return array->class_id == mxLOGICAL_CLASS && array->n_els == 1;
+}
+
+bool mxIsLogicalScalarTrue(const mxArray* array) {
+    return mxIsLogicalScalar(array) && *(mxLogical*) array->data;
+}
+
+// DATA ////////////////////////////////////////////////////////////////////////
+
+void* mxGetData(const mxArray* array) {
+    NOTE_THREAD();
+    return array->data;
+}
+
+void mxSetData(mxArray* array, void* data) {
+    // MATLAB requires data from mxMalloc; we keep our arrays' buffers in
+    // plain malloc'd memory, so take a copy and release the original.
+    size_t n_bytes = array->n_els * array->el_size;
+    free(array->data);
+    array->data = malloc(n_bytes + 1);
+    memcpy(array->data, data, n_bytes);
+    mxFree(data);
+}
+
+void* mxGetImagData(const mxArray* array) {
+    return array->imag_data;
+}
+
+mwIndex* mxGetIr(const mxArray* array) {
+    return NULL;
+}
+
+mwIndex* mxGetJc(const mxArray* array) {
+    return NULL;
+}
+
+mwSize mxGetNzmax(const mxArray* array) {
+    return 0;
+}
+
+void mxSetImagData(mxArray* array, void* data) {
+    size_t n_bytes = array->n_els * array->el_size;
+    free(array->imag_data);
+    array->imag_data = malloc(n_bytes + 1);
+    memcpy(array->imag_data, data, n_bytes);
+    mxFree(data);
+}
+
+double* mxGetPr(const mxArray* array) {
+    return (double*) array->data;
+}
+
+double* mxGetPi(const mxArray* array) {
+    return (double*) array->imag_data;
+}
+
+double mxGetScalar(const mxArray* array) {
+    if (array->n_els == 0) {
+        return 0.0;
+    }
+    switch (array->class_id) {
+        case mxLOGICAL_CLASS:   return *(mxLogical*) array->data;
+        case mxCHAR_CLASS:      return *(mxChar*) array->data;
+        case mxDOUBLE_CLASS:    return *(double*) array->data;
+        case mxSINGLE_CLASS:    return *(float*) array->data;
+        case mxINT8_CLASS:      return *(signed char*) array->data;
+        case mxUINT8_CLASS:     return *(unsigned char*) array->data;
+        case mxINT16_CLASS:     return *(short*) array->data;
+        case mxUINT16_CLASS:    return *(unsigned short*) array->data;
+        case mxINT32_CLASS:     return *(int*) array->data;
+        case mxUINT32_CLASS:    return *(unsigned int*) array->data;
+        case mxINT64_CLASS:     return (double) *(long long*) array->data;
+        case mxUINT64_CLASS:    return (double) *(unsigned long long*) array->data;
+        default:                return 0.0;
+    }
+}
+
+mxLogical* mxGetLogicals(const mxArray* array) {
+    return array->class_id == mxLOGICAL_CLASS ? array->data : NULL;
+}
+
+mxChar* mxGetChars(const mxArray* array) {
+    return array->class_id == mxCHAR_CLASS ? array->data : NULL;
+}
+
+int mxGetString(const mxArray* array, char* buf, mwSize buflen) {
+    mwSize idx, n;
+    mxChar* chars;
+    
+    if (array->class_id != mxCHAR_CLASS || buflen == 0) {
+        if (buflen > 0) {
+            buf[0] = '\0';
+        }
+        return 1;
+    }
+    chars = array->data;
+    n = array->n_els < buflen - 1 ? array->n_els : buflen - 1;
+    for (idx = 0; idx < n; ++idx) {
+        buf[idx] = (char) chars[idx];
+    }
+    buf[n] = '\0';
+    return n < array->n_els ? 1 : 0;
+}
+
+char* mxArrayToString(const mxArray* array) {
+    char* buf;
+    
+    if (array->class_id != mxCHAR_CLASS) {
+        return NULL;
+    }
+    buf = mxMalloc(array->n_els + 1);
+    mxGetString(array, buf, array->n_els + 1);
+    return buf;
+}
+
+// CELLS ///////////////////////////////////////////////////////////////////////
+
+mxArray* mxGetCell(const mxArray* array, mwIndex idx) {
+    if (array->class_id != mxCELL_CLASS || idx >= array->n_els) {
+        return NULL;
+    }
+    return get_child(array, idx);
+}
+
+void mxSetCell(mxArray* array, mwIndex idx, mxArray* value) {
+    if (array->class_id != mxCELL_CLASS || idx >= array->n_els) {
+        return;
+    }
+    set_child(array, idx, value);
+}
+
+// STRUCTS /////////////////////////////////////////////////////////////////////
+
+int mxGetNumberOfFields(const mxArray* array) {
+    NOTE_THREAD();
+    return array->n_fields;
+}
+
+const char* mxGetFieldNameByNumber(const mxArray* array, int field) {
+    NOTE_THREAD();
+    if (field < 0 || field >= array->n_fields) {
+        return NULL;
+    }
+    return array->field_names[field];
+}
+
+int mxGetFieldNumber(const mxArray* array, const char* name) {
+    int idx;
+    NOTE_THREAD();
+    for (idx = 0; idx < array->n_fields; ++idx) {
+        if (strcmp(array->field_names[idx], name) == 0) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+mxArray* mxGetFieldByNumber(const mxArray* array, mwIndex idx, int field) {
+    NOTE_THREAD();
+    if (field < 0 || field >= array->n_fields || idx >= array->n_els) {
+        return NULL;
+    }
+    return get_child(array, idx * array->n_fields + field);
+}
+
+mxArray* mxGetField(const mxArray* array, mwIndex idx, const char* name) {
+    return mxGetFieldByNumber(array, idx, mxGetFieldNumber(array, name));
+}
+
+void mxSetFieldByNumber(mxArray* array, mwIndex idx, int field, mxArray* value) {
+    if (field < 0 || field >= array->n_fields || idx >= array->n_els) {
+        return;
+    }
+    set_child(array, idx * array->n_fields + field, value);
+}
+
+void mxSetField(mxArray* array, mwIndex idx, const char* name, mxArray* value) {
+    mxSetFieldByNumber(array, idx, mxGetFieldNumber(array, name), value);
+}
+
+int mxAddField(mxArray* array, const char* name) {
+    mxArray** old_slots = array->data;
+    mxArray** new_slots;
+    int n_old = array->n_fields, field;
+    mwIndex idx;
+    
+    if ((field = mxGetFieldNumber(array, name)) >= 0) {
+        return field;
+    }
+    
+    new_slots = calloc(array->n_els * (n_old + 1) + 1, sizeof(mxArray*));
+    for (idx = 0; idx < array->n_els; ++idx) {
+        for (field = 0; field < n_old; ++field) {
+            new_slots[idx * (n_old + 1) + field] = old_slots[idx * n_old + field];
+        }
+    }
+    free(old_slots);
+    array->data = new_slots;
+    array->field_names = realloc(array->field_names, (n_old + 2) * sizeof(char*));
+    array->field_names[n_old] = copy_str(name);
+    array->n_fields = n_old + 1;
+    return n_old;
+}
+
+// OBJECTS /////////////////////////////////////////////////////////////////////
+
+mxArray* mxGetProperty(const mxArray* array, mwIndex idx, const char* name) {
+    mxArray* value;
+    
+    if (array->class_id != mxOBJECT_CLASS && array->class_id != mxFUNCTION_CLASS) {
+        return NULL;
+    }
+    // As in MATLAB, the caller gets a copy.
+    value = mxGetFieldByNumber(array, idx, mxGetFieldNumber(array, name));
+    return value == NULL ? NULL : mxDuplicateArray(value);
+}
+
+void mxSetProperty(mxArray* array, mwIndex idx, const char* name, const mxArray* value) {
+    int field = mxGetFieldNumber(array, name);
+    
+    if (field < 0 || idx >= array->n_els) {
+        return;
+    }
+    mxDestroyArray(get_child(array, idx * array->n_fields + field));
+    set_child(array, idx * array->n_fields + field, mxDuplicateArray(value));
+}
+
+// MEX FUNCTIONS ///////////////////////////////////////////////////////////////
+
+void mexErrMsgTxt(const char* msg) {
+    strncpy(last_error, msg, ERROR_BUF_SIZE - 1);
+    if (current_frame == NULL) {
+        fprintf(stderr, "mexstub: error outside of a MEX call: %s\n", msg);
+        abort();
+    }
+    longjmp(current_frame->jmp, 1);
+}
+
+void mexErrMsgIdAndTxt(const char* id, const char* fmt, ...) {
+    char buf[ERROR_BUF_SIZE];
+    va_list args;
+    
+    va_start(args, fmt);
+    vsnprintf(buf, ERROR_BUF_SIZE, fmt, args);
+    va_end(args);
+    mexErrMsgTxt(buf);
+}
+
+void mexWarnMsgTxt(const char* msg) {
+    fprintf(stderr, "Warning: %s\n", msg);
+}
+
+void mexWarnMsgIdAndTxt(const char* id, const char* fmt, ...) {
+    va_list args;
+    
+    fprintf(stderr, "Warning: ");
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+}
+
+int mexPrintf(const char* fmt, ...) {
+    int count;
+    va_list args;
+    
+    va_start(args, fmt);
+    count = vprintf(fmt, args);
+    va_end(args);
+    return count;
+}
+
+static mexstub_function_t find_function(const char* name) {
+    int idx;
+    
+    if (!defaults_registered) {
+        register_defaults();
+    }
+    for (idx = 0; idx < n_functions; ++idx) {
+        if (strcmp(functions[idx].name, name) == 0) {
+            return functions[idx].fn;
+        }
+    }
+    return NULL;
+}
+
+int mexCallMATLAB(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[], const char* name) {
+    char buf[ERROR_BUF_SIZE];
+    mexstub_function_t fn = find_function(name);
+    int idx;
+    
+    if (fn == NULL) {
+        snprintf(buf, ERROR_BUF_SIZE, "Undefined function '%s'.", name);
+        mexErrMsgTxt(buf);
+    }
+    for (idx = 0; idx < nlhs; ++idx) {
+        plhs[idx] = NULL;
+    }
+    fn(nlhs, plhs, nrhs, prhs);
+    return 0;
+}
+
+static mxArray* make_exception(const char* message) {
+    static const char* props[] = {"identifier", "message"};
+    mxArray* exception = mexstub_create_object("MException", 2, props);
+    mxSetProperty(exception, 0, "identifier", mxCreateString("mexstub:error"));
+    mxSetProperty(exception, 0, "message", mxCreateString(message));
+    return exception;
+}
+
+mxArray* mexCallMATLABWithTrap(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[], const char* name) {
+    call_frame_t frame;
+    
+    frame.trap_only = true;
+    frame.parent = current_frame;
+    current_frame = &frame;
+    
+    if (setjmp(frame.jmp) == 0) {
+        mexCallMATLAB(nlhs, plhs, nrhs, prhs, name);
+        current_frame = frame.parent;
+        return NULL;
+    }
+    current_frame = frame.parent;
+    return make_exception(last_error);
+}
+
+mxArray* mexEvalStringWithTrap(const char* cmd) {
+    mxArray* rhs[1];
+    
+    // There's no MATLAB interpreter here; drivers that care can register an
+    // "eval" function to receive the command.
+    if (find_function("eval") == NULL) {
+        return NULL;
+    }
+    rhs[0] = mxCreateString(cmd);
+    return mexCallMATLABWithTrap(0, NULL, 1, rhs, "eval");
+}
+
+int mexEvalString(const char* cmd) {
+    return mexEvalStringWithTrap(cmd) == NULL ? 0 : 1;
+}
+
+mxArray* mexGetVariable(const char* workspace, const char* name) {
+    variable_t* var;
+    
+    for (var = variables; var != NULL; var = var->next) {
+        if (strcmp(var->workspace, workspace) == 0 && strcmp(var->name, name) == 0) {
+            return mxDuplicateArray(var->value);
+        }
+    }
+    return NULL;
+}
+
+int mexPutVariable(const char* workspace, const char* name, const mxArray* value) {
+    variable_t* var;
+    mxArray* copy = mxDuplicateArray(value);
+    
+    mexMakeArrayPersistent(copy);
+    for (var = variables; var != NULL; var = var->next) {
+        if (strcmp(var->workspace, workspace) == 0 && strcmp(var->name, name) == 0) {
+            mxDestroyArray(var->value);
+            var->value = copy;
+            return 0;
+        }
+    }
+    var = malloc(sizeof(variable_t));
+    var->workspace = copy_str(workspace);
+    var->name = copy_str(name);
+    var->value = copy;
+    var->next = variables;
+    variables = var;
+    return 0;
+}
+
+int mexAtExit(void (*fn)(void)) {
+    int idx;
+    
+    // MATLAB keeps a single exit function per MEX file.
+    for (idx = 0; idx < n_exit_fns; ++idx) {
+        if (exit_fns[idx] == fn) {
+            return 0;
+        }
+    }
+    if (n_exit_fns < MAX_EXIT_FNS) {
+        exit_fns[n_exit_fns++] = fn;
+    }
+    return 0;
+}
+
+void mexLock(void) {
+}
+
+void mexUnlock(void) {
+}
+
+const char* mexFunctionName(void) {
+    return "pymex_fns";
+}
+
+// DEFAULT FUNCTIONS ///////////////////////////////////////////////////////////
+// Just enough of MATLAB for pymex to initialize and box values.
+
+static void get_str(const mxArray* array, char* buf, size_t buflen) {
+    mxGetString(array, buf, buflen);
+}
+
+static void fn_pyobject_new(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    static const char* props[] = {"py_pointer"};
+    
+    if (*(unsigned long long*) mxGetData(prhs[0]) == 0) {
+        plhs[0] = mxCreateDoubleMatrix(0, 0, mxREAL);
+        return;
+    }
+    plhs[0] = mexstub_create_object("PyObject", 1, props);
+    mxSetProperty(plhs[0], 0, "py_pointer", prhs[0]);
+}
+
+static void fn_getpref(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    char name[256], env_name[300], *value;
+    size_t idx;
+    
+    // Preferences can be given as environment variables, e.g.
+    // PYMEX_PYTHONHOME for getpref('pymex', 'pythonhome').
+    get_str(prhs[1], name, sizeof(name));
+    snprintf(env_name, sizeof(env_name), "PYMEX_%s", name);
+    for (idx = 0; env_name[idx] != '\0'; ++idx) {
+        env_name[idx] = (char) toupper((unsigned char) env_name[idx]);
+    }
+    value = getenv(env_name);
+    if (value != NULL) {
+        plhs[0] = mxCreateString(value);
+    } else {
+        plhs[0] = nrhs >= 3 ? mxDuplicateArray(prhs[2]) : mxCreateDoubleMatrix(0, 0, mxREAL);
+    }
+}
+
+static void fn_feval(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    char name[256];
+    mxArray* fn_name;
+    
+    if (mxIsFunctionHandle(prhs[0])) {
+        fn_name = mxGetProperty(prhs[0], 0, "function");
+        get_str(fn_name, name, sizeof(name));
+    } else {
+        get_str(prhs[0], name, sizeof(name));
+    }
+    mexCallMATLAB(nlhs, plhs, nrhs - 1, prhs + 1, name);
+}
+
+static void fn_str2func(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    static const char* props[] = {"function"};
+    plhs[0] = mexstub_create_object("function_handle", 1, props);
+    mxSetProperty(plhs[0], 0, "function", prhs[0]);
+}
+
+static void fn_class(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    plhs[0] = mxCreateString(mxGetClassName(prhs[0]));
+}
+
+static void fn_empty_cell(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    plhs[0] = mxCreateCellMatrix(0, 1);
+}
+
+static void fn_fprintf(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]) {
+    char* str;
+    int idx;
+    
+    // Only the pieces pymex uses: an optional file ID, then text.
+    for (idx = 0; idx < nrhs; ++idx) {
+        if (mxIsChar(prhs[idx])) {
+            str = mxArrayToString(prhs[idx]);
+            fputs(str, idx > 0 && mxGetScalar(prhs[0]) == 2.0 ? stderr : stdout);
+            mxFree(str);
+        }
+    }
+}
+
+static void register_defaults(void) {
+    defaults_registered = true;
+    mexstub_register("PyObject.new", fn_pyobject_new);
+    mexstub_register("getpref", fn_getpref);
+    mexstub_register("feval", fn_feval);
+    mexstub_register("str2func", fn_str2func);
+    mexstub_register("class", fn_class);
+    mexstub_register("properties", fn_empty_cell);
+    mexstub_register("methods", fn_empty_cell);
+    mexstub_register("fprintf", fn_fprintf);
+}
@@ -0,0 +1,90 @@
+/**
+ * mexstub.h: Host-side API for driving MEX code through the stand-in library.
+ **
+ * (c) 2013 Christopher E. Granade (cgranade@cgranade.com).
+ *    
+ * This file is a part of the pymex-embed project.
+ * Licensed under the AGPL version 3.
+ **
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **/
+// MATLAB itself plays the role of host for a MEX file: it calls
+// mexFunction, services mexCallMATLAB, and frees temporary arrays when each
+// call returns. These functions let a plain C program (a benchmark or test
+// driver) play that role instead.
+
+// PRAGMAS AND INCLUDE GUARD ///////////////////////////////////////////////////
+
+#pragma once
+#ifndef PYMEX_STUB_MEXSTUB_H
+#define PYMEX_STUB_MEXSTUB_H
+
+// INCLUDES ////////////////////////////////////////////////////////////////////
+
+#include "mex.h"
+
+// TYPEDEFS ////////////////////////////////////////////////////////////////////
+
+typedef void (*mexstub_entry_t)(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]);
+typedef void (*mexstub_function_t)(int nlhs, mxArray* plhs[], int nrhs, mxArray* prhs[]);
+
+// PROTOTYPES //////////////////////////////////////////////////////////////////
+
+/**
+ * Makes fn available to mexCallMATLAB (and to feval) under the given name.
+ * A handful of functions pymex relies on (PyObject.new, getpref, feval,
+ * class, ...) are registered by default; registering the same name again
+ * replaces them.
+ */
+void mexstub_register(const char* name, mexstub_function_t fn);
+
+/**
+ * Calls a MEX entry point as MATLAB would. Returns 0 on success, or nonzero
+ * if the entry point raised an error with mexErrMsgTxt, in which case the
+ * message is available from mexstub_last_error. Temporary arrays and
+ * mxCalloc'd memory are released on return, except for those in plhs.
+ *
+ * Drivers that want to call MEX-side functions (mat2py, py2mat, ...)
+ * directly should do so from inside an entry point of their own, passed to
+ * mexstub_call, so that they see the same error handling and cleanup.
+ */
+int mexstub_call(mexstub_entry_t entry, int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]);
+const char* mexstub_last_error(void);
+
+/**
+ * Creates an instance of a MATLAB class with the given property names, as
+ * mxGetProperty and mxGetClassName will see it.
+ */
+mxArray* mexstub_create_object(const char* class_name, int nprops, const char** prop_names);
+
+/**
+ * Runs any functions registered with mexAtExit, as MATLAB does when the MEX
+ * file is cleared.
+ */
+void mexstub_shutdown(void);
+
+/**
+ * Number of arrays currently allocated and not yet destroyed, for checking
+ * that driver code and the code under test don't leak.
+ */
+size_t mexstub_live_arrays(void);
+
+/**
+ * Number of calls to the struct field and array data accessors made from
+ * threads other than the one that first called mexstub_call, which stands
+ * in for MATLAB's. MATLAB only allows its API on that thread.
+ */
+size_t mexstub_off_thread_calls(void);
+
+#endif
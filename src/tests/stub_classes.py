@@ -46,6 +46,16 @@ def __eq__(self, other):
     def __le__(self, other):
         return isinstance(other, ComparisonStub) and self.wrapped <= other.wrapped
         
+class ConvertibleStub(object):
+    """
+    Opaque to pymex unless a converter is registered for it.
+    """
+    def __init__(self, value):
+        self.value = value
+
+class ConvertibleStubSubclass(ConvertibleStub):
+    pass
+        
 ## CONSTANTS ##################################################################
 
 A, B1, B2, C = map(ComparisonStub, "abbc")